@@ -0,0 +1,257 @@
+/* Deathray2 - An Avisynth plug-in filter for spatial/temporal non-local means de-noising.
+ *
+ * version 1.00
+ *
+ * Copyright 2015, Jawed Ashraf - Deathray@cupidity.f9.co.uk
+ */
+
+#include <Windows.h>
+#include <sstream>
+#include <vector>
+
+#include "result.h"
+#include "util.h"
+#include "device.h"
+#include "SingleFrame.h"
+#include "ChromaFrame.h"
+#include "MultiFrame.h"
+#include "MultiFrameRequest.h"
+#include "Autotune.h"
+
+// Frames timed for each candidate geometry, after an untimed frame
+static const int k_tuning_frames = 2;
+
+// Filtering strength used for timing, which is the default strength as scaled by the filter
+static const float k_timing_h = 1.f / 10000.f;
+
+// Candidate rows per launch. All are powers of 2, so that planes shared
+// by devices with different geometries have bands common to all. None is
+// taller than the blocks of rows that planes are padded to, since the
+// last region of a plane is finalised whole.
+static const int k_region_heights[] = {8, 16, 32, 64};
+
+// Candidate work group shapes of the pitched kernels
+static const size_t k_local_sizes[][2] = {{16, 4}, {8, 8}, {32, 2}, {64, 1}};
+
+// Candidate tile heights of the image weighting kernels, whose groups are
+// 64 work items for each row. Each height is compiled into a program of
+// its own the first time it is timed. Devices whose groups cannot be as
+// large as the tallest tile's fail those candidates.
+static const int k_tile_rows[] = {1, 2, 4};
+
+// Candidate work groups per compute unit of the persistent kernels
+static const int k_persistent_groups[] = {1, 2, 4, 8};
+
+// WaitForResult
+// Copies the filtered planes to the host and waits for them to arrive
+static result WaitForResult(
+    FilterFrame     *plane) {
+
+    cl_event copied = NULL;
+    result status = plane->CopyFrom(&copied);
+    if (status != FILTER_OK) return status;
+
+    clWaitForEvents(1, &copied);
+    clReleaseEvent(copied);
+    return FILTER_OK;
+}
+
+result FilterAndWait(
+    FilterFrame     *plane,
+    unsigned char   *dest) {
+
+    result status = plane->Execute(dest);
+    if (status != FILTER_OK) return status;
+
+    return WaitForResult(plane);
+}
+
+result FilterAndWait(
+    ChromaFrame     *planes,
+    unsigned char   *dest_u,
+    unsigned char   *dest_v) {
+
+    result status = planes->Execute(dest_u, dest_v);
+    if (status != FILTER_OK) return status;
+
+    return WaitForResult(planes);
+}
+
+void NoisePlane(
+    const   int                     &width,
+    const   int                     &height,
+            int                     *pitch,
+            vector<unsigned char>   *plane) {
+
+    *pitch = ByPowerOf2(width, 6);
+    plane->resize(*pitch * height);
+
+    unsigned int noise = 1;
+    for (size_t i = 0; i < plane->size(); ++i) {
+        noise = noise * 1664525 + 1013904223;
+        (*plane)[i] = static_cast<unsigned char>(96 + (noise >> 27));
+    }
+}
+
+// ValidGeometry
+// Returns true if a geometry read from the cache is usable
+static bool ValidGeometry(
+    const KernelGeometry &geometry) {
+
+    if (geometry.region_height < 8 || geometry.region_height > (1 << PLANE_HEIGHT_POWER_OF_2)) return false;
+    if ((geometry.region_height & (geometry.region_height - 1)) != 0) return false;
+    if (geometry.persistent_groups < 0 || geometry.persistent_groups > 64) return false;
+    if (geometry.tile_rows < 1 || geometry.tile_rows > 4 || (geometry.tile_rows & (geometry.tile_rows - 1)) != 0) return false;
+    if (geometry.persistent_groups > 0 && geometry.tile_rows != DEFAULT_TILE_ROWS) return false;
+    const size_t local_size = geometry.local_width * geometry.local_height;
+    return local_size > 0 && local_size <= 256;
+}
+
+result TimeFiltering(
+    const   int     &device_id,
+    const   int     &width,
+    const   int     &height,
+    const   int     &temporal_radius,
+    const   int     &sample_expand,
+    const   int     &frames,
+            double  *seconds) {
+
+    int pitch = 0;
+    vector<unsigned char> source;
+    NoisePlane(width, height, &pitch, &source);
+    vector<unsigned char> dest(pitch * height);
+
+    LARGE_INTEGER frequency, started, finished;
+    QueryPerformanceFrequency(&frequency);
+    started.QuadPart = 0;
+
+    result status = FILTER_OK;
+    if (temporal_radius == 0) {
+        SingleFrame plane;
+        status = plane.Init(device_id, width, height, 1, pitch, pitch, k_timing_h, sample_expand, 0, 1, 0);
+        for (int i = 0; i <= frames && status == FILTER_OK; ++i) {
+            if (i == 1) QueryPerformanceCounter(&started);
+
+            status = plane.CopyTo(&source[0]);
+            if (status == FILTER_OK) status = FilterAndWait(&plane, &dest[0]);
+        }
+    } else if (temporal_radius == CHROMA_PAIR_RADIUS) {
+        // U and V are the same plane of noise
+        vector<unsigned char> dest_v(pitch * height);
+        ChromaFrame planes;
+        status = planes.Init(device_id, width, height, 1, pitch, pitch, k_timing_h, sample_expand, 0, 0, 0);
+        for (int i = 0; i <= frames && status == FILTER_OK; ++i) {
+            if (i == 1) QueryPerformanceCounter(&started);
+
+            status = planes.CopyTo(NULL, &source[0], &source[0]);
+            if (status == FILTER_OK) status = FilterAndWait(&planes, &dest[0], &dest_v[0]);
+        }
+    } else {
+        MultiFrame plane;
+        status = plane.Init(device_id, temporal_radius, width, height, 1, pitch, pitch, k_timing_h, sample_expand, 0, 1, 0);
+        for (int i = 0; i <= frames && status == FILTER_OK; ++i) {
+            if (i == 1) QueryPerformanceCounter(&started);
+
+            // Every frame of the clip is the same plane of noise
+            MultiFrameRequest request;
+            int frame_number;
+            plane.SupplyFrameNumbers(i, &request);
+            while (request.GetFrameNumber(&frame_number))
+                request.Supply(frame_number, &source[0]);
+
+            status = plane.CopyTo(&request);
+            plane.WaitForCopies();
+            if (status == FILTER_OK) status = FilterAndWait(&plane, &dest[0]);
+        }
+    }
+    QueryPerformanceCounter(&finished);
+    if (status != FILTER_OK) return status;
+
+    *seconds = static_cast<double>(finished.QuadPart - started.QuadPart) / frequency.QuadPart;
+    return FILTER_OK;
+}
+
+result TuneGeometry(
+    const   int     &device_id,
+    const   int     &width,
+    const   int     &height,
+    const   int     &temporal_radius,
+    const   int     &sample_expand,
+    const   int     &alpha_size) {
+
+    Device &device = g_devices[device_id];
+
+    stringstream key;
+    key << "Deathray2 geometry 3\n";
+    key << device.info(CL_DEVICE_NAME) << "\n" << device.info(CL_DRIVER_VERSION) << "\n";
+    key << width << "x" << height << " x=" << sample_expand << " t=" << temporal_radius << " a=" << alpha_size << "\n";
+
+    KernelGeometry fastest;
+    string value;
+    if (LoadCacheRecord("geometry", key.str(), &value)) {
+        stringstream fields(value);
+        fields >> fastest.region_height >> fastest.local_width >> fastest.local_height >> fastest.persistent_groups >> fastest.tile_rows;
+        if (fields && ValidGeometry(fastest)) {
+            device.set_geometry(width, height, temporal_radius, fastest);
+            return FILTER_OK;
+        }
+    }
+
+    // The pitched kernels' work group shape is free, whereas the image
+    // weighting kernels' work group is shaped by the height of their tile
+    const bool pitched = device.pitched_planes();
+    const int region_height_count = sizeof(k_region_heights) / sizeof(k_region_heights[0]);
+    const int local_size_count = pitched ? sizeof(k_local_sizes) / sizeof(k_local_sizes[0]) : 1;
+    const int tile_rows_count = pitched ? 1 : sizeof(k_tile_rows) / sizeof(k_tile_rows[0]);
+
+    // Only single frame filtering of a plane has a persistent kernel. Its region 
+    // height is merely the granularity of the rows shared between devices,
+    // and its tiles are always the default height.
+    vector<KernelGeometry> candidates;
+    for (int i = 0; i < region_height_count; ++i) {
+        // Launches taller than the plane are no different from the first that is
+        if (i > 0 && k_region_heights[i - 1] >= height) break;
+
+        for (int j = 0; j < local_size_count; ++j) {
+            for (int k = 0; k < tile_rows_count; ++k) {
+                const int tile_rows = pitched ? DEFAULT_TILE_ROWS : k_tile_rows[k];
+                const KernelGeometry candidate = {k_region_heights[i], k_local_sizes[j][0], k_local_sizes[j][1], 0, tile_rows};
+                candidates.push_back(candidate);
+            }
+        }
+    }
+    const int persistent_count = temporal_radius == 0 ? sizeof(k_persistent_groups) / sizeof(k_persistent_groups[0]) : 0;
+    for (int i = 0; i < persistent_count; ++i) {
+        for (int j = 0; j < local_size_count; ++j) {
+            const KernelGeometry candidate = {k_region_heights[0], k_local_sizes[j][0], k_local_sizes[j][1], k_persistent_groups[i], DEFAULT_TILE_ROWS};
+            candidates.push_back(candidate);
+        }
+    }
+
+    result status = FILTER_ERROR;
+    double fastest_seconds = 0.;
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        device.set_geometry(width, height, temporal_radius, candidates[i]);
+
+        // Candidates that fail, e.g. because the alpha buffer is too large, are ignored
+        double seconds = 0.;
+        if (TimeFiltering(device_id, width, height, temporal_radius, sample_expand, k_tuning_frames, &seconds) != FILTER_OK) continue;
+        if (status != FILTER_OK || seconds < fastest_seconds) {
+            fastest = candidates[i];
+            fastest_seconds = seconds;
+            status = FILTER_OK;
+        }
+    }
+
+    if (status != FILTER_OK) {
+        device.ClearGeometry(width, height, temporal_radius);
+        return status;
+    }
+
+    device.set_geometry(width, height, temporal_radius, fastest);
+
+    stringstream fastest_value;
+    fastest_value << fastest.region_height << " " << fastest.local_width << " " << fastest.local_height << " " << fastest.persistent_groups << " " << fastest.tile_rows << "\n";
+    SaveCacheRecord("geometry", key.str(), fastest_value.str());
+    return FILTER_OK;
+}
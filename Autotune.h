@@ -0,0 +1,73 @@
+/* Deathray2 - An Avisynth plug-in filter for spatial/temporal non-local means de-noising.
+ *
+ * version 1.00
+ *
+ * Copyright 2015, Jawed Ashraf - Deathray@cupidity.f9.co.uk
+ */
+
+#ifndef _AUTOTUNE_H_
+#define _AUTOTUNE_H_
+
+#include <vector>
+
+using namespace std;
+
+enum result;
+class FilterFrame;
+class ChromaFrame;
+
+// FilterAndWait
+// Filters the plane that has been copied to the device and waits for
+// the result to arrive on the host
+result FilterAndWait(
+    FilterFrame     *plane,             // filter whose plane has been copied to the device
+    unsigned char   *dest);             // host buffer for the filtered plane
+
+// FilterAndWait
+// As above, for the U and V planes filtered together
+result FilterAndWait(
+    ChromaFrame     *planes,            // filter whose planes have been copied to the device
+    unsigned char   *dest_u,            // host buffer for the filtered U plane
+    unsigned char   *dest_v);           // host buffer for the filtered V plane
+
+// NoisePlane
+// Fills a plane, whose rows start on 64-byte boundaries as they do in
+// Avisynth's frames, with noise
+void NoisePlane(
+    const   int                     &width,     // width of the plane in pixels
+    const   int                     &height,    // height of the plane in pixels
+            int                     *pitch,     // length in bytes of each row
+            vector<unsigned char>   *plane);    // the plane
+
+// TimeFiltering
+// Measures the time taken on the device to filter frames of noise of
+// the given dimensions, after an untimed frame. The filter used for the
+// temporal radius is the one that filters clips, so its real weighting
+// and Finalise kernels are timed using the device's current geometry.
+// Requires the gaussian weights to be on the device.
+result TimeFiltering(
+    const   int     &device_id,         // device to time
+    const   int     &width,             // width of the plane in pixels
+    const   int     &height,            // height of the plane in pixels
+    const   int     &temporal_radius,   // 0 for single frame filtering, CHROMA_PAIR_RADIUS for U and V together
+    const   int     &sample_expand,     // factor of radius of 3 to use for sampling
+    const   int     &frames,            // count of frames timed
+            double  *seconds);          // time taken to filter the frames
+
+// TuneGeometry
+// Times each candidate KernelGeometry on the device for planes of the
+// given dimensions and records the fastest on the device, so that
+// filters created afterwards use it.
+//
+// The fastest geometry is cached for the device, its driver, the plane's
+// dimensions, temporal radius, sample expansion and alpha size, so later
+// scripts skip the timing.
+result TuneGeometry(
+    const   int     &device_id,         // device to tune
+    const   int     &width,             // width of the plane in pixels
+    const   int     &height,            // height of the plane in pixels
+    const   int     &temporal_radius,   // 0 for single frame filtering, CHROMA_PAIR_RADIUS for U and V together
+    const   int     &sample_expand,     // factor of radius of 3 to use for sampling
+    const   int     &alpha_size);       // 1/8th count of sorted samples used for filtering
+
+#endif // _AUTOTUNE_H_
@@ -0,0 +1,1107 @@
+/* Deathray2 - An Avisynth plug-in filter for spatial/temporal non-local means de-noising.
+ *
+ * version 1.00
+ *
+ * Copyright 2015, Jawed Ashraf - Deathray@cupidity.f9.co.uk
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <vector>
+
+#include "result.h"
+#include "util.h"
+#include "clutil.h"
+#include "device.h"
+#include "DeviceSelection.h"
+#include "Autotune.h"
+#include "CLKernel.h"
+#include "SingleFrame.h"
+#include "ChromaFrame.h"
+#include "MultiFrame.h"
+#include "MultiFrameRequest.h"
+#include "Profiler.h"
+#include "Benchmark.h"
+
+extern  cl_int  g_last_cl_error;
+
+void GaussianGenerator(const float &sigma, const int &device_id);
+
+// Sigma of the gaussian weights, the filter's default
+static const float k_benchmark_sigma = 1.f;
+
+// Counts of sorted samples swept, as given to the filter by a
+static const int k_alpha_sizes[] = {8, 16, 32, 64, 128};
+
+// Temporal radii swept: single frame and the smallest multi-frame window
+static const int k_temporal_radii[] = {0, 1};
+
+// Rows whose alpha sets Initialise fills, as many as a region of the filters' default geometry
+static const int k_initialise_rows = 32;
+
+// Floating point operations per candidate of the weighting kernels: a
+// difference, a square and a gaussian-weighted sum for each pixel of
+// the 7x7 window, then the weight's exponential
+static const double k_flops_per_candidate = 4. * 49. + 4.;
+
+// Constants of SSIM for 8-bit pixels, (0.01 * 255)^2 and (0.03 * 255)^2
+static const double k_ssim_c1 = 6.5025;
+static const double k_ssim_c2 = 58.5225;
+
+// PSNR reported when a filtered frame is identical to the clean frame
+static const double k_psnr_identical = 99.;
+
+// Settings of the regression suite: the single frame and multi-frame
+// filters, with small and large alpha sizes and sample expansions
+static const QualitySetting k_regression_settings[] = {
+    {1., 1, 128, 0},
+    {3., 2, 16, 0},
+    {1., 1, 64, 1},
+    {2., 3, 128, 2}
+};
+
+// Settings of the regression suite for chroma, which is filtered as a
+// clip's chroma would be: as a pair by ChromaFrame when single frame on
+// a device that uses images, otherwise plane by plane
+static const QualitySetting k_regression_chroma_settings[] = {
+    {1., 1, 64, 0},
+    {2., 2, 128, 1}
+};
+
+// Fixed input of the regression suite: frames of a synthetic picture with
+// noise, whose chroma planes are half its width and height
+static const int    k_regression_width  = 256;
+static const int    k_regression_height = 128;
+static const int    k_regression_frames = 6;
+static const double k_regression_noise  = 8.;
+
+// Times each setting is filtered by the regression suite, the fastest counting
+static const int k_regression_runs = 3;
+
+// QualityResult
+// Measurements of a setting by RunQualityBenchmark
+struct QualityResult {
+    QualitySetting  setting;        // setting measured
+    result          status;         // FILTER_OK unless the setting could not be filtered
+    double          psnr;           // of the filtered frames against the clean frames, dB
+    double          ssim;           // mean over the filtered frames
+    double          fps;            // frames filtered per second
+};
+
+// StageWork
+// Models the work of a stage for each pixel of a frame: the candidates
+// weighted, the floating point operations and the compulsory memory
+// traffic, each weight/pixel pair of an alpha set being 4 bytes.
+// Returns false for stages that are not modelled.
+static bool StageWork(
+    const   string  &stage,
+    const   int     &temporal_radius,
+    const   int     &sample_expand,
+    const   int     &alpha_size,
+            double  *candidates,
+            double  *flops,
+            double  *bytes) {
+
+    const double alpha_set_size = GetAlphaSetSize(temporal_radius, sample_expand);
+    const double frame_count = 2 * temporal_radius + 1;
+
+    *candidates = 0.;
+    if (stage.compare(0, 3, "NLM") == 0) {
+        // Each frame of the window is read and every pair is written
+        *candidates = alpha_set_size;
+        *flops = alpha_set_size * k_flops_per_candidate;
+        *bytes = frame_count + 4. * alpha_set_size;
+    } else if (stage.compare(0, 8, "Finalise") == 0) {
+        // Every pair is read and the best are blended into the pixel written
+        *flops = 2. * alpha_size;
+        *bytes = 4. * alpha_set_size + 2.;
+    } else if (stage == "Initialise") {
+        *flops = 0.;
+        *bytes = 4. * alpha_set_size;
+    } else if (stage == "PopulateCaches") {
+        *flops = 0.;
+        *bytes = 1.;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// TimeInitialise
+// Launches Initialise over the alpha sets of a region, once per frame
+static result TimeInitialise(
+    const   int     &width,
+    const   int     &temporal_radius,
+    const   int     &sample_expand,
+    const   int     &frames) {
+
+    Device &device = g_devices[0];
+    cl_command_queue cq = device.cq();
+
+    const size_t alpha_count = static_cast<size_t>(width) * k_initialise_rows * GetAlphaSetSize(temporal_radius, sample_expand);
+    int alpha = 0;
+    result status = device.buffers_.AllocBuffer(cq, alpha_count * sizeof(cl_uint), &alpha);
+    if (status == FILTER_OK) {
+        ClKernel initialise(0, "Initialise");
+        const cl_uint value = 0;
+
+        initialise.SetArg(sizeof(cl_mem), device.buffers_.ptr(alpha));
+        initialise.SetArg(sizeof(cl_uint), &value);
+
+        if (initialise.arguments_valid()) {
+            const size_t set_local_work_size[1]    = {64};
+            const size_t set_scalar_global_size[1] = {alpha_count};
+            const size_t set_scalar_item_size[1]   = {1};
+
+            initialise.set_work_dim(1);
+            initialise.set_local_work_size(set_local_work_size);
+            initialise.set_scalar_global_size(set_scalar_global_size);
+            initialise.set_scalar_item_size(set_scalar_item_size);
+
+            for (int i = 0; i <= frames && status == FILTER_OK; ++i)
+                status = initialise.Execute(cq, NULL);
+            clFinish(cq);
+        } else {
+            status = FILTER_KERNEL_ARGUMENT_ERROR;
+        }
+        initialise.Release();
+    }
+
+    device.buffers_.Destroy(alpha);
+    clReleaseCommandQueue(cq);
+    return status;
+}
+
+// TimePopulateCaches
+// Launches PopulateCaches over a plane of noise, once per frame, with
+// the caches of tiles of the given height
+static result TimePopulateCaches(
+    const   int     &width,
+    const   int     &height,
+    const   int     &tile_rows,
+    const   int     &frames) {
+
+    Device &device = g_devices[0];
+    cl_command_queue cq = device.cq();
+
+    int pitch = 0;
+    vector<unsigned char> source;
+    NoisePlane(width, height, &pitch, &source);
+
+    // One checksum per tile
+    const size_t tile_count = static_cast<size_t>((width + 7) >> 3) * ((height + tile_rows - 1) / tile_rows);
+
+    int plane = 0;
+    int checksums = 0;
+    result status = device.buffers_.AllocPlane(cq, width, height, &plane);
+    if (status == FILTER_OK) status = device.buffers_.CopyToPlane(plane, source[0], width, height, pitch);
+    if (status == FILTER_OK) status = device.buffers_.AllocBuffer(cq, tile_count * sizeof(float), &checksums);
+    if (status == FILTER_OK) {
+        ClKernel populate(0, "PopulateCaches", tile_rows);
+        const cl_int2 top_left = {0, 0};
+
+        populate.SetArg(sizeof(cl_mem), device.buffers_.ptr(plane));
+        populate.SetArg(sizeof(int), &width);
+        populate.SetArg(sizeof(int), &height);
+        populate.SetArg(sizeof(cl_int2), &top_left);
+        populate.SetArg(sizeof(cl_mem), device.buffers_.ptr(checksums));
+
+        if (populate.arguments_valid()) {
+            const size_t set_local_work_size[2]    = {8, static_cast<size_t>(tile_rows) << 3};
+            // height is increased as the weighting kernels' is, 8 work items to a pixel
+            const size_t set_scalar_global_size[2] = {width, height << 3};
+            const size_t set_scalar_item_size[2]   = {1, 1};
+
+            populate.set_work_dim(2);
+            populate.set_local_work_size(set_local_work_size);
+            populate.set_scalar_global_size(set_scalar_global_size);
+            populate.set_scalar_item_size(set_scalar_item_size);
+
+            for (int i = 0; i <= frames && status == FILTER_OK; ++i)
+                status = populate.Execute(cq, NULL);
+            clFinish(cq);
+        } else {
+            status = FILTER_KERNEL_ARGUMENT_ERROR;
+        }
+        populate.Release();
+    }
+
+    device.buffers_.Destroy(checksums);
+    device.buffers_.Destroy(plane);
+    clReleaseCommandQueue(cq);
+    return status;
+}
+
+// TimeStages
+// Filters frames of noise while profiling, so that the device times
+// every launch of each of the filter's kernels, then times the stages
+// that are launched alone. Cache fills are only timed on devices that
+// use images, since the pitched kernels have no caches.
+static result TimeStages(
+    const   int                             &width,
+    const   int                             &height,
+    const   int                             &temporal_radius,
+    const   int                             &sample_expand,
+    const   int                             &frames,
+            map<string, LatencyHistogram>   *durations) {
+
+    // Queues only time their commands if the profiler exists before they are created
+    Profiler profiler("", "");
+    g_profiler = &profiler;
+    profiler.Attribute("benchmark");
+
+    double seconds = 0.;
+    result status = TimeFiltering(0, width, height, temporal_radius, sample_expand, frames, &seconds);
+    if (status == FILTER_OK)
+        status = TimeInitialise(width, temporal_radius, sample_expand, frames);
+    // The caches filled are those of the tiles that the filter weighted
+    KernelGeometry geometry = {0, 0, 0, 0, DEFAULT_TILE_ROWS};
+    g_devices[0].geometry(width, height, temporal_radius, &geometry);
+    if (status == FILTER_OK && !g_devices[0].pitched_planes())
+        status = TimePopulateCaches(width, height, geometry.tile_rows, frames);
+
+    profiler.Collect();
+    profiler.StageDurations("benchmark", durations);
+    g_profiler = NULL;
+    return status;
+}
+
+// StartDevice
+// Starts OpenCL solely on the device, with the kernels compiled for the
+// alpha size, and readies it for filtering
+static result StartDevice(
+    const   cl_platform_id          &platform,
+    const   vector<cl_device_id>    &device,
+    const   int                     &alpha_size) {
+
+    result status = StartOpenCL(platform, device, "-D ALPHASIZE=" + GetAlphaSize(alpha_size >> 3));
+    if (status != FILTER_OK) {
+        StopOpenCL();
+        return status;
+    }
+
+    GaussianGenerator(k_benchmark_sigma, 0);
+    g_devices[0].WarmUp();
+    return FILTER_OK;
+}
+
+// WriteHeader
+// Describes the device, its peaks and the columns of the report
+static void WriteHeader(
+            ofstream    &report,
+            Device      &device,
+    const   double      &peak_gflops,
+    const   bool        &estimated,
+    const   double      &peak_gbs,
+    const   int         &frames) {
+
+    report << "Deathray2 kernel benchmark" << endl;
+    report << "Device: " << device.info(CL_DEVICE_NAME) << ", driver " << device.info(CL_DRIVER_VERSION) << endl;
+    if (peak_gflops > 0.) {
+        report << "Peak GFLOP/s: " << fixed << setprecision(1) << peak_gflops;
+        if (estimated) report << ", estimated from compute units, clock and vector width, set gflops for the true peak";
+        report << endl;
+    } else {
+        report << "Peak GFLOP/s unknown, set gflops for the compute roof" << endl;
+    }
+    if (peak_gbs > 0.)
+        report << "Peak GB/s: " << peak_gbs << endl;
+    else
+        report << "Peak GB/s unknown, set gbs for the memory roof" << endl;
+    report << "Times are medians of the device's timing of each launch over " << frames + 1 << " frames of noise." << endl;
+    report << "FLOP/s and GB/s follow a model of each stage's work: weighting kernels do "
+           << setprecision(0) << k_flops_per_candidate << " FLOPs per candidate, "
+           << "bytes are the compulsory traffic of planes and alpha sets." << endl << endl;
+
+    report << right
+           << setw(6) << "width"
+           << setw(6) << "height"
+           << setw(3) << "t"
+           << setw(3) << "x"
+           << setw(5) << "a" << "  "
+           << left << setw(32) << "stage" << right
+           << setw(9) << "launches"
+           << setw(11) << "ms/frame"
+           << setw(10) << "ns/pixel"
+           << setw(9) << "ns/cand"
+           << setw(9) << "GFLOP/s"
+           << setw(9) << "GB/s"
+           << setw(8) << "FLOP/B"
+           << setw(8) << "%FLOP"
+           << setw(8) << "%BW"
+           << setw(9) << "bound" << endl;
+}
+
+// WriteStages
+// Adds a line for each kernel stage timed for the configuration
+static void WriteStages(
+            ofstream                        &report,
+    const   int                             &width,
+    const   int                             &height,
+    const   int                             &temporal_radius,
+    const   int                             &sample_expand,
+    const   int                             &alpha_size,
+    const   int                             &frames,
+    const   double                          &peak_gflops,
+    const   double                          &peak_gbs,
+    const   map<string, LatencyHistogram>   &durations) {
+
+    for (map<string, LatencyHistogram>::const_iterator i = durations.begin(); i != durations.end(); ++i) {
+        const string &stage = i->first;
+        if (stage == "upload" || stage == "readback") continue;
+
+        const LatencyHistogram &launches = i->second;
+        const double launches_per_frame = static_cast<double>(launches.count()) / (frames + 1);
+        const double frame_ns = launches.Percentile(0.5) * launches_per_frame;
+        const double pixels = static_cast<double>(width) * (stage == "Initialise" ? k_initialise_rows : height);
+
+        report << right << fixed
+               << setw(6) << width
+               << setw(6) << height
+               << setw(3) << temporal_radius
+               << setw(3) << sample_expand
+               << setw(5) << alpha_size << "  "
+               << left << setw(32) << stage << right
+               << setprecision(1) << setw(9) << launches_per_frame
+               << setprecision(3) << setw(11) << frame_ns / 1000000.
+               << setw(10) << frame_ns / pixels;
+
+        double candidates, flops, bytes;
+        if (frame_ns <= 0. || !StageWork(stage, temporal_radius, sample_expand, alpha_size, &candidates, &flops, &bytes)) {
+            report << endl;
+            continue;
+        }
+
+        // Operations and bytes per nanosecond are GFLOP/s and GB/s
+        const double gflops = flops * pixels / frame_ns;
+        const double gbs = bytes * pixels / frame_ns;
+        const double intensity = flops / bytes;
+
+        report << setw(9);
+        if (candidates > 0.) report << frame_ns / (pixels * candidates); else report << "-";
+        report << setprecision(2)
+               << setw(9) << gflops
+               << setw(9) << gbs
+               << setw(8) << intensity
+               << setprecision(1) << setw(8);
+        if (peak_gflops > 0.) report << 100. * gflops / peak_gflops; else report << "-";
+        report << setw(8);
+        if (peak_gbs > 0.) report << 100. * gbs / peak_gbs; else report << "-";
+
+        // Below the ridge point the memory roof is the lower
+        report << setw(9);
+        if (peak_gbs > 0. && peak_gflops > 0.)
+            report << (intensity * peak_gbs < peak_gflops ? "memory" : "compute");
+        else
+            report << "-";
+        report << endl;
+    }
+}
+
+// AddNoise
+// Adds gaussian noise to a plane, clamping to the range of 8-bit pixels
+static void AddNoise(
+    const   vector<unsigned char>   &clean,
+    const   double                  &noise,
+            unsigned int            *seed,
+            vector<unsigned char>   *noisy) {
+
+    noisy->resize(clean.size());
+    for (size_t i = 0; i < clean.size(); ++i) {
+        // Box-Muller transform of a pair of uniform numbers from (0, 1]
+        *seed = *seed * 1664525 + 1013904223;
+        const double u1 = ((*seed >> 8) + 1.) / 16777216.;
+        *seed = *seed * 1664525 + 1013904223;
+        const double u2 = (*seed >> 8) / 16777216.;
+        const double gaussian = sqrt(-2. * log(u1)) * cos(6.283185307179586 * u2);
+
+        const double pixel = clean[i] + noise * gaussian + 0.5;
+        (*noisy)[i] = static_cast<unsigned char>(pixel < 0. ? 0. : (pixel > 255. ? 255. : pixel));
+    }
+}
+
+// SquaredError
+// Sum of the squared differences of the pixels of two planes
+static double SquaredError(
+    const   unsigned char   *a,
+    const   unsigned char   *b,
+    const   int             &width,
+    const   int             &height,
+    const   int             &pitch) {
+
+    double error = 0.;
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            const double difference = static_cast<double>(a[y * pitch + x]) - b[y * pitch + x];
+            error += difference * difference;
+        }
+    }
+    return error;
+}
+
+// PlaneSSIM
+// Mean structural similarity of two planes over 8x8 windows whose
+// corners are 4 pixels apart
+static double PlaneSSIM(
+    const   unsigned char   *a,
+    const   unsigned char   *b,
+    const   int             &width,
+    const   int             &height,
+    const   int             &pitch) {
+
+    double total = 0.;
+    int windows = 0;
+    for (int top = 0; top + 8 <= height; top += 4) {
+        for (int left = 0; left + 8 <= width; left += 4) {
+            double sum_a = 0., sum_b = 0., sum_aa = 0., sum_bb = 0., sum_ab = 0.;
+            for (int y = top; y < top + 8; ++y) {
+                for (int x = left; x < left + 8; ++x) {
+                    const double pixel_a = a[y * pitch + x];
+                    const double pixel_b = b[y * pitch + x];
+                    sum_a += pixel_a;
+                    sum_b += pixel_b;
+                    sum_aa += pixel_a * pixel_a;
+                    sum_bb += pixel_b * pixel_b;
+                    sum_ab += pixel_a * pixel_b;
+                }
+            }
+
+            const double mean_a = sum_a / 64.;
+            const double mean_b = sum_b / 64.;
+            const double variance_a = sum_aa / 64. - mean_a * mean_a;
+            const double variance_b = sum_bb / 64. - mean_b * mean_b;
+            const double covariance = sum_ab / 64. - mean_a * mean_b;
+
+            total += ((2. * mean_a * mean_b + k_ssim_c1) * (2. * covariance + k_ssim_c2))
+                   / ((mean_a * mean_a + mean_b * mean_b + k_ssim_c1) * (variance_a + variance_b + k_ssim_c2));
+            ++windows;
+        }
+    }
+    return windows > 0 ? total / windows : 1.;
+}
+
+// PSNR
+// Peak signal to noise ratio of 8-bit pixels from their total squared error
+static double PSNR(
+    const   double  &squared_error,
+    const   double  &pixels) {
+
+    if (squared_error <= 0.) return k_psnr_identical;
+    return 10. * log10(255. * 255. * pixels / squared_error);
+}
+
+// FilterClip
+// Filters every frame with the setting, as a clip would be. Only the
+// copies to the device and filtering of frames after the first are
+// timed, giving the frames filtered per second.
+static result FilterClip(
+    const   int                             &width,
+    const   int                             &height,
+    const   int                             &pitch,
+    const   QualitySetting                  &setting,
+    const   vector<vector<unsigned char> >  &source,
+            vector<vector<unsigned char> >  *filtered,
+            double                          *fps) {
+
+    const int frame_count = static_cast<int>(source.size());
+
+    // Filters use the fastest geometry for the plane, as the clip's would.
+    // Failures leave the default geometry.
+    TuneGeometry(0, width, height, setting.temporal_radius, setting.sample_expand, setting.alpha_size >> 3);
+
+    const float h = static_cast<float>(setting.h / 10000.);
+    SingleFrame *single = NULL;
+    MultiFrame *multi = NULL;
+    FilterFrame *plane = NULL;
+    result status = FILTER_OK;
+    if (setting.temporal_radius == 0) {
+        single = new SingleFrame();
+        plane = single;
+        status = single->Init(0, width, height, 1, pitch, pitch, h, setting.sample_expand, 0, 1, 0);
+    } else {
+        multi = new MultiFrame();
+        plane = multi;
+        status = multi->Init(0, setting.temporal_radius, width, height, 1, pitch, pitch, h, setting.sample_expand, 0, 1, 0);
+    }
+
+    LARGE_INTEGER frequency, started, finished;
+    QueryPerformanceFrequency(&frequency);
+    LONGLONG ticks = 0;
+
+    filtered->assign(frame_count, vector<unsigned char>(pitch * height, 0));
+    for (int n = 0; n < frame_count && status == FILTER_OK; ++n) {
+        QueryPerformanceCounter(&started);
+        if (single != NULL) {
+            status = single->CopyTo(&source[n][0]);
+        } else {
+            // Frames beyond the ends of the clip are its first and last, as Avisynth supplies them
+            MultiFrameRequest request;
+            int frame_number;
+            multi->SupplyFrameNumbers(n, &request);
+            while (request.GetFrameNumber(&frame_number))
+                request.Supply(frame_number, &source[min(max(frame_number, 0), frame_count - 1)][0]);
+            status = multi->CopyTo(&request);
+            multi->WaitForCopies();
+        }
+        if (status == FILTER_OK) status = FilterAndWait(plane, &(*filtered)[n][0]);
+        QueryPerformanceCounter(&finished);
+
+        // The first frame bears the driver's lazily performed work
+        if (n > 0) ticks += finished.QuadPart - started.QuadPart;
+    }
+
+    delete single;
+    delete multi;
+
+    *fps = ticks > 0 ? (frame_count - 1) * static_cast<double>(frequency.QuadPart) / ticks : 0.;
+    return status;
+}
+
+// ClipFilter
+// FilterClip or FilterChroma
+typedef result (*ClipFilter)(
+    const   int                             &width,
+    const   int                             &height,
+    const   int                             &pitch,
+    const   QualitySetting                  &setting,
+    const   vector<vector<unsigned char> >  &source,
+            vector<vector<unsigned char> >  *filtered,
+            double                          *fps);
+
+// FilterChroma
+// As FilterClip, for frames of U followed by frames of V. Both planes of
+// a frame are filtered before it counts as filtered.
+static result FilterChroma(
+    const   int                             &width,
+    const   int                             &height,
+    const   int                             &pitch,
+    const   QualitySetting                  &setting,
+    const   vector<vector<unsigned char> >  &source,
+            vector<vector<unsigned char> >  *filtered,
+            double                          *fps) {
+
+    const int frame_count = static_cast<int>(source.size()) / 2;
+    const vector<vector<unsigned char> > source_u(source.begin(), source.begin() + frame_count);
+    const vector<vector<unsigned char> > source_v(source.begin() + frame_count, source.end());
+
+    if (setting.temporal_radius > 0 || g_devices[0].pitched_planes()) {
+        vector<vector<unsigned char> > filtered_v;
+        double fps_u = 0., fps_v = 0.;
+        result status = FilterClip(width, height, pitch, setting, source_u, filtered, &fps_u);
+        if (status == FILTER_OK) status = FilterClip(width, height, pitch, setting, source_v, &filtered_v, &fps_v);
+        if (status != FILTER_OK) return status;
+
+        filtered->insert(filtered->end(), filtered_v.begin(), filtered_v.end());
+        *fps = (fps_u > 0. && fps_v > 0.) ? 1. / (1. / fps_u + 1. / fps_v) : 0.;
+        return FILTER_OK;
+    }
+
+    // Failures leave the default geometry
+    TuneGeometry(0, width, height, CHROMA_PAIR_RADIUS, setting.sample_expand, setting.alpha_size >> 3);
+
+    const float h = static_cast<float>(setting.h / 10000.);
+    ChromaFrame planes;
+    result status = planes.Init(0, width, height, 1, pitch, pitch, h, setting.sample_expand, 0, 0, 0);
+
+    LARGE_INTEGER frequency, started, finished;
+    QueryPerformanceFrequency(&frequency);
+    LONGLONG ticks = 0;
+
+    filtered->assign(2 * frame_count, vector<unsigned char>(pitch * height, 0));
+    for (int n = 0; n < frame_count && status == FILTER_OK; ++n) {
+        QueryPerformanceCounter(&started);
+        status = planes.CopyTo(NULL, &source_u[n][0], &source_v[n][0]);
+        if (status == FILTER_OK) status = FilterAndWait(&planes, &(*filtered)[n][0], &(*filtered)[frame_count + n][0]);
+        QueryPerformanceCounter(&finished);
+
+        // The first frame bears the driver's lazily performed work
+        if (n > 0) ticks += finished.QuadPart - started.QuadPart;
+    }
+
+    *fps = ticks > 0 ? (frame_count - 1) * static_cast<double>(frequency.QuadPart) / ticks : 0.;
+    return status;
+}
+
+// MeasureSetting
+// Filters the noisy frames with the setting, comparing each filtered
+// frame with its clean frame
+static void MeasureSetting(
+    const   int                             &width,
+    const   int                             &height,
+    const   int                             &pitch,
+    const   vector<vector<unsigned char> >  &clean,
+    const   vector<vector<unsigned char> >  &noisy,
+            QualityResult                   *measured) {
+
+    vector<vector<unsigned char> > filtered;
+    measured->status = FilterClip(width, height, pitch, measured->setting, noisy, &filtered, &measured->fps);
+    if (measured->status != FILTER_OK) return;
+
+    double squared_error = 0.;
+    double ssim = 0.;
+    for (size_t n = 0; n < clean.size(); ++n) {
+        squared_error += SquaredError(&filtered[n][0], &clean[n][0], width, height, pitch);
+        ssim += PlaneSSIM(&filtered[n][0], &clean[n][0], width, height, pitch);
+    }
+
+    measured->psnr = PSNR(squared_error, static_cast<double>(width) * height * clean.size());
+    measured->ssim = ssim / clean.size();
+}
+
+// FasterResult
+// Orders results from fastest to slowest
+static bool FasterResult(
+    const   QualityResult   &a,
+    const   QualityResult   &b) {
+
+    return a.fps > b.fps;
+}
+
+// WriteQualityResult
+// Adds a line for the result
+static void WriteQualityResult(
+            ofstream        &report,
+    const   QualityResult   &measured,
+    const   bool            &front) {
+
+    const QualitySetting &setting = measured.setting;
+    report << right << fixed
+           << setprecision(2) << setw(6) << setting.h
+           << setw(4) << setting.sample_expand
+           << setw(5) << setting.alpha_size
+           << setw(4) << setting.temporal_radius;
+
+    if (measured.status != FILTER_OK) {
+        report << "  failed, status=" << measured.status << endl;
+        return;
+    }
+
+    report << setprecision(2) << setw(10) << measured.psnr
+           << setprecision(4) << setw(8) << measured.ssim
+           << setprecision(2) << setw(9) << measured.fps
+           << (front ? "  *" : "") << endl;
+}
+
+result RunQualityBenchmark(
+    const   string                          &choice,
+    const   int                             &width,
+    const   int                             &height,
+    const   int                             &pitch,
+    const   vector<vector<unsigned char> >  &clean,
+    const   double                          &noise,
+    const   vector<QualitySetting>          &settings,
+    const   string                          &report_path) {
+
+    if (clean.size() < 2 || settings.empty()) return FILTER_INVALID_PARAMETER;
+
+    ofstream report(report_path.c_str(), ios::out | ios::trunc);
+    if (!report.is_open()) return FILTER_ERROR;
+
+    // The same noise for every setting
+    vector<vector<unsigned char> > noisy(clean.size());
+    unsigned int seed = 1;
+    double noisy_error = 0.;
+    double noisy_ssim = 0.;
+    for (size_t i = 0; i < clean.size(); ++i) {
+        AddNoise(clean[i], noise, &seed, &noisy[i]);
+        noisy_error += SquaredError(&noisy[i][0], &clean[i][0], width, height, pitch);
+        noisy_ssim += PlaneSSIM(&noisy[i][0], &clean[i][0], width, height, pitch);
+    }
+
+    cl_platform_id platform = NULL;
+    vector<cl_device_id> devices;
+    result status = SelectDevices(choice, width, height, 1, k_benchmark_sigma, "-D ALPHASIZE=" + GetAlphaSize(settings[0].alpha_size >> 3), false, &platform, &devices);
+    if (status != FILTER_OK) return status;
+    const vector<cl_device_id> device(1, devices[0]);
+
+    vector<QualityResult> results(settings.size());
+    for (size_t i = 0; i < settings.size(); ++i) {
+        results[i].setting = settings[i];
+        results[i].status = FILTER_ERROR;
+    }
+
+    // ALPHASIZE is compiled into the kernels, so the settings are measured in groups of alpha size
+    string device_name;
+    vector<bool> measured(settings.size(), false);
+    for (size_t i = 0; i < settings.size(); ++i) {
+        if (measured[i]) continue;
+
+        status = StartDevice(platform, device, settings[i].alpha_size);
+        if (status != FILTER_OK) return status;
+        if (device_name.empty()) device_name = g_devices[0].info(CL_DEVICE_NAME);
+
+        for (size_t j = i; j < settings.size(); ++j) {
+            if (measured[j] || settings[j].alpha_size != settings[i].alpha_size) continue;
+
+            MeasureSetting(width, height, pitch, clean, noisy, &results[j]);
+            measured[j] = true;
+        }
+
+        StopOpenCL();
+    }
+
+    // Faster settings with lower PSNR remain on the front
+    vector<QualityResult> fastest_first;
+    for (size_t i = 0; i < results.size(); ++i)
+        if (results[i].status == FILTER_OK) fastest_first.push_back(results[i]);
+    stable_sort(fastest_first.begin(), fastest_first.end(), FasterResult);
+
+    vector<QualityResult> front;
+    for (size_t i = 0; i < fastest_first.size(); ++i)
+        if (front.empty() || fastest_first[i].psnr > front.back().psnr) front.push_back(fastest_first[i]);
+
+    const double pixels = static_cast<double>(width) * height * clean.size();
+    report << "Deathray2 quality benchmark" << endl;
+    report << "Device: " << device_name << endl;
+    report << clean.size() << " frames of " << width << "x" << height << " luma, with gaussian noise of standard deviation "
+           << fixed << setprecision(2) << noise << endl;
+    report << "Noisy frames: PSNR " << PSNR(noisy_error, pixels) << " dB, SSIM " << setprecision(4) << noisy_ssim / clean.size() << endl;
+    report << "fps excludes the first frame. * marks the Pareto front of fps and PSNR." << endl << endl;
+
+    const char *columns = "    hY   x    a  tY   PSNR dB    SSIM      fps";
+    report << columns << endl;
+    for (size_t i = 0; i < results.size(); ++i) {
+        bool on_front = false;
+        for (size_t j = 0; j < front.size() && !on_front; ++j) {
+            const QualitySetting &a = front[j].setting;
+            const QualitySetting &b = results[i].setting;
+            on_front = results[i].status == FILTER_OK && a.h == b.h && a.sample_expand == b.sample_expand
+                    && a.alpha_size == b.alpha_size && a.temporal_radius == b.temporal_radius;
+        }
+        WriteQualityResult(report, results[i], on_front);
+    }
+
+    report << endl << "Pareto front, fastest first" << endl << endl;
+    report << columns << endl;
+    for (size_t i = 0; i < front.size(); ++i)
+        WriteQualityResult(report, front[i], false);
+
+    return FILTER_OK;
+}
+
+result RunBenchmark(
+    const   string  &choice,
+    const   int     &width,
+    const   int     &height,
+    const   int     &frames,
+    const   double  &peak_gflops,
+    const   double  &peak_gbs,
+    const   string  &report_path) {
+
+    ofstream report(report_path.c_str(), ios::out | ios::trunc);
+    if (!report.is_open()) return FILTER_ERROR;
+
+    const int alpha_size_count = sizeof(k_alpha_sizes) / sizeof(k_alpha_sizes[0]);
+    const int temporal_radius_count = sizeof(k_temporal_radii) / sizeof(k_temporal_radii[0]);
+
+    // The device chosen does not depend upon the alpha size
+    cl_platform_id platform = NULL;
+    vector<cl_device_id> devices;
+    result status = SelectDevices(choice, width, height, 1, k_benchmark_sigma, "-D ALPHASIZE=" + GetAlphaSize(k_alpha_sizes[0] >> 3), false, &platform, &devices);
+    if (status != FILTER_OK) return status;
+    const vector<cl_device_id> device(1, devices[0]);
+
+    // Luma's dimensions and those of 4:2:0 chroma
+    const int plane_sizes[2][2] = {{width, height}, {width >> 1, height >> 1}};
+
+    double gflops_roof = peak_gflops;
+
+    for (int i = 0; i < alpha_size_count; ++i) {
+        status = StartDevice(platform, device, k_alpha_sizes[i]);
+        if (status != FILTER_OK) return status;
+
+        if (i == 0) {
+            // Each core of a CPU completes a fused multiply-add in every lane of its native vector every
+            // cycle. Other devices report a native vector of 1 for their many lanes, so are not estimated.
+            const bool cpu = (g_devices[0].ulong_info(CL_DEVICE_TYPE) & CL_DEVICE_TYPE_CPU) != 0;
+            if (gflops_roof <= 0. && cpu)
+                gflops_roof = g_devices[0].compute_units()
+                            * g_devices[0].uint_info(CL_DEVICE_MAX_CLOCK_FREQUENCY)
+                            * g_devices[0].uint_info(CL_DEVICE_NATIVE_VECTOR_WIDTH_FLOAT)
+                            * 2. / 1000.;
+            WriteHeader(report, g_devices[0], gflops_roof, peak_gflops <= 0., peak_gbs, frames);
+        }
+
+        for (int j = 0; j < 2; ++j) {
+            for (int k = 0; k < temporal_radius_count; ++k) {
+                for (int sample_expand = 1; sample_expand <= 4; ++sample_expand) {
+                    const int plane_width = plane_sizes[j][0];
+                    const int plane_height = plane_sizes[j][1];
+
+                    // Configurations that fail, e.g. because the alpha buffer is too large, are noted
+                    map<string, LatencyHistogram> durations;
+                    result stage_status = TimeStages(plane_width, plane_height, k_temporal_radii[k], sample_expand, frames, &durations);
+                    if (stage_status != FILTER_OK) {
+                        report << right
+                               << setw(6) << plane_width
+                               << setw(6) << plane_height
+                               << setw(3) << k_temporal_radii[k]
+                               << setw(3) << sample_expand
+                               << setw(5) << k_alpha_sizes[i]
+                               << "  failed, status=" << stage_status << " and OpenCL status=" << g_last_cl_error << endl;
+                        continue;
+                    }
+
+                    WriteStages(report, plane_width, plane_height, k_temporal_radii[k], sample_expand, k_alpha_sizes[i], frames, gflops_roof, peak_gbs, durations);
+                }
+            }
+        }
+
+        StopOpenCL();
+    }
+
+    return FILTER_OK;
+}
+
+// RegressionName
+// Names a setting of the regression suite in the report, baselines and
+// golden files
+static string RegressionName(
+    const   QualitySetting  &setting) {
+
+    ostringstream name;
+    name << "h" << fixed << setprecision(2) << setting.h
+         << "_x" << setting.sample_expand
+         << "_a" << setting.alpha_size
+         << "_t" << setting.temporal_radius;
+    return name.str();
+}
+
+// RegressionInput
+// Fills the suite's frames of a plane with a picture of gradients, edges
+// and flat areas that drifts from frame to frame, plus noise. Each plane
+// has its own shade and noise.
+static void RegressionInput(
+    const   int                             &width,
+    const   int                             &height,
+    const   int                             &pitch,
+    const   int                             &shade,
+            unsigned int                    *seed,
+            vector<vector<unsigned char> >  *frames) {
+
+    vector<vector<unsigned char> > clean(k_regression_frames, vector<unsigned char>(pitch * height, 0));
+    for (int n = 0; n < k_regression_frames; ++n) {
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                const int square = (((x + n) >> 4) + (y >> 4)) & 1;
+                clean[n][y * pitch + x] = static_cast<unsigned char>(shade + ((x + y) >> 2) + 64 * square);
+            }
+        }
+    }
+
+    frames->resize(k_regression_frames);
+    for (int n = 0; n < k_regression_frames; ++n)
+        AddNoise(clean[n], k_regression_noise, seed, &(*frames)[n]);
+}
+
+// ReadGolden
+// Reads the golden frames of a setting, stored row after row without
+// padding. Returns false if they are missing or incomplete.
+static bool ReadGolden(
+    const   string                          &path,
+    const   int                             &width,
+    const   int                             &height,
+    const   int                             &pitch,
+    const   int                             &frame_count,
+            vector<vector<unsigned char> >  *golden) {
+
+    ifstream file(path.c_str(), ios::in | ios::binary);
+    if (!file.is_open()) return false;
+
+    golden->assign(frame_count, vector<unsigned char>(pitch * height, 0));
+    for (int n = 0; n < frame_count; ++n) {
+        for (int y = 0; y < height; ++y) {
+            file.read(reinterpret_cast<char*>(&(*golden)[n][y * pitch]), width);
+            if (!file) return false;
+        }
+    }
+    return true;
+}
+
+// WriteGolden
+// Writes the frames of a setting as its golden frames
+static bool WriteGolden(
+    const   string                          &path,
+    const   int                             &width,
+    const   int                             &height,
+    const   int                             &pitch,
+    const   vector<vector<unsigned char> >  &filtered) {
+
+    ofstream file(path.c_str(), ios::out | ios::binary | ios::trunc);
+    if (!file.is_open()) return false;
+
+    for (size_t n = 0; n < filtered.size(); ++n) {
+        for (int y = 0; y < height; ++y)
+            file.write(reinterpret_cast<const char*>(&filtered[n][y * pitch]), width);
+    }
+    return file.good();
+}
+
+result RunRegression(
+    const   string  &choice,
+    const   string  &directory,
+    const   bool    &record,
+    const   int     &tolerance,
+    const   double  &slowdown,
+    const   string  &report_path,
+            int     *failures) {
+
+    *failures = 0;
+
+    const char last = directory.empty() ? '\\' : directory[directory.length() - 1];
+    const string folder = (last == '\\' || last == '/') ? directory : directory + "\\";
+    const string baselines_path = folder + "baselines.txt";
+
+    const int luma_count = sizeof(k_regression_settings) / sizeof(k_regression_settings[0]);
+    const int setting_count = luma_count + sizeof(k_regression_chroma_settings) / sizeof(k_regression_chroma_settings[0]);
+
+    // A directory without golden frames has yet to be recorded, which no setting's pass or failure would reveal
+    if (!record) {
+        bool golden_found = false;
+        for (int i = 0; i < setting_count && !golden_found; ++i) {
+            const string name = i < luma_count ? RegressionName(k_regression_settings[i]) : "uv_" + RegressionName(k_regression_chroma_settings[i - luma_count]);
+            golden_found = ifstream((folder + name + ".golden").c_str(), ios::in | ios::binary).is_open();
+        }
+        if (!golden_found) return FILTER_NO_GOLDEN_FRAMES;
+    }
+
+    ofstream report(report_path.c_str(), ios::out | ios::trunc);
+    if (!report.is_open()) return FILTER_ERROR;
+
+    // Baselines recorded earlier, frames per second by setting
+    map<string, double> baselines;
+    if (!record) {
+        ifstream file(baselines_path.c_str());
+        string name;
+        double fps;
+        while (file >> name >> fps) baselines[name] = fps;
+    }
+
+    // Frames of chroma are those of U followed by those of V
+    const int chroma_width = k_regression_width >> 1;
+    const int chroma_height = k_regression_height >> 1;
+    const int luma_pitch = ByPowerOf2(k_regression_width, 6);
+    const int chroma_pitch = ByPowerOf2(chroma_width, 6);
+    vector<vector<unsigned char> > luma, chroma, chroma_v;
+    unsigned int seed = 1;
+    RegressionInput(k_regression_width, k_regression_height, luma_pitch, 48, &seed, &luma);
+    RegressionInput(chroma_width, chroma_height, chroma_pitch, 80, &seed, &chroma);
+    RegressionInput(chroma_width, chroma_height, chroma_pitch, 112, &seed, &chroma_v);
+    chroma.insert(chroma.end(), chroma_v.begin(), chroma_v.end());
+
+    cl_platform_id platform = NULL;
+    vector<cl_device_id> devices;
+    result status = SelectDevices(choice, k_regression_width, k_regression_height, 1, k_benchmark_sigma, "-D ALPHASIZE=" + GetAlphaSize(k_regression_settings[0].alpha_size >> 3), false, &platform, &devices);
+    if (status != FILTER_OK) return status;
+    const vector<cl_device_id> device(1, devices[0]);
+
+    report << "Deathray2 regression suite, " << (record ? "recording golden frames and baselines" : "comparing with golden frames and baselines") << endl;
+    report << k_regression_frames << " frames of " << k_regression_width << "x" << k_regression_height << " with chroma of " << chroma_width << "x" << chroma_height
+           << ", tolerance " << tolerance << " levels, slowdown allowed " << fixed << setprecision(1) << slowdown << "%" << endl << endl;
+
+    report << left << setw(20) << "setting" << right
+           << setw(10) << "max diff"
+           << setw(10) << "differ"
+           << setw(10) << "fps"
+           << setw(10) << "baseline"
+           << "  verdict" << endl;
+
+    ofstream recorded;
+    if (record) {
+        recorded.open(baselines_path.c_str(), ios::out | ios::trunc);
+        if (!recorded.is_open()) return FILTER_ERROR;
+    }
+
+    // ALPHASIZE is compiled into the kernels, so OpenCL is started for each setting
+    for (int i = 0; i < setting_count; ++i) {
+        const bool is_chroma = i >= luma_count;
+        const QualitySetting &setting = is_chroma ? k_regression_chroma_settings[i - luma_count] : k_regression_settings[i];
+        const string name = (is_chroma ? "uv_" : "") + RegressionName(setting);
+        const string golden_path = folder + name + ".golden";
+        const int width = is_chroma ? chroma_width : k_regression_width;
+        const int height = is_chroma ? chroma_height : k_regression_height;
+        const int pitch = is_chroma ? chroma_pitch : luma_pitch;
+        const vector<vector<unsigned char> > &source = is_chroma ? chroma : luma;
+
+        status = StartDevice(platform, device, setting.alpha_size);
+        if (status != FILTER_OK) return status;
+        if (i == 0) report << "Device: " << g_devices[0].info(CL_DEVICE_NAME) << endl;
+
+        const ClipFilter filter = is_chroma ? FilterChroma : FilterClip;
+        vector<vector<unsigned char> > filtered, repeated;
+        double fps = 0.;
+        status = filter(width, height, pitch, setting, source, &filtered, &fps);
+        for (int run = 1; run < k_regression_runs && status == FILTER_OK; ++run) {
+            double repeat_fps = 0.;
+            repeated.clear();
+            status = filter(width, height, pitch, setting, source, &repeated, &repeat_fps);
+            if (repeat_fps > fps) fps = repeat_fps;
+        }
+
+        StopOpenCL();
+
+        report << left << setw(20) << name << right;
+        if (status != FILTER_OK) {
+            report << "  failed, status=" << status << endl;
+            ++*failures;
+            continue;
+        }
+
+        if (record) {
+            if (!WriteGolden(golden_path, width, height, pitch, filtered)) return FILTER_ERROR;
+            recorded << name << " " << fixed << setprecision(3) << fps << endl;
+            report << setw(10) << "-" << setw(10) << "-" << fixed << setprecision(2) << setw(10) << fps << setw(10) << "-" << "  recorded" << endl;
+            continue;
+        }
+
+        // Output is intact when no pixel strays from the golden frames by more than the tolerance
+        vector<vector<unsigned char> > golden;
+        int max_difference = 0;
+        int differing = 0;
+        const bool golden_found = ReadGolden(golden_path, width, height, pitch, static_cast<int>(filtered.size()), &golden);
+        if (golden_found) {
+            for (size_t n = 0; n < filtered.size(); ++n) {
+                for (int y = 0; y < height; ++y) {
+                    for (int x = 0; x < width; ++x) {
+                        const int difference = abs(static_cast<int>(filtered[n][y * pitch + x]) - golden[n][y * pitch + x]);
+                        if (difference > 0) ++differing;
+                        if (difference > max_difference) max_difference = difference;
+                    }
+                }
+            }
+        }
+
+        const map<string, double>::const_iterator baseline = baselines.find(name);
+        const bool slower = baseline != baselines.end() && fps < baseline->second * (1. - slowdown / 100.);
+
+        string verdict = "pass";
+        if (!golden_found) {
+            verdict = "FAIL, no golden frames";
+        } else if (max_difference > tolerance) {
+            verdict = "FAIL, output differs";
+        } else if (slower) {
+            verdict = "FAIL, slower";
+        } else if (baseline == baselines.end()) {
+            verdict = "pass, no baseline";
+        }
+        if (verdict.compare(0, 4, "FAIL") == 0) ++*failures;
+
+        report << setw(10) << (golden_found ? max_difference : -1)
+               << setw(10) << differing
+               << fixed << setprecision(2) << setw(10) << fps;
+        if (baseline != baselines.end()) {
+            report << setw(10) << baseline->second;
+        } else {
+            report << setw(10) << "-";
+        }
+        report << "  " << verdict << endl;
+    }
+
+    report << endl << *failures << " of " << setting_count << " settings failed" << endl;
+    return FILTER_OK;
+}
@@ -0,0 +1,103 @@
+/* Deathray2 - An Avisynth plug-in filter for spatial/temporal non-local means de-noising.
+ *
+ * version 1.00
+ *
+ * Copyright 2015, Jawed Ashraf - Deathray@cupidity.f9.co.uk
+ */
+
+#ifndef _BENCHMARK_H_
+#define _BENCHMARK_H_
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+enum result;
+
+// QualitySetting
+// A combination of the filter's parameters for RunQualityBenchmark
+struct QualitySetting {
+    double  h;                  // strength, as given to the filter by hY
+    int     sample_expand;      // factor of radius of 3 to use for sampling, x
+    int     alpha_size;         // count of sorted samples used for filtering, a
+    int     temporal_radius;    // frames before and after the target, tY
+};
+
+// RunBenchmark
+// Times each kernel stage of filtering on the device, on planes of noise,
+// for every sample expansion (x), alpha size (a) and temporal radius of 0
+// or 1, on planes of the clip's luma dimensions and of half of them.
+//
+// The weighting and Finalise kernels are timed as the filters launch
+// them. Initialise and the cache fills of the weighting kernels are
+// launched on their own. The device times each launch.
+//
+// For each stage the report gives time per frame, per pixel and per
+// candidate, with the FLOP/s and bytes/s achieved according to a model
+// of each stage's work, against the device's peaks.
+//
+// ALPHASIZE is compiled into the kernels, so OpenCL is started for each
+// alpha size and stopped afterwards. The benchmark must therefore run
+// before any filter starts OpenCL.
+result RunBenchmark(
+    const   string  &choice,            // index or part of the name of a device, empty for automatic selection
+    const   int     &width,             // width of the clip's luma plane
+    const   int     &height,            // height of the clip's luma plane
+    const   int     &frames,            // count of frames timed for each configuration, after an untimed frame
+    const   double  &peak_gflops,       // device's peak GFLOP/s, 0 to estimate it
+    const   double  &peak_gbs,          // device's peak memory bandwidth in GB/s, 0 if unknown
+    const   string  &report_path);      // file for the report
+
+// RunQualityBenchmark
+// Adds gaussian noise to frames of a clean clip's luma, then filters the
+// noisy frames with each setting, measuring the PSNR and SSIM of the
+// filtered frames against the clean frames and the frames per second
+// filtered, excluding the first frame.
+//
+// The report lists every setting, then the Pareto front: the settings
+// that no other setting beats on both speed and PSNR, fastest first.
+// The fastest setting that meets a quality target is on the front.
+//
+// As with RunBenchmark, OpenCL is started for each alpha size and
+// stopped afterwards.
+result RunQualityBenchmark(
+    const   string                          &choice,        // index or part of the name of a device, empty for automatic selection
+    const   int                             &width,         // width of the luma plane
+    const   int                             &height,        // height of the luma plane
+    const   int                             &pitch,         // length in bytes of each row of the clean frames
+    const   vector<vector<unsigned char> >  &clean,         // luma of the clean frames, at least 2
+    const   double                          &noise,         // standard deviation of the noise, in 8-bit levels
+    const   vector<QualitySetting>          &settings,      // settings to be measured
+    const   string                          &report_path);  // file for the report
+
+// RunRegression
+// Filters fixed frames with a fixed set of settings, on the single frame
+// and multi-frame filters, to check that changes to the filter neither
+// alter its output nor slow it down. Settings of luma are followed by
+// settings of chroma, whose planes are filtered as a clip's would be.
+//
+// When recording, each setting's filtered frames are written to the
+// directory as its golden frames, and its frames per second, the
+// fastest of several runs, to the baselines. Otherwise a setting fails
+// if any pixel differs from its golden frames by more than the
+// tolerance or if it is slower than its baseline by more than the
+// slowdown allowed.
+//
+// Golden frames and baselines belong to the device they were recorded
+// on. A CPU OpenCL runtime, such as pocl, can be installed on any
+// machine, so its golden frames and baselines can be shared.
+//
+// Returns FILTER_NO_GOLDEN_FRAMES, without filtering, when comparing
+// and the directory holds none of the settings' golden frames, as
+// there is nothing to check against.
+result RunRegression(
+    const   string  &choice,            // index or part of the name of a device, empty for automatic selection
+    const   string  &directory,         // directory of the golden frames and baselines
+    const   bool    &record,            // record golden frames and baselines instead of comparing with them
+    const   int     &tolerance,         // largest difference in a pixel from the golden frames that passes
+    const   double  &slowdown,          // percentage by which a setting may be slower than its baseline
+    const   string  &report_path,       // file for the report
+            int     *failures);         // count of settings that failed
+
+#endif // _BENCHMARK_H_
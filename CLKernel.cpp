@@ -8,14 +8,31 @@
 #include "result.h"
 #include "CLKernel.h"
 #include "device.h"
+#include "Profiler.h"
 
 extern cl_int       g_last_cl_error;
 extern cl_context   g_context;
 
+ClKernel::ClKernel() {
+    device_id_          = 0;
+    tile_rows_          = DEFAULT_TILE_ROWS;
+    kernel_             = NULL;
+    arguments_valid_    = false;
+    argument_counter_   = 0;
+    work_dim_           = 0;
+    local_work_size_    = NULL;
+    scalar_global_size_ = NULL;
+    scalar_item_size_   = NULL;
+    global_work_size_   = NULL;
+}
+
 ClKernel::ClKernel(
     const   int     &device_id, 
     const   string  &kernel_name) {
 
+    device_id_          = device_id;
+    kernel_name_        = kernel_name;
+    tile_rows_          = DEFAULT_TILE_ROWS;
     kernel_             = g_devices[device_id].NewKernelInstance(kernel_name);
     arguments_valid_    = true;
     argument_counter_   = 0;
@@ -23,6 +40,25 @@ ClKernel::ClKernel(
     local_work_size_    = NULL;    
     scalar_global_size_ = NULL;
     scalar_item_size_   = NULL;    
+    global_work_size_   = NULL;
+}
+
+ClKernel::ClKernel(
+    const   int     &device_id, 
+    const   string  &kernel_name,
+    const   int     &tile_rows) {
+
+    device_id_          = device_id;
+    kernel_name_        = kernel_name;
+    tile_rows_          = tile_rows;
+    kernel_             = g_devices[device_id].NewKernelInstance(kernel_name, tile_rows);
+    arguments_valid_    = true;
+    argument_counter_   = 0;
+    work_dim_           = 0;            
+    local_work_size_    = NULL;    
+    scalar_global_size_ = NULL;
+    scalar_item_size_   = NULL;    
+    global_work_size_   = NULL;
 }
 
 void ClKernel::SetArg(
@@ -30,6 +66,7 @@ void ClKernel::SetArg(
     const   void    *arg_ptr) {
 
     if (arguments_valid_) {
+        RecordArg(argument_counter_, arg_size, arg_ptr);
         cl_int cl_status = clSetKernelArg(kernel_, argument_counter_++, arg_size, arg_ptr);
         if (cl_status != CL_SUCCESS) {
             g_last_cl_error = cl_status;
@@ -44,6 +81,7 @@ void ClKernel::SetNumberedArg(
     const   void    *arg_ptr) {
 
     if (arguments_valid_) {
+        RecordArg(arg_number, arg_size, arg_ptr);
         cl_int cl_status = clSetKernelArg(kernel_, arg_number, arg_size, arg_ptr);
         if (cl_status != CL_SUCCESS) {
             g_last_cl_error = cl_status;
@@ -52,6 +90,63 @@ void ClKernel::SetNumberedArg(
     }
 }
 
+void ClKernel::RecordArg(
+    const   int     &arg_number, 
+    const   size_t  &arg_size, 
+    const   void    *arg_ptr) {
+
+    if (arg_number >= static_cast<int>(argument_sizes_.size())) {
+        argument_sizes_.resize(arg_number + 1, 0);
+        argument_values_.resize(arg_number + 1);
+    }
+
+    argument_sizes_[arg_number] = arg_size;
+    if (arg_ptr == NULL) 
+        argument_values_[arg_number].clear();
+    else
+        argument_values_[arg_number].assign(static_cast<const unsigned char*>(arg_ptr), 
+                                            static_cast<const unsigned char*>(arg_ptr) + arg_size);
+}
+
+ClKernel ClKernel::Instance() const {
+    ClKernel instance(device_id_, kernel_name_, tile_rows_);
+    if (instance.kernel_ == NULL) instance.arguments_valid_ = false;
+
+    for (size_t i = 0; i < argument_sizes_.size(); ++i) {
+        if (argument_sizes_[i] == 0) continue;
+        instance.SetNumberedArg(static_cast<int>(i), 
+                                argument_sizes_[i], 
+                                argument_values_[i].empty() ? NULL : &argument_values_[i][0]);
+    }
+    instance.argument_counter_ = argument_counter_;
+    if (!arguments_valid_) instance.arguments_valid_ = false;
+
+    if (work_dim_ > 0) {
+        instance.set_work_dim(work_dim_);
+        instance.set_local_work_size(local_work_size_);
+        instance.set_scalar_global_size(scalar_global_size_);
+        instance.set_scalar_item_size(scalar_item_size_);
+    }
+    return instance;
+}
+
+void ClKernel::Release() {
+    if (kernel_ != NULL) clReleaseKernel(kernel_);
+    kernel_ = NULL;
+
+    if (work_dim_ > 0) {
+        delete [] local_work_size_;
+        delete [] scalar_global_size_;
+        delete [] scalar_item_size_;
+        delete [] global_work_size_;
+    }
+    work_dim_           = 0;
+    local_work_size_    = NULL;
+    scalar_global_size_ = NULL;
+    scalar_item_size_   = NULL;
+    global_work_size_   = NULL;
+}
+
 bool ClKernel::arguments_valid(){
     return arguments_valid_;
 }
@@ -111,6 +206,7 @@ result ClKernel::Execute(
 
     if (work_dim_ > 0 && work_dim_ < 4) {
         global_work_size();
+        cl_event profiled = NULL;
         cl_int cl_status = clEnqueueNDRangeKernel(cq, 
                                                   kernel_,
                                                   work_dim_,
@@ -119,13 +215,14 @@ result ClKernel::Execute(
                                                   local_work_size_,
                                                   0,
                                                   NULL,
-                                                  event);
+                                                  ProfiledEvent(event, &profiled));
         if (cl_status != CL_SUCCESS) {
             g_last_cl_error = cl_status;
-            *event = NULL;
+            if (event != NULL) *event = NULL;
             return FILTER_ERROR;
         }
 
+        if (g_profiler != NULL) g_profiler->Record(kernel_name_, 0, event, profiled);
         return FILTER_OK;
     }
     return FILTER_ERROR;
@@ -138,6 +235,7 @@ result ClKernel::ExecuteAsynch(
 
     if (work_dim_ > 0 && work_dim_ < 4) {
         global_work_size();
+        cl_event profiled = NULL;
         cl_int cl_status = clEnqueueNDRangeKernel(cq, 
                                                   kernel_,
                                                   work_dim_,
@@ -146,13 +244,14 @@ result ClKernel::ExecuteAsynch(
                                                   local_work_size_,
                                                   1,
                                                   antecedent,
-                                                  event);
+                                                  ProfiledEvent(event, &profiled));
         if (cl_status != CL_SUCCESS) {
             g_last_cl_error = cl_status;
-            *event = NULL;
+            if (event != NULL) *event = NULL;
             return FILTER_ERROR;
         }
 
+        if (g_profiler != NULL) g_profiler->Record(kernel_name_, 0, event, profiled);
         return FILTER_OK;
     }
     return FILTER_ERROR;
@@ -165,6 +264,7 @@ result ClKernel::ExecuteWaitList(
 
     if (work_dim_ > 0 && work_dim_ < 4) {
         global_work_size();
+        cl_event profiled = NULL;
         cl_int cl_status = clEnqueueNDRangeKernel(cq, 
                                                   kernel_,
                                                   work_dim_,
@@ -173,13 +273,14 @@ result ClKernel::ExecuteWaitList(
                                                   local_work_size_,
                                                   WaitListLength,
                                                   antecedents,
-                                                  event);
+                                                  ProfiledEvent(event, &profiled));
         if (cl_status != CL_SUCCESS) {
             g_last_cl_error = cl_status;
-            *event = NULL;
+            if (event != NULL) *event = NULL;
             return FILTER_ERROR;
         }
 
+        if (g_profiler != NULL) g_profiler->Record(kernel_name_, 0, event, profiled);
         return FILTER_OK;
     }
     return FILTER_ERROR;
@@ -10,6 +10,7 @@
 
 #include <CL/cl.h>
 #include <string>
+#include <vector>
 
 enum result;
 
@@ -19,7 +20,7 @@ using namespace std;
 // Manages a kernel from creation to execution. 
 class ClKernel {
 public:
-    ClKernel() {}
+    ClKernel();
 
     // Constructor
     // Associates a single OpenCL kernel with a single device
@@ -27,8 +28,31 @@ public:
         const   int     &device_id,     // device used to execute the kernel
         const   string  &kernel_name);  // OpenCL kernel name
 
+    // Constructor
+    // As above, for an image weighting kernel from the program compiled
+    // for tiles of the given height
+    ClKernel(
+        const   int     &device_id,     // device used to execute the kernel
+        const   string  &kernel_name,   // OpenCL kernel name
+        const   int     &tile_rows);    // rows of the image weighting kernels' tiles
+
     ~ClKernel() {}
 
+    // Instance
+    // Returns an independent instance of the same kernel, with the
+    // same arguments and execution geometry. Arguments can then be
+    // changed on either without affecting the other. 
+    //
+    // A sequence of launches that is repeated every frame can be 
+    // recorded as a set of instances, each with its arguments set 
+    // once, so that replaying the sequence merely enqueues them.
+    ClKernel Instance() const;
+
+    // Release
+    // Releases the OpenCL kernel and the execution geometry. Copies of 
+    // this object share both, so none of them can be executed afterwards.
+    void Release();
+
     // SetArg
     // Set the next argument in the sequence of kernel arguments.
     // Since this generates implicit argument numbers, the call ordering
@@ -126,12 +150,24 @@ public:
 
 private:
 
+    // RecordArg
+    // Keeps the value of an argument, so that Instance can set it
+    void RecordArg(
+        const   int     &arg_number,    // sequence number of argument
+        const   size_t  &arg_size,      // size in bytes of argument
+        const   void    *arg_ptr);      // pointer to the variable containing the value, NULL for local memory
+
     // global_work_size
     // Compute the size of the n-dimensional execution domain as a multiple of 
     // the work items per work group.
     void global_work_size();
 
+    int         device_id_;             // Device used to execute the kernel
+    string      kernel_name_;           // OpenCL kernel name
+    int         tile_rows_;             // Tile height of the program the kernel is from
     cl_kernel   kernel_;                // Compiled OpenCL kernel, ready to execute
+    vector<size_t> argument_sizes_;     // Size of each argument set, by argument number
+    vector<vector<unsigned char> > argument_values_;    // Value of each argument set, empty for local memory
     bool        arguments_valid_;       // Tracks occurrence of an error in arguments
     int         argument_counter_;      // Count of arguments, when setting them sequentially
     cl_uint     work_dim_;              // Count of dimensions in the execution domain
@@ -6,6 +6,9 @@
  */
 
 #include <direct.h>
+#include <fstream>
+#include <iterator>
+#include <sstream>
 
 #include "result.h"
 #include "util.h"
@@ -70,47 +73,88 @@ char* GetCLErrorString(const cl_int &err) {
     }
 }
 
-result GetPlatform(cl_platform_id *platform) {
-    *platform = NULL;
+string GetDeviceString(
+    const   cl_device_id    &device,
+    const   cl_device_info  &param) {
 
-    cl_int          status;    
-    cl_uint         platform_count;
-    cl_platform_id  *platforms;
+    size_t info_size = 0;
+    if (clGetDeviceInfo(device, param, 0, NULL, &info_size) != CL_SUCCESS || info_size == 0) 
+        return "";
+
+    vector<char> value(info_size + 1, 0);
+    clGetDeviceInfo(device, param, info_size, &value[0], NULL);
+    return string(&value[0]);
+}
+
+result GetAllDevices(vector<PlatformDevice> *found) {
+    found->clear();
+
+    cl_int  status;    
+    cl_uint platform_count = 0;
 
     status = clGetPlatformIDs(0, NULL, &platform_count);
     if (status != CL_SUCCESS) {
         g_last_cl_error = status;
         return FILTER_NO_PLATFORM;
     }
+    if (platform_count == 0) return FILTER_NO_PLATFORM;
 
-    if (platform_count > 0)    {
-        platforms = static_cast<cl_platform_id*> (malloc(platform_count * sizeof(cl_platform_id)));
+    vector<cl_platform_id> platforms(platform_count);
+    status = clGetPlatformIDs(platform_count, &platforms[0], NULL);
+    if (status != CL_SUCCESS) {
+        g_last_cl_error = status;
+        return FILTER_NO_PLATFORM;
+    }
 
-        status = clGetPlatformIDs(platform_count, platforms, NULL);
-        if (status != CL_SUCCESS) {
-            g_last_cl_error = status;
-            return FILTER_NO_PLATFORM;
+    for (cl_uint i = 0; i < platform_count; ++i) {
+        cl_uint device_count = 0;
+        if (clGetDeviceIDs(platforms[i], CL_DEVICE_TYPE_ALL, 0, NULL, &device_count) != CL_SUCCESS || device_count == 0) 
+            continue;
+
+        vector<cl_device_id> devices(device_count);
+        if (clGetDeviceIDs(platforms[i], CL_DEVICE_TYPE_ALL, device_count, &devices[0], NULL) != CL_SUCCESS) 
+            continue;
+
+        for (cl_uint j = 0; j < device_count; ++j) {
+            PlatformDevice candidate;
+            candidate.platform  = platforms[i];
+            candidate.device    = devices[j];
+            candidate.type      = CL_DEVICE_TYPE_GPU;
+            clGetDeviceInfo(devices[j], CL_DEVICE_TYPE, sizeof(cl_device_type), &candidate.type, NULL);
+
+            // Only CPU devices filter planes held as buffers, the rest require images
+            cl_bool image_support = CL_FALSE;
+            clGetDeviceInfo(devices[j], CL_DEVICE_IMAGE_SUPPORT, sizeof(cl_bool), &image_support, NULL);
+            if ((candidate.type & CL_DEVICE_TYPE_CPU) == 0 && image_support != CL_TRUE) continue;
+
+            candidate.name      = GetDeviceString(devices[j], CL_DEVICE_NAME);
+            candidate.driver    = GetDeviceString(devices[j], CL_DRIVER_VERSION);
+            found->push_back(candidate);
         }
+    }
 
-        *platform = platforms[0];
-        return FILTER_OK;        
-    } 
-
-    return FILTER_NO_PLATFORM;
+    if (found->empty()) return FILTER_NO_DEVICES_FOUND;
+    return FILTER_OK;        
 }
 
-result SetContext(const cl_platform_id &platform) {
+result SetContext(
+    const   cl_platform_id  &platform,
+    const   int             &device_count,
+    const   cl_device_id    *devices) {
+
     cl_int                  status                  = CL_SUCCESS;
     cl_context_properties   context_properties[3]   = {CL_CONTEXT_PLATFORM, 
                                                       (cl_context_properties)platform, 
                                                       0};
 
-    g_context = clCreateContextFromType(context_properties, 
-                                        CL_DEVICE_TYPE_GPU, 
-                                        NULL, 
-                                        NULL, 
-                                        &status);
+    g_context = clCreateContext(context_properties, 
+                                device_count,
+                                devices,
+                                NULL, 
+                                NULL, 
+                                &status);
     if (status != CL_SUCCESS) {  
+        g_context = NULL;
         g_last_cl_error = status;
         return FILTER_NO_CONTEXT;
     }
@@ -184,71 +228,261 @@ result AssembleSources(
     return FILTER_OK ;    
 }
 
-result CompileAll(
+string ProgramCacheKey(
+    const   cl_device_id    &device,
+    const   string          &source,
+    const   string          &build_options) {
+
+    // The version of the key's own layout comes first
+    string key = "Deathray2 program binary 1\n";
+
+    const cl_device_info properties[] = {CL_DEVICE_VENDOR, CL_DEVICE_NAME, CL_DEVICE_VERSION, CL_DRIVER_VERSION};
+    for (int i = 0; i < 4; ++i)
+        key.append(GetDeviceString(device, properties[i]) + "\n");
+
+    key.append(HashString(source) + "\n");
+    key.append(build_options + "\n");
+    return key;
+}
+
+bool LoadProgramBinary(
+    const   string                  &key,
+            vector<unsigned char>   *binary) {
+
+    string directory;
+    if (GetCacheDirectory(&directory) != FILTER_OK) return false;
+
+    ifstream cache((directory + HashString(key) + ".bin").c_str(), ios::in | ios::binary);
+    if (!cache) return false;
+
+    // The file starts with its key, which must match in full
+    string cached_key(key.size(), '\0');
+    cache.read(&cached_key[0], key.size());
+    if (!cache || cached_key != key) return false;
+
+    vector<unsigned char> contents((istreambuf_iterator<char>(cache)), istreambuf_iterator<char>());
+    if (contents.empty()) return false;
+
+    binary->swap(contents);
+    return true;
+}
+
+void SaveProgramBinaries(
+    const   cl_program      &program,
     const   int             &device_count,
-    const   cl_device_id    &devices,
-    const   string          cl_include) {
+    const   cl_device_id    *devices,
+    const   string          *keys) {
+
+    string directory;
+    if (GetCacheDirectory(&directory) != FILTER_OK) return;
+
+    // Binaries are returned in the program's order of devices, which
+    // is not necessarily the order of the devices passed in
+    cl_uint program_device_count = 0;
+    if (clGetProgramInfo(program, CL_PROGRAM_NUM_DEVICES, sizeof(cl_uint), &program_device_count, NULL) != CL_SUCCESS) return;
+
+    vector<cl_device_id> program_devices(program_device_count);
+    vector<size_t> binary_sizes(program_device_count);
+    if (clGetProgramInfo(program, CL_PROGRAM_DEVICES, program_device_count * sizeof(cl_device_id), &program_devices[0], NULL) != CL_SUCCESS) return;
+    if (clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, program_device_count * sizeof(size_t), &binary_sizes[0], NULL) != CL_SUCCESS) return;
+
+    vector<vector<unsigned char> > binaries(program_device_count);
+    vector<unsigned char*> binary_pointers(program_device_count, NULL);
+    for (cl_uint i = 0; i < program_device_count; ++i) {
+        if (binary_sizes[i] == 0) continue;
+        binaries[i].resize(binary_sizes[i]);
+        binary_pointers[i] = &binaries[i][0];
+    }
+    if (clGetProgramInfo(program, CL_PROGRAM_BINARIES, program_device_count * sizeof(unsigned char*), &binary_pointers[0], NULL) != CL_SUCCESS) return;
+
+    for (int i = 0; i < device_count; ++i) {
+        for (cl_uint j = 0; j < program_device_count; ++j) {
+            if (program_devices[j] != devices[i] || binaries[j].empty()) continue;
+
+            // Other processes may be reading the cache, so the file is
+            // written under a private name and then moved into place
+            const string file_name = directory + HashString(keys[i]) + ".bin";
+            stringstream temporary_name;
+            temporary_name << file_name << "." << GetCurrentProcessId() << ".tmp";
+
+            ofstream cache(temporary_name.str().c_str(), ios::out | ios::binary | ios::trunc);
+            cache.write(keys[i].c_str(), keys[i].size());
+            cache.write(reinterpret_cast<const char*>(&binaries[j][0]), binaries[j].size());
+            cache.close();
+
+            if (!cache || !MoveFileExA(temporary_name.str().c_str(), file_name.c_str(), MOVEFILE_REPLACE_EXISTING))
+                DeleteFileA(temporary_name.str().c_str());
+        }
+    }
+}
+
+// "include" definitions applied by CompileAll, which the programs
+// compiled later for other tile heights share
+static string g_cl_include;
+
+// TileDefinitions
+// "include" definitions of the image weighting kernels' tile height and
+// the height of their sample cache, which spans the tile and 15 rows
+// either side, rounded up to the pairs of rows that are filled together
+static string TileDefinitions(
+    const   int     &tile_rows) {
+
+    stringstream definitions;
+    definitions << "-D TILE_ROWS=" << tile_rows << " -D SAMPLE_CACHE_ROWS=" << ((tile_rows + 31) & ~1);
+    return definitions.str();
+}
+
+// BuildProgram
+// Builds the entire program for the devices, using binaries saved by an
+// earlier process if every device has one
+static result BuildProgram(
+    const   int             &device_count,
+    const   cl_device_id    *device_list,
+    const   string          &definitions,
+            cl_program      *built) {
 
     // The OpenCL source code is spread amongst a number of 
     // .cl files encoded as resources. Each of these resources is 
     // fetched into a string from which the entire program is built 
-    // and linked. Then each device in g_devices is given the program 
-    // and a list of kernels to create.
+    // and linked.
     //
     // IMPORTANT: After changing any .cl file, manually compile Deathray.rc,
     // then link Deathray. (Only applies to old Visual Studio versions?)
 
-    result  status    = FILTER_OK;
     cl_int  cl_status = CL_SUCCESS;
 
-    const int resource_count = 5;
+    const int resource_count = 8;
     const int resources[resource_count] = {RC_UTIL, // Always must be first
                                            RC_NLM,
                                            RC_NLM_SINGLE,
                                            RC_SORT,
                                            RC_NLM_MULTI,
+                                           RC_NLM_PITCHED,
+                                           RC_NLM_PERSISTENT, // Uses functions of all the others
+                                           RC_PACKED,
                                            };
     string entire_program_source;
 
     AssembleSources(&(resources[0]), resource_count, &entire_program_source);
 
-    const char* entire_program_c_str = entire_program_source.c_str();
-    cl_program program = clCreateProgramWithSource(g_context, 
-                                                   1, 
-                                                   &entire_program_c_str,
-                                                   NULL,
-                                                   &cl_status);
-    if (cl_status != CL_SUCCESS) {  
-        g_last_cl_error = cl_status;
-        return FILTER_OPENCL_COMPILATION_FAILED;
-    }
-
     // TODO use? -cl-fast-relaxed-math -cl-single-precision-constant -cl-mad-enable -cl-unsafe-math-optimizations -fuse-native
     const string compile_options = "-cl-fast-relaxed-math";
-    const string build_options = cl_include + " " + compile_options;
-
-    cl_status = clBuildProgram(program,
-                               device_count,
-                               &devices,
-                               build_options.c_str(),
-                               NULL, 
-                               NULL);
-    if (cl_status != CL_SUCCESS) {
-        g_last_cl_error = cl_status;
-        size_t build_log_size;
-        clGetProgramBuildInfo(program, devices, CL_PROGRAM_BUILD_LOG, 0, NULL, &build_log_size);
-        char* build_log = static_cast<char*>(malloc(build_log_size * sizeof(char)));
-        clGetProgramBuildInfo(program, devices, CL_PROGRAM_BUILD_LOG, build_log_size, build_log, NULL);
-        free(build_log);
-        return FILTER_OPENCL_KERNEL_DEVICE_BUILD_FAILED;
+    const string build_options = definitions + " " + compile_options;
+
+    vector<string> keys(device_count);
+    for (int i = 0; i < device_count; ++i)
+        keys[i] = ProgramCacheKey(device_list[i], entire_program_source, build_options);
+
+    // Compilation takes several seconds, so binaries saved by an earlier
+    // process are used if every device has one
+    cl_program program = NULL;
+    vector<vector<unsigned char> > binaries(device_count);
+    bool cached = true;
+    for (int i = 0; i < device_count && cached; ++i)
+        cached = LoadProgramBinary(keys[i], &binaries[i]);
+
+    if (cached) {
+        vector<size_t> binary_sizes(device_count);
+        vector<const unsigned char*> binary_pointers(device_count);
+        for (int i = 0; i < device_count; ++i) {
+            binary_sizes[i] = binaries[i].size();
+            binary_pointers[i] = &binaries[i][0];
+        }
+
+        program = clCreateProgramWithBinary(g_context,
+                                            device_count,
+                                            device_list,
+                                            &binary_sizes[0],
+                                            &binary_pointers[0],
+                                            NULL,
+                                            &cl_status);
+        if (cl_status == CL_SUCCESS)
+            cl_status = clBuildProgram(program, device_count, device_list, build_options.c_str(), NULL, NULL);
+
+        // A binary that the driver rejects is replaced by compiling the source
+        if (cl_status != CL_SUCCESS) {
+            if (program != NULL) clReleaseProgram(program);
+            program = NULL;
+        }
+    }
+
+    if (program == NULL) {
+        const char* entire_program_c_str = entire_program_source.c_str();
+        program = clCreateProgramWithSource(g_context, 
+                                            1, 
+                                            &entire_program_c_str,
+                                            NULL,
+                                            &cl_status);
+        if (cl_status != CL_SUCCESS) {  
+            g_last_cl_error = cl_status;
+            return FILTER_OPENCL_COMPILATION_FAILED;
+        }
+
+        cl_status = clBuildProgram(program,
+                                   device_count,
+                                   device_list,
+                                   build_options.c_str(),
+                                   NULL, 
+                                   NULL);
+        if (cl_status != CL_SUCCESS) {
+            g_last_cl_error = cl_status;
+            size_t build_log_size;
+            clGetProgramBuildInfo(program, device_list[0], CL_PROGRAM_BUILD_LOG, 0, NULL, &build_log_size);
+            char* build_log = static_cast<char*>(malloc(build_log_size * sizeof(char)));
+            clGetProgramBuildInfo(program, device_list[0], CL_PROGRAM_BUILD_LOG, build_log_size, build_log, NULL);
+            free(build_log);
+            clReleaseProgram(program);
+            return FILTER_OPENCL_KERNEL_DEVICE_BUILD_FAILED;
+        }
+
+        SaveProgramBinaries(program, device_count, device_list, &keys[0]);
+    }
+
+    *built = program;
+    return FILTER_OK;
+}
+
+result CompileAll(
+    const   int             &device_count,
+    const   cl_device_id    &devices,
+    const   string          cl_include) {
+
+    // The entire program is built for all devices, with the default tile 
+    // height. Then each device in g_devices is given the program and a
+    // list of kernels to create.
+
+    result  status    = FILTER_OK;
+
+    g_cl_include = cl_include;
+
+    cl_program program = NULL;
+    status = BuildProgram(device_count, &devices, cl_include + " " + TileDefinitions(DEFAULT_TILE_ROWS), &program);
+    if (status != FILTER_OK) {
+        return status;
     }
 
-    const int kernel_count = 4;
+    const int kernel_count = 20;
     const string kernels[kernel_count] = {
                                           "NLMSingleFrame",
                                           "Initialise",
                                           "Finalise",
                                           "NLMMultiFrameFourPixel",
+                                          "NLMSingleFramePitched",
+                                          "NLMMultiFramePitched",
+                                          "FinalisePitched",
+                                          "NLMSingleFramePersistent",
+                                          "NLMSingleFramePersistentPitched",
+                                          "NLMSingleFrameChroma",
+                                          "FinaliseChroma",
+                                          "NLMSingleFrameChromaGuided",
+                                          "DownsampleGuide",
+                                          "ConvertToLinear",
+                                          "UnpackYUY2",
+                                          "PackYUY2",
+                                          "UnpackRGB32",
+                                          "PackRGB32",
+                                          "PopulateCaches",
+                                          "FinaliseSweep",
                                           };
     for (int i = 0; i < device_count; ++i) {
         status = g_devices[i].KernelInit(program, kernel_count, &(kernels[0]));
@@ -261,43 +495,51 @@ result CompileAll(
     return status ;    
 }
 
-result StartOpenCL(
-            int     *device_count,
-    const   string  cl_include) {
-    // Platform and devices have a lifetime of this function only. 
+result CompileTileProgram(
+    const   cl_device_id    &device,
+    const   int             &tile_rows,
+            cl_program      *program) {
 
-    result          status      = FILTER_OK;
-    cl_platform_id  platform    = NULL;
+    return BuildProgram(1, &device, g_cl_include + " " + TileDefinitions(tile_rows), program);
+}
 
-    if ((status = GetPlatform(&platform)) != FILTER_OK) {
-        return status ;
-    }
+result StartOpenCL(
+    const   cl_platform_id          &platform,
+    const   vector<cl_device_id>    &devices,
+    const   string                  cl_include) {
 
-    if ((status = SetContext(platform)) != FILTER_OK) {
-        return status ;
-    }
+    result status = FILTER_OK;
 
-    if ((status = GetDeviceCount(device_count)) != FILTER_OK) {
-        return status ;
+    if (devices.empty()) {
+        return FILTER_NO_DEVICES_FOUND;
     }
 
-    cl_device_id* devices = NULL;
-    if ((status = GetDeviceList(&devices)) != FILTER_OK) {
+    const int device_count = static_cast<int>(devices.size());
+    if ((status = SetContext(platform, device_count, &devices[0])) != FILTER_OK) {
         return status ;
     }
 
-    if (*device_count == 0 || devices == NULL) {
-        return FILTER_NO_GPUS_FOUND;
-    }
-
     // Populate the global array of device objects with the devices
     // that were found and set up each device's command queue.
-    g_device_count = *device_count;
+    g_device_count = device_count;
     g_devices = new Device[g_device_count];
     for (int i = 0; i < g_device_count; ++i) {
-        g_devices[i].Init(static_cast<const cl_device_id&>(devices[i]));
+        g_devices[i].Init(devices[i]);
     }
 
-    status = CompileAll((g_device_count), static_cast<const cl_device_id&>(*devices), cl_include) ;
+    status = CompileAll((g_device_count), devices[0], cl_include) ;
     return status ;        
-}
\ No newline at end of file
+}
+
+void StopOpenCL() {
+    if (g_devices != NULL) {
+        for (int i = 0; i < g_device_count; ++i)
+            g_devices[i].buffers_.DestroyAll();
+        delete[] g_devices;
+    }
+    g_devices       = NULL;
+    g_device_count  = 0;
+
+    if (g_context != NULL) clReleaseContext(g_context);
+    g_context = NULL;
+}
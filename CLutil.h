@@ -9,6 +9,7 @@
 #define _CL_UTIL_H_
 
 #include <string>
+#include <vector>
 using namespace std;
 
 #include <CL/cl.h>
@@ -21,16 +22,36 @@ enum result;
 char* GetCLErrorString(
     const cl_int &err);                                 // Error number
 
-// GetPlatform
-// Finds the first available OpenCL platform
-result GetPlatform(
-    cl_platform_id *platform);                          // Platform found by OpenCL
+// PlatformDevice
+// A device found on one of the installed OpenCL platforms
+struct PlatformDevice {
+    cl_platform_id  platform;   // platform to which the device belongs
+    cl_device_id    device;     // id of the device
+    cl_device_type  type;       // CPU, GPU etc.
+    string          name;       // CL_DEVICE_NAME
+    string          driver;     // CL_DRIVER_VERSION
+};
+
+// GetDeviceString
+// Returns a string property of a device, e.g. CL_DEVICE_NAME
+string GetDeviceString(
+    const   cl_device_id    &device,                    // device to query
+    const   cl_device_info  &param);                    // property to query
+
+// GetAllDevices
+// Finds the devices of every type on every OpenCL platform that can
+// run the filter: CPUs and any device that supports images. Devices 
+// are listed in the order the platforms report them.
+result GetAllDevices(
+    vector<PlatformDevice> *found);                     // devices found by OpenCL
 
 // SetContext
-// Creates a context solely for GPU devices, setting the 
-// global variable g_context
+// Creates a context for the devices, setting the global 
+// variable g_context. The devices must share the platform.
 result SetContext(
-    const cl_platform_id &platform);                    // Platform that requires the new context
+    const   cl_platform_id  &platform,                  // Platform that requires the new context
+    const   int             &device_count,              // count of devices in the ...
+    const   cl_device_id    *devices);                  // ... array of devices
 
 // GetDeviceCount
 // Requires that g_context is valid
@@ -50,8 +71,35 @@ result AssembleSources(
     const   int             &resource_count,            // count of resources defined within DLL
             string          *entire_program_source);    // source code concatenated from all resources
 
+// ProgramCacheKey
+// Describes everything that a compiled program binary depends upon:
+// the device, its driver, the program source and the build options.
+// A cached binary is only used if its key matches exactly.
+string ProgramCacheKey(
+    const   cl_device_id    &device,                    // device that executes the binary
+    const   string          &source,                    // entire program source
+    const   string          &build_options);            // options passed to the compiler
+
+// LoadProgramBinary
+// Fetches the binary cached for the key, if there is one. Returns
+// false if the cache has no binary for the key.
+bool LoadProgramBinary(
+    const   string                  &key,               // key of the binary
+            vector<unsigned char>   *binary);           // binary from the cache
+
+// SaveProgramBinaries
+// Writes the binary for each device to the cache. Failures are 
+// ignored, since the cache is merely an optimisation.
+void SaveProgramBinaries(
+    const   cl_program      &program,                   // program built for the devices
+    const   int             &device_count,              // count of devices in the ...
+    const   cl_device_id    *devices,                   // ... array of devices
+    const   string          *keys);                     // key for each device's binary
+
 // CompileAll
 // All kernels are compiled, for all available devices.
+// Binaries from earlier processes are used instead, if 
+// every device has one in the cache.
 // Requires g_context and g_devices.
 // "include" definitions using the OpenCL compiler's 
 // -D syntax are applied to the entire source that's compiled
@@ -60,14 +108,31 @@ result CompileAll(
     const   cl_device_id    &devices,                   // ... array of devices
     const   string          cl_include);                // "include" definitions
 
+// CompileTileProgram
+// Compiles the entire program for a single device with the image
+// weighting kernels' tiles the given count of rows high, using the
+// "include" definitions of CompileAll. Cached binaries are used as
+// they are by CompileAll.
+result CompileTileProgram(
+    const   cl_device_id    &device,                    // device to compile for
+    const   int             &tile_rows,                 // rows of the image weighting kernels' tiles
+            cl_program      *program);                  // compiled program
+
 // StartOpenCL
-// Get OpenCL running, if possible.
-// The global array g_devices is configured based on the 
-// count of devices supplied and all of them are
-// targetted for compilation
+// Get OpenCL running, if possible, on the devices, which must
+// share the platform.
+// The global array g_devices is configured with the devices,
+// in the order given, and all of them are targetted for 
+// compilation. 
 result StartOpenCL(
-            int             *device_count,              // count of devices to configure
-    const   string          cl_include);                // "include" definitions
+    const   cl_platform_id          &platform,          // platform of the devices
+    const   vector<cl_device_id>    &devices,           // devices to configure
+    const   string                  cl_include);        // "include" definitions
+
+// StopOpenCL
+// Releases the devices and context configured by StartOpenCL,
+// so that OpenCL can be started again on other devices
+void StopOpenCL();
 
 #endif  // _CL_UTIL_H_
 
@@ -0,0 +1,433 @@
+/* Deathray2 - An Avisynth plug-in filter for spatial/temporal non-local means de-noising.
+ *
+ * version 1.00
+ *
+ * Copyright 2015, Jawed Ashraf - Deathray@cupidity.f9.co.uk
+ */
+
+#include "result.h"
+#include "util.h"
+#include "ChromaFrame.h"
+#include "device.h"
+#include "buffer_map.h"
+
+extern  int     g_device_count;
+extern  Device  *g_devices;
+
+extern  int     g_gaussian;
+
+// The guided filter kernel's arguments are shifted by its leading guide plane
+#define FILTER_ARG_INPUT_PLANE_U 0
+#define FILTER_ARG_INPUT_PLANE_V 1
+#define FILTER_ARG_TOP_LEFT 4
+#define GUIDE_ARG_LUMA_PLANE 0
+#define SORT_ARG_INPUT_PLANE_U 0
+#define SORT_ARG_INPUT_PLANE_V 1
+#define SORT_ARG_TOP_LEFT 3
+
+ChromaFrame::ChromaFrame() {
+    device_id_      = 0;
+    width_          = 0;
+    height_         = 0;
+    src_pitch_      = 0;
+    dst_pitch_      = 0;
+    source_plane_   = 0;
+    dest_plane_     = 0;
+    source_plane_v_ = 0;
+    dest_plane_v_   = 0;
+    alpha_          = 0;
+    region_width_   = 0;
+    region_height_  = 0;
+    pitched_        = false;
+    zero_copy_      = false;
+    plane_pitch_    = 0;
+    regions_per_band_ = 0;
+    alpha_plane_size_ = 0;
+    guided_         = false;
+    luma_width_     = 0;
+    luma_height_    = 0;
+    luma_pitch_     = 0;
+    luma_plane_     = 0;
+    guide_plane_    = 0;
+
+    const KernelGeometry default_geometry = {32, 16, 4, 0, DEFAULT_TILE_ROWS};
+    geometry_       = default_geometry;
+}
+
+ChromaFrame::~ChromaFrame() {
+    if (g_devices == NULL) return;
+
+    for (size_t i = 0; i < filter_launches_.size(); ++i) filter_launches_[i].Release();
+    for (size_t i = 0; i < sort_launches_.size(); ++i) sort_launches_[i].Release();
+    filter_.Release();
+    sort_.Release();
+    guide_.Release();
+
+    if (device_id_ < g_device_count) {
+        g_devices[device_id_].buffers_.Destroy(source_plane_v_);
+        g_devices[device_id_].buffers_.Destroy(dest_plane_v_);
+        g_devices[device_id_].buffers_.Destroy(luma_plane_);
+        g_devices[device_id_].buffers_.Destroy(guide_plane_);
+    }
+}
+
+result ChromaFrame::Init(
+    const   int     &device_id,
+    const   int     &width,
+    const   int     &height,
+    const   int     &pixel_size,
+    const   int     &src_pitch,
+    const   int     &dst_pitch,
+    const   float   &h,
+    const   int     &sample_expand,
+    const   int     &luma_width,
+    const   int     &luma_height,
+    const   int     &luma_pitch) {
+
+    if (device_id >= g_device_count) return FILTER_ERROR;
+    if (g_devices[device_id].pitched_planes()) return FILTER_INVALID_PARAMETER;
+    if (pixel_size == 4) return FILTER_INVALID_PARAMETER;
+
+    result status = FILTER_OK;
+
+    device_id_      = device_id;
+    width_          = width;
+    height_         = height;
+    src_pitch_      = src_pitch;
+    dst_pitch_      = dst_pitch;
+    g_devices[device_id_].geometry(width, height, CHROMA_PAIR_RADIUS, &geometry_);
+    region_width_   = width;
+    region_height_  = geometry_.region_height;
+    h_              = 1.f/h;
+    cq_             = g_devices[device_id_].cq();
+    readback_cq_    = g_devices[device_id_].cq();
+    zero_copy_      = g_devices[device_id_].zero_copy();
+    pixel_size_     = pixel_size;
+    guided_         = luma_width > 0;
+    luma_width_     = luma_width;
+    luma_height_    = luma_height;
+    luma_pitch_     = luma_pitch;
+
+    // The guide averages at most 2x2 luma pixels
+    if (guided_ && (luma_width_ > 2 * width_ || luma_height_ > 2 * height_ || luma_width_ < width_ || luma_height_ < height_))
+        return FILTER_INVALID_PARAMETER;
+
+    if (width_ == 0 || height_ == 0 || src_pitch_ == 0 || dst_pitch_ == 0 || h == 0 )
+        return FILTER_INVALID_PARAMETER;
+
+    alpha_set_size_ = GetAlphaSetSize(0, sample_expand);
+
+    status = InitBuffers(sample_expand);
+    if (status != FILTER_OK) return status;
+
+    if (guided_) {
+        status = InitGuideKernel();
+        if (status != FILTER_OK) return status;
+    }
+
+    status = InitFilterKernel(sample_expand);
+    if (status != FILTER_OK) return status;
+
+    status = InitSortKernel();
+    if (status != FILTER_OK) return status;
+
+    status = RecordLaunches();
+
+    return status;
+}
+
+result ChromaFrame::InitBuffers(const int &sample_expand) {
+    result status = FILTER_OK;
+
+    // Source planes that wrap host frames are created by CopyTo
+    if (!zero_copy_) {
+        status = AllocPlane(&source_plane_);
+        if (status != FILTER_OK) return status;
+
+        status = AllocPlane(&source_plane_v_);
+        if (status != FILTER_OK) return status;
+    }
+
+    status = AllocPlane(&dest_plane_);
+    if (status != FILTER_OK) return status;
+
+    status = AllocPlane(&dest_plane_v_);
+    if (status != FILTER_OK) return status;
+
+    if (guided_) {
+        if (!zero_copy_) {
+            if (pixel_size_ > 1)
+                status = g_devices[device_id_].buffers_.AllocWidePlane(cq_, luma_width_, luma_height_, pixel_size_, &luma_plane_);
+            else
+                status = g_devices[device_id_].buffers_.AllocPlane(cq_, luma_width_, luma_height_, &luma_plane_);
+            if (status != FILTER_OK) return status;
+        }
+
+        status = AllocPlane(&guide_plane_);
+        if (status != FILTER_OK) return status;
+    }
+
+    alpha_plane_size_ = GetAlphaBufferSize(0,
+                                           region_width_,
+                                           region_height_,
+                                           sample_expand);
+
+    const int alpha_buffer_size = 2 * alpha_plane_size_ * sizeof(cl_uint);
+
+    status = g_devices[device_id_].buffers_.AllocBuffer(cq_, alpha_buffer_size, &alpha_);
+
+    return status;
+}
+
+result ChromaFrame::InitGuideKernel() {
+
+    guide_ = ClKernel(device_id_, "DownsampleGuide");
+
+    const cl_int2 scale = {luma_width_ > width_ ? 2 : 1, luma_height_ > height_ ? 2 : 1};
+    // Until CopyTo wraps the first frame the guide stands in for luma
+    const int luma_plane = zero_copy_ ? guide_plane_ : luma_plane_;
+
+    guide_.SetArg(sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(luma_plane));
+    guide_.SetArg(sizeof(cl_int2), &scale);
+    guide_.SetArg(sizeof(int), &width_);
+    guide_.SetArg(sizeof(int), &height_);
+    guide_.SetArg(sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(guide_plane_));
+
+    if (guide_.arguments_valid()) {
+        // one work item per texel of 4 pixels
+        const size_t set_local_work_size[2]    = {16, 4};
+        const size_t set_scalar_global_size[2] = {(width_ + 3) >> 2, height_};
+        const size_t set_scalar_item_size[2]   = {1, 1};
+
+        guide_.set_work_dim(2);
+        guide_.set_local_work_size(set_local_work_size);
+        guide_.set_scalar_global_size(set_scalar_global_size);
+        guide_.set_scalar_item_size(set_scalar_item_size);
+
+        return FILTER_OK;
+    }
+
+    return FILTER_KERNEL_ARGUMENT_ERROR;
+}
+
+result ChromaFrame::InitFilterKernel(const int &sample_expand) {
+
+    filter_ = ClKernel(device_id_, guided_ ? "NLMSingleFrameChromaGuided" : "NLMSingleFrameChroma", geometry_.tile_rows);
+
+    const int linear = 0;
+    const cl_int2 top_left = {0, 0};
+    // Until CopyTo wraps the first frames the destination planes stand in for the sources
+    const int input_plane_u = zero_copy_ ? dest_plane_ : source_plane_;
+    const int input_plane_v = zero_copy_ ? dest_plane_v_ : source_plane_v_;
+
+    if (guided_) filter_.SetArg(sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(guide_plane_));
+    filter_.SetArg(sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(input_plane_u));
+    filter_.SetArg(sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(input_plane_v));
+    filter_.SetArg(sizeof(int), &width_);
+    filter_.SetArg(sizeof(int), &height_);
+    filter_.SetArg(sizeof(cl_int2), &top_left);
+    filter_.SetArg(sizeof(float), &h_);
+    filter_.SetArg(sizeof(int), &sample_expand);
+    filter_.SetArg(sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(g_gaussian));
+    filter_.SetArg(sizeof(int), &linear);
+    filter_.SetArg(sizeof(int), &alpha_set_size_);
+    filter_.SetArg(sizeof(int), &alpha_plane_size_);
+    filter_.SetArg(sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(alpha_));
+
+    if (filter_.arguments_valid()) {
+        const size_t set_local_work_size[2]    = {8, static_cast<size_t>(geometry_.tile_rows) << 3};
+        // height is increased to offset the fact that 8 work items collaborate on one pixel
+        const size_t set_scalar_global_size[2] = {region_width_, region_height_ << 3};
+        const size_t set_scalar_item_size[2]   = {1, 1};
+
+        filter_.set_work_dim(2);
+        filter_.set_local_work_size(set_local_work_size);
+        filter_.set_scalar_global_size(set_scalar_global_size);
+        filter_.set_scalar_item_size(set_scalar_item_size);
+
+        return FILTER_OK;
+    }
+
+    return FILTER_KERNEL_ARGUMENT_ERROR;
+}
+
+result ChromaFrame::InitSortKernel() {
+
+    sort_ = ClKernel(device_id_, "FinaliseChroma");
+
+    const int linear = 0;
+    const int alpha_size = 16;
+    const cl_int2 top_left = {0, 0};
+    const int input_plane_u = zero_copy_ ? dest_plane_ : source_plane_;
+    const int input_plane_v = zero_copy_ ? dest_plane_v_ : source_plane_v_;
+
+    sort_.SetArg(sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(input_plane_u));
+    sort_.SetArg(sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(input_plane_v));
+    sort_.SetArg(sizeof(int), &region_width_);
+    sort_.SetArg(sizeof(cl_int2), &top_left);
+    sort_.SetArg(sizeof(int), &linear);
+    sort_.SetArg(sizeof(int), &alpha_size);
+    sort_.SetArg(sizeof(int), &alpha_set_size_);
+    sort_.SetArg(sizeof(int), &alpha_plane_size_);
+    sort_.SetArg(sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(alpha_));
+    sort_.SetArg(sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(dest_plane_));
+    sort_.SetArg(sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(dest_plane_v_));
+
+    if (sort_.arguments_valid()) {
+        const size_t set_local_work_size[2]     = {8, 16};
+        // height is increased to offset the fact that 8 work items collaborate on one pixel
+        const size_t set_scalar_global_size[2]  = {region_width_, region_height_ << 3};
+        const size_t set_scalar_item_size[2]    = {1, 1};
+
+        sort_.set_work_dim(2);
+        sort_.set_local_work_size(set_local_work_size);
+        sort_.set_scalar_global_size(set_scalar_global_size);
+        sort_.set_scalar_item_size(set_scalar_item_size);
+
+        return FILTER_OK;
+    }
+
+    return FILTER_KERNEL_ARGUMENT_ERROR;
+}
+
+result ChromaFrame::RecordLaunches() {
+    regions_per_band_ = (width_ + region_width_ - 1) / region_width_;
+    const int band_count = (height_ + region_height_ - 1) / region_height_;
+
+    const int guide_args = guided_ ? 1 : 0;
+
+    filter_launches_.reserve(band_count * regions_per_band_);
+    sort_launches_.reserve(band_count * regions_per_band_);
+    for (int region_y = 0; region_y < band_count * region_height_; region_y += region_height_) {
+        for (int region_x = 0; region_x < regions_per_band_ * region_width_; region_x += region_width_) {
+            const cl_int2 top_left = {region_x, region_y};
+
+            ClKernel filter = filter_.Instance();
+            filter.SetNumberedArg(FILTER_ARG_TOP_LEFT + guide_args, sizeof(cl_int2), &top_left);
+            filter_launches_.push_back(filter);
+
+            ClKernel sort = sort_.Instance();
+            sort.SetNumberedArg(SORT_ARG_TOP_LEFT, sizeof(cl_int2), &top_left);
+            sort_launches_.push_back(sort);
+
+            if (!filter.arguments_valid() || !sort.arguments_valid())
+                return FILTER_KERNEL_ARGUMENT_ERROR;
+        }
+    }
+
+    return FILTER_OK;
+}
+
+result ChromaFrame::CopyTo(
+    const unsigned char *source_y,
+    const unsigned char *source_u,
+    const unsigned char *source_v) {
+
+    result status = FILTER_OK;
+    const int guide_args = guided_ ? 1 : 0;
+
+    if (zero_copy_) {
+        // Execute waited for the previous frame's kernels to complete
+        g_devices[device_id_].buffers_.Destroy(source_plane_);
+        g_devices[device_id_].buffers_.Destroy(source_plane_v_);
+
+        status = WrapPlane(source_u, &source_plane_);
+        if (status != FILTER_OK) return status;
+
+        status = WrapPlane(source_v, &source_plane_v_);
+        if (status != FILTER_OK) return status;
+
+        if (guided_) {
+            g_devices[device_id_].buffers_.Destroy(luma_plane_);
+            if (pixel_size_ > 1)
+                status = g_devices[device_id_].buffers_.WrapWidePlane(cq_, source_y, luma_width_, luma_height_, luma_pitch_, pixel_size_, &luma_plane_);
+            else
+                status = g_devices[device_id_].buffers_.WrapPlane(cq_, source_y, luma_width_, luma_height_, luma_pitch_, &luma_plane_);
+            if (status != FILTER_OK) return status;
+
+            guide_.SetNumberedArg(GUIDE_ARG_LUMA_PLANE, sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(luma_plane_));
+            if (!guide_.arguments_valid()) return FILTER_KERNEL_ARGUMENT_ERROR;
+        }
+
+        // The input planes are the only arguments of the recorded launches that change
+        const cl_mem *input_plane_u = g_devices[device_id_].buffers_.ptr(source_plane_);
+        const cl_mem *input_plane_v = g_devices[device_id_].buffers_.ptr(source_plane_v_);
+        for (size_t i = 0; i < filter_launches_.size(); ++i) {
+            filter_launches_[i].SetNumberedArg(FILTER_ARG_INPUT_PLANE_U + guide_args, sizeof(cl_mem), input_plane_u);
+            filter_launches_[i].SetNumberedArg(FILTER_ARG_INPUT_PLANE_V + guide_args, sizeof(cl_mem), input_plane_v);
+            sort_launches_[i].SetNumberedArg(SORT_ARG_INPUT_PLANE_U, sizeof(cl_mem), input_plane_u);
+            sort_launches_[i].SetNumberedArg(SORT_ARG_INPUT_PLANE_V, sizeof(cl_mem), input_plane_v);
+            if (!filter_launches_[i].arguments_valid() || !sort_launches_[i].arguments_valid())
+                return FILTER_KERNEL_ARGUMENT_ERROR;
+        }
+
+        return FILTER_OK;
+    }
+
+    if (guided_) {
+        status = g_devices[device_id_].buffers_.CopyToPlane(luma_plane_,
+                                                            *source_y,
+                                                            luma_width_,
+                                                            luma_height_,
+                                                            luma_pitch_);
+        if (status != FILTER_OK) return status;
+    }
+
+    status = g_devices[device_id_].buffers_.CopyToPlane(source_plane_,
+                                                        *source_u,
+                                                        width_,
+                                                        height_,
+                                                        src_pitch_);
+    if (status != FILTER_OK) return status;
+
+    return g_devices[device_id_].buffers_.CopyToPlane(source_plane_v_,
+                                                      *source_v,
+                                                      width_,
+                                                      height_,
+                                                      src_pitch_);
+}
+
+result ChromaFrame::Execute(
+    unsigned char *dest_u,
+    unsigned char *dest_v) {
+
+    result status = FILTER_OK;
+
+    // The guide is made once per frame, before the first band is weighted
+    if (guided_) {
+        status = guide_.Execute(cq_, NULL);
+        if (status != FILTER_OK)
+            return status;
+    }
+
+    // Replays the recorded launches of each band in turn
+    for (int region_y = 0; region_y < height_; region_y += region_height_) {
+        const int first_launch = (region_y / region_height_) * regions_per_band_;
+        cl_event finalised = NULL;
+        for (int region = 0; region < regions_per_band_; ++region) {
+            status = filter_launches_[first_launch + region].Execute(cq_, NULL);
+            if (status != FILTER_OK)
+                return status;
+
+            // The queue is in-order, so only the band's final region needs an event
+            const bool band_complete = region + 1 == regions_per_band_;
+            status = sort_launches_[first_launch + region].Execute(cq_, band_complete ? &finalised : NULL);
+            if (status != FILTER_OK)
+                return status;
+        }
+
+        // Both planes' rows wait upon the same event
+        status = CopyPlaneRowsFrom(dest_plane_, region_y, region_y + region_height_, dest_u, &finalised);
+        if (status == FILTER_OK)
+            status = CopyPlaneRowsFrom(dest_plane_v_, region_y, region_y + region_height_, dest_v, &finalised);
+        clReleaseEvent(finalised);
+        if (status != FILTER_OK)
+            return status;
+    }
+
+    return status;
+}
+
+result ChromaFrame::Execute(unsigned char *dest) {
+    return FILTER_INVALID_PARAMETER;
+}
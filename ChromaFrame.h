@@ -0,0 +1,126 @@
+/* Deathray2 - An Avisynth plug-in filter for spatial/temporal non-local means de-noising.
+ *
+ * version 1.00
+ *
+ * Copyright 2015, Jawed Ashraf - Deathray@cupidity.f9.co.uk
+ */
+
+#ifndef _CHROMA_FRAME_
+#define _CHROMA_FRAME_
+
+#include <vector>
+
+#include <CL/cl.h>
+#include "CLKernel.h"
+#include "FilterFrame.h"
+
+enum result;
+
+// ChromaFrame
+// Single frame filtering of the U and V planes together. Each launch
+// filters the same region of both planes, so chroma takes half the
+// launches of two SingleFrames and each work group shares its address
+// calculations and cache fills between the planes. The planes' weights
+// remain independent.
+//
+// The planes are images, so devices that use pitched planes filter U and
+// V with a SingleFrame each, as do planes of floats, whose samples need
+// the pixel stream that only the SingleFrame kernels write.
+//
+// Optionally the weights of both planes come from luma, averaged down to
+// chroma's dimensions as the guide. Luma's windows are less noisy than
+// chroma's, and a single distance per sample serves both planes.
+class ChromaFrame : public FilterFrame
+{
+public:
+    ChromaFrame();
+
+    // Destructor
+    // Releases the kernels and the V planes
+    ~ChromaFrame();
+
+    // Init
+    // Setup the static source and destination buffers of both planes
+    // on the device and configure the kernels and their arguments,
+    // which do not change over the duration of clip processing.
+    result Init(
+        const   int     &device_id,     // device used for filtering
+        const   int     &width,         // width of each plane in pixels
+        const   int     &height,        // height of each plane in pixels
+        const   int     &pixel_size,    // bytes per pixel: 1, 2 for 16-bit pixels or 4 for floats
+        const   int     &src_pitch,     // length in memory of a row of pixels in source buffers
+        const   int     &dst_pitch,     // length in memory of a row of pixels in destination buffers
+        const   float   &h,             // NLM filtering strength
+        const   int     &sample_expand, // factor of radius of 3 to use for sampling
+        const   int     &luma_width,    // width of luma in pixels, 0 unless luma guides the weights
+        const   int     &luma_height,   // height of luma in pixels
+        const   int     &luma_pitch);   // length in memory of a row of pixels in the luma source buffer
+
+    // CopyTo
+    // Copy both planes, and luma when it guides the weights, from host to
+    // device. Devices that share memory with the host use the host 
+    // buffers in place instead, so they must remain valid until the next
+    // call.
+    result CopyTo(
+        const unsigned char *source_y,  // host buffer of Y, unused unless luma guides the weights
+        const unsigned char *source_u,  // host buffer of U to be copied to device
+        const unsigned char *source_v); // host buffer of V to be copied to device
+
+    // Execute
+    // Perform NLM computation on both planes, streaming each band of
+    // filtered rows of both to the host as soon as it is finalised.
+    result Execute(
+        unsigned char *dest_u,          // host buffer for the filtered U plane
+        unsigned char *dest_v);         // host buffer for the filtered V plane
+
+    // Execute
+    // Both planes' destinations are required, so this returns
+    // FILTER_INVALID_PARAMETER
+    result Execute(
+        unsigned char *dest) override;  // host buffer for a single filtered plane
+
+private:
+
+    // InitBuffers
+    // Create the source and destination planes and the alpha buffer,
+    // which holds U's alpha sets followed by V's
+    result InitBuffers(
+        const int &sample_expand);      // factor of radius of 3 to use for sampling
+
+    // InitGuideKernel
+    // Configure the kernel that averages luma down to the guide
+    result InitGuideKernel();
+
+    // InitFilterKernel
+    // Configure the arguments of the kernel that weights both planes
+    result InitFilterKernel(
+        const int &sample_expand);      // factor of radius of 3 to use for sampling
+
+    // InitSortKernel
+    // Configure the arguments of the kernel that sorts and finalises
+    // both planes
+    result InitSortKernel();
+
+    // RecordLaunches
+    // Records the launches of the filter and sort kernels for every region,
+    // as SingleFrame does
+    result RecordLaunches();
+
+    ClKernel filter_    ;   // non local means kernel for both planes
+    ClKernel sort_      ;   // sort kernel for both planes
+    vector<ClKernel> filter_launches_;  // filter kernel instance for each region, in execution order
+    vector<ClKernel> sort_launches_;    // sort kernel instance for each region, in execution order
+    int regions_per_band_;  // count of regions across the planes
+    int source_plane_v_ ;   // source V plane, source_plane_ being U
+    int dest_plane_v_   ;   // destination V plane, dest_plane_ being U
+    int alpha_plane_size_;  // count of weight/pixel pairs of each plane in the alpha buffer
+    bool guided_        ;   // weights of both planes are computed from the guide
+    int luma_width_     ;   // width of luma in pixels
+    int luma_height_    ;   // height of luma in pixels
+    int luma_pitch_     ;   // host luma format allows each row to be potentially longer than luma_width_
+    int luma_plane_     ;   // luma plane from which the guide is made
+    int guide_plane_    ;   // luma averaged down to the dimensions of the chroma planes
+    ClKernel guide_     ;   // kernel that makes the guide
+};
+
+#endif // _CHROMA_FRAME_
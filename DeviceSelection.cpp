@@ -0,0 +1,180 @@
+/* Deathray2 - An Avisynth plug-in filter for spatial/temporal non-local means de-noising.
+ *
+ * version 1.00
+ *
+ * Copyright 2015, Jawed Ashraf - Deathray@cupidity.f9.co.uk
+ */
+
+#include <cctype>
+#include <cstdlib>
+#include <sstream>
+
+#include "result.h"
+#include "util.h"
+#include "clutil.h"
+#include "Autotune.h"
+#include "DeviceSelection.h"
+
+void GaussianGenerator(const float &sigma, const int &device_id);
+
+// Frames timed on each device, after an untimed frame
+static const int k_calibration_frames = 3;
+
+// MatchChoice
+// Finds the device that the user chose, by index or by part of its name
+// regardless of case. Returns -1 if no device matches.
+static int MatchChoice(
+    const   string                  &choice,
+    const   vector<PlatformDevice>  &candidates) {
+
+    if (choice.find_first_not_of("0123456789") == string::npos) {
+        const int index = atoi(choice.c_str());
+        return index < static_cast<int>(candidates.size()) ? index : -1;
+    }
+
+    string lower_choice = choice;
+    for (size_t i = 0; i < lower_choice.size(); ++i)
+        lower_choice[i] = static_cast<char>(tolower(lower_choice[i]));
+
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        string lower_name = candidates[i].name;
+        for (size_t j = 0; j < lower_name.size(); ++j)
+            lower_name[j] = static_cast<char>(tolower(lower_name[j]));
+        if (lower_name.find(lower_choice) != string::npos) return static_cast<int>(i);
+    }
+    return -1;
+}
+
+// CalibrationKey
+// Describes everything the outcome of timing depends upon: the devices
+// installed, their drivers and the work done by the kernels
+static string CalibrationKey(
+    const   vector<PlatformDevice>  &candidates,
+    const   int                     &width,
+    const   int                     &height,
+    const   int                     &sample_expand,
+    const   string                  &cl_include) {
+
+    stringstream key;
+    key << "Deathray2 calibration 1\n";
+    for (size_t i = 0; i < candidates.size(); ++i)
+        key << candidates[i].name << "\n" << candidates[i].driver << "\n";
+    key << width << "x" << height << " " << sample_expand << " " << cl_include << "\n";
+    return key.str();
+}
+
+// LoadCalibration
+// Returns the index of the fastest device, or -1 if the devices
+// have not been timed for the key
+static int LoadCalibration(
+    const   string  &key) {
+
+    string value;
+    if (!LoadCacheRecord("calibration", key, &value)) return -1;
+
+    int fastest = -1;
+    stringstream index(value);
+    index >> fastest;
+    return index ? fastest : -1;
+}
+
+// SaveCalibration
+// Records the index of the fastest device for the key
+static void SaveCalibration(
+    const   string  &key,
+    const   int     &fastest) {
+
+    stringstream value;
+    value << fastest << "\n";
+    SaveCacheRecord("calibration", key, value.str());
+}
+
+// TimeDevice
+// Starts OpenCL solely on the device and measures the time taken to
+// filter a plane of noise of the given dimensions. OpenCL is stopped 
+// afterwards.
+static result TimeDevice(
+    const   PlatformDevice  &candidate,
+    const   int             &width,
+    const   int             &height,
+    const   int             &sample_expand,
+    const   float           &sigma,
+    const   string          &cl_include,
+            double          *seconds) {
+
+    const vector<cl_device_id> device(1, candidate.device);
+    result status = StartOpenCL(candidate.platform, device, cl_include);
+    if (status == FILTER_OK) {
+        GaussianGenerator(sigma, 0);
+        status = TimeFiltering(0, width, height, 0, sample_expand, k_calibration_frames, seconds);
+    }
+
+    StopOpenCL();
+    return status;
+}
+
+// FindFastest
+// Times every device, returning the index of the fastest. Devices
+// that fail are ignored.
+static result FindFastest(
+    const   vector<PlatformDevice>  &candidates,
+    const   int                     &width,
+    const   int                     &height,
+    const   int                     &sample_expand,
+    const   float                   &sigma,
+    const   string                  &cl_include,
+            int                     *fastest) {
+
+    *fastest = -1;
+    double fastest_seconds = 0.;
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        double seconds = 0.;
+        if (TimeDevice(candidates[i], width, height, sample_expand, sigma, cl_include, &seconds) != FILTER_OK) continue;
+        if (*fastest == -1 || seconds < fastest_seconds) {
+            *fastest = static_cast<int>(i);
+            fastest_seconds = seconds;
+        }
+    }
+    return *fastest == -1 ? FILTER_NO_DEVICES_FOUND : FILTER_OK;
+}
+
+result SelectDevices(
+    const   string                  &choice,
+    const   int                     &width,
+    const   int                     &height,
+    const   int                     &sample_expand,
+    const   float                   &sigma,
+    const   string                  &cl_include,
+    const   bool                    &hybrid,
+            cl_platform_id          *platform,
+            vector<cl_device_id>    *devices) {
+
+    vector<PlatformDevice> candidates;
+    result status = GetAllDevices(&candidates);
+    if (status != FILTER_OK) return status;
+
+    int chosen = 0;
+    if (!choice.empty()) {
+        chosen = MatchChoice(choice, candidates);
+        if (chosen == -1) return FILTER_NO_SUCH_DEVICE;
+    } else if (candidates.size() > 1) {
+        const string key = CalibrationKey(candidates, width, height, sample_expand, cl_include);
+        chosen = LoadCalibration(key);
+        if (chosen < 0 || chosen >= static_cast<int>(candidates.size())) {
+            status = FindFastest(candidates, width, height, sample_expand, sigma, cl_include, &chosen);
+            if (status != FILTER_OK) return status;
+            SaveCalibration(key, chosen);
+        }
+    }
+
+    *platform = candidates[chosen].platform;
+    devices->clear();
+    devices->push_back(candidates[chosen].device);
+    if (!hybrid) return FILTER_OK;
+
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        if (static_cast<int>(i) == chosen || candidates[i].platform != *platform) continue;
+        devices->push_back(candidates[i].device);
+    }
+    return FILTER_OK;
+}
@@ -0,0 +1,47 @@
+/* Deathray2 - An Avisynth plug-in filter for spatial/temporal non-local means de-noising.
+ *
+ * version 1.00
+ *
+ * Copyright 2015, Jawed Ashraf - Deathray@cupidity.f9.co.uk
+ */
+
+#ifndef _DEVICE_SELECTION_H_
+#define _DEVICE_SELECTION_H_
+
+#include <string>
+#include <vector>
+
+#include <CL/cl.h>
+
+using namespace std;
+
+enum result;
+
+// SelectDevices
+// Chooses the devices, from amongst all OpenCL platforms, that filter
+// the clip.
+//
+// The user's choice takes precedence. It is either the index of the
+// device, counting from 0 over all platforms' devices, or part of the
+// device's name. Otherwise, if there is more than one device, each is
+// timed filtering a plane of the clip's luma dimensions and the
+// fastest is chosen. The outcome of the timing is cached, so that
+// later scripts on the machine skip it.
+//
+// The chosen device is the first of the devices returned. When hybrid
+// the other devices of its platform follow it.
+//
+// Timing requires OpenCL to be started on each device in turn. OpenCL
+// is stopped afterwards.
+result SelectDevices(
+    const   string                  &choice,        // index or part of the name of a device, empty for automatic selection
+    const   int                     &width,         // width of the clip's luma plane
+    const   int                     &height,        // height of the clip's luma plane
+    const   int                     &sample_expand, // factor of radius of 3 to use for sampling
+    const   float                   &sigma,         // sigma of the gaussian weights
+    const   string                  &cl_include,    // "include" definitions for compilation
+    const   bool                    &hybrid,        // use the other devices of the chosen device's platform
+            cl_platform_id          *platform,      // platform of the devices
+            vector<cl_device_id>    *devices);      // devices chosen, fastest first
+
+#endif // _DEVICE_SELECTION_H_
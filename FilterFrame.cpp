@@ -15,15 +15,162 @@ extern cl_context   g_context;
 
 #include "FilterFrame.h"
 
+extern int          g_device_count;
+
+FilterFrame::FilterFrame() {
+    device_id_      = 0;
+    source_plane_   = 0;
+    dest_plane_     = 0;
+    alpha_          = 0;
+    alpha_pixels_   = 0;
+    linear_         = 0;
+    pixel_size_     = 1;
+    cq_             = NULL;
+    readback_cq_    = NULL;
+}
+
+FilterFrame::~FilterFrame() {
+    // Buffers were destroyed when the devices were
+    if (g_devices != NULL && device_id_ < g_device_count) {
+        g_devices[device_id_].buffers_.Destroy(source_plane_);
+        g_devices[device_id_].buffers_.Destroy(dest_plane_);
+        g_devices[device_id_].buffers_.Destroy(alpha_);
+        g_devices[device_id_].buffers_.Destroy(alpha_pixels_);
+    }
+
+    if (cq_ != NULL) clReleaseCommandQueue(cq_);
+    if (readback_cq_ != NULL) clReleaseCommandQueue(readback_cq_);
+}
+
+result FilterFrame::AllocPlane(
+    int *plane) {
+
+    if (pitched_ && pixel_size_ > 1)
+        return FILTER_WIDE_PLANES_UNSUPPORTED;
+    else if (pitched_)
+        return g_devices[device_id_].buffers_.AllocPitchedPlane(cq_, width_, height_, plane_pitch_, plane);
+    else if (pixel_size_ > 1)
+        return g_devices[device_id_].buffers_.AllocWidePlane(cq_, width_, height_, pixel_size_, plane);
+    else
+        return g_devices[device_id_].buffers_.AllocPlane(cq_, width_, height_, plane);
+}
+
+result FilterFrame::WrapPlane(
+    const   unsigned char   *source,
+            int             *plane) {
+
+    if (pitched_ && pixel_size_ > 1)
+        return FILTER_WIDE_PLANES_UNSUPPORTED;
+    else if (pitched_)
+        return g_devices[device_id_].buffers_.WrapPitchedPlane(cq_, source, width_, height_, src_pitch_, plane);
+    else if (pixel_size_ > 1)
+        return g_devices[device_id_].buffers_.WrapWidePlane(cq_, source, width_, height_, src_pitch_, pixel_size_, plane);
+    else
+        return g_devices[device_id_].buffers_.WrapPlane(cq_, source, width_, height_, src_pitch_, plane);
+}
+
+result FilterFrame::AllocAlphaPixels(
+    const int &alpha_buffer_size) {
+
+    if (!ExactSamples()) return FILTER_OK;
+
+    // Pixels are floats, the same size as the alpha entries
+    return g_devices[device_id_].buffers_.AllocBuffer(cq_, alpha_buffer_size, &alpha_pixels_);
+}
+
 result FilterFrame::CopyFrom(
-    unsigned char   *dest,                              
     cl_event        *returned) {
 
-    return g_devices[device_id_].buffers_.CopyFromPlaneAsynch(dest_plane_,
+    // The copy queue is in-order, so a marker completes only after
+    // every band of rows that has been queued for copying
+    cl_int cl_status = clEnqueueMarker(readback_cq_, returned);
+    if (cl_status != CL_SUCCESS) {
+        g_last_cl_error = cl_status;
+        return FILTER_COPYING_FROM_PLANE_FAILED;
+    }
+
+    // Clients may track the marker with a callback rather than waiting on it
+    clFlush(readback_cq_);
+    return FILTER_OK;
+}
+
+result FilterFrame::InitLinearKernel(
+    const   int             &device_id,
+    const   int             &gamma_plane,
+    const   int             &linear_plane,
+    const   int             &width,
+    const   int             &height,
+            ClKernel        *convert) {
+
+    *convert = ClKernel(device_id, "ConvertToLinear");
+
+    convert->SetArg(sizeof(cl_mem), g_devices[device_id].buffers_.ptr(gamma_plane));
+    convert->SetArg(sizeof(int), &width);
+    convert->SetArg(sizeof(int), &height);
+    convert->SetArg(sizeof(cl_mem), g_devices[device_id].buffers_.ptr(linear_plane));
+
+    if (convert->arguments_valid()) {
+        // one work item per texel of 4 pixels
+        const size_t set_local_work_size[2]    = {16, 4};
+        const size_t set_scalar_global_size[2] = {(width + 3) >> 2, height};
+        const size_t set_scalar_item_size[2]   = {1, 1};
+
+        convert->set_work_dim(2);
+        convert->set_local_work_size(set_local_work_size);
+        convert->set_scalar_global_size(set_scalar_global_size);
+        convert->set_scalar_item_size(set_scalar_item_size);
+
+        return FILTER_OK;
+    }
+
+    return FILTER_KERNEL_ARGUMENT_ERROR;
+}
+
+result FilterFrame::CopyRegionFrom(
+    const   int             &region_y,
+            unsigned char   *dest,
+            cl_event        *finalised) {
+
+    return CopyRowsFrom(region_y, region_y + region_height_, dest, finalised);
+}
+
+result FilterFrame::CopyRowsFrom(
+    const   int             &first_row,
+    const   int             &end_row,
+            unsigned char   *dest,
+            cl_event        *finalised) {
+
+    // The plane stays on the device, e.g. to be packed into a frame
+    if (dest == NULL) {
+        clReleaseEvent(*finalised);
+        return FILTER_OK;
+    }
+
+    result status = CopyPlaneRowsFrom(dest_plane_, first_row, end_row, dest, finalised);
+    clReleaseEvent(*finalised);
+    return status;
+}
+
+result FilterFrame::CopyPlaneRowsFrom(
+    const   int             &plane,
+    const   int             &first_row,
+    const   int             &end_row,
+            unsigned char   *dest,
+    const   cl_event        *finalised) {
+
+    // The final band of regions usually extends beyond the bottom of the plane
+    const int rows = (end_row > height_ ? height_ : end_row) - first_row;
+
+    // Kernels queued so far must be submitted before the copy can wait upon them
+    clFlush(cq_);
+
+    return g_devices[device_id_].buffers_.CopyFromPlaneAsynch(plane,
+                                                              readback_cq_,
+                                                              first_row,
                                                               width_,
-                                                              height_, 
-                                                              dst_pitch_, 
-                                                              NULL, 
-                                                              returned,
-                                                              dest);
+                                                              rows,
+                                                              dst_pitch_,
+                                                              finalised,
+                                                              NULL,
+                                                              dest + first_row * dst_pitch_);
 }
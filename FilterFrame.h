@@ -9,6 +9,8 @@
 #define _FILTERFRAME_H_
 
 #include <CL/cl.h>
+#include "CLKernel.h"
+#include "device.h"
 
 enum result;
 
@@ -17,21 +19,103 @@ enum result;
 class FilterFrame
 {
 public:
-    FilterFrame() {}
-    ~FilterFrame() {}
+    FilterFrame();
+
+    // Destructor
+    // Releases the planes, alpha buffer and queues on the device
+    virtual ~FilterFrame();
     
     // Execute
-    // Perform NLM computation.
-    virtual result Execute() = 0;
+    // Perform NLM computation. As each band of regions is 
+    // finalised its rows of filtered pixels are copied to the 
+    // destination buffer on the host, while the remaining 
+    // regions are computed.
+    virtual result Execute(
+        unsigned char   *dest) = 0;     // host buffer for the filtered plane
 
     // CopyFrom
-    // Copy the plane of filtered pixels from the device
-    // to the destination buffer on the host.
-    result CopyFrom(
-        unsigned char   *dest,
-        cl_event        *returned);
+    // Returns an event that completes when all rows of filtered
+    // pixels streamed by Execute have arrived on the host.
+    virtual result CopyFrom(
+        cl_event        *returned);     // event to track completion of all copies
 
 protected:
+
+    // AllocPlane
+    // Allocate a plane of width_ by height_ pixels on the device,
+    // as an image or as a pitched buffer according to pitched_, of
+    // 16-bit or float pixels according to pixel_size_. Pitched buffers
+    // only support 8-bit pixels.
+    result AllocPlane(
+        int *plane);                        // index of the new plane
+
+    // WrapPlane
+    // Create a read-only plane of width_ by height_ pixels that uses 
+    // the host's buffer in place. The host's buffer must remain valid
+    // until the plane is destroyed.
+    result WrapPlane(
+        const   unsigned char   *source,    // host buffer with rows of src_pitch_
+                int             *plane);    // index of the new plane
+
+    // ExactSamples
+    // Samples of planes of floats, which include linear planes made from
+    // 16-bit pixels, keep their pixels exactly, in the pixel stream
+    bool ExactSamples() {return pixel_size_ == 4 || (linear_ && pixel_size_ == 2);}
+
+    // AllocAlphaPixels
+    // Allocate the stream of sample pixels that accompanies the alpha
+    // buffer, entry for entry, when samples are exact. Otherwise the
+    // kernels never touch the stream, so the alpha buffer stands in.
+    result AllocAlphaPixels(
+        const   int             &alpha_buffer_size);// size in bytes of the alpha buffer
+
+    // AlphaPixels
+    // Returns the index of the stream of sample pixels, or of its stand-in
+    int AlphaPixels() {return alpha_pixels_ != 0 ? alpha_pixels_ : alpha_;}
+
+    // CopyRegionFrom
+    // Copy the rows of a band of regions from the device to the 
+    // host once the band's final kernel has completed. The copy 
+    // uses its own queue, so it overlaps the regions that follow.
+    result CopyRegionFrom(
+        const   int             &region_y,  // top row of the band of regions
+                unsigned char   *dest,      // host buffer for the filtered plane
+                cl_event        *finalised);// event for the band's final kernel, released once the copy is queued
+
+    // CopyRowsFrom
+    // Copy rows of the plane from the device to the host once the 
+    // kernel that filters them has completed, using the queue 
+    // dedicated to copies. Nothing is copied when dest is NULL.
+    result CopyRowsFrom(
+        const   int             &first_row, // first row to be copied
+        const   int             &end_row,   // row after the last row to be copied, clamped to the plane
+                unsigned char   *dest,      // host buffer for the filtered plane
+                cl_event        *finalised);// event for the kernel, released once the copy is queued
+
+    // InitLinearKernel
+    // Configure an instance of ConvertToLinear, which converts the gamma
+    // plane into the linear plane, both width_ by height_ pixels. It runs
+    // once per plane uploaded, so the filter kernels only ever read the
+    // linear plane.
+    static result InitLinearKernel(
+        const   int             &device_id,     // device holding the planes
+        const   int             &gamma_plane,   // plane as uploaded
+        const   int             &linear_plane,  // plane in linear light
+        const   int             &width,         // width in pixels
+        const   int             &height,        // height in pixels
+                ClKernel        *convert);      // the configured kernel
+
+    // CopyPlaneRowsFrom
+    // As CopyRowsFrom, for any plane of width_ by height_ pixels. 
+    // The event is not released, so it can gate the copies of more
+    // than one plane.
+    result CopyPlaneRowsFrom(
+        const   int             &plane,     // index of the plane to be copied
+        const   int             &first_row, // first row to be copied
+        const   int             &end_row,   // row after the last row to be copied, clamped to the plane
+                unsigned char   *dest,      // host buffer for the filtered plane
+        const   cl_event        *finalised);// event for the kernel
+
     int device_id_      ;   // device used to execute the filter kernels
     int width_          ;   // width of plane's content
     int height_         ;   // height of plane's content
@@ -41,10 +125,18 @@ protected:
     int source_plane_   ;   // dedicated buffer for source plane
     int dest_plane_     ;   // dedicated buffer for destination plane
     int alpha_          ;   // alpha weight/pixel pairs packed as single uints
+    int alpha_pixels_   ;   // sample pixels of exact samples, entry for entry with alpha_, 0 when unused
     int region_width_   ;   // width of region to be filtered by a single kernel invocation
     int region_height_  ;   // height of region to be filtered by a single kernel invocation
     int alpha_set_size_ ;   // count of all weight/pixel pairs that will be generated during filtering
     cl_command_queue cq_;   // synchronous queue of device commands
+    cl_command_queue readback_cq_;  // queue dedicated to streaming filtered rows back to the host
+    bool pitched_       ;   // planes are pitched buffers processed by the *Pitched kernels, rather than images
+    bool zero_copy_     ;   // source planes wrap host frames rather than holding copies of them
+    int plane_pitch_    ;   // pitch of pitched planes, equal to src_pitch_ when source planes wrap host frames
+    int linear_         ;   // 1 when planes are filtered in linear light, which only image planes support
+    int pixel_size_     ;   // bytes per pixel: 1, 2 for 16-bit pixels or 4 for floats, the latter only supported by image planes
+    KernelGeometry geometry_;   // shape of each launch, the device's recorded geometry for the plane or else the default
 
 };
 
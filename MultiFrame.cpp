@@ -5,6 +5,8 @@
  * Copyright 2015, Jawed Ashraf - Deathray@cupidity.f9.co.uk
  */
 
+#include <climits>
+
 #include "result.h"
 #include "util.h"
 #include "device.h"
@@ -31,6 +33,11 @@ extern  int         g_gaussian;
 #define FILTER_ARG_ALPHA_SET_SIZE 10
 #define FILTER_ARG_ALPHA_SO_FAR 11
 #define FILTER_ARG_REGION_ALPHA 12
+#define FILTER_ARG_PITCH 13
+#define FILTER_ARG_REGION_PIXELS 13
+#define FILTER_ARG_FIELD_MODE 14
+#define FILTER_ARG_FIELD 15
+#define CONVERT_ARG_GAMMA_PLANE 0
 
 MultiFrame::MultiFrame() {
     device_id_          = 0;
@@ -41,6 +48,23 @@ MultiFrame::MultiFrame() {
     height_             = 0;
     src_pitch_          = 0;
     dst_pitch_          = 0;
+    pitched_            = false;
+    zero_copy_          = false;
+    plane_pitch_        = 0;
+    fields_.clear();
+    field_bytes_        = 0;
+
+    const KernelGeometry default_geometry = {8, 16, 4, 0, DEFAULT_TILE_ROWS};
+    geometry_           = default_geometry;
+}
+
+MultiFrame::~MultiFrame() {
+    if (g_devices == NULL || device_id_ >= g_device_count) return;
+
+    for (size_t i = 0; i < frames_.size(); ++i) frames_[i].Release();
+    for (size_t i = 0; i < fields_.size(); ++i) g_devices[device_id_].buffers_.Destroy(fields_[i].buffer);
+    filter_.Release();
+    sort_.Release();
 }
 
 result MultiFrame::Init(
@@ -48,6 +72,7 @@ result MultiFrame::Init(
     const   int     &temporal_radius,
     const   int     &width, 
     const   int     &height,
+    const   int     &pixel_size,
     const   int     &src_pitch,
     const   int     &dst_pitch,
     const   float   &h,
@@ -66,10 +91,17 @@ result MultiFrame::Init(
     height_             = height;    
     src_pitch_          = src_pitch;
     dst_pitch_          = dst_pitch;
+    g_devices[device_id_].geometry(width, height, temporal_radius, &geometry_);
     region_width_       = width;
-    region_height_      = 8;
+    region_height_      = geometry_.region_height;
     h_                  = 1.f/h;
     cq_                 = g_devices[device_id_].cq();
+    readback_cq_        = g_devices[device_id_].cq();
+    pitched_            = g_devices[device_id_].pitched_planes();
+    zero_copy_          = g_devices[device_id_].zero_copy();
+    plane_pitch_        = zero_copy_ ? src_pitch_ : GetPitchedPlanePitch(width_);
+    linear_             = pitched_ ? 0 : linear;
+    pixel_size_         = pixel_size;
 
     if (width_ == 0 || height_ == 0 || src_pitch_ == 0 || dst_pitch_ == 0 || h == 0 ) 
         return FILTER_INVALID_PARAMETER;
@@ -78,7 +110,7 @@ result MultiFrame::Init(
 
     status = InitBuffers(sample_expand);
     if (status != FILTER_OK) return status;
-    status = InitKernels(sample_expand, linear, correction, balanced);
+    status = InitKernels(sample_expand, linear_, correction, balanced);
     if (status != FILTER_OK) return status;
     status = InitFrames();
 
@@ -88,7 +120,7 @@ result MultiFrame::Init(
 result MultiFrame::InitBuffers(const int &sample_expand) {
     result status = FILTER_OK;
 
-    status = g_devices[device_id_].buffers_.AllocPlane(cq_, width_, height_, &dest_plane_);
+    status = AllocPlane(&dest_plane_);
     if (status != FILTER_OK) return status;
 
     const int alpha_buffer_size = GetAlphaBufferSize(temporal_radius_,
@@ -98,8 +130,9 @@ result MultiFrame::InitBuffers(const int &sample_expand) {
                                 * sizeof(cl_uint);
 
     status = g_devices[device_id_].buffers_.AllocBuffer(cq_, alpha_buffer_size, &alpha_);
+    if (status != FILTER_OK) return status;
 
-    return status;
+    return AllocAlphaPixels(alpha_buffer_size);
 }
 
 result MultiFrame::InitKernels(
@@ -125,7 +158,10 @@ result MultiFrame::InitFilterKernel(
     const int &correction,
     const int &balanced) {
 
-    filter_ = ClKernel(device_id_, "NLMMultiFrameFourPixel");
+    if (pitched_)
+        filter_ = ClKernel(device_id_, "NLMMultiFramePitched");
+    else
+        filter_ = ClKernel(device_id_, "NLMMultiFrameFourPixel", geometry_.tile_rows);
     filter_.SetNumberedArg(FILTER_ARG_WIDTH, sizeof(int), &width_);
     filter_.SetNumberedArg(FILTER_ARG_HEIGHT, sizeof(int), &height_);
     filter_.SetNumberedArg(FILTER_ARG_H, sizeof(float), &h_);
@@ -134,16 +170,32 @@ result MultiFrame::InitFilterKernel(
     filter_.SetNumberedArg(FILTER_ARG_LINEAR, sizeof(int), &linear);
     filter_.SetNumberedArg(FILTER_ARG_ALPHA_SET_SIZE, sizeof(int), &alpha_set_size_);
     filter_.SetNumberedArg(FILTER_ARG_REGION_ALPHA, sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(alpha_));
+    if (pitched_)
+        filter_.SetNumberedArg(FILTER_ARG_PITCH, sizeof(int), &plane_pitch_);
+    else {
+        // Until BindFrames chooses a field the alpha buffer stands in for one
+        const int field_mode = k_field_unused;
+        filter_.SetNumberedArg(FILTER_ARG_REGION_PIXELS, sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(AlphaPixels()));
+        filter_.SetNumberedArg(FILTER_ARG_FIELD_MODE, sizeof(int), &field_mode);
+        filter_.SetNumberedArg(FILTER_ARG_FIELD, sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(alpha_));
+    }
 
     if (filter_.arguments_valid()) {
         filter_.set_work_dim(2);
-        const size_t set_local_work_size[2]        = {8, 16};
-        // height is increased to offset the fact that 8 work items collaborate on one pixel
-        const size_t set_scalar_global_size[2]    = {region_width_, region_height_ << 3};
+        if (pitched_) {
+            // one work item per pixel
+            const size_t set_local_work_size[2]     = {geometry_.local_width, geometry_.local_height};
+            const size_t set_scalar_global_size[2]  = {region_width_, region_height_};
+            filter_.set_local_work_size(set_local_work_size);
+            filter_.set_scalar_global_size(set_scalar_global_size);
+        } else {
+            const size_t set_local_work_size[2]     = {8, static_cast<size_t>(geometry_.tile_rows) << 3};
+            // height is increased to offset the fact that 8 work items collaborate on one pixel
+            const size_t set_scalar_global_size[2]  = {region_width_, region_height_ << 3};
+            filter_.set_local_work_size(set_local_work_size);
+            filter_.set_scalar_global_size(set_scalar_global_size);
+        }
         const size_t set_scalar_item_size[2]    = {1, 1};
-
-        filter_.set_local_work_size(set_local_work_size);
-        filter_.set_scalar_global_size(set_scalar_global_size);
         filter_.set_scalar_item_size(set_scalar_item_size);
 
         return FILTER_OK;                        
@@ -154,7 +206,7 @@ result MultiFrame::InitFilterKernel(
 
 result MultiFrame::InitSortKernel(const int &linear) {
 
-    sort_ = ClKernel(device_id_, "Finalise");
+    sort_ = ClKernel(device_id_, pitched_ ? "FinalisePitched" : "Finalise");
     
     const int alpha_size = 16;
     const cl_int2 top_left = {0, 0};
@@ -166,16 +218,30 @@ result MultiFrame::InitSortKernel(const int &linear) {
     sort_.SetNumberedArg(5, sizeof(int), &alpha_set_size_);
     sort_.SetNumberedArg(6, sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(alpha_));
     sort_.SetNumberedArg(7, sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(dest_plane_));
+    if (pitched_) {
+        sort_.SetNumberedArg(8, sizeof(int), &width_);
+        sort_.SetNumberedArg(9, sizeof(int), &height_);
+        sort_.SetNumberedArg(10, sizeof(int), &plane_pitch_);
+    } else {
+        sort_.SetNumberedArg(8, sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(AlphaPixels()));
+    }
 
     if (sort_.arguments_valid()) {
         sort_.set_work_dim(2);
-        const size_t set_local_work_size[2]     = {8, 16};
-        // height is increased to offset the fact that 8 work items collaborate on one pixel
-        const size_t set_scalar_global_size[2]  = {region_width_, region_height_ << 3};
+        if (pitched_) {
+            // one work item per pixel
+            const size_t set_local_work_size[2]     = {geometry_.local_width, geometry_.local_height};
+            const size_t set_scalar_global_size[2]  = {region_width_, region_height_};
+            sort_.set_local_work_size(set_local_work_size);
+            sort_.set_scalar_global_size(set_scalar_global_size);
+        } else {
+            const size_t set_local_work_size[2]     = {8, 16};
+            // height is increased to offset the fact that 8 work items collaborate on one pixel
+            const size_t set_scalar_global_size[2]  = {region_width_, region_height_ << 3};
+            sort_.set_local_work_size(set_local_work_size);
+            sort_.set_scalar_global_size(set_scalar_global_size);
+        }
         const size_t set_scalar_item_size[2]    = {1, 1};
-
-        sort_.set_local_work_size(set_local_work_size);
-        sort_.set_scalar_global_size(set_scalar_global_size);
         sort_.set_scalar_item_size(set_scalar_item_size);
 
         return FILTER_OK;
@@ -190,7 +256,8 @@ result MultiFrame::InitFrames() {
     for (int i = 0; i < frame_count; ++i) {
         Frame new_frame;
         frames_.push_back(new_frame);
-        frames_[i].Init(device_id_, &cq_, filter_, width_, height_, src_pitch_);
+        result status = frames_[i].Init(device_id_, &cq_, filter_, width_, height_, pixel_size_, src_pitch_, linear_);
+        if (status != FILTER_OK) return status;
     }
 
     if (frames_.size() != frame_count)
@@ -199,6 +266,39 @@ result MultiFrame::InitFrames() {
     return FILTER_OK;
 }
 
+result MultiFrame::InitFields(const cl_ulong &budget) {
+    if (pitched_) return FILTER_FIELDS_UNSUPPORTED;
+
+    // Each pixel has a weight for each position of its set sampled in a frame
+    const cl_ulong field_entries = static_cast<cl_ulong>(width_) * height_
+                                 * (alpha_set_size_ / (2 * temporal_radius_ + 1));
+    const cl_ulong field_size = field_entries * sizeof(cl_uint);
+
+    // The kernels address fields with unsigned ints, and the host sizes
+    // buffers with size_t, which is 32 bits in 32-bit builds
+    if (field_entries > INT_MAX) return FILTER_OK;
+    if (field_size > g_devices[device_id_].ulong_info(CL_DEVICE_MAX_MEM_ALLOC_SIZE)) return FILTER_OK;
+    if (field_size > static_cast<size_t>(-1)) return FILTER_OK;
+
+    // While a target is filtered the fields in use are those of the pairs
+    // of frames whose later frame is yet to be the target, or is the
+    // target, and those of the target and each later frame
+    const int field_count = temporal_radius_ * (temporal_radius_ + 3) / 2;
+
+    for (int i = 0; i < field_count && field_bytes_ + field_size <= budget; ++i) {
+        Field field = {0, 0, 0, false, false};
+
+        // A device may refuse a field before the budget is spent
+        result status = g_devices[device_id_].buffers_.AllocBuffer(cq_, static_cast<size_t>(field_size), &field.buffer);
+        if (status != FILTER_OK) break;
+
+        fields_.push_back(field);
+        field_bytes_ += field_size;
+    }
+
+    return FILTER_OK;
+}
+
 void MultiFrame::SupplyFrameNumbers(
     const   int                 &target_frame_number, 
             MultiFrameRequest   *required) {
@@ -220,21 +320,77 @@ result MultiFrame::CopyTo(MultiFrameRequest *retrieved) {
         status = frames_[frame_id].CopyTo(frame_number, retrieved->Retrieve(frame_number));
         if (status != FILTER_OK) return status;
     }
-    clFinish(cq_);
     return status;
 }
 
-result MultiFrame::ExecuteFrame(
-    const   int         &frame_id,
-    const   bool        &sample_equals_target) {
+void MultiFrame::WaitForCopies() {
+    clFinish(cq_);
+}
 
-    filter_.SetNumberedArg(FILTER_ARG_ALPHA_SO_FAR, sizeof(int), &alpha_so_far_);
-    result status = frames_[frame_id].Execute(sample_equals_target);
-    alpha_so_far_ += alpha_set_size_ / (8 * (2 * temporal_radius_ + 1)); // TODO make this a function
-    return status;
+result MultiFrame::BindFrames(
+    const   int         &target_frame_id,
+    const   int         &target_frame_plane) {
+
+    const int frame_count = 2 * temporal_radius_ + 1;
+    const int alpha_step = alpha_set_size_ / (8 * frame_count); // TODO make this a function
+
+    // A field is kept until its later frame has been the target, while
+    // the target's own fields are stored again
+    for (size_t i = 0; i < fields_.size(); ++i) {
+        if (fields_[i].earlier >= target_frame_number_ || fields_[i].later < target_frame_number_)
+            fields_[i].used = false;
+    }
+
+    for (int i = 0; i < frame_count; ++i) {
+        // Frames are filtered in order, except the target which is last
+        int position = i < target_frame_id ? i : i - 1;
+        if (i == target_frame_id) position = frame_count - 1;
+
+        int field_mode = k_field_unused;
+        int field = alpha_;
+        if (i != target_frame_id) ChooseField(frames_[i].frame_number(), &field_mode, &field);
+
+        result status = frames_[i].Bind(target_frame_plane, i == target_frame_id, position * alpha_step, field_mode, field);
+        if (status != FILTER_OK) return status;
+    }
+    return FILTER_OK;
 }
 
-result MultiFrame::Execute() {
+void MultiFrame::ChooseField(
+    const   int     &sample_frame_number,
+            int     *field_mode,
+            int     *field) {
+
+    *field_mode = k_field_unused;
+    *field = alpha_;
+
+    if (sample_frame_number < target_frame_number_) {
+        for (size_t i = 0; i < fields_.size(); ++i) {
+            if (fields_[i].used && fields_[i].complete &&
+                fields_[i].earlier == sample_frame_number && fields_[i].later == target_frame_number_) {
+                *field_mode = k_field_reuse;
+                *field = fields_[i].buffer;
+                return;
+            }
+        }
+        return;
+    }
+
+    // When every field is in use the pair is weighted again later
+    for (size_t i = 0; i < fields_.size(); ++i) {
+        if (!fields_[i].used) {
+            fields_[i].earlier  = target_frame_number_;
+            fields_[i].later    = sample_frame_number;
+            fields_[i].complete = false;
+            fields_[i].used     = true;
+            *field_mode = k_field_store;
+            *field = fields_[i].buffer;
+            return;
+        }
+    }
+}
+
+result MultiFrame::Execute(unsigned char *dest) {
     result status = FILTER_OK;
 
     // Query the Frame object handling the target frame to get the plane for the other Frames to use
@@ -243,33 +399,44 @@ result MultiFrame::Execute() {
     int target_frame_plane;         
     cl_event copying_target;
     frames_[target_frame_id].Plane(&target_frame_plane, &copying_target);
-    filter_.SetNumberedArg(FILTER_ARG_TARGET_PLANE, sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(target_frame_plane));
+
+    // Only the region changes from one launch to the next
+    status = BindFrames(target_frame_id, target_frame_plane);
+    if (status != FILTER_OK) return status;
+    sort_.SetNumberedArg(0, sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(target_frame_plane));
     
     const int rounded_width = region_width_ * ((width_ + region_width_ - 1) / region_width_);
     const int rounded_height = region_height_ * ((height_ + region_height_ - 1) / region_height_);
 
-    for (int region_x = 0; region_x < rounded_width; region_x += region_width_)
-        for (int region_y = 0; region_y < rounded_height; region_y += region_height_) {
+    for (int region_y = 0; region_y < rounded_height; region_y += region_height_) {
+        cl_event finalised = NULL;
+        for (int region_x = 0; region_x < rounded_width; region_x += region_width_) {
             const cl_int2 top_left = {region_x, region_y};
-            alpha_so_far_ = 0;
-            filter_.SetNumberedArg(FILTER_ARG_TOP_LEFT, sizeof(cl_int2), &top_left);
 
             for (int i = 0; i < 2 * temporal_radius_ + 1; ++i) {
-                bool sample_equals_target = i == target_frame_id;
-                if (!sample_equals_target) { // exclude the target frame so that it is processed last - TODO unnecessary
-                    status = ExecuteFrame(i, sample_equals_target);
-                    if (status != FILTER_OK) return status;
-                }
+                if (i == target_frame_id) continue; // the target frame is processed last - TODO unnecessary
+                status = frames_[i].Execute(top_left);
+                if (status != FILTER_OK) return status;
             }
-            status = ExecuteFrame(target_frame_id, true);
+            status = frames_[target_frame_id].Execute(top_left);
             if (status != FILTER_OK) return status;
 
-            sort_.SetNumberedArg(0, sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(target_frame_plane));
+            // The queue is in-order, so only the band's final region needs an event
+            const bool band_complete = region_x + region_width_ >= rounded_width;
             sort_.SetNumberedArg(2, sizeof(cl_int2), &top_left);
-            status = sort_.Execute(cq_, NULL);
+            status = sort_.Execute(cq_, band_complete ? &finalised : NULL);
             if (status != FILTER_OK) return status;
         }
 
+        status = CopyRegionFrom(region_y, dest, &finalised);
+        if (status != FILTER_OK) return status;
+    }
+
+    // The queue is in-order, so the fields are stored before any later target reads them
+    for (size_t i = 0; i < fields_.size(); ++i) {
+        if (fields_[i].used && fields_[i].earlier == target_frame_number_) fields_[i].complete = true;
+    }
+
     return status;
 }
 
@@ -280,6 +447,10 @@ MultiFrame::Frame::Frame() {
     width_          = 0;
     height_         = 0;
     pitch_          = 0;
+    zero_copy_      = false;
+    pixel_size_     = 1;
+    linear_         = 0;
+    linear_plane_   = 0;
 }
 
 result MultiFrame::Frame::Init(
@@ -288,21 +459,46 @@ result MultiFrame::Frame::Init(
     const   ClKernel            &filter,
     const   int                 &width, 
     const   int                 &height, 
-    const   int                 &pitch) {
+    const   int                 &pixel_size,
+    const   int                 &pitch,
+    const   int                 &linear) {
 
-    // Setting this frame's kernel object to the client's kernel object means all frames share the 
-    // same instance, and therefore each Frame object only needs to do minimal argument
-    // setup.
+    // Each frame has its own instance of the client's kernel object, so the arguments the frame 
+    // binds for the target frame persist while the regions of the plane are filtered.
                         
     device_id_  = device_id;
     cq_         = *cq;
-    filter_     = filter;
+    filter_     = filter.Instance();
+    if (!filter_.arguments_valid()) return FILTER_KERNEL_ARGUMENT_ERROR;
     width_      = width;
     height_     = height;
     pitch_      = pitch;
     frame_used_ = 0;
+    zero_copy_  = g_devices[device_id_].zero_copy();
+    pixel_size_ = pixel_size;
+    linear_     = linear;
+
+    result status = FILTER_OK;
+
+    // Planes that wrap host frames are created by CopyTo
+    if (!zero_copy_) {
+        if (g_devices[device_id_].pitched_planes())
+            status = g_devices[device_id_].buffers_.AllocPitchedPlane(cq_, width_, height_, &plane_);
+        else if (pixel_size_ > 1)
+            status = g_devices[device_id_].buffers_.AllocWidePlane(cq_, width_, height_, pixel_size_, &plane_);
+        else
+            status = g_devices[device_id_].buffers_.AllocPlane(cq_, width_, height_, &plane_);
+        if (status != FILTER_OK) return status;
+    }
 
-    return g_devices[device_id_].buffers_.AllocPlane(cq_, width_, height_, &plane_);
+    if (!linear_) return FILTER_OK;
+
+    status = g_devices[device_id_].buffers_.AllocLinearPlane(cq_, width_, height_, pixel_size_ > 1, &linear_plane_);
+    if (status != FILTER_OK) return status;
+
+    // The kernel is not run until CopyTo has provided the plane, so meanwhile 
+    // the linear plane stands in for a wrapped plane
+    return InitLinearKernel(device_id_, zero_copy_ ? linear_plane_ : plane_, linear_plane_, width_, height_, &convert_);
 }
 
 bool MultiFrame::Frame::IsCopyRequired(int &frame_number) {
@@ -322,11 +518,32 @@ result MultiFrame::Frame::CopyTo(
 
     if (IsCopyRequired(frame_number)) {
         frame_number_ = frame_number;
-        status = g_devices[device_id_].buffers_.CopyToPlane(plane_,
-                                                           *source, 
-                                                           width_, 
-                                                           height_, 
-                                                           pitch_);
+        if (zero_copy_) {
+            // The plane being replaced is not used by any queued kernel, as
+            // the previous frame's kernels have all completed
+            g_devices[device_id_].buffers_.Destroy(plane_);
+            if (g_devices[device_id_].pitched_planes())
+                status = g_devices[device_id_].buffers_.WrapPitchedPlane(cq_, source, width_, height_, pitch_, &plane_);
+            else if (pixel_size_ > 1)
+                status = g_devices[device_id_].buffers_.WrapWidePlane(cq_, source, width_, height_, pitch_, pixel_size_, &plane_);
+            else
+                status = g_devices[device_id_].buffers_.WrapPlane(cq_, source, width_, height_, pitch_, &plane_);
+        } else {
+            status = g_devices[device_id_].buffers_.CopyToPlane(plane_,
+                                                               *source, 
+                                                               width_, 
+                                                               height_, 
+                                                               pitch_);
+        }
+        if (status != FILTER_OK) return status;
+
+        if (linear_) {
+            if (zero_copy_) {
+                convert_.SetNumberedArg(CONVERT_ARG_GAMMA_PLANE, sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(plane_));
+                if (!convert_.arguments_valid()) return FILTER_KERNEL_ARGUMENT_ERROR;
+            }
+            status = convert_.Execute(cq_, NULL);
+        }
     }
     copied_ = NULL;
     ++frame_used_;
@@ -337,20 +554,41 @@ void MultiFrame::Frame::Plane(
     int         *plane,
     cl_event    *target_copied) {
 
-    *plane = plane_;
+    *plane = FilteredPlane();
     *target_copied = copied_;
 }
 
-result MultiFrame::Frame::Execute(
-    const   bool        &is_sample_equal_to_target) {
-
-    result status = FILTER_OK;
+result MultiFrame::Frame::Bind(
+    const   int         &target_plane,
+    const   bool        &is_sample_equal_to_target,
+    const   int         &alpha_so_far,
+    const   int         &field_mode,
+    const   int         &field) {
 
     int sample_equals_target = is_sample_equal_to_target ? k_sample_equals_target : k_sample_is_not_target;
 
-    filter_.SetNumberedArg(FILTER_ARG_SAMPLE_PLANE, sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(plane_));
+    filter_.SetNumberedArg(FILTER_ARG_TARGET_PLANE, sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(target_plane));
+    filter_.SetNumberedArg(FILTER_ARG_SAMPLE_PLANE, sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(FilteredPlane()));
     filter_.SetNumberedArg(FILTER_ARG_SAMPLE_EQUALS_TARGET, sizeof(int), &sample_equals_target);
+    filter_.SetNumberedArg(FILTER_ARG_ALPHA_SO_FAR, sizeof(int), &alpha_so_far);
+    if (!g_devices[device_id_].pitched_planes()) {
+        filter_.SetNumberedArg(FILTER_ARG_FIELD_MODE, sizeof(int), &field_mode);
+        filter_.SetNumberedArg(FILTER_ARG_FIELD, sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(field));
+    }
 
-    status = filter_.Execute(cq_, NULL);
-    return status;
+    return filter_.arguments_valid() ? FILTER_OK : FILTER_KERNEL_ARGUMENT_ERROR;
+}
+
+result MultiFrame::Frame::Execute(
+    const   cl_int2     &top_left) {
+
+    filter_.SetNumberedArg(FILTER_ARG_TOP_LEFT, sizeof(cl_int2), &top_left);
+    return filter_.Execute(cq_, NULL);
+}
+
+void MultiFrame::Frame::Release() {
+    g_devices[device_id_].buffers_.Destroy(plane_);
+    g_devices[device_id_].buffers_.Destroy(linear_plane_);
+    filter_.Release();
+    convert_.Release();
 }
@@ -22,7 +22,9 @@ class MultiFrame : public FilterFrame
 public:
     MultiFrame();
 
-    ~MultiFrame() {}
+    // Destructor
+    // Releases the frames' planes and kernels
+    ~MultiFrame();
 
     // Init
     // One-time configuration of this object to handle all multi-frame 
@@ -32,14 +34,37 @@ public:
         const   int     &temporal_radius,   // frame count both before and after frame being filtered
         const   int     &width,             // width of frame in pixels
         const   int     &height,            // height of frame in pixels
+        const   int     &pixel_size,        // bytes per pixel: 1, 2 for 16-bit pixels or 4 for floats
         const   int     &src_pitch,         // length in memory of a row of pixels in source buffer
         const   int     &dst_pitch,         // length in memory of a row of pixels in destination buffer
         const   float   &h,                 // NLM filtering strength
         const   int     &sample_expand,     // factor of radius of 3 to use for sampling
-        const   int     &linear,            // TODO delete
+        const   int     &linear,            // filter in linear light, ignored for pitched planes
         const   int     &correction,        // TODO delete
         const   int     &balanced);         // TODO float for bias: shadows or highlights
 
+    // InitFields
+    // Keeps fields of weights on the device, one for each pair of frames
+    // that are both in the temporal window of more than one target. When
+    // the earlier frame of a pair is the target, the weights of its
+    // interior pixels against the later frame are stored in the pair's
+    // field, so that when the later frame is the target its weights
+    // against the earlier frame are read rather than computed again.
+    //
+    // As many fields are created as fit in the budget, up to the count
+    // used at once. A pair without a field is weighted as usual, so the
+    // filtered plane is the same whatever the budget. No fields are
+    // created when a field would exceed the device's largest allocation,
+    // or have more than INT_MAX entries.
+    //
+    // Only for devices that support images
+    result InitFields(
+        const   cl_ulong    &budget);       // most bytes that the fields may use
+
+    // field_bytes
+    // Bytes used by the fields
+    cl_ulong field_bytes() const {return field_bytes_;}
+
     // SupplyFrameNumbers
     // Returns a set of frame numbers, in the MultiFrameRequest
     // object, when Deathray requests which frames should be copied
@@ -58,13 +83,20 @@ public:
     //
     // Also zeroes the intermediate buffers.
     //
-    // Called once per filtered frame
+    // Called once per filtered frame, followed by WaitForCopies
     result CopyTo(
                 MultiFrameRequest   *retrieved);    // set of frame numbers to be copied to device
 
+    // WaitForCopies
+    // Blocks until the copies queued by CopyTo have completed, after
+    // which the host buffers of the copied frames may be released
+    void WaitForCopies();
+
     // Execute
-    // Runs all iterations of the temporal filter
-    result Execute() override;
+    // Runs all iterations of the temporal filter, streaming each
+    // band of filtered rows to the host as soon as it is finalised
+    result Execute(
+        unsigned char *dest) override;  // host buffer for the filtered plane
 
 private:
 
@@ -102,11 +134,34 @@ private:
     // Create the Frame objects, one per step of the temporal filter
     result InitFrames();
 
-    // ExecuteFrame
-    // Process a single frame in the circular buffer of frames
-    result ExecuteFrame(
-        const   int         &frame_id,              // frame being filtered
-        const   bool        &sample_equals_target); // frame containing sample pixels is also target of filtering
+    // BindFrames
+    // Sets the arguments of each Frame's kernel that are constant for 
+    // the whole of the target frame, leaving only the region to be set
+    // for each launch. The target is filtered last.
+    result BindFrames(
+        const   int         &target_frame_id,       // Frame object handling the target frame
+        const   int         &target_frame_plane);   // plane of the target frame
+
+    // ChooseField
+    // Returns the mode and buffer of the field for the target frame and
+    // a sample frame: reusing the pair's field when the sample frame is
+    // earlier and its field is complete, otherwise storing to a free
+    // field when the sample frame is later
+    void ChooseField(
+        const   int         &sample_frame_number,   // frame sampled
+                int         *field_mode,            // k_field_unused, k_field_store or k_field_reuse
+                int         *field);                // buffer of the field, alpha_ when unused
+
+    // Field
+    // Weights of the interior pixels of the earlier frame of a pair against
+    // the later frame
+    struct Field {
+        int buffer      ;   // buffer of packed weights, per pixel per position of the set sampled
+        int earlier     ;   // frame number of the pair's earlier frame, the target when storing
+        int later       ;   // frame number of the pair's later frame, the target when reusing
+        bool complete   ;   // every region of the earlier frame has been weighted
+        bool used       ;   // field belongs to a pair
+    };
 
     // Frame
     // An object for each of the 2 * temporal_radius + 1 frames, all of which are processed separately.
@@ -128,10 +183,12 @@ private:
         result Init(
             const   int                 &device_id,     // device where buffer reside
                     cl_command_queue    *cq,            // command queue to use for the kernel
-            const   ClKernel            &NLM_kernel,    // kernel object to load
+            const   ClKernel            &NLM_kernel,    // kernel object whose instance the frame uses
             const   int                 &width,         // width in pixels of the frame
             const   int                 &height,        // height in pixels of the frame
-            const   int                 &pitch);        // length of a row of pixels in memory
+            const   int                 &pixel_size,    // bytes per pixel: 1, 2 for 16-bit pixels or 4 for floats
+            const   int                 &pitch,         // length of a row of pixels in memory
+            const   int                 &linear);       // convert the plane to linear light once it is on the device
 
         // IsCopyRequired
         // Queries the Frame to discover if it needs data from the host
@@ -142,7 +199,10 @@ private:
         // CopyTo
         // All frame objects are given the chance to copy host data to the device, if needed.
         //
-        // This handles the once-per-cycle copying of host data to the device
+        // This handles the once-per-cycle copying of host data to the device. On devices
+        // that share memory with the host the host buffer is used in place, so it must 
+        // remain valid for as long as the frame is in the cycle. In linear light the
+        // plane is converted as soon as it is copied.
         result CopyTo(
                     int             &frame_number,      // frame number to copy, if required
             const   unsigned char   *const source);     // host buffer containing original pixels
@@ -157,20 +217,41 @@ private:
             int         *plane,                         // returned buffer id for the frame
             cl_event    *target_copied);                // copy event
 
-        // Execute
-        // Performs the NLM pass.
+        // Bind
+        // Sets the arguments of the frame's kernel for the target frame.
         //
         // During each cycle the client instructs a single frame object that it is 
         // handling the target frame. The id of the frame object handling the target frame
         // progresses circularly around the "ring" of Frame objects, as the clip is processed
+        result Bind(
+            const   int         &target_plane,                  // plane of the frame being filtered
+            const   bool        &is_sample_equal_to_target,     // specify whether frame is that being filtered
+            const   int         &alpha_so_far,                  // position in alpha buffer for the frame's weight/pixel pairs
+            const   int         &field_mode,                    // k_field_unused, k_field_store or k_field_reuse
+            const   int         &field);                        // buffer of weights shared with the target, ignored for pitched planes
+
+        // frame_number
+        // Frame whose plane the object holds
+        int frame_number() const {return frame_number_;}
+
+        // Execute
+        // Performs the NLM pass for a region
         result Execute(
-            const   bool        &is_sample_equal_to_target);    // specify whether frame is that being filtered
+            const   cl_int2     &top_left);                     // coordinates of the region
+
+        // Release
+        // Releases the frame's planes and kernels
+        void Release();
 
     private:
 
+        // FilteredPlane
+        // Returns the plane read by the kernels, the linear plane in linear light
+        int FilteredPlane() {return linear_ ? linear_plane_ : plane_;}
+
         int device_id_          ;   // device executing the kernels
         cl_command_queue cq_    ;   // command queue shared by all Frame objects and client object
-        ClKernel filter_        ;   // each frame sets arguments for a kernel shared by all
+        ClKernel filter_        ;   // frame's own instance of the kernel, so its arguments persist between regions
         int frame_number_       ;   // frame being processed
         int plane_              ;   // buffer for the frame being processed
         int width_              ;   // width of plane's content
@@ -179,21 +260,32 @@ private:
         cl_event copied_        ;   // tracks completion of the copy from host to device of the Frame's sample plane
         cl_event wait_list_[2]  ;   // used during execution to track completion of copying of target and sample planes
         int frame_used_         ;   // tracks count of times plane data has been copied to device - enables kludge
+        bool zero_copy_         ;   // plane wraps the host's frame rather than holding a copy of it
+        int pixel_size_         ;   // bytes per pixel: 1, 2 for 16-bit pixels or 4 for floats
+        int linear_             ;   // 1 when the plane is converted to linear light
+        int linear_plane_       ;   // plane converted to linear light
+        ClKernel convert_       ;   // kernel that converts the plane to linear light
     };
 
 
     int temporal_radius_        ;   // count of frames either side of target frame that will be included in multi-frame filtering
     vector<Frame> frames_       ;   // set of frame planes including target
     int target_frame_number_    ;   // frame to be filtered
-    int alpha_so_far_           ;   // position in alpha buffer where weight/pixel pairs will be written next
-    ClKernel filter_            ;   // kernel that performs NLM computations, once per sample plane
+    ClKernel filter_            ;   // kernel that performs NLM computations, instanced by each Frame
     ClKernel sort_              ;   // single invocation of this kernel to sort all samples from all frames
     cl_event copied_            ;   // used to track the final copy to the device - at least one frame is copied to the device
     cl_event executed_          ;   // sort kernel is executed synchronously, but event is used for asynchronous copy back to host
+    vector<Field> fields_       ;   // fields of weights shared by pairs of frames, empty unless InitFields is used
+    cl_ulong field_bytes_       ;   // bytes used by the fields
 
     // Kernel needs to know whether the plane it is sampling from is the target plane
     static const int k_sample_equals_target = 1;
     static const int k_sample_is_not_target = 0;
+
+    // Modes of the field of weights, as defined in nlm.cl
+    static const int k_field_unused = 0;
+    static const int k_field_store  = 1;
+    static const int k_field_reuse  = 2;
 };
 
 #endif // MULTI_FRAME_H_
\ No newline at end of file
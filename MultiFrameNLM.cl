@@ -5,7 +5,7 @@
  * Copyright 2015, Jawed Ashraf - Deathray@cupidity.f9.co.uk
  */
 
-__attribute__((reqd_work_group_size(8, 16, 1)))
+__attribute__((reqd_work_group_size(8, TILE_ROWS << 3, 1)))
 __kernel void NLMMultiFrameFourPixel(
     read_only   image2d_t   target_plane,           // plane being filtered
     read_only   image2d_t   sample_plane,           // any other plane
@@ -19,15 +19,45 @@ __kernel void NLMMultiFrameFourPixel(
     const       int         linear,                 // process plane in linear space instead of gamma space
     const       int         alpha_set_size,         // number of weight/pixel pairs per target pixel
     const       int         alpha_so_far,           // count of alpha samples generated so far for each cooperator
-    global      uint        *region_alpha) {        // region's alpha weight/pixel pairs packed as uints
+    global      uint        *region_alpha,          // region's alpha weight/pixel pairs packed as uints
+    global      float       *region_pixels,         // region's sample pixels, written only for float planes
+    const       int         field_mode,             // FIELD_UNUSED, FIELD_STORE or FIELD_REUSE
+    global      uint        *field) {               // weights shared by the target and sample frames, any buffer when unused
 
 
-    local float target_cache[128];
-    local float sample_cache[1280];
+    local float target_cache[TARGET_CACHE_SIZE];
+    local float sample_cache[SAMPLE_CACHE_SIZE];
+    local int sample_table[MAX_SET_SAMPLES];
 
-    PopulateTargetCache(target_plane, top_left, linear, target_cache);
+    PopulateTargetCache(target_plane, GetCoordinatesTile(top_left), TILE_ROWS, linear, target_cache);
 
     int skip_target = sample_equals_target;
+
+    // Tiles away from the plane's borders take the path without wrapping or clamping
+    const int radius = GetRadius(sample_expand);
+    if (IsInteriorTile(top_left, (int2)(width, height), radius)) {
+        BuildSampleTable(radius, skip_target, sample_table);
+        WeightAnEighthInterior(sample_plane,
+                               h, 
+                               sample_expand, 
+                               width, 
+                               height, 
+                               top_left, 
+                               g_gaussian, 
+                               linear, 
+                               target_cache, 
+                               sample_cache, 
+                               sample_table,
+                               alpha_set_size, 
+                               alpha_so_far,
+                               width,
+                               region_alpha,
+                               region_pixels,
+                               field_mode,
+                               field);
+        return;
+    }
+
     WeightAnEighth(sample_plane,
                    h, 
                    sample_expand, 
@@ -41,7 +71,11 @@ __kernel void NLMMultiFrameFourPixel(
                    sample_cache, 
                    alpha_set_size, 
                    alpha_so_far,
-                   region_alpha);
+                   width,
+                   region_alpha,
+                   region_pixels,
+                   field_mode,
+                   field);
 
 }
 
@@ -0,0 +1,131 @@
+/* Deathray2 - An Avisynth plug-in filter for spatial/temporal non-local means de-noising.
+ *
+ * version 1.00
+ *
+ * Copyright 2015, Jawed Ashraf - Deathray@cupidity.f9.co.uk
+ */
+
+// Packed frames, YUY2 and RGB32, arrive on the device as they are held by
+// the host: rows of bytes with the host's pitch. The Unpack kernels split
+// each frame into the planes read by the filter kernels and the Pack
+// kernels interleave the filtered planes back into a frame for the host.
+//
+// Each work item moves 16 bytes of the frame. Avisynth pads rows to a
+// multiple of 16 bytes, so the final work item of a row stays within it.
+//
+// YUY2 is Y0 U0 Y1 V0, so 16 bytes are 8 pixels of Y and 4 each of U and
+// V, the chroma planes being half the width of luma. RGB32 is B G R A, so
+// 16 bytes are 4 pixels of each of the planes. Alpha is not filtered.
+
+// UnpackTexel
+// Converts 4 bytes of the frame to a texel of a UNORM8 plane
+float4 UnpackTexel(
+    const       uchar4      bytes) {        // 4 pixels of one plane
+
+    return convert_float4(bytes) * (1.f / 255.f);
+}
+
+// PackTexel
+// Converts a texel of a UNORM8 plane to 4 bytes of the frame
+uchar4 PackTexel(
+    const       float4      pixels) {       // 4 pixels of one plane
+
+    return convert_uchar4_sat_rte(pixels * 255.f);
+}
+
+// UnpackYUY2
+// Splits a YUY2 frame into its Y, U and V planes
+__kernel void UnpackYUY2(
+    global const uchar      *frame,         // packed frame as uploaded
+    const       int         pitch,          // length in bytes of a row of the frame
+    const       int         width,          // width of luma in pixels
+    const       int         height,         // height in pixels
+    write_only  image2d_t   plane_y,        // Y plane
+    write_only  image2d_t   plane_u,        // U plane
+    write_only  image2d_t   plane_v) {      // V plane
+
+    const int2 texel = (int2)(get_global_id(0), get_global_id(1));
+    if (texel.x >= ((width + 7) >> 3) || texel.y >= height) return;
+
+    const uchar16 bytes = vload16(0, frame + mad24(texel.y, pitch, texel.x << 4));
+    const uchar8 luma = bytes.even;
+    const uchar8 chroma = bytes.odd;
+
+    write_imagef(plane_y, (int2)(texel.x << 1, texel.y), UnpackTexel(luma.lo));
+    if ((texel.x << 1) + 1 < ((width + 3) >> 2))
+        write_imagef(plane_y, (int2)((texel.x << 1) + 1, texel.y), UnpackTexel(luma.hi));
+    write_imagef(plane_u, texel, UnpackTexel(chroma.even));
+    write_imagef(plane_v, texel, UnpackTexel(chroma.odd));
+}
+
+// PackYUY2
+// Interleaves filtered Y, U and V planes into a YUY2 frame
+__kernel void PackYUY2(
+    read_only   image2d_t   plane_y,        // Y plane
+    read_only   image2d_t   plane_u,        // U plane
+    read_only   image2d_t   plane_v,        // V plane
+    const       int         width,          // width of luma in pixels
+    const       int         height,         // height in pixels
+    const       int         pitch,          // length in bytes of a row of the frame
+    global      uchar       *frame) {       // packed frame for the host
+
+    const int2 texel = (int2)(get_global_id(0), get_global_id(1));
+    if (texel.x >= ((width + 7) >> 3) || texel.y >= height) return;
+
+    // Beyond the final texel of luma the bytes are the row's padding
+    const uchar4 luma_lo = PackTexel(ReadPixel4(plane_y, (int2)(texel.x << 1, texel.y)));
+    const uchar4 luma_hi = PackTexel(ReadPixel4(plane_y, (int2)((texel.x << 1) + 1, texel.y)));
+    const uchar4 u = PackTexel(ReadPixel4(plane_u, texel));
+    const uchar4 v = PackTexel(ReadPixel4(plane_v, texel));
+
+    uchar16 bytes;
+    bytes.even = (uchar8)(luma_lo, luma_hi);
+    bytes.odd = (uchar8)(u.s0, v.s0, u.s1, v.s1, u.s2, v.s2, u.s3, v.s3);
+    vstore16(bytes, 0, frame + mad24(texel.y, pitch, texel.x << 4));
+}
+
+// UnpackRGB32
+// Splits an RGB32 frame into its B, G and R planes
+__kernel void UnpackRGB32(
+    global const uchar      *frame,         // packed frame as uploaded
+    const       int         pitch,          // length in bytes of a row of the frame
+    const       int         width,          // width in pixels
+    const       int         height,         // height in pixels
+    write_only  image2d_t   plane_g,        // G plane
+    write_only  image2d_t   plane_b,        // B plane
+    write_only  image2d_t   plane_r) {      // R plane
+
+    const int2 texel = (int2)(get_global_id(0), get_global_id(1));
+    if (texel.x >= ((width + 3) >> 2) || texel.y >= height) return;
+
+    const uchar16 bytes = vload16(0, frame + mad24(texel.y, pitch, texel.x << 4));
+
+    write_imagef(plane_g, texel, UnpackTexel(bytes.s159d));
+    write_imagef(plane_b, texel, UnpackTexel(bytes.s048c));
+    write_imagef(plane_r, texel, UnpackTexel(bytes.s26ae));
+}
+
+// PackRGB32
+// Interleaves filtered B, G and R planes into an RGB32 frame, taking
+// alpha from the frame as uploaded
+__kernel void PackRGB32(
+    read_only   image2d_t   plane_g,        // G plane
+    read_only   image2d_t   plane_b,        // B plane
+    read_only   image2d_t   plane_r,        // R plane
+    const       int         width,          // width in pixels
+    const       int         height,         // height in pixels
+    const       int         pitch,          // length in bytes of a row of the frame
+    global      uchar       *frame,         // packed frame for the host
+    global const uchar      *source_frame,  // packed frame as uploaded
+    const       int         source_pitch) { // length in bytes of a row of the uploaded frame
+
+    const int2 texel = (int2)(get_global_id(0), get_global_id(1));
+    if (texel.x >= ((width + 3) >> 2) || texel.y >= height) return;
+
+    uchar16 bytes = vload16(0, source_frame + mad24(texel.y, source_pitch, texel.x << 4));
+    bytes.s159d = PackTexel(ReadPixel4(plane_g, texel));
+    bytes.s048c = PackTexel(ReadPixel4(plane_b, texel));
+    bytes.s26ae = PackTexel(ReadPixel4(plane_r, texel));
+    vstore16(bytes, 0, frame + mad24(texel.y, pitch, texel.x << 4));
+}
+
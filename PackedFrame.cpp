@@ -0,0 +1,262 @@
+/* Deathray2 - An Avisynth plug-in filter for spatial/temporal non-local means de-noising.
+ *
+ * version 1.00
+ *
+ * Copyright 2015, Jawed Ashraf - Deathray@cupidity.f9.co.uk
+ */
+
+#include "result.h"
+#include "PackedFrame.h"
+#include "SingleFrame.h"
+#include "device.h"
+#include "buffer_map.h"
+
+extern  int     g_device_count;
+extern  Device  *g_devices;
+extern  cl_int  g_last_cl_error;
+
+#define UNPACK_ARG_FRAME 0
+#define PACK_ARG_SOURCE_FRAME 7
+
+PackedFrame::PackedFrame() {
+    device_id_      = 0;
+    rgb_            = false;
+    width_          = 0;
+    height_         = 0;
+    row_size_       = 0;
+    src_pitch_      = 0;
+    dst_pitch_      = 0;
+    source_frame_   = 0;
+    dest_frame_     = 0;
+    cq_             = NULL;
+    readback_cq_    = NULL;
+    zero_copy_      = false;
+
+    for (int i = 0; i < 3; ++i) {
+        source_planes_[i]   = 0;
+        dest_planes_[i]     = 0;
+    }
+}
+
+PackedFrame::~PackedFrame() {
+    if (cq_ != NULL) clReleaseCommandQueue(cq_);
+    if (readback_cq_ != NULL) clReleaseCommandQueue(readback_cq_);
+
+    if (g_devices == NULL) return;
+
+    unpack_.Release();
+    pack_.Release();
+
+    // Buffers were destroyed when the devices were
+    if (device_id_ < g_device_count) {
+        g_devices[device_id_].buffers_.Destroy(source_frame_);
+        g_devices[device_id_].buffers_.Destroy(dest_frame_);
+        for (size_t i = 0; i < unfiltered_planes_.size(); ++i)
+            g_devices[device_id_].buffers_.Destroy(unfiltered_planes_[i]);
+    }
+}
+
+result PackedFrame::Init(
+    const   int             &device_id,
+    const   bool            &rgb,
+    const   int             &width,
+    const   int             &height,
+    const   int             &src_pitch,
+    const   int             &dst_pitch,
+            SingleFrame     *luma,
+            SingleFrame     *chroma_u,
+            SingleFrame     *chroma_v) {
+
+    if (device_id >= g_device_count) return FILTER_ERROR;
+    if (g_devices[device_id].pitched_planes()) return FILTER_PACKED_FRAMES_UNSUPPORTED;
+
+    result status = FILTER_OK;
+
+    device_id_      = device_id;
+    rgb_            = rgb;
+    width_          = width;
+    height_         = height;
+    row_size_       = rgb ? width << 2 : width << 1;
+    src_pitch_      = src_pitch;
+    dst_pitch_      = dst_pitch;
+    cq_             = g_devices[device_id_].cq();
+    readback_cq_    = g_devices[device_id_].cq();
+    zero_copy_      = g_devices[device_id_].zero_copy();
+
+    if (width_ == 0 || height_ == 0 || src_pitch_ == 0 || dst_pitch_ == 0)
+        return FILTER_INVALID_PARAMETER;
+
+    status = InitPlanes(luma, chroma_u, chroma_v);
+    if (status != FILTER_OK) return status;
+
+    // The source frame that wraps host frames is created by CopyTo
+    if (!zero_copy_) {
+        status = g_devices[device_id_].buffers_.AllocPitchedPlane(cq_, row_size_, height_, src_pitch_, &source_frame_);
+        if (status != FILTER_OK) return status;
+    }
+
+    status = g_devices[device_id_].buffers_.AllocPitchedPlane(cq_, row_size_, height_, dst_pitch_, &dest_frame_);
+    if (status != FILTER_OK) return status;
+
+    status = InitUnpackKernel();
+    if (status != FILTER_OK) return status;
+
+    return InitPackKernel();
+}
+
+result PackedFrame::InitPlanes(
+    SingleFrame *luma,
+    SingleFrame *chroma_u,
+    SingleFrame *chroma_v) {
+
+    SingleFrame *filters[3] = {luma, chroma_u, chroma_v};
+
+    // YUY2's chroma is half the width of luma
+    const int widths[3] = {width_, rgb_ ? width_ : width_ >> 1, rgb_ ? width_ : width_ >> 1};
+
+    for (int i = 0; i < 3; ++i) {
+        if (filters[i] != NULL) {
+            result status = filters[i]->DeviceSource(cq_, &source_planes_[i]);
+            if (status != FILTER_OK) return status;
+
+            dest_planes_[i] = filters[i]->dest_plane();
+        } else {
+            // Unpacked and packed again unchanged
+            int plane = 0;
+            result status = g_devices[device_id_].buffers_.AllocPlane(cq_, widths[i], height_, &plane);
+            if (status != FILTER_OK) return status;
+
+            unfiltered_planes_.push_back(plane);
+            source_planes_[i]   = plane;
+            dest_planes_[i]     = plane;
+        }
+    }
+
+    return FILTER_OK;
+}
+
+result PackedFrame::InitUnpackKernel() {
+    unpack_ = ClKernel(device_id_, rgb_ ? "UnpackRGB32" : "UnpackYUY2");
+
+    // Until CopyTo wraps the first frame the destination frame stands in for the source
+    const int source_frame = zero_copy_ ? dest_frame_ : source_frame_;
+
+    unpack_.SetArg(sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(source_frame));
+    unpack_.SetArg(sizeof(int), &src_pitch_);
+    unpack_.SetArg(sizeof(int), &width_);
+    unpack_.SetArg(sizeof(int), &height_);
+    for (int i = 0; i < 3; ++i)
+        unpack_.SetArg(sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(source_planes_[i]));
+
+    if (unpack_.arguments_valid()) {
+        // one work item per 16 bytes of the frame
+        const size_t set_local_work_size[2]    = {16, 4};
+        const size_t set_scalar_global_size[2] = {(row_size_ + 15) >> 4, height_};
+        const size_t set_scalar_item_size[2]   = {1, 1};
+
+        unpack_.set_work_dim(2);
+        unpack_.set_local_work_size(set_local_work_size);
+        unpack_.set_scalar_global_size(set_scalar_global_size);
+        unpack_.set_scalar_item_size(set_scalar_item_size);
+
+        return FILTER_OK;
+    }
+
+    return FILTER_KERNEL_ARGUMENT_ERROR;
+}
+
+result PackedFrame::InitPackKernel() {
+    pack_ = ClKernel(device_id_, rgb_ ? "PackRGB32" : "PackYUY2");
+
+    for (int i = 0; i < 3; ++i)
+        pack_.SetArg(sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(dest_planes_[i]));
+    pack_.SetArg(sizeof(int), &width_);
+    pack_.SetArg(sizeof(int), &height_);
+    pack_.SetArg(sizeof(int), &dst_pitch_);
+    pack_.SetArg(sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(dest_frame_));
+    if (rgb_) {
+        // Alpha comes from the source frame
+        const int source_frame = zero_copy_ ? dest_frame_ : source_frame_;
+        pack_.SetArg(sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(source_frame));
+        pack_.SetArg(sizeof(int), &src_pitch_);
+    }
+
+    if (pack_.arguments_valid()) {
+        // one work item per 16 bytes of the frame
+        const size_t set_local_work_size[2]    = {16, 4};
+        const size_t set_scalar_global_size[2] = {(row_size_ + 15) >> 4, height_};
+        const size_t set_scalar_item_size[2]   = {1, 1};
+
+        pack_.set_work_dim(2);
+        pack_.set_local_work_size(set_local_work_size);
+        pack_.set_scalar_global_size(set_scalar_global_size);
+        pack_.set_scalar_item_size(set_scalar_item_size);
+
+        return FILTER_OK;
+    }
+
+    return FILTER_KERNEL_ARGUMENT_ERROR;
+}
+
+result PackedFrame::CopyTo(const unsigned char *source) {
+    result status = FILTER_OK;
+
+    if (zero_copy_) {
+        // Execute waited for the previous frame's kernels to complete
+        g_devices[device_id_].buffers_.Destroy(source_frame_);
+
+        status = g_devices[device_id_].buffers_.WrapPitchedPlane(cq_, source, row_size_, height_, src_pitch_, &source_frame_);
+        if (status != FILTER_OK) return status;
+
+        const cl_mem *source_frame = g_devices[device_id_].buffers_.ptr(source_frame_);
+        unpack_.SetNumberedArg(UNPACK_ARG_FRAME, sizeof(cl_mem), source_frame);
+        if (rgb_) pack_.SetNumberedArg(PACK_ARG_SOURCE_FRAME, sizeof(cl_mem), source_frame);
+        if (!unpack_.arguments_valid() || !pack_.arguments_valid())
+            return FILTER_KERNEL_ARGUMENT_ERROR;
+    } else {
+        status = g_devices[device_id_].buffers_.CopyToPlane(source_frame_,
+                                                            *source,
+                                                            row_size_,
+                                                            height_,
+                                                            src_pitch_);
+        if (status != FILTER_OK) return status;
+    }
+
+    // The filters share the queue, which is in-order, so the planes are 
+    // unpacked before they are filtered
+    return unpack_.Execute(cq_, NULL);
+}
+
+result PackedFrame::Execute(unsigned char *dest) {
+    // The planes were filtered on this queue, so they are complete
+    cl_event packed = NULL;
+    result status = pack_.Execute(cq_, &packed);
+    if (status != FILTER_OK) return status;
+
+    // Kernels queued so far must be submitted before the copy can wait upon them
+    clFlush(cq_);
+
+    status = g_devices[device_id_].buffers_.CopyFromPlaneAsynch(dest_frame_,
+                                                                readback_cq_,
+                                                                0,
+                                                                row_size_,
+                                                                height_,
+                                                                dst_pitch_,
+                                                                &packed,
+                                                                NULL,
+                                                                dest);
+    clReleaseEvent(packed);
+    return status;
+}
+
+result PackedFrame::CopyFrom(cl_event *returned) {
+    // The copy queue is in-order, so the marker completes after the frame's copy
+    cl_int cl_status = clEnqueueMarker(readback_cq_, returned);
+    if (cl_status != CL_SUCCESS) {
+        g_last_cl_error = cl_status;
+        return FILTER_COPYING_FROM_PLANE_FAILED;
+    }
+
+    clFlush(readback_cq_);
+    return FILTER_OK;
+}
@@ -0,0 +1,113 @@
+/* Deathray2 - An Avisynth plug-in filter for spatial/temporal non-local means de-noising.
+ *
+ * version 1.00
+ *
+ * Copyright 2015, Jawed Ashraf - Deathray@cupidity.f9.co.uk
+ */
+
+#ifndef _PACKED_FRAME_
+#define _PACKED_FRAME_
+
+#include <vector>
+
+#include <CL/cl.h>
+#include "CLKernel.h"
+
+enum result;
+class SingleFrame;
+
+// PackedFrame
+// Moves frames of packed clips, YUY2 and RGB32, between host and device
+// whole. The frame as uploaded is split into planes on the device, which
+// the plane's SingleFrames filter without copying to or from the host,
+// on the same in-order queue as the unpacking and packing. The filtered
+// planes are then interleaved into a frame on the device, which is the
+// only copy back to the host.
+//
+// YUY2's planes are Y, U and V. RGB32's planes are filtered as though
+// green were luma and blue and red were chroma. Alpha is not filtered.
+//
+// Planes that are not filtered are unpacked and packed unchanged.
+class PackedFrame
+{
+public:
+    PackedFrame();
+
+    // Destructor
+    // Releases the kernels, the queues, the frames and the planes that 
+    // are not filtered
+    ~PackedFrame();
+
+    // Init
+    // Setup the frames on the device, take the source and destination
+    // planes of each SingleFrame and configure the unpack and pack
+    // kernels. The planes are images, so devices that use pitched planes
+    // are unsupported.
+    result Init(
+        const   int             &device_id,     // device used for filtering
+        const   bool            &rgb,           // frames are RGB32, otherwise YUY2
+        const   int             &width,         // width of frame in pixels
+        const   int             &height,        // height of frame in pixels
+        const   int             &src_pitch,     // length in memory of a row of the source frame
+        const   int             &dst_pitch,     // length in memory of a row of the destination frame
+                SingleFrame     *luma,          // filter of Y, or G, NULL when not filtered
+                SingleFrame     *chroma_u,      // filter of U, or B, NULL when not filtered
+                SingleFrame     *chroma_v);     // filter of V, or R, NULL when not filtered
+
+    // CopyTo
+    // Copy the frame from host to device and unpack it into the planes.
+    // Devices that share memory with the host use the host buffer in
+    // place instead, so it must remain valid until the next call.
+    result CopyTo(
+        const unsigned char *source);           // host buffer to be copied to device
+
+    // Execute
+    // Pack the planes, once they have been filtered, into the frame
+    // and copy it to the host
+    result Execute(
+        unsigned char *dest);                   // host buffer for the filtered frame
+
+    // CopyFrom
+    // Returns an event that completes when the frame has arrived on
+    // the host
+    result CopyFrom(
+        cl_event *returned);                    // event to track completion of the copy
+
+private:
+
+    // InitPlanes
+    // Take each filter's planes, or create one plane serving as both
+    // source and destination for a plane that is not filtered
+    result InitPlanes(
+        SingleFrame *luma,                      // filter of Y, or G, NULL when not filtered
+        SingleFrame *chroma_u,                  // filter of U, or B, NULL when not filtered
+        SingleFrame *chroma_v);                 // filter of V, or R, NULL when not filtered
+
+    // InitUnpackKernel
+    // Configure the kernel that splits the uploaded frame into planes
+    result InitUnpackKernel();
+
+    // InitPackKernel
+    // Configure the kernel that interleaves the filtered planes
+    result InitPackKernel();
+
+    int device_id_      ;   // device used to execute the kernels
+    bool rgb_           ;   // frames are RGB32, otherwise YUY2
+    int width_          ;   // width of frame in pixels
+    int height_         ;   // height of frame in pixels
+    int row_size_       ;   // length in bytes of a row of pixels of the frame
+    int src_pitch_      ;   // host frame format allows each row to be potentially longer than row_size_
+    int dst_pitch_      ;   // host frame format allows each row to be potentially longer than row_size_
+    int source_frame_   ;   // frame as uploaded, a pitched plane of bytes
+    int dest_frame_     ;   // frame packed from the filtered planes, a pitched plane of bytes
+    int source_planes_[3];  // planes unpacked from the frame: Y, U and V, or G, B and R
+    int dest_planes_[3] ;   // planes packed into the frame, in the same order
+    vector<int> unfiltered_planes_; // planes created for the planes that are not filtered
+    cl_command_queue cq_;   // synchronous queue of device commands
+    cl_command_queue readback_cq_;  // queue used to copy the frame back to the host
+    bool zero_copy_     ;   // source frame wraps the host frame rather than holding a copy of it
+    ClKernel unpack_    ;   // kernel that splits the frame into planes
+    ClKernel pack_      ;   // kernel that interleaves the planes into the frame
+};
+
+#endif // _PACKED_FRAME_
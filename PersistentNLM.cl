@@ -0,0 +1,229 @@
+/* Deathray2 - An Avisynth plug-in filter for spatial/temporal non-local means de-noising.
+ *
+ * version 1.00
+ *
+ * Copyright 2015, Jawed Ashraf - Deathray@cupidity.f9.co.uk
+ */
+
+// Persistent kernels filter a whole plane, or the rows of it assigned to
+// the device, in a single launch. A fixed number of work groups, sized to
+// the device, take tiles of the plane from a queue until none remain,
+// weighting and finalising each tile before taking the next. Tiles near
+// the borders of the plane, whose sample sets are clamped, cost a
+// different amount from interior tiles, so groups that take cheap tiles
+// simply take more of them.
+//
+// The work groups are launched as a single column. Each group keeps the
+// alpha sets of the tile it is filtering in its own part of tile_alpha,
+// so the buffer's size depends only upon the count of groups.
+//
+// The queue is two ints: the count of tiles taken and the count of groups
+// that have finished. The last group to finish empties the queue for the
+// next launch.
+
+// TakeTile
+// Returns the index of the next tile of the plane, the same for every work
+// item in the group
+int TakeTile(
+    global      int     *tile_queue,    // count of tiles taken, count of groups finished
+    local       int     *tile) {        // broadcasts the tile taken to the group
+
+    // The group's reads of its previous tile's alpha sets complete before
+    // any work item writes the next tile's
+    if (get_local_id(0) == 0 && get_local_id(1) == 0)
+        *tile = atomic_inc(&tile_queue[0]);
+    barrier(CLK_LOCAL_MEM_FENCE | CLK_GLOBAL_MEM_FENCE);
+
+    const int taken = *tile;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    return taken;
+}
+
+// FinishTiles
+// Records that the group has finished. The last group to finish empties
+// the queue.
+void FinishTiles(
+    global      int     *tile_queue) {  // count of tiles taken, count of groups finished
+
+    if (get_local_id(0) != 0 || get_local_id(1) != 0) return;
+
+    const int group_count = get_num_groups(0) * get_num_groups(1);
+    if (atomic_inc(&tile_queue[1]) == group_count - 1) {
+        atomic_xchg(&tile_queue[0], 0);
+        atomic_xchg(&tile_queue[1], 0);
+    }
+}
+
+// NLMSingleFramePersistent weights and finalises each tile in the same
+// group, so its tiles are the 8x2 tiles of the Finalise kernels. Programs
+// compiled for other heights of weighting tile leave it out.
+#if TILE_ROWS == 2
+
+__attribute__((reqd_work_group_size(8, 16, 1)))
+__kernel void NLMSingleFramePersistent(
+    read_only   image2d_t   input_plane,        // input plane
+    const       int         width,              // width in pixels
+    const       int         height,             // height in pixels
+    const       int         first_row,          // first row to be filtered
+    const       int         end_row,            // row after the last row to be filtered
+    const       float       h,                  // strength of denoising
+    const       int         sample_expand,      // factor to expand sample radius
+    constant    float       *g_gaussian,        // 49 weights of gaussian kernel
+    const       int         linear,             // process plane in linear space instead of gamma space
+    const       int         alpha_size,         // TODO delete
+    const       int         alpha_set_size,     // number of weight/pixel pairs per target pixel
+    global      uint        *tile_alpha,        // each group's alpha weight/pixel pairs packed as uints
+    global      int         *tile_queue,        // count of tiles taken, count of groups finished
+    write_only  image2d_t   destination_plane,  // filtered result
+    global      float       *tile_pixels) {     // each group's sample pixels, written only for float planes
+
+    // Tiles are 8x2 pixels, filtered exactly as NLMSingleFrame and Finalise
+    // filter them. Those functions add the group's position in the launch,
+    // which is (0, 2 * group), to top_left, so it is subtracted from each
+    // tile's coordinates. For the same reason the group's alpha sets are
+    // addressed as though the group were filtering a region 8 pixels wide.
+
+    local float target_cache[TARGET_CACHE_SIZE];
+    local float sample_cache[SAMPLE_CACHE_SIZE];
+    local uint weight_swap[256];
+    local uint pixel_swap[128];
+    local int sample_table[MAX_SET_SAMPLES];
+    local int tile;
+
+    const int tiles_across = (width + 7) >> 3;
+    const int tile_count = mul24(tiles_across, (end_row - first_row + 1) >> 1);
+    const int alpha_width = 8;
+    const int skip_target = 1;
+
+    // The table is the same for every interior tile
+    const int radius = GetRadius(sample_expand);
+    BuildSampleTable(radius, skip_target, sample_table);
+
+    for (int i = TakeTile(tile_queue, &tile); i < tile_count; i = TakeTile(tile_queue, &tile)) {
+        const int2 tile_coordinates = (int2)((i % tiles_across) << 3, first_row + ((i / tiles_across) << 1));
+        const int2 top_left = tile_coordinates - GetRegionCoordinates8x2();
+
+        PopulateTargetCache(input_plane, tile_coordinates, 2, linear, target_cache);
+        if (IsInteriorTile(top_left, (int2)(width, height), radius)) {
+            WeightAnEighthInterior(input_plane,
+                                   h,
+                                   sample_expand,
+                                   width,
+                                   height,
+                                   top_left,
+                                   g_gaussian,
+                                   linear,
+                                   target_cache,
+                                   sample_cache,
+                                   sample_table,
+                                   alpha_set_size,
+                                   0,
+                                   alpha_width,
+                                   tile_alpha,
+                                   tile_pixels,
+                                   FIELD_UNUSED,
+                                   tile_alpha);
+        } else {
+            WeightAnEighth(input_plane,
+                           h,
+                           sample_expand,
+                           width,
+                           height,
+                           top_left,
+                           skip_target,
+                           g_gaussian,
+                           linear,
+                           target_cache,
+                           sample_cache,
+                           alpha_set_size,
+                           0,
+                           alpha_width,
+                           tile_alpha,
+                           tile_pixels,
+                           FIELD_UNUSED,
+                           tile_alpha);
+        }
+
+        // Cooperators sort weights written by the others
+        barrier(CLK_GLOBAL_MEM_FENCE);
+
+        FinaliseTile(alpha_width,
+                     top_left,
+                     linear,
+                     get_image_channel_data_type(input_plane),
+                     alpha_size,
+                     alpha_set_size,
+                     tile_alpha,
+                     tile_pixels,
+                     destination_plane,
+                     target_cache,
+                     weight_swap,
+                     pixel_swap);
+    }
+
+    FinishTiles(tile_queue);
+}
+
+#endif
+
+__kernel void NLMSingleFramePersistentPitched(
+    global const uchar  *input_plane,       // input plane
+    const       int     width,              // width in pixels
+    const       int     height,             // height in pixels
+    const       int     first_row,          // first row to be filtered
+    const       int     end_row,            // row after the last row to be filtered
+    const       float   h,                  // strength of denoising
+    const       int     sample_expand,      // factor to expand sample radius
+    constant    float   *g_gaussian,        // 49 weights of gaussian kernel
+    const       int     alpha_set_size,     // number of weight/pixel pairs per target pixel
+    global      uint    *tile_alpha,        // each work item's alpha weight/pixel pairs packed as uints
+    global      int     *tile_queue,        // count of tiles taken, count of groups finished
+    global      uchar   *destination_plane, // filtered result
+    const       int     pitch) {            // length in bytes of a row of either plane
+
+    // Tiles are the shape of the work group. Each work item weights and
+    // finalises its own pixel of the tile, so its alpha set needs no
+    // synchronisation.
+
+    local int tile;
+
+    const int tile_width = get_local_size(0);
+    const int tile_height = get_local_size(1);
+    const int tiles_across = (width + tile_width - 1) / tile_width;
+    const int tile_count = mul24(tiles_across, (end_row - first_row + tile_height - 1) / tile_height);
+    const int work_item = mad24((int)get_global_id(1), (int)get_global_size(0), (int)get_global_id(0));
+    const int alpha_base = mul24(work_item, alpha_set_size);
+    const int skip_target = 1;
+
+    for (int i = TakeTile(tile_queue, &tile); i < tile_count; i = TakeTile(tile_queue, &tile)) {
+        const int2 tile_coordinates = (int2)(mul24(i % tiles_across, tile_width),
+                                             first_row + mul24(i / tiles_across, tile_height));
+        const int2 target = tile_coordinates + (int2)(get_local_id(0), get_local_id(1));
+
+        WeightPitched(input_plane,
+                      input_plane,
+                      pitch,
+                      width,
+                      height,
+                      target,
+                      h,
+                      sample_expand,
+                      skip_target,
+                      g_gaussian,
+                      alpha_base,
+                      0,
+                      tile_alpha);
+
+        FinalisePitchedPixel(input_plane,
+                             target,
+                             alpha_base,
+                             alpha_set_size,
+                             tile_alpha,
+                             destination_plane,
+                             width,
+                             height,
+                             pitch);
+    }
+
+    FinishTiles(tile_queue);
+}
@@ -0,0 +1,337 @@
+/* Deathray2 - An Avisynth plug-in filter for spatial/temporal non-local means de-noising.
+ *
+ * version 1.00
+ *
+ * Copyright 2015, Jawed Ashraf - Deathray@cupidity.f9.co.uk
+ */
+
+// Kernels for planes held as linear buffers of uchars with a pitch, rather
+// than as images. These are used on CPU devices, where image sampling is
+// emulated and local memory is merely ordinary memory.
+//
+// Each work item handles a single target pixel from start to finish, with no
+// cooperation between work items. Work items follow identical paths through
+// the sample set, so the compiler can vectorise across adjacent work items.
+
+// ReadPitchedPixel
+// Returns a single pixel normalised to the range 0.f to 1.f. Coordinates
+// are clamped to the edges of the plane.
+float ReadPitchedPixel(
+    global  const   uchar   *plane,         // input plane
+    const           int     pitch,          // length in bytes of a row of the plane
+    const           int2    image_max,      // width,height of image (1-based)
+                    int2    coordinates) {  // scalar coordinates of pixel
+
+    coordinates = clamp(coordinates, (int2)(0, 0), image_max - (int2)(1, 1));
+    return (float)plane[mad24(coordinates.y, pitch, coordinates.x)] * 0.0039215686f;
+}
+
+// GetPitchedTargetCoordinates
+// Coordinates of the pixel being filtered
+int2 GetPitchedTargetCoordinates(
+    const int2 top_left) {  // coordinates of the top left corner of the region to be filtered
+
+    return top_left + (int2)(get_global_id(0), get_global_id(1));
+}
+
+// GetPitchedRegionBaseAddress
+// Base address within the region_alpha buffer for the target pixel's alpha samples
+int GetPitchedRegionBaseAddress(
+    const int width,            // region width in pixels
+    const int alpha_set_size) { // number of weight/pixel pairs per target pixel
+
+    const int region_pixel_base = mad24((int)get_global_id(1), width, (int)get_global_id(0));
+    return mul24(region_pixel_base, alpha_set_size);
+}
+
+// GetPitchedWindowDistance
+// Gaussian-weighted distance between the target window and the
+// 7x7 window centred upon the sample
+float GetPitchedWindowDistance(
+    const       float   *target_window, // 7x7 window centred upon the target pixel
+    global const uchar  *sample_plane,  // plane containing the sample
+    const       int     pitch,          // length in bytes of a row of the plane
+    const       int2    image_max,      // width,height of image (1-based)
+    const       int2    sample,         // centre coordinates of sample window
+    constant    float   *g_gaussian) {  // 49 weights of gaussian kernel
+
+    float distance = 0.f;
+    int position = 0;
+
+    for (int y = -3; y < 4; ++y) {
+        for (int x = -3; x < 4; ++x) {
+            float diff = target_window[position] - ReadPitchedPixel(sample_plane, pitch, image_max, sample + (int2)(x, y));
+            distance += g_gaussian[position++] * (diff * diff);
+        }
+    }
+    return distance;
+}
+
+// GetPitchedWindowDistanceInterior
+// As GetPitchedWindowDistance, for a sample whose window lies wholly
+// within the plane, so rows are read without clamping
+float GetPitchedWindowDistanceInterior(
+    const       float   *target_window, // 7x7 window centred upon the target pixel
+    global const uchar  *sample_plane,  // plane containing the sample
+    const       int     pitch,          // length in bytes of a row of the plane
+    const       int2    sample,         // centre coordinates of sample window
+    constant    float   *g_gaussian) {  // 49 weights of gaussian kernel
+
+    global const uchar *row = sample_plane + mad24(sample.y - 3, pitch, sample.x - 3);
+    float distance = 0.f;
+    int position = 0;
+
+    for (int y = 0; y < 7; ++y, row += pitch) {
+        for (int x = 0; x < 7; ++x) {
+            float diff = target_window[position] - (float)row[x] * 0.0039215686f;
+            distance += g_gaussian[position++] * (diff * diff);
+        }
+    }
+    return distance;
+}
+
+// WeightPitchedInterior
+// As WeightPitched, for a target pixel where IsInteriorPixel is true, so
+// neither the set nor the windows of its samples need clamping
+void WeightPitchedInterior(
+    global const uchar  *target_plane,  // plane being filtered
+    global const uchar  *sample_plane,  // plane containing the samples
+    const       int     pitch,          // length in bytes of a row of either plane
+    const       int2    target,         // coordinates of the pixel being filtered
+    const       int     radius,         // spatial sampling radius
+    const       float   h,              // strength of denoising
+    const       int     skip_target,    // when set do not sample at the target pixel
+    constant    float   *g_gaussian,    // 49 weights of gaussian kernel
+                int     alpha_index,    // address in region_alpha of the first weight/pixel pair
+    global      uint    *region_alpha) {// region's alpha weight/pixel pairs packed as uints
+
+    float target_window[49];
+    global const uchar *row = target_plane + mad24(target.y - 3, pitch, target.x - 3);
+    int position = 0;
+    for (int y = 0; y < 7; ++y, row += pitch)
+        for (int x = 0; x < 7; ++x)
+            target_window[position++] = (float)row[x] * 0.0039215686f;
+
+    const int set_side = GetSetSide(radius);
+    const int2 set_min = target - (int2)(radius, radius);
+    const int2 set_max = target + (int2)(radius, radius);
+    int samples_remaining = mul24(set_side, set_side) - 1;
+
+    for (int y = set_min.y; y <= set_max.y; ++y) {
+        for (int x = set_min.x; x <= set_max.x; ++x) {
+            const int2 sample = (int2)(x, y);
+            const int is_target = skip_target && (x == target.x) && (y == target.y);
+            if (is_target || samples_remaining == 0) continue;
+
+            float euclidean_distance = GetPitchedWindowDistanceInterior(target_window, sample_plane, pitch, sample, g_gaussian);
+            uint sample_weight = (uint)(floor(16777215.f * exp(-euclidean_distance * h))) << 8;
+            uint sample_pixel = sample_plane[mad24(y, pitch, x)];
+
+            region_alpha[alpha_index++] = sample_weight | sample_pixel;
+            --samples_remaining;
+        }
+    }
+}
+
+// WeightPitched
+// Computes the weight/pixel pair for every sample in the set of a single
+// target pixel, writing them to the pixel's alpha set.
+//
+// The set has one fewer sample than its area, either because the target
+// pixel is skipped or, when the sample plane is not the target plane,
+// because the final sample is dropped.
+void WeightPitched(
+    global const uchar  *target_plane,  // plane being filtered
+    global const uchar  *sample_plane,  // plane containing the samples
+    const       int     pitch,          // length in bytes of a row of either plane
+    const       int     width,          // width in pixels
+    const       int     height,         // height in pixels
+    const       int2    target,         // coordinates of the pixel being filtered
+    const       float   h,              // strength of denoising
+    const       int     sample_expand,  // factor to expand sample radius
+    const       int     skip_target,    // when set do not sample at the target pixel
+    constant    float   *g_gaussian,    // 49 weights of gaussian kernel
+    const       int     alpha_base,     // address of the pixel's alpha set in region_alpha
+    const       int     alpha_so_far,   // count of alpha samples generated so far for each eighth (multi-frame support)
+    global      uint    *region_alpha) {// region's alpha weight/pixel pairs packed as uints
+
+    const int2 image_max = (int2)(width, height);
+    if (target.x >= width || target.y >= height) return;
+
+    // alpha_so_far counts samples per eighth, as the image kernels spread each pixel's
+    // alpha set across 8 cooperating work items
+    int alpha_index = alpha_base + (alpha_so_far << 3);
+
+    const int radius = GetRadius(sample_expand);
+    if (IsInteriorPixel(target, image_max, radius)) {
+        WeightPitchedInterior(target_plane, sample_plane, pitch, target, radius, h, skip_target, g_gaussian, alpha_index, region_alpha);
+        return;
+    }
+
+    float target_window[49];
+    int position = 0;
+    for (int y = -3; y < 4; ++y)
+        for (int x = -3; x < 4; ++x)
+            target_window[position++] = ReadPitchedPixel(target_plane, pitch, image_max, target + (int2)(x, y));
+
+    const int set_side = GetSetSide(radius);
+    const int2 set_max = GetSetMax(target, image_max, radius);
+    const int2 set_min = set_max - (int2)(set_side - 1, set_side - 1);
+
+    int samples_remaining = mul24(set_side, set_side) - 1;
+
+    for (int y = set_min.y; y <= set_max.y; ++y) {
+        for (int x = set_min.x; x <= set_max.x; ++x) {
+            const int2 sample = (int2)(x, y);
+            const int is_target = skip_target && (x == target.x) && (y == target.y);
+            if (is_target || samples_remaining == 0) continue;
+
+            float euclidean_distance = GetPitchedWindowDistance(target_window, sample_plane, pitch, image_max, sample, g_gaussian);
+            uint sample_weight = (uint)(floor(16777215.f * exp(-euclidean_distance * h))) << 8;
+            uint sample_pixel = sample_plane[mad24(y, pitch, x)];
+
+            region_alpha[alpha_index++] = sample_weight | sample_pixel;
+            --samples_remaining;
+        }
+    }
+}
+
+__kernel void NLMSingleFramePitched(
+    global const uchar  *input_plane,   // input plane
+    const       int     width,          // width in pixels
+    const       int     height,         // height in pixels
+    const       int2    top_left,       // coordinates of the top left corner of the region to be filtered
+    const       float   h,              // strength of denoising
+    const       int     sample_expand,  // factor to expand sample radius
+    constant    float   *g_gaussian,    // 49 weights of gaussian kernel
+    const       int     linear,         // process plane in linear space instead of gamma space
+    const       int     alpha_set_size, // number of weight/pixel pairs per target pixel
+    global      uint    *region_alpha,  // region's alpha weight/pixel pairs packed as uints
+    const       int     pitch) {        // length in bytes of a row of the plane
+
+    const int skip_target = 1;
+    WeightPitched(input_plane,
+                  input_plane,
+                  pitch,
+                  width,
+                  height,
+                  GetPitchedTargetCoordinates(top_left),
+                  h,
+                  sample_expand,
+                  skip_target,
+                  g_gaussian,
+                  GetPitchedRegionBaseAddress(width, alpha_set_size),
+                  0,
+                  region_alpha);
+}
+
+__kernel void NLMMultiFramePitched(
+    global const uchar  *target_plane,          // plane being filtered
+    global const uchar  *sample_plane,          // any other plane
+    const       int     sample_equals_target,   // 1 when sample plane is target plane, 0 otherwise
+    const       int     width,                  // width in pixels
+    const       int     height,                 // height in pixels
+    const       int2    top_left,               // coordinates of the top left corner of the region to be filtered
+    const       float   h,                      // strength of denoising
+    const       int     sample_expand,          // factor to expand sample radius
+    constant    float   *g_gaussian,            // 49 weights of gaussian kernel
+    const       int     linear,                 // process plane in linear space instead of gamma space
+    const       int     alpha_set_size,         // number of weight/pixel pairs per target pixel
+    const       int     alpha_so_far,           // count of alpha samples generated so far for each eighth
+    global      uint    *region_alpha,          // region's alpha weight/pixel pairs packed as uints
+    const       int     pitch) {                // length in bytes of a row of either plane
+
+    WeightPitched(target_plane,
+                  sample_plane,
+                  pitch,
+                  width,
+                  height,
+                  GetPitchedTargetCoordinates(top_left),
+                  h,
+                  sample_expand,
+                  sample_equals_target,
+                  g_gaussian,
+                  GetPitchedRegionBaseAddress(width, alpha_set_size),
+                  alpha_so_far,
+                  region_alpha);
+}
+
+// FinalisePitchedPixel
+// Produces the filtered pixel from the best 8 * ALPHASIZE weights of 
+// its alpha set, which the work item keeps in descending order
+void FinalisePitchedPixel(
+    global const uchar  *input_plane,       // input plane
+    const       int2    target,             // coordinates of the pixel being filtered
+    const       int     alpha_base,         // address of the pixel's alpha set in region_alpha
+    const       int     alpha_set_size,     // number of weight/pixel pairs per target pixel
+    global      uint    *region_alpha,      // region's alpha weight/pixel pairs packed as uints
+    global      uchar   *destination_plane, // filtered result
+    const       int     plane_width,        // width of plane in pixels
+    const       int     plane_height,       // height of plane in pixels
+    const       int     pitch) {            // length in bytes of a row of either plane
+
+    if (target.x >= plane_width || target.y >= plane_height) return;
+
+    const int best_count = ALPHASIZE << 3;
+    uint alpha[ALPHASIZE << 3];
+    for (int i = 0; i < best_count; ++i)
+        alpha[i] = 0;
+
+    // Sort
+    for (int i = 0; i < alpha_set_size; ++i) {
+        uint candidate = region_alpha[alpha_base + i];
+        if (candidate <= alpha[best_count - 1]) continue;
+
+        for (int j = 0; j < best_count; ++j) {
+            uint next_candidate = min(candidate, alpha[j]);
+            alpha[j] = max(alpha[j], candidate);
+            candidate = next_candidate;
+        }
+    }
+
+    // Reduce
+    float average = 0.f;
+    float weight = 0.f;
+    for (int i = 0; i < best_count; ++i) {
+        float sample_weight = (float)(alpha[i] >> 8) * 0.000000059604648f;
+        float sample_pixel = (float)(alpha[i] & 255) * 0.0039215686f;
+        average += sample_weight * sample_pixel;
+        weight += sample_weight;
+    }
+
+    // Filter, giving the target pixel the weight that FilterPixel ends up applying in Finalise
+    const float target_weight = 0.004f;
+    const float target_pixel = ReadPitchedPixel(input_plane, pitch, (int2)(plane_width, plane_height), target);
+    average += target_weight * target_pixel;
+    weight += target_weight;
+
+    // Write
+    destination_plane[mad24(target.y, pitch, target.x)] = convert_uchar_sat_rte(255.f * average / weight);
+}
+
+__kernel void FinalisePitched(
+    global const uchar  *input_plane,       // input plane
+    const       int     width,              // region width in pixels
+    const       int2    top_left,           // coordinates of the top left corner of the region to be filtered
+    const       int     linear,             // process plane in linear space instead of gamma space
+    const       int     alpha_size,         // TODO delete
+    const       int     alpha_set_size,     // number of weight/pixel pairs per target pixel
+    global      uint    *region_alpha,      // region's alpha weight/pixel pairs packed as uints
+    global      uchar   *destination_plane, // filtered result
+    const       int     plane_width,        // width of plane in pixels
+    const       int     plane_height,       // height of plane in pixels
+    const       int     pitch) {            // length in bytes of a row of either plane
+
+    // Each work item keeps the best 8 * ALPHASIZE weights of its own pixel's
+    // alpha set, in descending order, and produces the filtered pixel from them.
+
+    FinalisePitchedPixel(input_plane,
+                         GetPitchedTargetCoordinates(top_left),
+                         GetPitchedRegionBaseAddress(width, alpha_set_size),
+                         alpha_set_size,
+                         region_alpha,
+                         destination_plane,
+                         plane_width,
+                         plane_height,
+                         pitch);
+}
@@ -0,0 +1,304 @@
+/* Deathray2 - An Avisynth plug-in filter for spatial/temporal non-local means de-noising.
+ *
+ * version 1.00
+ *
+ * Copyright 2015, Jawed Ashraf - Deathray@cupidity.f9.co.uk
+ */
+
+#include <iomanip>
+
+#include "Profiler.h"
+
+// Buckets below 8 ns count each duration exactly, then 8 per doubling up to 2^64 ns
+static const int k_exact_buckets    = 8;
+static const int k_bucket_count     = 496;
+
+LatencyHistogram::LatencyHistogram() : buckets_(k_bucket_count, 0), count_(0), total_(0) {}
+
+int LatencyHistogram::Bucket(
+    const cl_ulong &nanoseconds) {
+
+    if (nanoseconds < k_exact_buckets) return static_cast<int>(nanoseconds);
+
+    int exponent = 3;
+    while ((nanoseconds >> (exponent + 1)) != 0) ++exponent;
+
+    // The 3 bits below the leading bit choose the bucket within the doubling
+    return ((exponent - 2) << 3) + static_cast<int>((nanoseconds >> (exponent - 3)) & 7);
+}
+
+cl_ulong LatencyHistogram::BucketDuration(
+    const int &bucket) {
+
+    if (bucket < k_exact_buckets) return bucket;
+
+    const int exponent = (bucket >> 3) + 2;
+    const cl_ulong lowest = static_cast<cl_ulong>(8 + (bucket & 7)) << (exponent - 3);
+    const cl_ulong width = static_cast<cl_ulong>(1) << (exponent - 3);
+    return lowest + (width >> 1);
+}
+
+void LatencyHistogram::Add(
+    const cl_ulong &nanoseconds) {
+
+    ++buckets_[Bucket(nanoseconds)];
+    ++count_;
+    total_ += nanoseconds;
+}
+
+cl_ulong LatencyHistogram::Percentile(
+    const double &fraction) const {
+
+    if (count_ == 0) return 0;
+
+    cl_ulong rank = static_cast<cl_ulong>(fraction * count_ + 0.5);
+    if (rank < 1) rank = 1;
+    if (rank > count_) rank = count_;
+
+    cl_ulong counted = 0;
+    for (int i = 0; i < k_bucket_count; ++i) {
+        counted += buckets_[i];
+        if (counted >= rank) return BucketDuration(i);
+    }
+    return BucketDuration(k_bucket_count - 1);
+}
+
+Profiler *g_profiler = NULL;
+
+Profiler::Profiler(
+    const   string  &report_path,
+    const   string  &trace_path) : report_path_(report_path),
+                                   trace_started_(false),
+                                   trace_origin_(0),
+                                   frames_(0),
+                                   tick_(0.) {
+
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    if (frequency.QuadPart > 0) tick_ = 1000000000. / frequency.QuadPart;
+
+    if (trace_path.empty()) return;
+
+    trace_.open(trace_path.c_str(), ios::out | ios::trunc);
+    if (trace_.is_open()) trace_ << "{\"traceEvents\":[\n";
+}
+
+Profiler::~Profiler() {
+    // Commands of a frame that failed part way through
+    Collect();
+
+    if (!report_path_.empty()) Report();
+
+    if (trace_.is_open()) {
+        trace_ << "\n]}\n";
+        trace_.close();
+    }
+}
+
+void Profiler::Attribute(
+    const   string  &plane) {
+
+    plane_ = plane;
+}
+
+void Profiler::Record(
+    const   string      &stage,
+    const   size_t      &bytes,
+    const   cl_event    *event,
+            cl_event    profiled) {
+
+    cl_event recorded = profiled;
+    if (recorded == NULL && event != NULL && *event != NULL) {
+        // The client's event is released by the client
+        recorded = *event;
+        clRetainEvent(recorded);
+    }
+    if (recorded == NULL) return;
+
+    if (plane_.empty()) {
+        clReleaseEvent(recorded);
+        return;
+    }
+
+    // Counted once the command is attributed, so autotuning is excluded
+    if (stage == "upload") {
+        Count("bytes uploaded", bytes);
+    } else if (stage == "readback") {
+        Count("bytes read back", bytes);
+    } else {
+        Count("kernel launches", 1);
+    }
+
+    Command command;
+    command.event   = recorded;
+    command.plane   = plane_;
+    command.stage   = stage;
+    command.bytes   = bytes;
+    commands_.push_back(command);
+}
+
+void Profiler::Collect() {
+    if (commands_.empty()) return;
+
+    for (size_t i = 0; i < commands_.size(); ++i) {
+        const Command &command = commands_[i];
+
+        // The frame's final copies have been waited upon, so this is a formality
+        cl_ulong queued = 0;
+        cl_ulong start = 0;
+        cl_ulong end = 0;
+        cl_int cl_status = clWaitForEvents(1, &command.event);
+        if (cl_status == CL_SUCCESS)
+            cl_status = clGetEventProfilingInfo(command.event, CL_PROFILING_COMMAND_QUEUED, sizeof(cl_ulong), &queued, NULL);
+        if (cl_status == CL_SUCCESS)
+            cl_status = clGetEventProfilingInfo(command.event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL);
+        if (cl_status == CL_SUCCESS)
+            cl_status = clGetEventProfilingInfo(command.event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL);
+
+        // Queues created before the profiler do not time their commands
+        if (cl_status == CL_SUCCESS && end >= start && start >= queued) {
+            StageStatistics &statistics = statistics_[make_pair(command.plane, command.stage)];
+            statistics.durations.Add(end - start);
+            statistics.waits.Add(start - queued);
+            statistics.bytes += command.bytes;
+
+            if (trace_.is_open()) Trace(command, start, end);
+        }
+
+        clReleaseEvent(command.event);
+    }
+
+    commands_.clear();
+    ++frames_;
+}
+
+void Profiler::Time(
+    const   string          &stage,
+    const   LARGE_INTEGER   &started) {
+
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+
+    const LONGLONG ticks = now.QuadPart - started.QuadPart;
+    host_stages_[stage].Add(ticks > 0 ? static_cast<cl_ulong>(ticks * tick_) : 0);
+}
+
+void Profiler::Count(
+    const   string      &counter,
+    const   cl_ulong    &amount) {
+
+    counters_[counter] += amount;
+}
+
+void Profiler::StageDurations(
+    const   string                          &plane,
+            map<string, LatencyHistogram>   *durations) const {
+
+    for (map<pair<string, string>, StageStatistics>::const_iterator i = statistics_.begin(); i != statistics_.end(); ++i) {
+        if (i->first.first == plane) (*durations)[i->first.second] = i->second.durations;
+    }
+}
+
+void Profiler::Trace(
+    const   Command     &command,
+    const   cl_ulong    &start,
+    const   cl_ulong    &end) {
+
+    // Each queue is a thread of the timeline
+    cl_command_queue queue = NULL;
+    clGetEventInfo(command.event, CL_EVENT_COMMAND_QUEUE, sizeof(queue), &queue, NULL);
+    if (queues_.find(queue) == queues_.end()) {
+        const int thread = static_cast<int>(queues_.size()) + 1;
+        queues_[queue] = thread;
+    }
+
+    if (!trace_started_) trace_origin_ = start;
+
+    // Timestamps are microseconds
+    const double timestamp = start >= trace_origin_ ? (start - trace_origin_) / 1000. : 0.;
+    const double duration = (end - start) / 1000.;
+
+    if (trace_started_) trace_ << ",\n";
+    trace_started_ = true;
+
+    trace_ << fixed << setprecision(3)
+           << "{\"name\":\"" << command.stage
+           << "\",\"cat\":\"" << command.plane
+           << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << queues_[queue]
+           << ",\"ts\":" << timestamp
+           << ",\"dur\":" << duration
+           << ",\"args\":{\"plane\":\"" << command.plane
+           << "\",\"bytes\":" << command.bytes
+           << ",\"frame\":" << frames_ << "}}";
+}
+
+void Profiler::Report() {
+    ofstream report(report_path_.c_str(), ios::out | ios::trunc);
+    if (!report.is_open()) return;
+
+    report << "Deathray2 profile of " << frames_ << " frames" << endl;
+    report << "Times in microseconds, from the device's profiling of each command. "
+           << "Queued is the wait from enqueueing until the command starts." << endl << endl;
+
+    report << left << setw(6) << "plane" << setw(34) << "stage" << right
+           << setw(10) << "count"
+           << setw(12) << "mean"
+           << setw(12) << "p50"
+           << setw(12) << "p99"
+           << setw(12) << "queued"
+           << setw(12) << "total ms"
+           << setw(12) << "MB"
+           << setw(10) << "GB/s" << endl;
+
+    for (map<pair<string, string>, StageStatistics>::const_iterator i = statistics_.begin(); i != statistics_.end(); ++i) {
+        const StageStatistics &statistics = i->second;
+        const double busy = static_cast<double>(statistics.durations.total());
+
+        report << left << setw(6) << i->first.first << setw(34) << i->first.second << right << fixed
+               << setw(10) << statistics.durations.count()
+               << setprecision(1)
+               << setw(12) << statistics.durations.mean() / 1000.
+               << setw(12) << statistics.durations.Percentile(0.5) / 1000.
+               << setw(12) << statistics.durations.Percentile(0.99) / 1000.
+               << setw(12) << statistics.waits.mean() / 1000.
+               << setw(12) << busy / 1000000.
+               << setw(12) << statistics.bytes / 1000000.;
+
+        // Bytes per nanosecond are GB/s
+        if (statistics.bytes > 0 && busy > 0.)
+            report << setprecision(2) << setw(10) << statistics.bytes / busy;
+        report << endl;
+    }
+
+    ReportHost(report);
+}
+
+void Profiler::ReportHost(
+    ofstream &report) {
+
+    report << endl << "Host stages of GetFrame, times in microseconds" << endl << endl;
+
+    report << left << setw(40) << "stage" << right
+           << setw(10) << "count"
+           << setw(12) << "mean"
+           << setw(12) << "p50"
+           << setw(12) << "p99"
+           << setw(12) << "total ms" << endl;
+
+    for (map<string, LatencyHistogram>::const_iterator i = host_stages_.begin(); i != host_stages_.end(); ++i) {
+        const LatencyHistogram &times = i->second;
+
+        report << left << setw(40) << i->first << right << fixed
+               << setw(10) << times.count()
+               << setprecision(1)
+               << setw(12) << times.mean() / 1000.
+               << setw(12) << times.Percentile(0.5) / 1000.
+               << setw(12) << times.Percentile(0.99) / 1000.
+               << setw(12) << times.total() / 1000000. << endl;
+    }
+
+    report << endl << "Counters" << endl << endl;
+
+    for (map<string, cl_ulong>::const_iterator i = counters_.begin(); i != counters_.end(); ++i)
+        report << left << setw(40) << i->first << right << setw(20) << i->second << endl;
+}
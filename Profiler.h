@@ -0,0 +1,226 @@
+/* Deathray2 - An Avisynth plug-in filter for spatial/temporal non-local means de-noising.
+ *
+ * version 1.00
+ *
+ * Copyright 2015, Jawed Ashraf - Deathray@cupidity.f9.co.uk
+ */
+
+#ifndef _PROFILER_H_
+#define _PROFILER_H_
+
+#include <Windows.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <CL/cl.h>
+
+using namespace std;
+
+// LatencyHistogram
+// Counts durations in buckets spaced logarithmically, 8 to each doubling,
+// so that percentiles are resolved to within about 9% of any duration
+// without keeping every one
+class LatencyHistogram {
+public:
+    LatencyHistogram();
+
+    // Add
+    // Counts a duration
+    void Add(
+        const cl_ulong &nanoseconds);           // duration to be counted
+
+    // Percentile
+    // Returns the duration below which the fraction of durations fall
+    cl_ulong Percentile(
+        const double &fraction) const;          // 0.5 for the median etc.
+
+    // count
+    // Count of durations added
+    cl_ulong count() const {return count_;}
+
+    // total
+    // Sum of the durations added
+    cl_ulong total() const {return total_;}
+
+    // mean
+    // Mean of the durations added, 0 when there are none
+    double mean() const {return count_ > 0 ? static_cast<double>(total_) / count_ : 0.;}
+
+private:
+
+    // Bucket
+    // Returns the bucket counting the duration
+    static int Bucket(
+        const cl_ulong &nanoseconds);           // duration
+
+    // BucketDuration
+    // Returns the middle of the durations counted by the bucket
+    static cl_ulong BucketDuration(
+        const int &bucket);                     // bucket
+
+    vector<cl_ulong> buckets_;  // count of durations in each bucket
+    cl_ulong count_;            // count of durations added
+    cl_ulong total_;            // sum of the durations added
+};
+
+// Profiler
+// Times the commands that the filters enqueue: uploads, kernel launches
+// and readbacks. Each command's event is kept until the frame has been
+// filtered, then its queued, start and end times are counted against its
+// plane and stage. A report of each plane's stages is written when the
+// profiler is destroyed, at the end of the clip, and optionally a
+// timeline of every command in the Chrome trace format, which is viewed
+// with chrome://tracing.
+//
+// Queues only time their commands if they are created once the profiler
+// exists. Commands enqueued while no plane is attributed, e.g. by
+// autotuning, are not counted.
+//
+// The host's side of each frame is timed too: stages of GetFrame, such
+// as fetching frames from the upstream filter or waiting for the device,
+// are counted in histograms by HostTimer, alongside counters such as
+// frames served and bytes uploaded. Both are added to the report.
+class Profiler {
+public:
+
+    // Constructor
+    // Opens the timeline, if one is requested
+    Profiler(
+        const   string  &report_path,           // file for the report, empty for none
+        const   string  &trace_path);           // file for the timeline, empty for none
+
+    // Destructor
+    // Writes the report, if one is requested, and completes the timeline
+    ~Profiler();
+
+    // Attribute
+    // Commands enqueued from now on are attributed to the plane
+    void Attribute(
+        const   string  &plane);                // Y, U, V, UV etc., empty to stop counting
+
+    // Record
+    // Keeps the event of a command just enqueued, for Collect. profiled
+    // is the event that the profiler asked for, by ProfiledEvent, when
+    // the client wanted none, otherwise event is the client's own.
+    void Record(
+        const   string      &stage,             // upload, readback or the kernel's name
+        const   size_t      &bytes,             // bytes moved by a copy, 0 for kernels
+        const   cl_event    *event,             // client's event, NULL for none
+                cl_event    profiled);          // profiler's own event, NULL if the client had an event
+
+    // Collect
+    // Counts the times of the commands recorded for the frame, once they
+    // have completed, and releases their events
+    void Collect();
+
+    // Time
+    // Counts the time taken by a host stage, from started until now
+    void Time(
+        const   string          &stage,         // host stage timed
+        const   LARGE_INTEGER   &started);      // performance counter when the stage started
+
+    // Count
+    // Adds to a counter
+    void Count(
+        const   string      &counter,           // name of the counter
+        const   cl_ulong    &amount);           // amount to add
+
+    // StageDurations
+    // Copies the durations of the commands collected for each stage of
+    // the plane, by stage
+    void StageDurations(
+        const   string                          &plane,         // plane attributed
+                map<string, LatencyHistogram>   *durations) const;  // durations by stage
+
+private:
+
+    // StageStatistics
+    // Times of the commands of one stage of one plane
+    struct StageStatistics {
+        LatencyHistogram    durations;          // from start to end of each command
+        LatencyHistogram    waits;              // from queueing to start of each command
+        cl_ulong            bytes;              // bytes moved by copies
+        StageStatistics() : bytes(0) {}
+    };
+
+    // Command
+    // Command awaiting collection
+    struct Command {
+        cl_event    event;                      // event of the command, retained
+        string      plane;                      // plane attributed
+        string      stage;                      // stage of the command
+        size_t      bytes;                      // bytes moved
+    };
+
+    // Trace
+    // Adds the command to the timeline
+    void Trace(
+        const   Command     &command,           // command to be traced
+        const   cl_ulong    &start,             // device time of the command's start, ns
+        const   cl_ulong    &end);              // device time of the command's end, ns
+
+    // Report
+    // Writes per-plane, per-stage statistics to the report file,
+    // followed by the host's stages and the counters
+    void Report();
+
+    // ReportHost
+    // Writes the host's stages and the counters
+    void ReportHost(
+        ofstream &report);                      // report being written
+
+    string report_path_         ;   // file for the report
+    ofstream trace_             ;   // timeline, closed when not requested
+    bool trace_started_         ;   // timeline has at least one command, so the next is preceded by a comma
+    cl_ulong trace_origin_      ;   // device time of the first command traced, ns
+    string plane_               ;   // plane attributed to commands enqueued now
+    vector<Command> commands_   ;   // commands of the frame awaiting collection
+    map<pair<string, string>, StageStatistics> statistics_; // times by plane and stage
+    map<cl_command_queue, int> queues_;     // thread of the timeline used by each queue
+    int frames_                 ;   // count of frames collected
+    double tick_                ;   // length of a tick of the performance counter, ns
+    map<string, LatencyHistogram> host_stages_; // times of the host's stages of GetFrame
+    map<string, cl_ulong> counters_;        // counters of frames, copies and launches
+};
+
+extern Profiler *g_profiler;
+
+// ProfiledEvent
+// Returns the event to pass when enqueuing a command: the client's own,
+// or when the client wants none and the profiler is running, profiled,
+// which is then given to Profiler::Record
+inline cl_event *ProfiledEvent(
+            cl_event    *event,                 // client's event, NULL for none
+            cl_event    *profiled) {            // profiler's event
+
+    return (event == NULL && g_profiler != NULL) ? profiled : event;
+}
+
+// HostTimer
+// Times a host stage while the profiler is running, from construction
+// until Stop, or destruction should the stage throw
+class HostTimer {
+public:
+    HostTimer(
+        const   char    *stage) : stage_(stage), running_(g_profiler != NULL) {
+        if (running_) QueryPerformanceCounter(&started_);
+    }
+
+    ~HostTimer() {Stop();}
+
+    // Stop
+    // Counts the time since construction, once
+    void Stop() {
+        if (!running_) return;
+        running_ = false;
+        if (g_profiler != NULL) g_profiler->Time(stage_, started_);
+    }
+
+private:
+    const char *stage_      ;   // host stage timed
+    bool running_           ;   // timing has started and not yet been counted
+    LARGE_INTEGER started_  ;   // performance counter when the stage started
+};
+
+#endif // _PROFILER_H_
@@ -16,8 +16,17 @@ extern  Device  *g_devices;
 
 extern  int     g_gaussian;
 
+#define FILTER_ARG_INPUT_PLANE 0
 #define FILTER_ARG_TOP_LEFT 3
+#define SORT_ARG_INPUT_PLANE 0
 #define SORT_ARG_TOP_LEFT 2
+#define PERSISTENT_ARG_INPUT_PLANE 0
+#define PERSISTENT_ARG_FIRST_ROW 3
+#define PERSISTENT_ARG_END_ROW 4
+#define CONVERT_ARG_GAMMA_PLANE 0
+
+// Pixels in each tile of the persistent image kernel
+static const int k_image_tile_size = 16;
 
 SingleFrame::SingleFrame() {
     device_id_      = 0;
@@ -30,12 +39,48 @@ SingleFrame::SingleFrame() {
     alpha_          = 0;
     region_width_   = 0;
     region_height_  = 0;
+    pitched_        = false;
+    zero_copy_      = false;
+    plane_pitch_    = 0;
+    first_row_      = 0;
+    end_row_        = 0;
+    regions_per_band_ = 0;
+    persistent_group_count_ = 0;
+    tile_queue_     = 0;
+    linear_plane_   = 0;
+    sweep_count_    = 0;
+    sweep_stride_   = 0;
+    sweep_plane_    = 0;
+    sweep_settings_ = 0;
+
+    const KernelGeometry default_geometry = {32, 16, 4, 0, DEFAULT_TILE_ROWS};
+    geometry_       = default_geometry;
+}
+
+SingleFrame::~SingleFrame() {
+    if (g_devices == NULL) return;
+
+    for (size_t i = 0; i < filter_launches_.size(); ++i) filter_launches_[i].Release();
+    for (size_t i = 0; i < sort_launches_.size(); ++i) sort_launches_[i].Release();
+    filter_.Release();
+    sort_.Release();
+    initialise_.Release();
+    persistent_.Release();
+    convert_.Release();
+
+    if (device_id_ < g_device_count) {
+        g_devices[device_id_].buffers_.Destroy(tile_queue_);
+        g_devices[device_id_].buffers_.Destroy(linear_plane_);
+        g_devices[device_id_].buffers_.Destroy(sweep_plane_);
+        g_devices[device_id_].buffers_.Destroy(sweep_settings_);
+    }
 }
 
 result SingleFrame::Init(
     const   int     &device_id,
     const   int     &width, 
     const   int     &height,
+    const   int     &pixel_size,
     const   int     &src_pitch,
     const   int     &dst_pitch,
     const   float   &h,
@@ -53,10 +98,20 @@ result SingleFrame::Init(
     height_         = height;
     src_pitch_      = src_pitch;
     dst_pitch_      = dst_pitch;
+    g_devices[device_id_].geometry(width, height, 0, &geometry_);
     region_width_   = width;
-    region_height_  = 32;
+    region_height_  = geometry_.region_height;
     h_              = 1.f/h;
     cq_             = g_devices[device_id_].cq();
+    readback_cq_    = g_devices[device_id_].cq();
+    pitched_        = g_devices[device_id_].pitched_planes();
+    zero_copy_      = g_devices[device_id_].zero_copy();
+    plane_pitch_    = zero_copy_ ? src_pitch_ : GetPitchedPlanePitch(width_);
+    linear_         = pitched_ ? 0 : linear;
+    pixel_size_     = pixel_size;
+    first_row_      = 0;
+    end_row_        = height;
+    persistent_group_count_ = geometry_.persistent_groups * g_devices[device_id_].compute_units();
 
     if (width_ == 0 || height_ == 0 || src_pitch_ == 0 || dst_pitch_ == 0 || h == 0 ) 
         return FILTER_INVALID_PARAMETER;
@@ -66,7 +121,7 @@ result SingleFrame::Init(
     status = InitBuffers(sample_expand);
     if (status != FILTER_OK) return status;
 
-    status = InitKernels(sample_expand, linear, correction, balanced);
+    status = InitKernels(sample_expand, linear_, correction, balanced);
 
     return status;
 }
@@ -74,12 +129,37 @@ result SingleFrame::Init(
 result SingleFrame::InitBuffers(const int &sample_expand) {
     result status = FILTER_OK;
 
-    status = g_devices[device_id_].buffers_.AllocPlane(cq_, width_, height_, &source_plane_);
-    if (status != FILTER_OK) return status;
+    // Source planes that wrap host frames are created by CopyTo
+    if (!zero_copy_) {
+        status = AllocPlane(&source_plane_);
+        if (status != FILTER_OK) return status;
+    }
 
-    status = g_devices[device_id_].buffers_.AllocPlane(cq_, width_, height_, &dest_plane_);
+    status = AllocPlane(&dest_plane_);
     if (status != FILTER_OK) return status;
 
+    if (linear_) {
+        status = g_devices[device_id_].buffers_.AllocLinearPlane(cq_, width_, height_, pixel_size_ > 1, &linear_plane_);
+        if (status != FILTER_OK) return status;
+    }
+
+    if (persistent_group_count_ > 0) {
+        // Each work group of the persistent kernel holds the alpha sets of its own tile
+        const int tile_size = pitched_ ? static_cast<int>(geometry_.local_width * geometry_.local_height) 
+                                       : k_image_tile_size;
+        const int alpha_buffer_size = persistent_group_count_ * tile_size * alpha_set_size_ * sizeof(cl_uint);
+        status = g_devices[device_id_].buffers_.AllocBuffer(cq_, alpha_buffer_size, &alpha_);
+        if (status != FILTER_OK) return status;
+
+        status = AllocAlphaPixels(alpha_buffer_size);
+        if (status != FILTER_OK) return status;
+
+        // The queue starts empty, and the kernel empties it after each launch
+        status = g_devices[device_id_].buffers_.AllocBuffer(cq_, 2 * sizeof(cl_int), &tile_queue_);
+        if (status != FILTER_OK) return status;
+        return EmptyTileQueue();
+    }
+
     const int alpha_buffer_size = GetAlphaBufferSize(0,
                                                     region_width_, 
                                                     region_height_,
@@ -87,8 +167,9 @@ result SingleFrame::InitBuffers(const int &sample_expand) {
                                 * sizeof(cl_uint);
 
     status = g_devices[device_id_].buffers_.AllocBuffer(cq_, alpha_buffer_size, &alpha_);
+    if (status != FILTER_OK) return status;
 
-    return status;
+    return AllocAlphaPixels(alpha_buffer_size);
 }
 
 result SingleFrame::InitKernels(
@@ -99,6 +180,15 @@ result SingleFrame::InitKernels(
 
     result status = FILTER_OK;
 
+    if (linear_) {
+        // Until CopyTo wraps the first frame the destination plane stands in for the source
+        status = InitLinearKernel(device_id_, zero_copy_ ? dest_plane_ : source_plane_, linear_plane_, width_, height_, &convert_);
+        if (status != FILTER_OK) return status;
+    }
+
+    if (persistent_group_count_ > 0) 
+        return InitPersistentKernel(sample_expand, linear);
+
     status = InitFilterKernel(sample_expand, linear, correction, balanced);
     if (status != FILTER_OK) return status;
 
@@ -106,6 +196,9 @@ result SingleFrame::InitKernels(
     if (status != FILTER_OK) return status;
 
     status = InitInitialiseKernel();
+    if (status != FILTER_OK) return status;
+
+    status = RecordLaunches();
 
     return status;
 }
@@ -116,12 +209,17 @@ result SingleFrame::InitFilterKernel(
     const int &correction,
     const int &balanced) {
 
-    filter_ = ClKernel(device_id_, "NLMSingleFrame");
+    if (pitched_)
+        filter_ = ClKernel(device_id_, "NLMSingleFramePitched");
+    else
+        filter_ = ClKernel(device_id_, "NLMSingleFrame", geometry_.tile_rows);
     
     const int alpha_size = 16;
     const cl_int2 top_left = {0, 0};
+    // Until CopyTo wraps the first frame the destination plane stands in for the source
+    const int input_plane = InputPlane();
 
-    filter_.SetArg(sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(source_plane_));
+    filter_.SetArg(sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(input_plane));
     filter_.SetArg(sizeof(int), &width_);
     filter_.SetArg(sizeof(int), &height_);
     filter_.SetArg(sizeof(cl_int2), &top_left);
@@ -131,16 +229,27 @@ result SingleFrame::InitFilterKernel(
     filter_.SetArg(sizeof(int), &linear);
     filter_.SetArg(sizeof(int), &alpha_set_size_);
     filter_.SetArg(sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(alpha_));
+    if (pitched_) 
+        filter_.SetArg(sizeof(int), &plane_pitch_);
+    else
+        filter_.SetArg(sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(AlphaPixels()));
 
     if (filter_.arguments_valid()) {
         filter_.set_work_dim(2);
-        const size_t set_local_work_size[2]    = {8, 16};
-        // height is increased to offset the fact that 8 work items collaborate on one pixel
-        const size_t set_scalar_global_size[2] = {region_width_, region_height_ << 3};
+        if (pitched_) {
+            // one work item per pixel
+            const size_t set_local_work_size[2]    = {geometry_.local_width, geometry_.local_height};
+            const size_t set_scalar_global_size[2] = {region_width_, region_height_};
+            filter_.set_local_work_size(set_local_work_size);
+            filter_.set_scalar_global_size(set_scalar_global_size);
+        } else {
+            const size_t set_local_work_size[2]    = {8, static_cast<size_t>(geometry_.tile_rows) << 3};
+            // height is increased to offset the fact that 8 work items collaborate on one pixel
+            const size_t set_scalar_global_size[2] = {region_width_, region_height_ << 3};
+            filter_.set_local_work_size(set_local_work_size);
+            filter_.set_scalar_global_size(set_scalar_global_size);
+        }
         const size_t set_scalar_item_size[2]   = {1, 1};
-
-        filter_.set_local_work_size(set_local_work_size);
-        filter_.set_scalar_global_size(set_scalar_global_size);
         filter_.set_scalar_item_size(set_scalar_item_size);
 
         return FILTER_OK;
@@ -151,12 +260,13 @@ result SingleFrame::InitFilterKernel(
 
 result SingleFrame::InitSortKernel(const int &linear) {
 
-    sort_ = ClKernel(device_id_, "Finalise");
+    sort_ = ClKernel(device_id_, pitched_ ? "FinalisePitched" : "Finalise");
     
     const int alpha_size = 16;
     const cl_int2 top_left = {0, 0};
+    const int input_plane = InputPlane();
 
-    sort_.SetArg(sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(source_plane_));
+    sort_.SetArg(sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(input_plane));
     sort_.SetArg(sizeof(int), &region_width_);
     sort_.SetArg(sizeof(cl_int2), &top_left);
     sort_.SetArg(sizeof(int), &linear);
@@ -164,16 +274,30 @@ result SingleFrame::InitSortKernel(const int &linear) {
     sort_.SetArg(sizeof(int), &alpha_set_size_);
     sort_.SetArg(sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(alpha_));
     sort_.SetArg(sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(dest_plane_));
+    if (pitched_) {
+        sort_.SetArg(sizeof(int), &width_);
+        sort_.SetArg(sizeof(int), &height_);
+        sort_.SetArg(sizeof(int), &plane_pitch_);
+    } else {
+        sort_.SetArg(sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(AlphaPixels()));
+    }
 
     if (sort_.arguments_valid()) {
         sort_.set_work_dim(2);
-        const size_t set_local_work_size[2]        = {8, 16};
-        // height is increased to offset the fact that 8 work items collaborate on one pixel
-        const size_t set_scalar_global_size[2]    = {region_width_, region_height_ << 3};
+        if (pitched_) {
+            // one work item per pixel
+            const size_t set_local_work_size[2]     = {geometry_.local_width, geometry_.local_height};
+            const size_t set_scalar_global_size[2]  = {region_width_, region_height_};
+            sort_.set_local_work_size(set_local_work_size);
+            sort_.set_scalar_global_size(set_scalar_global_size);
+        } else {
+            const size_t set_local_work_size[2]     = {8, 16};
+            // height is increased to offset the fact that 8 work items collaborate on one pixel
+            const size_t set_scalar_global_size[2]  = {region_width_, region_height_ << 3};
+            sort_.set_local_work_size(set_local_work_size);
+            sort_.set_scalar_global_size(set_scalar_global_size);
+        }
         const size_t set_scalar_item_size[2]    = {1, 1};
-
-        sort_.set_local_work_size(set_local_work_size);
-        sort_.set_scalar_global_size(set_scalar_global_size);
         sort_.set_scalar_item_size(set_scalar_item_size);
 
         return FILTER_OK;
@@ -206,7 +330,168 @@ result SingleFrame::InitInitialiseKernel() {
     return FILTER_KERNEL_ARGUMENT_ERROR;
 }
 
+result SingleFrame::InitPersistentKernel(
+    const int &sample_expand,
+    const int &linear) {
+
+    persistent_ = ClKernel(device_id_, pitched_ ? "NLMSingleFramePersistentPitched" : "NLMSingleFramePersistent");
+
+    const int alpha_size = 16;
+    const int input_plane = InputPlane();
+
+    persistent_.SetArg(sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(input_plane));
+    persistent_.SetArg(sizeof(int), &width_);
+    persistent_.SetArg(sizeof(int), &height_);
+    persistent_.SetArg(sizeof(int), &first_row_);
+    persistent_.SetArg(sizeof(int), &end_row_);
+    persistent_.SetArg(sizeof(float), &h_);
+    persistent_.SetArg(sizeof(int), &sample_expand);
+    persistent_.SetArg(sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(g_gaussian));
+    if (!pitched_) {
+        persistent_.SetArg(sizeof(int), &linear);
+        persistent_.SetArg(sizeof(int), &alpha_size);
+    }
+    persistent_.SetArg(sizeof(int), &alpha_set_size_);
+    persistent_.SetArg(sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(alpha_));
+    persistent_.SetArg(sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(tile_queue_));
+    persistent_.SetArg(sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(dest_plane_));
+    if (pitched_) 
+        persistent_.SetArg(sizeof(int), &plane_pitch_);
+    else
+        persistent_.SetArg(sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(AlphaPixels()));
+
+    if (persistent_.arguments_valid()) {
+        // The work groups are launched as a single column
+        persistent_.set_work_dim(2);
+        if (pitched_) {
+            const size_t set_local_work_size[2]    = {geometry_.local_width, geometry_.local_height};
+            const size_t set_scalar_global_size[2] = {geometry_.local_width, geometry_.local_height * persistent_group_count_};
+            persistent_.set_local_work_size(set_local_work_size);
+            persistent_.set_scalar_global_size(set_scalar_global_size);
+        } else {
+            const size_t set_local_work_size[2]    = {8, 16};
+            const size_t set_scalar_global_size[2] = {8, 16 * persistent_group_count_};
+            persistent_.set_local_work_size(set_local_work_size);
+            persistent_.set_scalar_global_size(set_scalar_global_size);
+        }
+        const size_t set_scalar_item_size[2]   = {1, 1};
+        persistent_.set_scalar_item_size(set_scalar_item_size);
+
+        return FILTER_OK;
+    }
+
+    return FILTER_KERNEL_ARGUMENT_ERROR;
+}
+
+result SingleFrame::RecordLaunches() {
+    regions_per_band_ = (width_ + region_width_ - 1) / region_width_;
+    const int band_count = (height_ + region_height_ - 1) / region_height_;
+
+    filter_launches_.reserve(band_count * regions_per_band_);
+    sort_launches_.reserve(band_count * regions_per_band_);
+    for (int region_y = 0; region_y < band_count * region_height_; region_y += region_height_) {
+        for (int region_x = 0; region_x < regions_per_band_ * region_width_; region_x += region_width_) {
+            const cl_int2 top_left = {region_x, region_y};
+
+            ClKernel filter = filter_.Instance();
+            filter.SetNumberedArg(FILTER_ARG_TOP_LEFT, sizeof(cl_int2), &top_left);
+            filter_launches_.push_back(filter);
+
+            ClKernel sort = sort_.Instance();
+            sort.SetNumberedArg(SORT_ARG_TOP_LEFT, sizeof(cl_int2), &top_left);
+            sort_launches_.push_back(sort);
+
+            if (!filter.arguments_valid() || !sort.arguments_valid())
+                return FILTER_KERNEL_ARGUMENT_ERROR;
+        }
+    }
+
+    return FILTER_OK;
+}
+
+result SingleFrame::InitSweep(
+    const   vector<float>   &exponents,
+    const   vector<int>     &alpha_sizes) {
+
+    if (pitched_ || persistent_group_count_ > 0 || pixel_size_ > 1) return FILTER_SWEEP_UNSUPPORTED;
+    if (exponents.empty() || exponents.size() != alpha_sizes.size()) return FILTER_INVALID_PARAMETER;
+
+    sweep_count_    = static_cast<int>(exponents.size());
+    sweep_stride_   = region_height_ * ((height_ + region_height_ - 1) / region_height_);
+
+    // The plane is padded across to whole tiles of FinaliseSweep, whose
+    // writes to the padding beneath each result are within the stride
+    result status = g_devices[device_id_].buffers_.AllocPlane(cq_, width_, sweep_stride_ * sweep_count_, &sweep_plane_);
+    if (status != FILTER_OK) return status;
+
+    vector<float> settings;
+    for (int i = 0; i < sweep_count_; ++i) {
+        settings.push_back(exponents[i]);
+        settings.push_back(static_cast<float>(alpha_sizes[i]));
+    }
+
+    status = g_devices[device_id_].buffers_.AllocBuffer(cq_, settings.size() * sizeof(float), &sweep_settings_);
+    if (status != FILTER_OK) return status;
+
+    status = g_devices[device_id_].buffers_.CopyToBuffer(sweep_settings_, &settings[0], settings.size() * sizeof(float));
+    if (status != FILTER_OK) return status;
+
+    // The sweep's sort kernel writes every setting's pixels
+    for (size_t i = 0; i < sort_launches_.size(); ++i) sort_launches_[i].Release();
+    sort_.Release();
+
+    sort_ = ClKernel(device_id_, "FinaliseSweep");
+
+    const cl_int2 top_left = {0, 0};
+    const int input_plane = InputPlane();
+
+    sort_.SetArg(sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(input_plane));
+    sort_.SetArg(sizeof(int), &region_width_);
+    sort_.SetArg(sizeof(cl_int2), &top_left);
+    sort_.SetArg(sizeof(int), &linear_);
+    sort_.SetArg(sizeof(int), &alpha_set_size_);
+    sort_.SetArg(sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(alpha_));
+    sort_.SetArg(sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(sweep_plane_));
+    sort_.SetArg(sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(AlphaPixels()));
+    sort_.SetArg(sizeof(int), &sweep_count_);
+    sort_.SetArg(sizeof(int), &sweep_stride_);
+    sort_.SetArg(sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(sweep_settings_));
+
+    if (!sort_.arguments_valid()) return FILTER_KERNEL_ARGUMENT_ERROR;
+
+    const size_t set_local_work_size[2]     = {8, 16};
+    // height is increased to offset the fact that 8 work items collaborate on one pixel
+    const size_t set_scalar_global_size[2]  = {region_width_, region_height_ << 3};
+    const size_t set_scalar_item_size[2]    = {1, 1};
+    sort_.set_work_dim(2);
+    sort_.set_local_work_size(set_local_work_size);
+    sort_.set_scalar_global_size(set_scalar_global_size);
+    sort_.set_scalar_item_size(set_scalar_item_size);
+
+    // Launches are in the order recorded by RecordLaunches
+    for (size_t i = 0; i < sort_launches_.size(); ++i) {
+        const cl_int2 region_top_left = {static_cast<cl_int>((i % regions_per_band_) * region_width_), 
+                                         static_cast<cl_int>((i / regions_per_band_) * region_height_)};
+
+        sort_launches_[i] = sort_.Instance();
+        sort_launches_[i].SetNumberedArg(SORT_ARG_TOP_LEFT, sizeof(cl_int2), &region_top_left);
+        if (!sort_launches_[i].arguments_valid()) return FILTER_KERNEL_ARGUMENT_ERROR;
+    }
+
+    return FILTER_OK;
+}
+
 result SingleFrame::CopyTo(const unsigned char *source) {
+    if (zero_copy_) {
+        // Execute waited for the previous frame's kernels to complete
+        g_devices[device_id_].buffers_.Destroy(source_plane_);
+
+        result status = WrapPlane(source, &source_plane_);
+        if (status != FILTER_OK) return status;
+
+        return BindSourcePlane();
+    }
+
     return g_devices[device_id_].buffers_.CopyToPlane(source_plane_,
                                                       *source, 
                                                       width_, 
@@ -215,26 +500,157 @@ result SingleFrame::CopyTo(const unsigned char *source) {
 
 }
 
-result SingleFrame::Execute() {
+result SingleFrame::DeviceSource(
+    const   cl_command_queue    &cq,
+            int                 *plane) {
+
+    clRetainCommandQueue(cq);
+    clReleaseCommandQueue(cq_);
+    cq_ = cq;
+
+    if (zero_copy_) {
+        // From now on the source plane is the device's own
+        zero_copy_ = false;
+
+        result status = AllocPlane(&source_plane_);
+        if (status != FILTER_OK) return status;
+
+        status = BindSourcePlane();
+        if (status != FILTER_OK) return status;
+    }
+
+    *plane = source_plane_;
+    return FILTER_OK;
+}
+
+result SingleFrame::BindSourcePlane() {
+    // The launches read the linear plane, which does not change
+    if (linear_) {
+        convert_.SetNumberedArg(CONVERT_ARG_GAMMA_PLANE, sizeof(cl_mem), g_devices[device_id_].buffers_.ptr(source_plane_));
+        return convert_.arguments_valid() ? FILTER_OK : FILTER_KERNEL_ARGUMENT_ERROR;
+    }
+
+    // The input plane is the only argument of the recorded launches that changes
+    const cl_mem *input_plane = g_devices[device_id_].buffers_.ptr(source_plane_);
+    if (persistent_group_count_ > 0) {
+        persistent_.SetNumberedArg(PERSISTENT_ARG_INPUT_PLANE, sizeof(cl_mem), input_plane);
+        return persistent_.arguments_valid() ? FILTER_OK : FILTER_KERNEL_ARGUMENT_ERROR;
+    }
+
+    for (size_t i = 0; i < filter_launches_.size(); ++i) {
+        filter_launches_[i].SetNumberedArg(FILTER_ARG_INPUT_PLANE, sizeof(cl_mem), input_plane);
+        sort_launches_[i].SetNumberedArg(SORT_ARG_INPUT_PLANE, sizeof(cl_mem), input_plane);
+        if (!filter_launches_[i].arguments_valid() || !sort_launches_[i].arguments_valid())
+            return FILTER_KERNEL_ARGUMENT_ERROR;
+    }
+
+    return FILTER_OK;
+}
+
+void SingleFrame::SetRows(
+    const   int     &first_row,
+    const   int     &end_row) {
+
+    first_row_  = first_row;
+    end_row_    = end_row;
+}
+
+int SingleFrame::InputPlane() {
+    if (linear_) return linear_plane_;
+
+    return zero_copy_ ? dest_plane_ : source_plane_;
+}
+
+result SingleFrame::Execute(unsigned char *dest) {
     result status = FILTER_OK;
 
-    const int rounded_width = region_width_ * ((width_ + region_width_ - 1) / region_width_);
-    const int rounded_height = region_height_ * ((height_ + region_height_ - 1) / region_height_);
+    if (linear_) {
+        status = convert_.Execute(cq_, NULL);
+        if (status != FILTER_OK) 
+            return status;
+    }
+
+    if (persistent_group_count_ > 0) 
+        return ExecutePersistent(dest);
 
-    for (int region_x = 0; region_x < rounded_width; region_x += region_width_)
-        for (int region_y = 0; region_y < rounded_height; region_y += region_height_) {
+    const int rounded_end_row = region_height_ * ((end_row_ + region_height_ - 1) / region_height_);
 
-            const cl_int2 top_left = {region_x, region_y};
-            filter_.SetNumberedArg(FILTER_ARG_TOP_LEFT, sizeof(cl_int2), &top_left);
-            status = filter_.Execute(cq_, NULL);
+    // Replays the recorded launches of each band in turn
+    for (int region_y = first_row_; region_y < rounded_end_row; region_y += region_height_) {
+        const int first_launch = (region_y / region_height_) * regions_per_band_;
+        cl_event finalised = NULL;
+        for (int region = 0; region < regions_per_band_; ++region) {
+            status = filter_launches_[first_launch + region].Execute(cq_, NULL);
             if (status != FILTER_OK) 
                 return status;
 
-            sort_.SetNumberedArg(SORT_ARG_TOP_LEFT, sizeof(cl_int2), &top_left);
-            status = sort_.Execute(cq_, NULL);
+            // The queue is in-order, so only the band's final region needs an event
+            const bool band_complete = region + 1 == regions_per_band_;
+            status = sort_launches_[first_launch + region].Execute(cq_, band_complete ? &finalised : NULL);
             if (status != FILTER_OK) 
                 return status;
         }
+
+        status = sweep_count_ > 0 ? CopySweepFrom(region_y, dest, &finalised)
+                                  : CopyRegionFrom(region_y, dest, &finalised);
+        if (status != FILTER_OK) 
+            return status;
+    }
         
     return status;
 }
+
+result SingleFrame::ExecutePersistent(unsigned char *dest) {
+    persistent_.SetNumberedArg(PERSISTENT_ARG_FIRST_ROW, sizeof(int), &first_row_);
+    persistent_.SetNumberedArg(PERSISTENT_ARG_END_ROW, sizeof(int), &end_row_);
+
+    cl_event finalised = NULL;
+    result status = persistent_.Execute(cq_, &finalised);
+    if (status == FILTER_OK) 
+        status = CopyRowsFrom(first_row_, end_row_, dest, &finalised);
+
+    // A launch that failed may not have emptied the queue, which the next frame's launch relies upon
+    if (status != FILTER_OK) {
+        clFinish(cq_);
+        EmptyTileQueue();
+    }
+    return status;
+}
+
+result SingleFrame::EmptyTileQueue() {
+    const cl_int empty_queue[2] = {0, 0};
+    return g_devices[device_id_].buffers_.CopyToBuffer(tile_queue_, empty_queue, sizeof(empty_queue));
+}
+
+result SingleFrame::CopySweepFrom(
+    const   int             &region_y,
+            unsigned char   *dest,
+            cl_event        *finalised) {
+
+    if (dest == NULL) {
+        clReleaseEvent(*finalised);
+        return FILTER_OK;
+    }
+
+    // The final band of regions usually extends beyond the bottom of the plane
+    const int rows = (region_y + region_height_ > height_ ? height_ : region_y + region_height_) - region_y;
+
+    // Kernels queued so far must be submitted before the copies can wait upon them
+    clFlush(cq_);
+
+    result status = FILTER_OK;
+    for (int i = 0; i < sweep_count_ && status == FILTER_OK; ++i) {
+        status = g_devices[device_id_].buffers_.CopyFromPlaneAsynch(sweep_plane_,
+                                                                    readback_cq_,
+                                                                    i * sweep_stride_ + region_y,
+                                                                    width_,
+                                                                    rows,
+                                                                    dst_pitch_,
+                                                                    finalised,
+                                                                    NULL,
+                                                                    dest + (i * height_ + region_y) * dst_pitch_);
+    }
+
+    clReleaseEvent(*finalised);
+    return status;
+}
\ No newline at end of file
@@ -8,6 +8,8 @@
 #ifndef _SINGLE_FRAME_
 #define _SINGLE_FRAME_
 
+#include <vector>
+
 #include <CL/cl.h>
 #include "CLKernel.h"
 #include "FilterFrame.h"
@@ -18,6 +20,10 @@ class SingleFrame : public FilterFrame
 {
 public:
     SingleFrame();
+
+    // Destructor
+    // Releases the kernels
+    ~SingleFrame();
     
     // Init
     // Setup the static source and destination buffers on the device
@@ -27,22 +33,72 @@ public:
         const   int     &device_id,     // device used for filtering
         const   int     &width,         // width of frame in pixels
         const   int     &height,        // height of frame in pixels
+        const   int     &pixel_size,    // bytes per pixel: 1, 2 for 16-bit pixels or 4 for floats
         const   int     &src_pitch,     // length in memory of a row of pixels in source buffer
         const   int     &dst_pitch,     // length in memory of a row of pixels in destination buffer
         const   float   &h,             // NLM filtering strength
         const   int     &sample_expand, // factor of radius of 3 to use for sampling
-        const   int     &linear,        // TODO delete
+        const   int     &linear,        // filter in linear light, ignored for pitched planes
         const   int     &correction,    // TODO delete
         const   int     &balanced);     // TODO float for bias: shadows or highlights
                                         
     // CopyTo
-    // Copy the plane from host to device.
+    // Copy the plane from host to device. Devices that share memory
+    // with the host use the host buffer in place instead, so it must
+    // remain valid until the next call.
     result CopyTo(
         const unsigned char *source);   // host buffer to be copied to device
 
+    // DeviceSource
+    // Provides the source plane for a kernel to write, as when frames
+    // are unpacked on the device. Devices that share memory with the 
+    // host otherwise wrap host frames, so they are given a plane of 
+    // their own, after which CopyTo must not be used.
+    //
+    // The filter adopts the writer's queue, so that its kernels follow
+    // the write and whatever the writer queues after Execute follows
+    // them.
+    result DeviceSource(
+        const   cl_command_queue    &cq,    // in-order queue of the kernel that writes the plane
+                int                 *plane);// index of the source plane
+
+    // dest_plane
+    // Index of the plane holding the filtered pixels
+    int dest_plane() {return dest_plane_;}
+
     // Execute
-    // Perform NLM computation.
-    result Execute() override;
+    // Perform NLM computation, streaming each band of filtered
+    // rows to the host as soon as it is finalised. In linear light
+    // the plane is converted first. When dest is NULL the filtered
+    // plane stays on the device.
+    result Execute(
+        unsigned char *dest) override;  // host buffer for the filtered plane
+
+    // SetRows
+    // Restrict Execute to the bands of regions from first_row up to,
+    // but excluding, end_row. first_row must be a multiple of 
+    // band_height. By default every row of the plane is filtered.
+    void SetRows(
+        const   int     &first_row,     // first row to be filtered
+        const   int     &end_row);      // row after the last row to be filtered
+
+    // band_height
+    // Count of rows in each band of regions
+    int band_height() {return region_height_;}
+
+    // InitSweep
+    // Replaces the sort kernel so that Execute produces a filtered plane
+    // for each setting of the sweep, one beneath the other in the host
+    // buffer, from a single computation of the weights. Each setting's
+    // strength is given as the exponent of the weights computed with the
+    // strength passed to Init, so exponents should be at least 1. Each
+    // alpha size must be no more than the alpha size compiled.
+    //
+    // Only devices that use images and regions, rather than the 
+    // persistent kernel, sweep 8-bit planes.
+    result InitSweep(
+        const   vector<float>   &exponents,     // power to which weights are raised for each setting
+        const   vector<int>     &alpha_sizes);  // count of the best weights used for each setting
 
 private:
 
@@ -80,9 +136,68 @@ private:
     // of filtering and sorting.
     result InitInitialiseKernel();
 
+    // InitPersistentKernel
+    // Configure the persistent kernel, which filters all the rows of the
+    // plane in a single launch, and its queue of tiles
+    result InitPersistentKernel(
+        const int &sample_expand,       // factor of radius of 3 to use for sampling
+        const int &linear);             // TODO delete
+
+    // ExecutePersistent
+    // Filter the rows with a single launch of the persistent kernel,
+    // streaming them to the host once it completes
+    result ExecutePersistent(
+        unsigned char *dest);           // host buffer for the filtered plane
+
+    // EmptyTileQueue
+    // Sets the persistent kernel's queue to no tiles taken and no work
+    // groups finished, as the kernel leaves it after each launch
+    result EmptyTileQueue();
+
+    // InputPlane
+    // Returns the plane read by the filter and sort kernels: the linear
+    // plane in linear light, otherwise the source plane, for which the
+    // destination plane stands in until CopyTo wraps the first frame
+    int InputPlane();
+
+    // BindSourcePlane
+    // Points the kernels that read the source plane at source_plane_,
+    // once it has been replaced
+    result BindSourcePlane();
+
+    // RecordLaunches
+    // Records the launches of the filter and sort kernels for every region
+    // of the plane, each an instance of the kernel whose region is set. 
+    // Execute replays the launches of the bands it filters, so that 
+    // arguments are only set when they change, i.e. when CopyTo wraps a
+    // new host frame.
+    result RecordLaunches();
+
+    // CopySweepFrom
+    // As CopyRegionFrom, copying the band of rows of each setting of the
+    // sweep from the sweep plane to its place in the host buffer
+    result CopySweepFrom(
+        const   int             &region_y,  // top row of the band of regions
+                unsigned char   *dest,      // host buffer for the filtered planes, one beneath the other
+                cl_event        *finalised);// event for the band's final kernel, released once the copies are queued
+
     ClKernel filter_    ;   // non local means kernel executed on device
     ClKernel sort_      ;   // sort kernel executed on device
     ClKernel initialise_;   // zeroing kernel executed on device - TODO delete
+    vector<ClKernel> filter_launches_;  // filter kernel instance for each region, in execution order
+    vector<ClKernel> sort_launches_;    // sort kernel instance for each region, in execution order
+    int regions_per_band_;  // count of regions across the plane
+    ClKernel persistent_;   // kernel that filters every tile of the plane in a single launch
+    int persistent_group_count_;    // work groups launched by the persistent kernel, 0 when regions are launched
+    int tile_queue_     ;   // persistent kernel's count of tiles taken and count of work groups finished
+    int linear_plane_   ;   // source plane converted to linear light, read by the kernels when linear_ is set
+    ClKernel convert_   ;   // kernel that converts the source plane to linear light
+    int first_row_      ;   // first row filtered by Execute
+    int end_row_        ;   // row after the last row filtered by Execute
+    int sweep_count_    ;   // count of settings of the sweep, 0 when not sweeping
+    int sweep_stride_   ;   // rows of the sweep plane for each setting, a whole number of bands
+    int sweep_plane_    ;   // filtered planes of the sweep, one beneath the other
+    int sweep_settings_ ;   // exponent and alpha size of each setting of the sweep, as float pairs
 };
 
 #endif // _SINGLE_FRAME_
\ No newline at end of file
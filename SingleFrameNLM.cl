@@ -5,7 +5,7 @@
  * Copyright 2015, Jawed Ashraf - Deathray@cupidity.f9.co.uk
  */
 
-__attribute__((reqd_work_group_size(8, 16, 1)))
+__attribute__((reqd_work_group_size(8, TILE_ROWS << 3, 1)))
 __kernel void NLMSingleFrame(
     read_only   image2d_t   input_plane,    // input plane
     const       int         width,          // width in pixels
@@ -16,10 +16,12 @@ __kernel void NLMSingleFrame(
     constant    float       *g_gaussian,    // 49 weights of gaussian kernel
     const       int         linear,         // process plane in linear space instead of gamma space
     const       int         alpha_set_size, // number of weight/pixel pairs per target pixel
-    global      uint        *region_alpha) {// region's alpha weight/pixel pairs packed as uints
+    global      uint        *region_alpha,  // region's alpha weight/pixel pairs packed as uints
+    global      float       *region_pixels) {// region's sample pixels, written only for float planes
 
     // Each work group produces a set of alpha weight/pixel pairs for 
-    // 16 filtered pixels, organised as a tile that's 8 wide and 2 high.
+    // 8 * TILE_ROWS filtered pixels, organised as a tile that's 8 wide and
+    // TILE_ROWS high.
     //
     // Each work item computes multiple weights, in an 8-stride sequence, 
     // for a single pixel. 8 work items, together, compute the entire set 
@@ -44,12 +46,39 @@ __kernel void NLMSingleFrame(
     // Input plane contains pixels as uchars. UNORM8 format is defined,
     // so a read converts uchar into a normalised float of range 0.f to 1.f. 
 
-    local float target_cache[128];
-    local float sample_cache[1280];
+    local float target_cache[TARGET_CACHE_SIZE];
+    local float sample_cache[SAMPLE_CACHE_SIZE];
+    local int sample_table[MAX_SET_SAMPLES];
 
-    PopulateTargetCache(input_plane, top_left, linear, target_cache);
+    PopulateTargetCache(input_plane, GetCoordinatesTile(top_left), TILE_ROWS, linear, target_cache);
 
     int skip_target = 1;
+
+    // Tiles away from the plane's borders take the path without wrapping or clamping
+    const int radius = GetRadius(sample_expand);
+    if (IsInteriorTile(top_left, (int2)(width, height), radius)) {
+        BuildSampleTable(radius, skip_target, sample_table);
+        WeightAnEighthInterior(input_plane,
+                               h, 
+                               sample_expand, 
+                               width, 
+                               height, 
+                               top_left, 
+                               g_gaussian, 
+                               linear, 
+                               target_cache, 
+                               sample_cache, 
+                               sample_table,
+                               alpha_set_size, 
+                               0,
+                               width,
+                               region_alpha,
+                               region_pixels,
+                               FIELD_UNUSED,
+                               region_alpha);
+        return;
+    }
+
     WeightAnEighth(input_plane,
                    h, 
                    sample_expand, 
@@ -63,6 +92,111 @@ __kernel void NLMSingleFrame(
                    sample_cache, 
                    alpha_set_size, 
                    0,
+                   width,
+                   region_alpha,
+                   region_pixels,
+                   FIELD_UNUSED,
                    region_alpha);
 }
 
+__attribute__((reqd_work_group_size(8, TILE_ROWS << 3, 1)))
+__kernel void NLMSingleFrameChroma(
+    read_only   image2d_t   input_plane_u,  // input U plane
+    read_only   image2d_t   input_plane_v,  // input V plane
+    const       int         width,          // width in pixels
+    const       int         height,         // height in pixels
+    const       int2        top_left,       // coordinates of the top left corner of the region to be filtered
+    const       float       h,              // strength of denoising
+    const       int         sample_expand,  // factor to expand sample radius
+    constant    float       *g_gaussian,    // 49 weights of gaussian kernel
+    const       int         linear,         // process plane in linear space instead of gamma space
+    const       int         alpha_set_size, // number of weight/pixel pairs per target pixel
+    const       int         alpha_plane_size,// count of weight/pixel pairs of each plane in region_alpha
+    global      uint        *region_alpha) {// region's alpha weight/pixel pairs packed as uints, U's then V's
+
+    // As NLMSingleFrame, with each work group filtering the same tile
+    // of both chroma planes. The planes' weights are independent, but
+    // the caches are filled, and the samples are addressed, together.
+
+    local float target_cache_u[TARGET_CACHE_SIZE];
+    local float target_cache_v[TARGET_CACHE_SIZE];
+    local float sample_cache_u[SAMPLE_CACHE_SIZE];
+    local float sample_cache_v[SAMPLE_CACHE_SIZE];
+    local int sample_table[MAX_SET_SAMPLES];
+
+    PopulateTargetCachePair(input_plane_u, input_plane_v, GetCoordinatesTile(top_left), TILE_ROWS, linear, target_cache_u, target_cache_v);
+
+    int skip_target = 1;
+
+    WeightAnEighthPair(input_plane_u,
+                       input_plane_v,
+                       h, 
+                       sample_expand, 
+                       width, 
+                       height, 
+                       top_left, 
+                       skip_target, 
+                       g_gaussian, 
+                       linear, 
+                       target_cache_u, 
+                       target_cache_v, 
+                       sample_cache_u, 
+                       sample_cache_v, 
+                       sample_table,
+                       alpha_set_size, 
+                       width,
+                       region_alpha,
+                       region_alpha + alpha_plane_size);
+}
+
+__attribute__((reqd_work_group_size(8, TILE_ROWS << 3, 1)))
+__kernel void NLMSingleFrameChromaGuided(
+    read_only   image2d_t   guide_plane,    // luma at the dimensions of the chroma planes
+    read_only   image2d_t   input_plane_u,  // input U plane
+    read_only   image2d_t   input_plane_v,  // input V plane
+    const       int         width,          // width in pixels
+    const       int         height,         // height in pixels
+    const       int2        top_left,       // coordinates of the top left corner of the region to be filtered
+    const       float       h,              // strength of denoising
+    const       int         sample_expand,  // factor to expand sample radius
+    constant    float       *g_gaussian,    // 49 weights of gaussian kernel
+    const       int         linear,         // process plane in linear space instead of gamma space
+    const       int         alpha_set_size, // number of weight/pixel pairs per target pixel
+    const       int         alpha_plane_size,// count of weight/pixel pairs of each plane in region_alpha
+    global      uint        *region_alpha) {// region's alpha weight/pixel pairs packed as uints, U's then V's
+
+    // As NLMSingleFrameChroma, except that U and V share weights computed
+    // from the guide, whose windows are less noisy than chroma's. 
+
+    local float target_cache[TARGET_CACHE_SIZE];
+    local float sample_cache[SAMPLE_CACHE_SIZE];
+    local float sample_cache_u[SAMPLE_CACHE_SIZE];
+    local float sample_cache_v[SAMPLE_CACHE_SIZE];
+    local int sample_table[MAX_SET_SAMPLES];
+
+    PopulateTargetCache(guide_plane, GetCoordinatesTile(top_left), TILE_ROWS, linear, target_cache);
+
+    int skip_target = 1;
+
+    WeightAnEighthGuided(guide_plane,
+                         input_plane_u,
+                         input_plane_v,
+                         h, 
+                         sample_expand, 
+                         width, 
+                         height, 
+                         top_left, 
+                         skip_target, 
+                         g_gaussian, 
+                         linear, 
+                         target_cache, 
+                         sample_cache, 
+                         sample_cache_u, 
+                         sample_cache_v, 
+                         sample_table,
+                         alpha_set_size, 
+                         width,
+                         region_alpha,
+                         region_alpha + alpha_plane_size);
+}
+
@@ -95,23 +95,36 @@ void SortAlpha(
     }
 }
 
-// ReduceAlpha
-// Returns the target weight and sums the weighted pixels and weights based
-// upon the final alpha weights and samples
-float ReduceAlpha(
-    const       int     alpha_size,             // TODO delete
+// ReduceAlphaSubset
+// As ReduceAlpha, for the best alpha_count weights of the alpha set, each
+// raised to the exponent. The weights are exp(-distance * h), so raising
+// them re-weights the samples as though filtered with h * exponent.
+float ReduceAlphaSubset(
+    const       float   exponent,               // power to which each weight is raised
+    const       int     alpha_count,            // count of the best weights used, no more than 8 * ALPHASIZE
+    const       int     linear,                 // samples are coded in linear light
+    const       int     pixel_bits,             // count of bits of each sample's pixel code
+    const       bool    exact,                  // samples' pixels are in set_pixels rather than coded
+    global      float   *set_pixels,            // sample pixels of the set, for exact samples
                 uint    *alpha,                 // an eighth of the best weights and samples to be used to filter the pixel
     local       uint    *weight_swap,           // swap buffer for running averages/sums
     local       uint    *pixel_swap,            // swap buffer for weight/pixel pairs
                 float   *all_samples_average,   // sum of weighted pixel values
                 float   *all_samples_weight) {  // sum of weights
 
+    const float weight_scale = ldexp(1.f, pixel_bits - 32);
+    const uint pixel_mask = (1 << pixel_bits) - 1;
+
+    // Cooperator 0 holds the highest weights, so the best alpha_count come first
+    const int set_position = mul24((int)get_local_id(0), ALPHASIZE);
+
     float own_average = 0.f;
     float own_weight = 0.f;
     uint min_weight = UINT_MAX;
-    for (int i = 0; i < ALPHASIZE; ++i) {
-        float weight = (float)(alpha[i] >> 8) * 0.000000059604648f;
-        float pixel = (float)(alpha[i] & 255) * 0.0039215686f;
+    for (int i = 0; i < ALPHASIZE && set_position + i < alpha_count; ++i) {
+        float weight = (float)(alpha[i] >> pixel_bits) * weight_scale;
+        weight = (exponent == 1.f) ? weight : pow(weight, exponent);
+        float pixel = exact ? set_pixels[alpha[i] & pixel_mask] : UnpackSamplePixel(alpha[i] & pixel_mask, linear, pixel_bits);
         own_average += weight * pixel;
         own_weight += weight;
         min_weight = (weight == 0.f) ? min_weight : min(min_weight, alpha[i]);
@@ -139,6 +152,34 @@ float ReduceAlpha(
     return as_float(pixel_swap[pixel_id]);
 }
 
+// ReduceAlpha
+// Returns the target weight and sums the weighted pixels and weights based
+// upon the final alpha weights and samples
+float ReduceAlpha(
+    const       int     alpha_size,             // TODO delete
+    const       int     linear,                 // samples are coded in linear light
+    const       int     pixel_bits,             // count of bits of each sample's pixel code
+    const       bool    exact,                  // samples' pixels are in set_pixels rather than coded
+    global      float   *set_pixels,            // sample pixels of the set, for exact samples
+                uint    *alpha,                 // an eighth of the best weights and samples to be used to filter the pixel
+    local       uint    *weight_swap,           // swap buffer for running averages/sums
+    local       uint    *pixel_swap,            // swap buffer for weight/pixel pairs
+                float   *all_samples_average,   // sum of weighted pixel values
+                float   *all_samples_weight) {  // sum of weights
+
+    return ReduceAlphaSubset(1.f,
+                             ALPHASIZE << 3,
+                             linear,
+                             pixel_bits,
+                             exact,
+                             set_pixels,
+                             alpha,
+                             weight_swap,
+                             pixel_swap,
+                             all_samples_average,
+                             all_samples_weight);
+}
+
 // FilterPixel
 // Uses the weights to compute a filtered pixel
 float FilterPixel (
@@ -200,6 +241,54 @@ void SwapAndWriteFilteredPixels(
     }
 }
 
+// FinaliseTile
+// Produces the work group's 16 filtered pixels from the tile's alpha sets.
+// The target cache must already hold the pixels around the tile.
+void FinaliseTile(
+    const       int         width,              // width in pixels of the region whose alpha sets are in region_alpha
+    const       int2        top_left,           // coordinates of the top left corner of the region to be filtered
+    const       int         linear,             // process plane in linear space instead of gamma space
+    const       int         sample_format,      // channel data type of the plane the samples came from
+    const       int         alpha_size,         // TODO delete          
+    const       int         alpha_set_size,     // number of weight/pixel pairs per target pixel
+    global      uint        *region_alpha,      // region's alpha weight/pixel pairs packed as uints
+    global      float       *region_pixels,     // region's sample pixels, for float planes
+    write_only  image2d_t   destination_plane,  // filtered result
+    local       float       *target_cache,      // caches pixels around the 8x2 tile of target pixels
+    local       uint        *weight_swap,       // swap buffer for running averages/sums
+    local       uint        *pixel_swap) {      // swap buffer for weight/pixel pairs
+
+    // Sort
+    uint alpha[ALPHASIZE];    // an eighth of the best weights and samples to be used to filter the pixel
+    ResetAlpha(alpha_size, alpha);
+
+    // Determine base address in region_alpha buffer
+    const int region_base = GetRegionBaseAddress(width, alpha_set_size);
+
+    SortAlpha(region_base, pixel_swap, alpha_set_size, region_alpha, alpha);
+
+    // Reduce
+    float average = 0.f;    // Weights are kept as running average and running weight ... 
+    float weight = 0.f;        // ... which simplifies final reduction into a weighted-average pixel.
+    const int pixel_bits = SampleBits(sample_format, alpha_set_size);
+    float target_weight = ReduceAlpha(alpha_size, 
+                                      linear, 
+                                      pixel_bits, 
+                                      IsExactSample(sample_format), 
+                                      region_pixels + GetRegionBaseAddress(width, alpha_set_size),
+                                      alpha, 
+                                      weight_swap, 
+                                      pixel_swap, 
+                                      &average, 
+                                      &weight);
+
+    // Filter
+    float filtered_pixel = FilterPixel(target_cache, &average, &weight, &target_weight);
+    
+    // Write
+    SwapAndWriteFilteredPixels(destination_plane, top_left, pixel_swap, linear, filtered_pixel);
+}
+
 __attribute__((reqd_work_group_size(8, 16, 1)))
 __kernel void Finalise(
     read_only   image2d_t   input_plane,        // input plane
@@ -209,7 +298,8 @@ __kernel void Finalise(
     const       int         alpha_size,         // TODO delete          
     const       int         alpha_set_size,     // number of weight/pixel pairs per target pixel
     global      uint        *region_alpha,      // region's alpha weight/pixel pairs packed as uints
-    write_only  image2d_t   destination_plane) {// filtered result
+    write_only  image2d_t   destination_plane,  // filtered result
+    global      float       *region_pixels) {   // region's sample pixels, for float planes
 
     // Each work group produces 16 filtered pixels derived from the best
     // 128 weights in the alpha set of weight/pixel pairs.
@@ -223,32 +313,142 @@ __kernel void Finalise(
     // master is responsible for writing the filtered result for 4 target 
     // pixels. The slaves send their results through pixel_swap in local memory.
     // 
-    // Destination plane is formatted as UNORM8 uchar. The device 
-    // automatically converts a pixel in range 0.f to 1.f into 0 to 255.
+    // Destination plane is formatted as UNORM8 uchar, or UNORM16 ushort for
+    // 16-bit clips. The device automatically converts a pixel in range 0.f
+    // to 1.f into 0 to 255, or 0 to 65535.
 
     local uint weight_swap[256];
     local uint pixel_swap[128];
+    local float target_cache[128];
+
+    // TODO no need to read so many target pixels
+    PopulateTargetCache(input_plane, GetCoordinates8x2(top_left), 2, linear, target_cache);
+
+    FinaliseTile(width,
+                 top_left,
+                 linear,
+                 get_image_channel_data_type(input_plane),
+                 alpha_size,
+                 alpha_set_size,
+                 region_alpha,
+                 region_pixels,
+                 destination_plane,
+                 target_cache,
+                 weight_swap,
+                 pixel_swap);
+}
+
+__attribute__((reqd_work_group_size(8, 16, 1)))
+__kernel void FinaliseSweep(
+    read_only   image2d_t   input_plane,        // input plane
+    const       int         width,              // region width in pixels
+    const       int2        top_left,           // coordinates of the top left corner of the region to be filtered
+    const       int         linear,             // process plane in linear space instead of gamma space
+    const       int         alpha_set_size,     // number of weight/pixel pairs per target pixel
+    global      uint        *region_alpha,      // region's alpha weight/pixel pairs packed as uints
+    write_only  image2d_t   destination_plane,  // filtered results, one beneath the other
+    global      float       *region_pixels,     // region's sample pixels, for float planes
+    const       int         sweep_count,        // count of filtered results
+    const       int         sweep_stride,       // rows between the tops of consecutive results
+    constant    float2      *sweep) {           // exponent of the weights and count of the best weights used, for each result
+
+    // As Finalise, producing a filtered result for each setting of the 
+    // sweep from a single sort of the alpha set. The order of the weights
+    // does not depend upon h, so the best weights for every h are those
+    // sorted for the h that the weights were computed with. Each result
+    // raises the weights to its exponent, giving the weights of another
+    // h, and uses as many of the best as its alpha size.
+
+    local uint weight_swap[256];
+    local uint pixel_swap[128];
+    local float target_cache[128];
+
+    PopulateTargetCache(input_plane, GetCoordinates8x2(top_left), 2, linear, target_cache);
 
-    // Sort
     uint alpha[ALPHASIZE];    // an eighth of the best weights and samples to be used to filter the pixel
-    ResetAlpha(alpha_size, alpha);
+    ResetAlpha(0, alpha);
 
-    // Determine base address in region_alpha buffer
     const int region_base = GetRegionBaseAddress(width, alpha_set_size);
-
     SortAlpha(region_base, pixel_swap, alpha_set_size, region_alpha, alpha);
 
-    // Reduce
-    float average = 0.f;    // Weights are kept as running average and running weight ... 
-    float weight = 0.f;        // ... which simplifies final reduction into a weighted-average pixel.
-    float target_weight = ReduceAlpha(alpha_size, alpha, weight_swap, pixel_swap, &average, &weight);
+    const int sample_format = get_image_channel_data_type(input_plane);
+    const int pixel_bits = SampleBits(sample_format, alpha_set_size);
+
+    for (int i = 0; i < sweep_count; ++i) {
+        float average = 0.f;
+        float weight = 0.f;
+        float target_weight = ReduceAlphaSubset(sweep[i].x,
+                                                (int)sweep[i].y,
+                                                linear,
+                                                pixel_bits,
+                                                IsExactSample(sample_format),
+                                                region_pixels + region_base,
+                                                alpha,
+                                                weight_swap,
+                                                pixel_swap,
+                                                &average,
+                                                &weight);
+
+        float filtered_pixel = FilterPixel(target_cache, &average, &weight, &target_weight);
+
+        // Regions beyond the bottom of the plane write to the padding beneath each
+        // result. Tiles beyond the right of the plane write to its padding across,
+        // as the sweep plane is padded as every plane is.
+        SwapAndWriteFilteredPixels(destination_plane, top_left + (int2)(0, i * sweep_stride), pixel_swap, linear, filtered_pixel);
+
+        // The masters have read pixel_swap before the next result is reduced
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+}
 
-    // Filter
-    local float target_cache[128];
-    // TODO no need to read so many target pixels
-    PopulateTargetCache(input_plane, top_left, linear, target_cache);
-    float filtered_pixel = FilterPixel(target_cache, &average, &weight, &target_weight);
-    
-    // Write
-    SwapAndWriteFilteredPixels(destination_plane, top_left, pixel_swap, linear, filtered_pixel);
+__attribute__((reqd_work_group_size(8, 16, 1)))
+__kernel void FinaliseChroma(
+    read_only   image2d_t   input_plane_u,      // input U plane
+    read_only   image2d_t   input_plane_v,      // input V plane
+    const       int         width,              // region width in pixels
+    const       int2        top_left,           // coordinates of the top left corner of the region to be filtered
+    const       int         linear,             // process plane in linear space instead of gamma space
+    const       int         alpha_size,         // TODO delete          
+    const       int         alpha_set_size,     // number of weight/pixel pairs per target pixel
+    const       int         alpha_plane_size,   // count of weight/pixel pairs of each plane in region_alpha
+    global      uint        *region_alpha,      // region's alpha weight/pixel pairs packed as uints, U's then V's
+    write_only  image2d_t   destination_plane_u,// filtered U
+    write_only  image2d_t   destination_plane_v) {// filtered V
+
+    // As Finalise, for the same tile of both chroma planes in turn. Chroma
+    // planes filtered together are never floats, so there is no pixel
+    // stream and the alpha buffer stands in for it.
+
+    local uint weight_swap[256];
+    local uint pixel_swap[128];
+    local float target_cache_u[128];
+    local float target_cache_v[128];
+
+    PopulateTargetCachePair(input_plane_u, input_plane_v, GetCoordinates8x2(top_left), 2, linear, target_cache_u, target_cache_v);
+
+    FinaliseTile(width,
+                 top_left,
+                 linear,
+                 get_image_channel_data_type(input_plane_u),
+                 alpha_size,
+                 alpha_set_size,
+                 region_alpha,
+                 (global float *)region_alpha,
+                 destination_plane_u,
+                 target_cache_u,
+                 weight_swap,
+                 pixel_swap);
+
+    FinaliseTile(width,
+                 top_left,
+                 linear,
+                 get_image_channel_data_type(input_plane_v),
+                 alpha_size,
+                 alpha_set_size,
+                 region_alpha + alpha_plane_size,
+                 (global float *)region_alpha,
+                 destination_plane_v,
+                 target_cache_v,
+                 weight_swap,
+                 pixel_swap);
 }
@@ -0,0 +1,221 @@
+/* Deathray2 - An Avisynth plug-in filter for spatial/temporal non-local means de-noising.
+ *
+ * version 1.00
+ *
+ * Copyright 2015, Jawed Ashraf - Deathray@cupidity.f9.co.uk
+ */
+
+#include "result.h"
+#include "SingleFrame.h"
+#include "SplitFrame.h"
+
+extern  cl_int      g_last_cl_error;
+extern  cl_context  g_context;
+
+SplitFrame::SplitFrame() {
+    device_id_          = 0;
+    width_              = 0;
+    height_             = 0;
+    src_pitch_          = 0;
+    dst_pitch_          = 0;
+    band_height_        = 0;
+    frames_measured_    = 0;
+    outstanding_        = 0;
+    failed_             = 0;
+    all_completed_      = NULL;
+    started_.QuadPart   = 0;
+    parts_.clear();
+}
+
+SplitFrame::~SplitFrame() {
+    for (size_t i = 0; i < parts_.size(); ++i)
+        delete parts_[i].frame;
+}
+
+result SplitFrame::Init(
+    const   int     &device_count,
+    const   int     &width,
+    const   int     &height,
+    const   int     &pixel_size,
+    const   int     &src_pitch,
+    const   int     &dst_pitch,
+    const   float   &h,
+    const   int     &sample_expand,
+    const   int     &linear,
+    const   int     &correction,
+    const   int     &balanced) {
+
+    if (device_count == 0) return FILTER_ERROR;
+
+    result status = FILTER_OK;
+
+    width_      = width;
+    height_     = height;
+    src_pitch_  = src_pitch;
+    dst_pitch_  = dst_pitch;
+
+    // parts_ must not be resized once callbacks can refer to its elements
+    parts_.reserve(device_count);
+    int band_count = device_count;
+    for (int i = 0; i < device_count && i < band_count; ++i) {
+        Part part = {this, new SingleFrame(), 0, height, {0}, NULL, 0., 0.};
+        parts_.push_back(part);
+        status = part.frame->Init(i, width, height, pixel_size, src_pitch, dst_pitch, h, sample_expand, linear, correction, balanced);
+        if (status != FILTER_OK) return status;
+
+        // Band heights are powers of 2, so the tallest is a multiple of the 
+        // rest. A device is only worth using if it can be given a band of its own
+        if (part.frame->band_height() > band_height_) band_height_ = part.frame->band_height();
+        band_count = (height_ + band_height_ - 1) / band_height_;
+    }
+
+    Balance();
+    return status;
+}
+
+result SplitFrame::CopyTo(const unsigned char *source) {
+    result status = FILTER_OK;
+
+    for (size_t i = 0; i < parts_.size(); ++i) {
+        status = parts_[i].frame->CopyTo(source);
+        if (status != FILTER_OK) return status;
+    }
+    return status;
+}
+
+result SplitFrame::Execute(unsigned char *dest) {
+    result status = FILTER_OK;
+
+    Measure();
+    if (frames_measured_ >= k_balance_interval)
+        Balance();
+
+    cl_int cl_status = CL_SUCCESS;
+    all_completed_ = clCreateUserEvent(g_context, &cl_status);
+    if (cl_status != CL_SUCCESS) {
+        g_last_cl_error = cl_status;
+        return FILTER_SPLIT_FRAME_SYNCHRONISATION_FAILED;
+    }
+    outstanding_ = static_cast<LONG>(parts_.size());
+    failed_ = 0;
+
+    QueryPerformanceCounter(&started_);
+    for (size_t i = 0; i < parts_.size(); ++i) {
+        status = parts_[i].frame->Execute(dest);
+        if (status != FILTER_OK) {
+            Abandon();
+            return status;
+        }
+    }
+    return status;
+}
+
+result SplitFrame::CopyFrom(cl_event *returned) {
+    result status = FILTER_OK;
+
+    for (size_t i = 0; i < parts_.size(); ++i) {
+        cl_event copied = NULL;
+        status = parts_[i].frame->CopyFrom(&copied);
+        if (status != FILTER_OK) {
+            Abandon();
+            return status;
+        }
+
+        // The callback releases the event and its reference to the frame's event
+        clRetainEvent(all_completed_);
+        parts_[i].frame_event = all_completed_;
+        cl_int cl_status = clSetEventCallback(copied, CL_COMPLETE, PartCompleted, &parts_[i]);
+        if (cl_status != CL_SUCCESS) {
+            g_last_cl_error = cl_status;
+            clReleaseEvent(copied);
+            clReleaseEvent(all_completed_);
+            Abandon();
+            return FILTER_SPLIT_FRAME_SYNCHRONISATION_FAILED;
+        }
+    }
+
+    *returned = all_completed_;
+    return status;
+}
+
+void CL_CALLBACK SplitFrame::PartCompleted(
+    cl_event    event,
+    cl_int      status,
+    void        *part) {
+
+    Part *completed = static_cast<Part*>(part);
+    QueryPerformanceCounter(&completed->completed);
+    clReleaseEvent(event);
+
+    // A failed event's status is negative. Only the first failure is
+    // passed on, as a user event's status can be set once.
+    SplitFrame *owner = completed->owner;
+    cl_event frame_event = completed->frame_event;
+    if (status < 0 && InterlockedExchange(&owner->failed_, 1) == 0)
+        clSetUserEventStatus(frame_event, status);
+
+    if (InterlockedDecrement(&owner->outstanding_) == 0 && owner->failed_ == 0)
+        clSetUserEventStatus(frame_event, CL_COMPLETE);
+    clReleaseEvent(frame_event);
+}
+
+void SplitFrame::Abandon() {
+    if (InterlockedExchange(&failed_, 1) == 0)
+        clSetUserEventStatus(all_completed_, k_frame_abandoned);
+    clReleaseEvent(all_completed_);
+    all_completed_ = NULL;
+}
+
+void SplitFrame::Measure() {
+    // Nothing to measure before the first frame. The client has waited
+    // for the previous frame, so every part's completion time is set.
+    if (started_.QuadPart == 0) return;
+
+    for (size_t i = 0; i < parts_.size(); ++i) {
+        parts_[i].rows_done     += parts_[i].end_row - parts_[i].first_row;
+        parts_[i].ticks_taken   += static_cast<double>(parts_[i].completed.QuadPart - started_.QuadPart);
+    }
+    ++frames_measured_;
+}
+
+void SplitFrame::Balance() {
+    const int part_count = static_cast<int>(parts_.size());
+    const int band_count = (height_ + band_height_ - 1) / band_height_;
+
+    vector<double> throughput(part_count, 0.);
+    double total_throughput = 0.;
+    for (int i = 0; i < part_count; ++i) {
+        if (parts_[i].ticks_taken > 0.)
+            throughput[i] = parts_[i].rows_done / parts_[i].ticks_taken;
+        total_throughput += throughput[i];
+    }
+
+    int first_band = 0;
+    for (int i = 0; i < part_count; ++i) {
+        const int parts_remaining = part_count - i - 1;
+
+        int bands = 0;
+        if (parts_remaining == 0)
+            bands = band_count - first_band;
+        else if (total_throughput == 0.)
+            bands = (i == 0) ? band_count - parts_remaining : 1;
+        else
+            bands = static_cast<int>(band_count * throughput[i] / total_throughput + 0.5);
+
+        // Every device keeps at least one band, so that its throughput
+        // continues to be measured
+        const int most_bands = band_count - first_band - parts_remaining;
+        if (bands > most_bands) bands = most_bands;
+        if (bands < 1) bands = 1;
+
+        parts_[i].first_row     = first_band * band_height_;
+        parts_[i].end_row       = (first_band + bands) * band_height_;
+        if (parts_[i].end_row > height_) parts_[i].end_row = height_;
+        parts_[i].rows_done     = 0.;
+        parts_[i].ticks_taken   = 0.;
+        parts_[i].frame->SetRows(parts_[i].first_row, parts_[i].end_row);
+
+        first_band += bands;
+    }
+    frames_measured_ = 0;
+}
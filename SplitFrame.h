@@ -0,0 +1,124 @@
+/* Deathray2 - An Avisynth plug-in filter for spatial/temporal non-local means de-noising.
+ *
+ * version 1.00
+ *
+ * Copyright 2015, Jawed Ashraf - Deathray@cupidity.f9.co.uk
+ */
+
+#ifndef _SPLIT_FRAME_H_
+#define _SPLIT_FRAME_H_
+
+#include <Windows.h>
+#include <vector>
+
+#include <CL/cl.h>
+#include "FilterFrame.h"
+
+using namespace std;
+
+enum result;
+class SingleFrame;
+
+// SplitFrame
+// Single frame filtering of a plane shared by all devices in the context,
+// e.g. a GPU and the CPU. Each device filters a contiguous range of bands
+// and streams its rows directly into the host's destination buffer.
+//
+// The range given to each device is proportional to its measured
+// throughput, re-balanced periodically from the times at which the
+// devices completed their ranges.
+class SplitFrame : public FilterFrame
+{
+public:
+    SplitFrame();
+    ~SplitFrame();
+
+    // Init
+    // Set up a SingleFrame for each device, all sharing the plane
+    result Init(
+        const   int     &device_count,  // count of devices, from device 0, used for filtering
+        const   int     &width,         // width of frame in pixels
+        const   int     &height,        // height of frame in pixels
+        const   int     &pixel_size,    // bytes per pixel: 1, 2 for 16-bit pixels or 4 for floats
+        const   int     &src_pitch,     // length in memory of a row of pixels in source buffer
+        const   int     &dst_pitch,     // length in memory of a row of pixels in destination buffer
+        const   float   &h,             // NLM filtering strength
+        const   int     &sample_expand, // factor of radius of 3 to use for sampling
+        const   int     &linear,        // TODO delete
+        const   int     &correction,    // TODO delete
+        const   int     &balanced);     // TODO float for bias: shadows or highlights
+
+    // CopyTo
+    // Give every device the whole plane, since the samples for a band
+    // extend beyond its rows
+    result CopyTo(
+        const unsigned char *source);   // host buffer to be copied to devices
+
+    // Execute
+    // Each device filters its range of bands, streaming the rows to
+    // the host as they are finalised
+    result Execute(
+        unsigned char *dest) override;  // host buffer for the filtered plane
+
+    // CopyFrom
+    // Returns an event that completes once every device's rows have
+    // arrived on the host
+    result CopyFrom(
+        cl_event        *returned) override;    // event to track completion of all copies
+
+private:
+
+    // Part
+    // A device's share of the plane
+    struct Part {
+        SplitFrame      *owner      ;   // object whose event completes once all parts have completed
+        SingleFrame     *frame      ;   // filter running on the device
+        int             first_row   ;   // first row of the device's range
+        int             end_row     ;   // row after the last row of the device's range
+        LARGE_INTEGER   completed   ;   // time at which the range's rows arrived on the host
+        cl_event        frame_event ;   // reference to the user event of the frame whose rows are being copied
+        double          rows_done   ;   // rows filtered since the last re-balance
+        double          ticks_taken ;   // time taken for those rows
+    };
+
+    // PartCompleted
+    // Event callback recording the completion time of a part. Runs
+    // on a thread belonging to the OpenCL runtime. A part that failed
+    // fails the frame's user event with its status.
+    static void CL_CALLBACK PartCompleted(
+        cl_event        event,          // event for the part's final copy
+        cl_int          status,         // execution status of the event
+        void            *part);         // the Part that has completed
+
+    // Abandon
+    // Fails the frame's user event, unless a part has already failed it,
+    // and releases it, as the client will not be given it. Parts whose
+    // callbacks are still to run hold their own references.
+    void Abandon();
+
+    // Measure
+    // Adds the previous frame's timings to each part's totals
+    void Measure();
+
+    // Balance
+    // Shares the bands amongst the parts in proportion to their
+    // throughput. Until throughput has been measured, every device
+    // but the first is given a single band.
+    void Balance();
+
+    vector<Part>    parts_          ;   // one part per device
+    int             band_height_    ;   // rows in each band of regions, common to all devices
+    int             frames_measured_;   // frames filtered since the last re-balance
+    LARGE_INTEGER   started_        ;   // time at which the current frame was started
+    volatile LONG   outstanding_    ;   // parts yet to complete in the current frame
+    volatile LONG   failed_         ;   // 1 once the current frame's user event has been failed
+    cl_event        all_completed_  ;   // user event completed when the last part completes
+
+    // Frames filtered between re-balances
+    static const int k_balance_interval = 8;
+
+    // Status of a user event failed by the host, as any negative status fails an event
+    static const cl_int k_frame_abandoned = -1;
+};
+
+#endif // _SPLIT_FRAME_H_
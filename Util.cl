@@ -28,16 +28,143 @@ float4 ReadPixel4(
     return read_imagef(plane, frame, coordinates);
 }
 
+// Planes filtered in linear light are converted once, by ConvertToLinear,
+// after they arrive on the device. Kernels read the converted plane as 
+// they would any other. Filtered pixels are converted back to gamma space
+// as they are written. The transfer is a pure power of 2.4, as BT.1886.
+#define DISPLAY_GAMMA 2.4f
+
+// GammaToLinear4
+// Converts four pixels from gamma space to linear light
+float4 GammaToLinear4(
+    const       float4      pixel) {        // four pixels in gamma space
+
+    return powr(pixel, DISPLAY_GAMMA);
+}
+
+// LinearToGamma4
+// Converts four pixels from linear light to gamma space
+float4 LinearToGamma4(
+    const       float4      pixel) {        // four pixels in linear light
+
+    return powr(pixel, 1.f / DISPLAY_GAMMA);
+}
+
+// Each alpha entry packs a sample's weight above its pixel. Pixels of 
+// 8-bit planes take the low 8 bits, leaving 24 for the weight. Pixels of
+// 16-bit planes take 16 bits, leaving 16 for the weight, which still
+// resolves every weight that can make a visible difference to the
+// average. Entries remain uints, so the sort and the buffers are the same
+// for both.
+//
+// Pixels of float planes are not coded at all. Each is written to the
+// region's pixel stream, at the address of its entry, and the entry holds
+// the sample's position in its set instead, from which the pixel is found
+// once the set has been sorted.
+
+// IsExactSample
+// Samples from planes of floats are kept exactly, in the pixel stream.
+// Linear planes made from 16-bit planes are floats.
+bool IsExactSample(
+    const       int         channel_data_type) {    // CLK_UNORM_INT8 etc.
+
+    return channel_data_type == CLK_FLOAT;
+}
+
+// SampleBits
+// Returns the count of bits beneath the weight of an alpha entry, given the
+// channel data type of the plane the sample comes from. Linear planes made
+// from 8-bit planes are half floats.
+int SampleBits(
+    const       int         channel_data_type,  // CLK_UNORM_INT8 etc.
+    const       int         alpha_set_size) {   // number of weight/pixel pairs per target pixel
+
+    if (IsExactSample(channel_data_type)) return 32 - clz(alpha_set_size - 1);
+    return (channel_data_type == CLK_UNORM_INT16) ? 16 : 8;
+}
+
+// PackSampleWeight
+// Returns a sample's weight, in the range 0.f to 1.f, in the bits of an
+// alpha entry above its pixel
+uint PackSampleWeight(
+    const       float       weight,         // weight of the sample
+    const       int         pixel_bits) {   // count of bits of the pixel's code
+
+    return (uint)floor((float)(UINT_MAX >> pixel_bits) * weight) << pixel_bits;
+}
+
+// PackSamplePixel
+// Returns the code of a sample pixel, for packing beneath its weight.
+// Linear light is coded by its square root, so that dark pixels keep the
+// precision that gamma gives them.
+uint PackSamplePixel(
+    const       float       pixel,          // sample pixel in the range 0.f to 1.f
+    const       int         linear,         // pixel is in linear light
+    const       int         pixel_bits) {   // count of bits of the code
+
+    const float code_max = (float)((1 << pixel_bits) - 1);
+    return linear ? (uint)(code_max * sqrt(pixel) + 0.5f) : (uint)floor(code_max * pixel);
+}
+
+// UnpackSamplePixel
+// Returns the sample pixel coded by PackSamplePixel
+float UnpackSamplePixel(
+    const       uint        code,           // code of the pixel
+    const       int         linear,         // pixel is in linear light
+    const       int         pixel_bits) {   // count of bits of the code
+
+    const float pixel = (float)code / (float)((1 << pixel_bits) - 1);
+    return linear ? pixel * pixel : pixel;
+}
+
 void WritePixel4(
     const       float4      pixel,          // four contiguous pixels to be written            
     const       int2        coordinates,    // coordinates of the left-most pixel (as vec4 coordinates)
     const       int         linear,         // 1 means treat the pixel as being in linear space and convert back to gamma space
     write_only  image2d_t   plane) {        // output plane
 
-    write_imagef(plane, coordinates, pixel);
+    // Tiles and regions at the plane's right and bottom edges may extend
+    // beyond the image, whose writes would be undefined
+    if (coordinates.x >= get_image_width(plane) || coordinates.y >= get_image_height(plane)) return;
+
+    write_imagef(plane, coordinates, linear ? LinearToGamma4(pixel) : pixel);
+}
+
+// ConvertToLinear
+// Converts a plane in gamma space to linear light, once per plane 
+// uploaded. Each work item converts one texel, 4 pixels.
+__kernel void ConvertToLinear(
+    read_only   image2d_t   gamma_plane,    // plane as uploaded
+    const       int         width,          // width in pixels
+    const       int         height,         // height in pixels
+    write_only  image2d_t   linear_plane) { // plane in linear light, read by the filter kernels
+
+    const int2 texel = (int2)(get_global_id(0), get_global_id(1));
+    if (texel.x >= ((width + 3) >> 2) || texel.y >= height) return;
+
+    write_imagef(linear_plane, texel, GammaToLinear4(ReadPixel4(gamma_plane, texel)));
 }
 
 
+// The image weighting kernels' work groups each weight a tile of target
+// pixels that's 8 wide and TILE_ROWS high, with 8 cooperators for each
+// pixel, so the group is 8 by 8 * TILE_ROWS. The host compiles the program
+// for the tile height that the device's geometry names, defining
+// TILE_ROWS and SAMPLE_CACHE_ROWS as it defines ALPHASIZE. The Finalise
+// kernels always take 8x2 tiles.
+#if SAMPLE_CACHE_ROWS < TILE_ROWS + 30 || (SAMPLE_CACHE_ROWS & 1) != 0
+#error "SAMPLE_CACHE_ROWS must be even and span the tile with 15 rows either side"
+#endif
+
+// Work items in a group of the weighting kernels
+#define TILE_ITEMS (TILE_ROWS << 6)
+
+// Floats in the target cache of a weighting tile, 16 wide
+#define TARGET_CACHE_SIZE ((TILE_ROWS + 6) << 4)
+
+// Floats in the sample cache of a weighting tile, 40 wide
+#define SAMPLE_CACHE_SIZE (SAMPLE_CACHE_ROWS * 40)
+
 // GetLocalID
 // Returns the coordinates of the work item within the work group
 int2 GetLocalID() {
@@ -58,6 +185,20 @@ int2 GetCoordinates8x2(
     return top_left + GetRegionCoordinates8x2();
 }
 
+// GetRegionCoordinatesTile
+// The weighting tile's top-left position in the region
+int2 GetRegionCoordinatesTile() {
+    return (int2)(get_group_id(0) << 3, mul24((int)get_group_id(1), TILE_ROWS));
+}
+
+// GetCoordinatesTile
+// The weighting tile's top-left position in the plane
+int2 GetCoordinatesTile(
+    const int2 top_left) {  // coordinates of the top left corner of the region to be filtered
+
+    return top_left + GetRegionCoordinatesTile();
+}
+
 // GetLocalCoordinates
 // Coordinates within the workgroup of the pixel being filtered
 int2 GetLocalCoordinates() {
@@ -72,6 +213,14 @@ int2 GetTargetCoordinates(
     return GetCoordinates8x2(top_left) + GetLocalCoordinates();
 }
 
+// GetTileTargetCoordinates
+// Coordinates of the pixel being weighted
+int2 GetTileTargetCoordinates(
+    const int2 top_left) {  // coordinates of the top left corner of the region to be filtered
+
+    return GetCoordinatesTile(top_left) + GetLocalCoordinates();
+}
+
 // GetRegionBaseAddress
 // Base address within the region_alpha buffer for all alpha samples
 int GetRegionBaseAddress(
@@ -85,13 +234,15 @@ int GetRegionBaseAddress(
 
 // GetFilterRegionBaseAddress
 // Base address within the region_alpha buffer for all alpha samples
-// with an offset for the cooperator
+// of the pixel being weighted, with an offset for the cooperator
 int GetFilterRegionBaseAddress(
     const int width,            // width in pixels
     const int alpha_set_size) { // number of weight/pixel pairs per target pixel
 
     const int cooperator_id = get_local_id(0);
-    return GetRegionBaseAddress(width, alpha_set_size) + cooperator_id;
+    const int2 region_coordinates = GetRegionCoordinatesTile() + GetLocalCoordinates();
+    const int region_pixel_base = mad24(region_coordinates.y, width, region_coordinates.x);
+    return mad24(region_pixel_base, alpha_set_size, cooperator_id);
 }
 
 // GetCoord4
@@ -315,6 +466,32 @@ int2 GetSetMax(
     return set_max;
 }
 
+// IsInteriorPixel
+// Returns true if the set of samples of the target pixel, along with
+// the windows around them, lies wholly within the plane, so that none of
+// the set's coordinates need to be adjusted or clamped.
+bool IsInteriorPixel(
+    int2    target,     // coordinates of pixel being filtered
+    int2    image_max,  // width,height of image (1-based)
+    int     radius) {   // radius of the set of samples
+
+    // The same bounds that GetSetMax applies
+    const int2 set_max = target + (int2)(radius, radius);
+    const int2 set_min = target - (int2)(radius, radius);
+    return all(set_max <= image_max - (int2)(4, 4)) && all(set_min >= (int2)(3, 3));
+}
+
+// IsInteriorTile
+// Returns true if every pixel of the work group's weighting tile is interior
+bool IsInteriorTile(
+    const   int2    top_left,   // coordinates of the top left corner of the region to be filtered
+            int2    image_max,  // width,height of image (1-based)
+            int     radius) {   // radius of the set of samples
+
+    const int2 tile = GetCoordinatesTile(top_left);
+    return IsInteriorPixel(tile, image_max, radius) && IsInteriorPixel(tile + (int2)(7, TILE_ROWS - 1), image_max, radius);
+}
+
 // GetSampleCacheBaseCoordinates
 // Returns the input plane coordinates at O, in the following picture of the top
 // half + 1 row of the sample cache:
@@ -341,7 +518,7 @@ int2 GetSetMax(
 // o = sample window
 // x = sample pixel
 // T = target pixel
-// t = 7 other target pixels in the 8x2 tile
+// t = other target pixels in the tile
 int2 GetSampleCacheBaseCoordinates(
     const   int2    top_left,   // coordinates of the top left corner of the region to be filtered
             int2    image_max) {// width,height of image (1-based)
@@ -353,12 +530,12 @@ int2 GetSampleCacheBaseCoordinates(
     // fixed, and based on x == 4.
     //
     // Additionally, the base is the same for all work items - it does not
-    // vary with target pixel position within the 8x2 tile.
+    // vary with target pixel position within the tile.
     //
     // TODO need to be careful about what happens when x != 4 and T is near bottom-right
 
     int radius = GetRadius(4);
-    int2 target = GetCoordinates8x2(top_left);
+    int2 target = GetCoordinatesTile(top_left);
     int2 set_max = GetSetMax(target, image_max, radius);
     int2 base = set_max - (int2)(GetSetSide(radius) - 1, GetSetSide(radius) - 1);
     base -= (int2)(3, 3);
@@ -419,98 +596,231 @@ int IsMaster() {
             : 0;
 }
 
-// PopulateSampleCache32x32
-// 32x32 subset of the sample cache is constructed based on pixels with origin 
-// at (-15, -15) from the work-group's left-most pixel.
-void PopulateSampleCache32x32(
+// PopulateSampleCache32Wide
+// The left 32 columns of the sample cache are constructed based on pixels
+// with origin at (-15, -15) from the work-group's left-most pixel.
+void PopulateSampleCache32Wide(
     read_only   image2d_t   plane,              // input plane
     const       int         linear,             // process plane in linear space instead of gamma space - TODO delete
     const       int2        sample_cache_base,  // coordinates in plane for top left of the cache
-    local       float       *sample_cache) {    // caches pixels around the 8x2 tile of target pixels
+    local       float       *sample_cache) {    // caches pixels around the tile of target pixels
 
-    // Each work item is responsible for 8 pixels, arranged as a 4x2 block.
+    // Each work item is responsible for 8 pixels, arranged as a 4x2 block, 
+    // in each pair of rows that it visits. The group's rows of work items
+    // step down the cache together.
 
-    int2 coordinates = sample_cache_base;
-    int2 local_pos = GetLocalID();
-    int2 offset = (int2)(local_pos.x << 2, local_pos.y << 1);
-    coordinates += offset;
+    const int2 local_pos = GetLocalID();
+    for (int pair = local_pos.y; pair < (SAMPLE_CACHE_ROWS >> 1); pair += TILE_ROWS << 3) {
+        const int2 offset = (int2)(local_pos.x << 2, pair << 1);
 
-    float8 pixel_block = ReadPixel4x2(plane, coordinates, linear);
+        float8 pixel_block = ReadPixel4x2(plane, sample_cache_base + offset, linear);
 
-    int cache_address = mul24(local_pos.y, 20) + local_pos.x;
-    vstore4(pixel_block.s0123, cache_address, sample_cache);
-    cache_address += 10;
-    vstore4(pixel_block.s4567, cache_address, sample_cache);
+        int cache_address = mul24(pair, 20) + local_pos.x;
+        vstore4(pixel_block.s0123, cache_address, sample_cache);
+        cache_address += 10;
+        vstore4(pixel_block.s4567, cache_address, sample_cache);
+    }
     barrier(CLK_LOCAL_MEM_FENCE);
 }
 
-// PopulateSampleCache8x32
-// 8x32 subset of the sample cache is constructed based on pixels with origin 
-// at (16, -15) from the work-group's left-most pixel.
-void PopulateSampleCache8x32(
+// PopulateSampleCache8Wide
+// The right 8 columns of the sample cache are constructed based on pixels
+// with origin at (16, -15) from the work-group's left-most pixel.
+void PopulateSampleCache8Wide(
     read_only   image2d_t   plane,              // input plane
     const       int         linear,             // process plane in linear space instead of gamma space
     const       int2        sample_cache_base,  // coordinates in plane for top left of the cache
-    local       float       *sample_cache) {    // caches pixels around the 8x2 tile of target pixels
+    local       float       *sample_cache) {    // caches pixels around the tile of target pixels
 
-    // Each work item is responsible for vertical strip of 4 pixels, arranged as a 1x4 block.
+    // Each work item is responsible for a vertical strip of 2 pixels in
+    // each pair of rows that it visits.
 
-    int2 coordinates = sample_cache_base;
-    int2 local_pos = GetLocalID();
-    int2 offset = (int2)(local_pos.x + 32, local_pos.y << 1);
-    coordinates += offset;
+    const int2 local_pos = GetLocalID();
+    for (int pair = local_pos.y; pair < (SAMPLE_CACHE_ROWS >> 1); pair += TILE_ROWS << 3) {
+        const int2 offset = (int2)(local_pos.x + 32, pair << 1);
 
-    float2 column = ReadPixel1x2(plane, coordinates, linear);
+        float2 column = ReadPixel1x2(plane, sample_cache_base + offset, linear);
 
-    int cache_address = mul24(offset.y, 40) + offset.x;
-    sample_cache[cache_address] = column.x;
-    cache_address += 40;
-    sample_cache[cache_address] = column.y;
+        int cache_address = mul24(offset.y, 40) + offset.x;
+        sample_cache[cache_address] = column.x;
+        cache_address += 40;
+        sample_cache[cache_address] = column.y;
+    }
     barrier(CLK_LOCAL_MEM_FENCE);
 }
 
 // PopulateSampleCache
-// 40x32 cache of pixels with origin at (-15, -15) from the work-group's
-// left-most target pixel.
+// 40 wide cache of SAMPLE_CACHE_ROWS rows of pixels with origin at 
+// (-15, -15) from the work-group's left-most target pixel.
 void PopulateSampleCache(
     read_only   image2d_t   plane,                          // input plane
     const       int         linear,                         // process plane in linear space instead of gamma space
                 int2        sample_cache_base_coordinates,  // coordinates in plane for top left of the cache
-    local       float       *sample_cache) {                // caches pixels around the 8x2 tile of target pixels
+    local       float       *sample_cache) {                // caches pixels around the tile of target pixels
 
     // The width of the cache accounts for the 8-wide strip of pixels processed 
     // by the work group. The cache only needs to be 39 wide, but 
-    // it's simpler to schedule 128 work items across a size of 40x32.
+    // it's simpler to schedule the group's 8 columns of work items across 
+    // a width of 40.
     //
     // The cache is populated in two sections: 
-    // - 32x32 with each work item handling 8 pixels
-    PopulateSampleCache32x32(plane, linear, sample_cache_base_coordinates, sample_cache);
+    // - 32 wide with each work item handling 8 pixels in each pair of rows
+    PopulateSampleCache32Wide(plane, linear, sample_cache_base_coordinates, sample_cache);
 
-    // - 8x32 with each work item handling 2 pixels.
-    PopulateSampleCache8x32(plane, linear, sample_cache_base_coordinates, sample_cache);
+    // - 8 wide with each work item handling 2 pixels in each pair of rows.
+    PopulateSampleCache8Wide(plane, linear, sample_cache_base_coordinates, sample_cache);
 }
 
 // PopulateTargetCache
-// 16x8 window of pixels centred upon the 8-wide strip of target pixels
-// is read from memory into local memory
+// 16 wide window of pixels centred upon the 8-wide tile of target pixels,
+// with 3 rows above and below it, is read from memory into local memory
 //
-// Each work item reads two pixels. y, ordinate, corresponds with the row
-// of target pixels.
+// The work items read the window's pixels in turn, so the 128 work items
+// of a group with an 8x2 tile each read one pixel.
 //
 // The cache is 2 too wide.
 void PopulateTargetCache(
     read_only   image2d_t   plane,          // input plane
-    const       int2        top_left,       // coordinates of the top left corner of the region to be filtered
+    const       int2        tile,           // coordinates of the top left pixel of the tile
+    const       int         tile_rows,      // rows of target pixels in the tile
     const       int         linear,         // process plane in linear space instead of gamma space
-    local       float       *target_cache) {// caches pixels around the 8x2 tile of target pixels
+    local       float       *target_cache) {// caches pixels around the tile of target pixels
+
+    const int item = mad24((int)get_local_id(1), (int)get_local_size(0), (int)get_local_id(0));
+    const int item_count = mul24((int)get_local_size(0), (int)get_local_size(1));
+    const int cache_size = (tile_rows + 6) << 4;
+
+    for (int i = item; i < cache_size; i += item_count) {
+        const int2 coordinates = tile + (int2)((i & 15) - 3, (i >> 4) - 3);
+        target_cache[i] = ReadPixel(plane, coordinates, linear);
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+}
+// PopulateSampleCachePair
+// As PopulateSampleCache, for a pair of planes of the same dimensions,
+// e.g. U and V, whose caches are filled in the same pass
+void PopulateSampleCachePair(
+    read_only   image2d_t   plane_u,                        // first input plane
+    read_only   image2d_t   plane_v,                        // second input plane
+    const       int         linear,                         // process plane in linear space instead of gamma space
+                int2        sample_cache_base_coordinates,  // coordinates in plane for top left of the caches
+    local       float       *sample_cache_u,                // caches pixels of the first plane
+    local       float       *sample_cache_v) {              // caches pixels of the second plane
 
     const int2 local_pos = GetLocalID();
-    const int2 offset_top_left = GetCoordinates8x2(top_left) + (int2)(-3, -3);
-    const int2 coordinates = offset_top_left + (int2)(get_local_id(1), get_local_id(0));
 
-    float pixel = ReadPixel(plane, coordinates, linear);
+    for (int pair = local_pos.y; pair < (SAMPLE_CACHE_ROWS >> 1); pair += TILE_ROWS << 3) {
+        // 32 wide section, each work item handling a 4x2 block of each plane
+        int2 offset = (int2)(local_pos.x << 2, pair << 1);
+        int2 coordinates = sample_cache_base_coordinates + offset;
+
+        float8 pixel_block_u = ReadPixel4x2(plane_u, coordinates, linear);
+        float8 pixel_block_v = ReadPixel4x2(plane_v, coordinates, linear);
+
+        int cache_address = mul24(pair, 20) + local_pos.x;
+        vstore4(pixel_block_u.s0123, cache_address, sample_cache_u);
+        vstore4(pixel_block_v.s0123, cache_address, sample_cache_v);
+        cache_address += 10;
+        vstore4(pixel_block_u.s4567, cache_address, sample_cache_u);
+        vstore4(pixel_block_v.s4567, cache_address, sample_cache_v);
+
+        // 8 wide section, each work item handling a 1x2 column of each plane
+        offset = (int2)(local_pos.x + 32, pair << 1);
+        coordinates = sample_cache_base_coordinates + offset;
+
+        float2 column_u = ReadPixel1x2(plane_u, coordinates, linear);
+        float2 column_v = ReadPixel1x2(plane_v, coordinates, linear);
+
+        cache_address = mul24(offset.y, 40) + offset.x;
+        sample_cache_u[cache_address] = column_u.x;
+        sample_cache_v[cache_address] = column_v.x;
+        cache_address += 40;
+        sample_cache_u[cache_address] = column_u.y;
+        sample_cache_v[cache_address] = column_v.y;
+    }
+
+    // The sections do not overlap, so one barrier serves both
+    barrier(CLK_LOCAL_MEM_FENCE);
+}
 
-    target_cache[(get_local_id(0) << 4) + get_local_id(1)] = pixel;
+// PopulateTargetCachePair
+// As PopulateTargetCache, for a pair of planes of the same dimensions
+void PopulateTargetCachePair(
+    read_only   image2d_t   plane_u,            // first input plane
+    read_only   image2d_t   plane_v,            // second input plane
+    const       int2        tile,               // coordinates of the top left pixel of the tile
+    const       int         tile_rows,          // rows of target pixels in the tile
+    const       int         linear,             // process plane in linear space instead of gamma space
+    local       float       *target_cache_u,    // caches pixels around the tile of the first plane
+    local       float       *target_cache_v) {  // caches pixels around the tile of the second plane
+
+    const int item = mad24((int)get_local_id(1), (int)get_local_size(0), (int)get_local_id(0));
+    const int item_count = mul24((int)get_local_size(0), (int)get_local_size(1));
+    const int cache_size = (tile_rows + 6) << 4;
+
+    for (int i = item; i < cache_size; i += item_count) {
+        const int2 coordinates = tile + (int2)((i & 15) - 3, (i >> 4) - 3);
+        target_cache_u[i] = ReadPixel(plane_u, coordinates, linear);
+        target_cache_v[i] = ReadPixel(plane_v, coordinates, linear);
+    }
 
     barrier(CLK_LOCAL_MEM_FENCE);
-}
\ No newline at end of file
+}
+
+// PopulateCaches
+// Fills the target and sample caches of each tile of the region as
+// the weighting kernels do, and does nothing else, so that the cost of
+// the fills can be timed apart from the weighting that follows them.
+__attribute__((reqd_work_group_size(8, TILE_ROWS << 3, 1)))
+__kernel void PopulateCaches(
+    read_only   image2d_t   input_plane,    // input plane
+    const       int         width,          // width in pixels
+    const       int         height,         // height in pixels
+    const       int2        top_left,       // coordinates of the top left corner of the region
+    global      float       *checksums) {   // a value per work group, so that the fills are not discarded
+
+    local float target_cache[TARGET_CACHE_SIZE];
+    local float sample_cache[SAMPLE_CACHE_SIZE];
+
+    PopulateTargetCache(input_plane, GetCoordinatesTile(top_left), TILE_ROWS, 0, target_cache);
+    PopulateSampleCache(input_plane, 0, GetSampleCacheBaseCoordinates(top_left, (int2)(width, height)), sample_cache);
+
+    if (get_local_id(0) != 0 || get_local_id(1) != 0) return;
+
+    float checksum = 0.f;
+    for (int i = 0; i < TARGET_CACHE_SIZE; ++i) 
+        checksum += target_cache[i];
+    for (int i = 0; i < SAMPLE_CACHE_SIZE; i += 10) 
+        checksum += sample_cache[i];
+    checksums[mad24(get_group_id(1), get_num_groups(0), get_group_id(0))] = checksum;
+}
+
+// DownsampleGuide
+// Averages the luma plane down to the dimensions of the chroma planes,
+// producing the guide whose windows weight chroma's samples. Each work
+// item produces one texel, 4 pixels, of the guide.
+__kernel void DownsampleGuide(
+    read_only   image2d_t   luma_plane,     // input luma plane
+    const       int2        scale,          // luma pixels per guide pixel across and down, 1 or 2
+    const       int         width,          // width of the guide in pixels
+    const       int         height,         // height of the guide in pixels
+    write_only  image2d_t   guide_plane) {  // luma at chroma's dimensions
+
+    const int2 texel = (int2)(get_global_id(0), get_global_id(1));
+    if (texel.x >= ((width + 3) >> 2) || texel.y >= height) return;
+
+    const int2 luma_texel = (int2)(mul24(texel.x, scale.x), mul24(texel.y, scale.y));
+
+    float4 left = ReadPixel4(luma_plane, luma_texel);
+    float4 right = (scale.x == 2) ? ReadPixel4(luma_plane, luma_texel + (int2)(1, 0)) : left;
+    if (scale.y == 2) {
+        left = 0.5f * (left + ReadPixel4(luma_plane, luma_texel + (int2)(0, 1)));
+        right = 0.5f * (right + ReadPixel4(luma_plane, luma_texel + (int2)(scale.x - 1, 1)));
+    }
+
+    // Pairs of luma pixels across are averaged when chroma is half width
+    const float4 guide = (scale.x == 2) ? 0.5f * (float4)(left.xz + left.yw, right.xz + right.yw) : left;
+
+    write_imagef(guide_plane, texel, guide);
+}
@@ -8,6 +8,7 @@
 #include "result.h"
 #include "buffer.h"
 #include "util.h"
+#include "Profiler.h"
 
 extern cl_int        g_last_cl_error;
 extern cl_context    g_context;
@@ -119,13 +120,25 @@ result Buffer::CopyFrom(
     return FILTER_OK;
 }
 
+// ImageRegionBytes
+// Size in bytes of a region of an image, for the profiler
+static size_t ImageRegionBytes(
+    const   cl_mem  &image,
+    const   size_t  *region) {
+
+    size_t element_size = 0;
+    clGetImageInfo(image, CL_IMAGE_ELEMENT_SIZE, sizeof(element_size), &element_size, NULL);
+    return element_size * region[0] * region[1];
+}
+
 // Plane
 void Plane::Init(
     const cl_command_queue  &cq,
     const int               &width, 
     const int               &height,
     const int               &width_constraint,
-    const int               &height_constraint) {
+    const int               &height_constraint,
+    const bool              &cal_buffer_size_fault) {
 
     cl_int cl_status = CL_SUCCESS;
 
@@ -134,12 +147,14 @@ void Plane::Init(
                        height, 
                        width_constraint, 
                        height_constraint, 
+                       cal_buffer_size_fault,
                        &width_, 
                        &height_);
 
+    const cl_image_format format = Format();
     mem_ = clCreateImage2D(g_context,
                            CL_MEM_READ_WRITE,
-                           &GetFormatPixel(),
+                           &format,
                            width_,
                            height_,
                            0,
@@ -167,6 +182,7 @@ result Plane::CopyTo(
 
     size_t zero_offset[] = {0, 0, 0}; 
     size_t copy_region[] = {ByPowerOf2(host_cols, 2) >> 2, host_rows, 1};
+    cl_event profiled = NULL;
     cl_status = clEnqueueWriteImage(cq_,
                                     mem_,
                                     CL_FALSE,
@@ -177,11 +193,12 @@ result Plane::CopyTo(
                                     &host_buffer,
                                     0,
                                     NULL,
-                                    NULL);
+                                    ProfiledEvent(NULL, &profiled));
     if (cl_status != CL_SUCCESS) {  
         g_last_cl_error = cl_status;
         return FILTER_COPYING_TO_PLANE_FAILED;
     }
+    if (g_profiler != NULL) g_profiler->Record("upload", ImageRegionBytes(mem_, copy_region), NULL, profiled);
 
     valid_ = true;
     return FILTER_OK;
@@ -202,6 +219,7 @@ result Plane::CopyToAsynch(
 
     size_t zero_offset[] = {0, 0, 0}; 
     size_t copy_region[] = {ByPowerOf2(host_cols, 2) >> 2, host_rows, 1};
+    cl_event profiled = NULL;
     cl_status = clEnqueueWriteImage(cq_,
                                     mem_,
                                     CL_FALSE,
@@ -212,11 +230,12 @@ result Plane::CopyToAsynch(
                                     &host_buffer,
                                     0,
                                     NULL,
-                                    event);
+                                    ProfiledEvent(event, &profiled));
     if (cl_status != CL_SUCCESS) {  
         g_last_cl_error = cl_status;
         return FILTER_COPYING_TO_PLANE_FAILED;
     }
+    if (g_profiler != NULL) g_profiler->Record("upload", ImageRegionBytes(mem_, copy_region), event, profiled);
 
     valid_ = true;
     return FILTER_OK;
@@ -235,6 +254,7 @@ result Plane::CopyFrom(
     size_t zero_offset[] = {0, 0, 0}; 
     size_t copy_region[] = {ByPowerOf2(host_cols,2) >> 2, host_rows, 1};
 
+    cl_event profiled = NULL;
     cl_status = clEnqueueReadImage(cq_,
                                    mem_,
                                    CL_FALSE,
@@ -245,11 +265,12 @@ result Plane::CopyFrom(
                                    host_buffer,
                                    0,
                                    NULL,
-                                   NULL);
+                                   ProfiledEvent(NULL, &profiled));
     if (cl_status != CL_SUCCESS) {  
         g_last_cl_error = cl_status;
         return FILTER_COPYING_FROM_PLANE_FAILED;
     }
+    if (g_profiler != NULL) g_profiler->Record("readback", ImageRegionBytes(mem_, copy_region), NULL, profiled);
 
     return FILTER_OK;
 }
@@ -262,32 +283,276 @@ result Plane::CopyFromAsynch(
             cl_event        *event,
             unsigned char   *host_buffer) {
 
+    const int first_row = 0;
+    return CopyFromAsynch(cq_, first_row, host_cols, host_rows, host_pitch, antecedent, event, host_buffer);
+}
+
+result Plane::CopyFromAsynch(
+    const   cl_command_queue    &cq,
+    const   int                 &first_row,
+    const   int                 &host_cols,                 
+    const   int                 &host_rows,                 
+    const   int                 &host_pitch,
+    const   cl_event            *antecedent,
+            cl_event            *event,
+            unsigned char       *host_buffer) {
+
     if (!valid_) return FILTER_INVALID_PLANE_BUFFER_STATE;
 
     cl_int cl_status = CL_SUCCESS;
 
-    size_t zero_offset[] = {0, 0, 0}; 
+    size_t row_offset[] = {0, first_row, 0}; 
     size_t copy_region[] = {ByPowerOf2(host_cols,2) >> 2, host_rows, 1};
 
-    cl_status = clEnqueueReadImage(cq_,
+    cl_event profiled = NULL;
+    cl_status = clEnqueueReadImage(cq,
                                    mem_,
                                    CL_FALSE,
-                                   zero_offset,
+                                   row_offset,
                                    copy_region,
                                    host_pitch,
                                    0,
                                    host_buffer,
                                    (antecedent == NULL) ? 0 : 1,
                                    antecedent,
-                                   event);
+                                   ProfiledEvent(event, &profiled));
     if (cl_status != CL_SUCCESS) {  
         g_last_cl_error = cl_status;
         return FILTER_COPYING_FROM_PLANE_FAILED;
     }
+    if (g_profiler != NULL) g_profiler->Record("readback", ImageRegionBytes(mem_, copy_region), event, profiled);
 
     return FILTER_OK;
 }
 
+void Plane::Wrap(
+    const cl_command_queue  &cq,
+    const unsigned char     *host_buffer,
+    const int               &width, 
+    const int               &height,
+    const int               &host_pitch,
+    const int               &alignment) {
+
+    cl_int cl_status = CL_SUCCESS;
+
+    cq_     = cq;
+    width_  = ByPowerOf2(width, 2) >> 2;
+    height_ = height;
+
+    const cl_image_format format = Format();
+    mem_ = clCreateImage2D(g_context,
+                           HostFlags(host_buffer, alignment),
+                           &format,
+                           width_,
+                           height_,
+                           host_pitch,
+                           const_cast<unsigned char*>(host_buffer),
+                           &cl_status);
+    if (cl_status != CL_SUCCESS) {  
+        g_last_cl_error = cl_status;
+        return;
+    }
+
+    valid_ = true;
+}
+
+cl_mem_flags Plane::HostFlags(
+    const unsigned char     *host_buffer,
+    const int               &alignment) {
+
+    // Unaligned buffers cannot be used in place by the device, so the 
+    // driver would have to shadow them anyway. Copying at creation makes
+    // that explicit.
+    const bool aligned = alignment <= 1 || (reinterpret_cast<size_t>(host_buffer) % alignment) == 0;
+    return CL_MEM_READ_ONLY | (aligned ? CL_MEM_USE_HOST_PTR : CL_MEM_COPY_HOST_PTR);
+}
+
+// PitchedPlane
+void PitchedPlane::Init(
+    const cl_command_queue  &cq,
+    const int               &width, 
+    const int               &height,
+    const int               &width_constraint,
+    const int               &height_constraint,
+    const bool              &cal_buffer_size_fault) {
+
+    Init(cq, width, height, GetPitchedPlanePitch(width));
+}
+
+void PitchedPlane::Init(
+    const cl_command_queue  &cq,
+    const int               &width, 
+    const int               &height,
+    const int               &pitch) {
+
+    cl_int cl_status = CL_SUCCESS;
+
+    cq_     = cq;
+    width_  = width;
+    height_ = height;
+    pitch_  = pitch;
+
+    mem_ = clCreateBuffer(g_context,
+                          CL_MEM_READ_WRITE,
+                          pitch_ * height_,
+                          NULL,
+                          &cl_status);
+    if (cl_status != CL_SUCCESS) {  
+        g_last_cl_error = cl_status;
+        return;
+    }
+
+    valid_ = true;
+}
+
+result PitchedPlane::CopyTo(
+    const unsigned char &host_buffer,             
+    const int           &host_cols,                 
+    const int           &host_rows,                 
+    const int           &host_pitch) {
+
+    return CopyToAsynch(host_buffer, host_cols, host_rows, host_pitch, NULL);
+}
+
+result PitchedPlane::CopyToAsynch(
+    const   unsigned char   &host_buffer,             
+    const   int             &host_cols,                 
+    const   int             &host_rows,                 
+    const   int             &host_pitch,
+            cl_event        *event) {
+    
+    if (!valid_) return FILTER_INVALID_PLANE_BUFFER_STATE;
+
+    valid_ = false;
+
+    cl_int cl_status = CL_SUCCESS;
+
+    size_t zero_offset[] = {0, 0, 0}; 
+    size_t copy_region[] = {host_cols, host_rows, 1};
+    cl_event profiled = NULL;
+    cl_status = clEnqueueWriteBufferRect(cq_,
+                                         mem_,
+                                         CL_FALSE,
+                                         zero_offset,
+                                         zero_offset,
+                                         copy_region,
+                                         pitch_,
+                                         0,
+                                         host_pitch,
+                                         0,
+                                         &host_buffer,
+                                         0,
+                                         NULL,
+                                         ProfiledEvent(event, &profiled));
+    if (cl_status != CL_SUCCESS) {  
+        g_last_cl_error = cl_status;
+        return FILTER_COPYING_TO_PLANE_FAILED;
+    }
+    if (g_profiler != NULL) g_profiler->Record("upload", host_cols * host_rows, event, profiled);
+
+    valid_ = true;
+    return FILTER_OK;
+}
+
+result PitchedPlane::CopyFrom(
+    const int           &host_cols,                 
+    const int           &host_rows,                 
+    const int           &host_pitch,
+          unsigned char *host_buffer) {
+
+    const int first_row = 0;
+    return CopyFromAsynch(cq_, first_row, host_cols, host_rows, host_pitch, NULL, NULL, host_buffer);
+}
+
+result PitchedPlane::CopyFromAsynch(
+    const   cl_command_queue    &cq,
+    const   int                 &first_row,
+    const   int                 &host_cols,                 
+    const   int                 &host_rows,                 
+    const   int                 &host_pitch,
+    const   cl_event            *antecedent,
+            cl_event            *event,
+            unsigned char       *host_buffer) {
+
+    if (!valid_) return FILTER_INVALID_PLANE_BUFFER_STATE;
+
+    cl_int cl_status = CL_SUCCESS;
+
+    size_t row_offset[] = {0, first_row, 0}; 
+    size_t zero_offset[] = {0, 0, 0}; 
+    size_t copy_region[] = {host_cols, host_rows, 1};
+
+    cl_event profiled = NULL;
+    cl_status = clEnqueueReadBufferRect(cq,
+                                        mem_,
+                                        CL_FALSE,
+                                        row_offset,
+                                        zero_offset,
+                                        copy_region,
+                                        pitch_,
+                                        0,
+                                        host_pitch,
+                                        0,
+                                        host_buffer,
+                                        (antecedent == NULL) ? 0 : 1,
+                                        antecedent,
+                                        ProfiledEvent(event, &profiled));
+    if (cl_status != CL_SUCCESS) {  
+        g_last_cl_error = cl_status;
+        return FILTER_COPYING_FROM_PLANE_FAILED;
+    }
+    if (g_profiler != NULL) g_profiler->Record("readback", host_cols * host_rows, event, profiled);
+
+    return FILTER_OK;
+}
+
+void PitchedPlane::Wrap(
+    const cl_command_queue  &cq,
+    const unsigned char     *host_buffer,
+    const int               &width, 
+    const int               &height,
+    const int               &host_pitch,
+    const int               &alignment) {
+
+    cl_int cl_status = CL_SUCCESS;
+
+    cq_     = cq;
+    width_  = width;
+    height_ = height;
+    pitch_  = host_pitch;
+
+    mem_ = clCreateBuffer(g_context,
+                          HostFlags(host_buffer, alignment),
+                          pitch_ * height_,
+                          const_cast<unsigned char*>(host_buffer),
+                          &cl_status);
+    if (cl_status != CL_SUCCESS) {  
+        g_last_cl_error = cl_status;
+        return;
+    }
+
+    valid_ = true;
+}
+
+cl_image_format Plane::Format() {
+    return GetFormatPixel();
+}
+
+// WidePlane
+cl_image_format WidePlane::Format() {
+    return GetFormatWidePixel();
+}
+
+// LinearPlane
+cl_image_format LinearPlane::Format() {
+    return GetFormatLinearPixel();
+}
+
+// FloatPlane
+cl_image_format FloatPlane::Format() {
+    return GetFormatFloatPixel();
+}
+
 cl_image_format GetFormatPixel() {
     // Image processing uses floating point arithmetic.
     // The device automatically converts integers between the host
@@ -303,3 +568,32 @@ cl_image_format GetFormatPixel() {
 
     return format;
 }
+
+cl_image_format GetFormatWidePixel() {
+    cl_image_format format;
+
+    format.image_channel_order      = CL_RGBA;
+    // unsigned normalised short, i.e. 0 to 65535 seen by host, is 0.f to 1.f in kernel
+    format.image_channel_data_type  = CL_UNORM_INT16;
+
+    return format;
+}
+
+cl_image_format GetFormatLinearPixel() {
+    cl_image_format format;
+
+    format.image_channel_order      = CL_RGBA;
+    // 16-bit float, read and written as float in kernels
+    format.image_channel_data_type  = CL_HALF_FLOAT;
+
+    return format;
+}
+
+cl_image_format GetFormatFloatPixel() {
+    cl_image_format format;
+
+    format.image_channel_order      = CL_RGBA;
+    format.image_channel_data_type  = CL_FLOAT;
+
+    return format;
+}
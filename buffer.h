@@ -75,7 +75,8 @@ private:
 // Includes padding:
 //  - final byte4 on each row is padded with zeroes if necessary
 //    - width and height of the buffer is further expanded and 
-//    zero-padded to work-around an underlying CAL bug
+//    zero-padded to work-around an underlying CAL bug, on
+//    devices that have it
 class Plane: public Mem {
 public:
     // Init
@@ -87,18 +88,22 @@ public:
     // a kernel that accesses pixels in horizontal strips
     // of 4 (uchar4, effectively) can specify a 
     // width_constraint of 2.
+    //
+    // Devices that have the CAL buffer size fault get planes
+    // whose dimensions are padded further, see FixCALBufferSizeFault.
     virtual void Init(
         const   cl_command_queue    &cq,                // command queue, corresponds with the device holding the buffer
         const   int                 &width,             // width in pixels
         const   int                 &height,            // height in pixels
         const   int                 &width_constraint,  // power of 2 specifier for width of buffer
-        const   int                 &height_constraint);// power of 2 specifier for height of buffer
+        const   int                 &height_constraint, // power of 2 specifier for height of buffer
+        const   bool                &cal_buffer_size_fault);    // device requires the CAL workaround
 
     // CopyTo
     // Copy pixels from host buffer to device buffer
     // Method returns immediately, i.e. copy completion 
     // is not guaranteed upon return
-    result CopyTo(
+    virtual result CopyTo(
         const   unsigned char       &host_buffer,       // host's buffer of pixels in row major layout    
         const   int                 &host_cols,         // count of pixels per row to be copied
         const   int                 &host_rows,         // count of rows to be copied
@@ -109,7 +114,7 @@ public:
     // Method returns immediately, i.e. copy completion 
     // is not guaranteed upon return. Event can be used
     // to discern when copy has finished.
-    result CopyToAsynch(
+    virtual result CopyToAsynch(
         const   unsigned char       &host_buffer,       // host's buffer of pixels in row major layout    
         const   int                 &host_cols,         // count of pixels per row to be copied        
         const   int                 &host_rows,         // count of rows to be copied        
@@ -120,7 +125,7 @@ public:
     // Copy pixels from device buffer to host buffer.
     // Method returns immediately, i.e. copy completion 
     // is not guaranteed upon return
-    result CopyFrom(                                    
+    virtual result CopyFrom(                                    
         const   int                 &host_cols,         // count of pixels per row to be copied        
         const   int                 &host_rows,         // count of rows to be copied                        
         const   int                 &host_pitch,        // size in pixels of each row of host buffer                    
@@ -135,7 +140,24 @@ public:
     // completion. Set to NULL for an immediate copy.
     //
     // Event can be used to discern when copy has finished.
-    result CopyFromAsynch(
+    virtual result CopyFromAsynch(
+        const   int                 &host_cols,         // count of pixels per row to be copied        
+        const   int                 &host_rows,         // count of rows to be copied                            
+        const   int                 &host_pitch,        // size in pixels of each row of host buffer    
+        const   cl_event            *antecedent,        // event that must complete before this copy can start
+                cl_event            *event,             // event to track completion of this copy
+                unsigned char       *host_buffer);      // host's buffer of floats in row major layout
+
+    // CopyFromAsynch
+    // Copy a band of rows from device buffer to host buffer, 
+    // using the command queue supplied rather than the plane's 
+    // own. This allows rows that have been completed to be 
+    // copied whilst the plane's queue continues with other work.
+    //
+    // host_buffer is the address of first_row in the host's buffer.
+    virtual result CopyFromAsynch(
+        const   cl_command_queue    &cq,                // command queue used solely for the copy
+        const   int                 &first_row,         // first row of the plane to be copied
         const   int                 &host_cols,         // count of pixels per row to be copied        
         const   int                 &host_rows,         // count of rows to be copied                            
         const   int                 &host_pitch,        // size in pixels of each row of host buffer    
@@ -143,14 +165,175 @@ public:
                 cl_event            *event,             // event to track completion of this copy
                 unsigned char       *host_buffer);      // host's buffer of floats in row major layout
 
+    // Wrap
+    // Set up a read-only plane that uses the pixels in the host's
+    // buffer in place, rather than a copy of them. On devices that 
+    // share memory with the host the device reads the host's buffer
+    // directly, which must remain valid and unchanged until the plane
+    // is destroyed.
+    //
+    // A host buffer that is not aligned as the device requires is
+    // copied once, when the plane is set up.
+    virtual void Wrap(
+        const   cl_command_queue    &cq,                // command queue, corresponds with the device holding the buffer
+        const   unsigned char       *host_buffer,       // host's buffer of pixels in row major layout
+        const   int                 &width,             // width in pixels
+        const   int                 &height,            // height in pixels
+        const   int                 &host_pitch,        // size in pixels of each row of host buffer
+        const   int                 &alignment);        // alignment in bytes the device requires of host buffers
+
 protected:
+    // Format
+    // Format of the image's elements
+    virtual cl_image_format Format();
+
+    // HostFlags
+    // Memory flags for a read-only object that uses the host's 
+    // buffer in place, if its alignment allows
+    cl_mem_flags HostFlags(
+        const   unsigned char       *host_buffer,       // host's buffer of pixels
+        const   int                 &alignment);        // alignment in bytes the device requires of host buffers
+
     int     width_;     // width of plane buffer in pixels
     int     height_;    // height of plane buffer
 };
 
+// WidePlane
+// A plane of 16-bit pixels, e.g. 10-, 12- or 16-bit video scaled to
+// 16-bit words. The host's words are little endian, as are the devices'.
+// Kernels read and write the pixels as floats, exactly as they do those
+// of 8-bit planes.
+class WidePlane: public Plane {
+protected:
+    cl_image_format Format() override;
+};
+
+// LinearPlane
+// A plane of pixels in linear light, stored as half floats so that dark
+// pixels keep their precision. It is written and read solely by kernels,
+// as the host's planes are in gamma space.
+class LinearPlane: public Plane {
+protected:
+    cl_image_format Format() override;
+};
+
+// FloatPlane
+// A plane of 32-bit float pixels, either the host's or those of a 
+// WidePlane converted to linear light, whose precision half floats
+// would lose. Pixels are read and written unconverted.
+class FloatPlane: public Plane {
+protected:
+    cl_image_format Format() override;
+};
+
+// PitchedPlane
+// A linear buffer of pixels stored as uchars, row by row, with an 
+// explicit pitch. Used instead of an image by devices, such as CPUs, 
+// that emulate image sampling in software.
+//
+// Rows are padded to the pitch returned by GetPitchedPlanePitch, unless
+// another pitch is specified.
+class PitchedPlane: public Plane {
+public:
+    // Init
+    // Set up a plane based upon pixel dimensions. 
+    //
+    // The pitch is derived solely from the width, so the
+    // constraints are ignored. The CAL fault only affects images.
+    void Init(
+        const   cl_command_queue    &cq,                // command queue, corresponds with the device holding the buffer
+        const   int                 &width,             // width in pixels
+        const   int                 &height,            // height in pixels
+        const   int                 &width_constraint,  // ignored
+        const   int                 &height_constraint, // ignored
+        const   bool                &cal_buffer_size_fault) override;   // ignored
+
+    // Init
+    // Set up a plane whose rows are padded to the pitch specified,
+    // e.g. to match planes that wrap host buffers.
+    void Init(
+        const   cl_command_queue    &cq,                // command queue, corresponds with the device holding the buffer
+        const   int                 &width,             // width in pixels
+        const   int                 &height,            // height in pixels
+        const   int                 &pitch);            // length in bytes of each row of the buffer
+
+    // CopyTo
+    // Copy pixels from host buffer to device buffer
+    // Method returns immediately, i.e. copy completion 
+    // is not guaranteed upon return
+    result CopyTo(
+        const   unsigned char       &host_buffer,       // host's buffer of pixels in row major layout    
+        const   int                 &host_cols,         // count of pixels per row to be copied
+        const   int                 &host_rows,         // count of rows to be copied
+        const   int                 &host_pitch) override;  // size in pixels of each row of host buffer
+                    
+    // CopyToAsynch
+    // Copy pixels from host buffer to device buffer.
+    // Event can be used to discern when copy has finished.
+    result CopyToAsynch(
+        const   unsigned char       &host_buffer,       // host's buffer of pixels in row major layout    
+        const   int                 &host_cols,         // count of pixels per row to be copied        
+        const   int                 &host_rows,         // count of rows to be copied        
+        const   int                 &host_pitch,        // size in pixels of each row of host buffer
+                cl_event            *event) override;   // event to track completion of this copy
+
+    // CopyFrom
+    // Copy pixels from device buffer to host buffer.
+    // Method returns immediately, i.e. copy completion 
+    // is not guaranteed upon return
+    result CopyFrom(                                    
+        const   int                 &host_cols,         // count of pixels per row to be copied        
+        const   int                 &host_rows,         // count of rows to be copied                        
+        const   int                 &host_pitch,        // size in pixels of each row of host buffer                    
+                unsigned char       *host_buffer) override; // host's buffer of pixels in row major layout        
+
+    using Plane::CopyFromAsynch;
+
+    // CopyFromAsynch
+    // Copy a band of rows from device buffer to host buffer, 
+    // using the command queue supplied.
+    //
+    // host_buffer is the address of first_row in the host's buffer.
+    result CopyFromAsynch(
+        const   cl_command_queue    &cq,                // command queue used solely for the copy
+        const   int                 &first_row,         // first row of the plane to be copied
+        const   int                 &host_cols,         // count of pixels per row to be copied        
+        const   int                 &host_rows,         // count of rows to be copied                            
+        const   int                 &host_pitch,        // size in pixels of each row of host buffer    
+        const   cl_event            *antecedent,        // event that must complete before this copy can start
+                cl_event            *event,             // event to track completion of this copy
+                unsigned char       *host_buffer) override; // host's buffer of pixels in row major layout
+
+    // Wrap
+    // Set up a read-only plane that uses the host's buffer in place,
+    // adopting the host's pitch.
+    void Wrap(
+        const   cl_command_queue    &cq,                // command queue, corresponds with the device holding the buffer
+        const   unsigned char       *host_buffer,       // host's buffer of pixels in row major layout
+        const   int                 &width,             // width in pixels
+        const   int                 &height,            // height in pixels
+        const   int                 &host_pitch,        // size in pixels of each row of host buffer
+        const   int                 &alignment) override;   // alignment in bytes the device requires of host buffers
+
+private:
+    int     pitch_;     // length in bytes of each row of the buffer
+};
+
 // GetFormatPixel
 // Returns a structure containing the correct settings
 // for a 2D buffer of pixels organised in 4s horizontally.
 cl_image_format GetFormatPixel();
 
+// GetFormatWidePixel
+// As GetFormatPixel, for 16-bit pixels
+cl_image_format GetFormatWidePixel();
+
+// GetFormatLinearPixel
+// As GetFormatPixel, for pixels in linear light held as half floats
+cl_image_format GetFormatLinearPixel();
+
+// GetFormatFloatPixel
+// As GetFormatPixel, for float pixels
+cl_image_format GetFormatFloatPixel();
+
 #endif // _BUFFER_H_
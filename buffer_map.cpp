@@ -79,7 +79,150 @@ result BufferMap::AllocPlane(
     result status = FILTER_OK;
 
     Plane *new_plane = new Plane;
-    new_plane->Init(cq, width, height, 2, 0);
+    new_plane->Init(cq, width, height, PLANE_WIDTH_POWER_OF_2, PLANE_HEIGHT_POWER_OF_2, cal_buffer_size_fault_);
+    if (new_plane->valid()) {
+        Mem *new_mem = new_plane;
+        status = Append(&new_mem, new_index);
+        return status;
+    } else {
+        return FILTER_PLANE_ALLOCATION_FAILED;
+    }
+}
+
+result BufferMap::AllocWidePlane(
+    const   cl_command_queue    &cq,    
+    const   int                 &width, 
+    const   int                 &height,
+    const   int                 &pixel_size,
+            int                 *new_index) {
+
+    result status = FILTER_OK;
+
+    Plane *new_plane = (pixel_size == 4) ? static_cast<Plane*>(new FloatPlane) : new WidePlane;
+    new_plane->Init(cq, width, height, PLANE_WIDTH_POWER_OF_2, PLANE_HEIGHT_POWER_OF_2, cal_buffer_size_fault_);
+    if (new_plane->valid()) {
+        Mem *new_mem = new_plane;
+        status = Append(&new_mem, new_index);
+        return status;
+    } else {
+        return FILTER_PLANE_ALLOCATION_FAILED;
+    }
+}
+
+result BufferMap::AllocLinearPlane(
+    const   cl_command_queue    &cq,    
+    const   int                 &width, 
+    const   int                 &height,
+    const   bool                &wide,
+            int                 *new_index) {
+
+    result status = FILTER_OK;
+
+    Plane *new_plane = wide ? static_cast<Plane*>(new FloatPlane) : new LinearPlane;
+    new_plane->Init(cq, width, height, PLANE_WIDTH_POWER_OF_2, PLANE_HEIGHT_POWER_OF_2, cal_buffer_size_fault_);
+    if (new_plane->valid()) {
+        Mem *new_mem = new_plane;
+        status = Append(&new_mem, new_index);
+        return status;
+    } else {
+        return FILTER_PLANE_ALLOCATION_FAILED;
+    }
+}
+
+result BufferMap::AllocPitchedPlane(
+    const   cl_command_queue    &cq,    
+    const   int                 &width, 
+    const   int                 &height,
+            int                 *new_index) {
+
+    result status = FILTER_OK;
+
+    Plane *new_plane = new PitchedPlane;
+    new_plane->Init(cq, width, height, 0, 0, false);
+    if (new_plane->valid()) {
+        Mem *new_mem = new_plane;
+        status = Append(&new_mem, new_index);
+        return status;
+    } else {
+        return FILTER_PLANE_ALLOCATION_FAILED;
+    }
+}
+
+result BufferMap::AllocPitchedPlane(
+    const   cl_command_queue    &cq,    
+    const   int                 &width, 
+    const   int                 &height,
+    const   int                 &pitch,
+            int                 *new_index) {
+
+    result status = FILTER_OK;
+
+    PitchedPlane *new_plane = new PitchedPlane;
+    new_plane->Init(cq, width, height, pitch);
+    if (new_plane->valid()) {
+        Mem *new_mem = new_plane;
+        status = Append(&new_mem, new_index);
+        return status;
+    } else {
+        return FILTER_PLANE_ALLOCATION_FAILED;
+    }
+}
+
+result BufferMap::WrapPlane(
+    const   cl_command_queue    &cq,    
+    const   byte                *host_buffer,
+    const   int                 &width, 
+    const   int                 &height,
+    const   int                 &host_pitch,
+            int                 *new_index) {
+
+    result status = FILTER_OK;
+
+    Plane *new_plane = new Plane;
+    new_plane->Wrap(cq, host_buffer, width, height, host_pitch, host_alignment_);
+    if (new_plane->valid()) {
+        Mem *new_mem = new_plane;
+        status = Append(&new_mem, new_index);
+        return status;
+    } else {
+        return FILTER_PLANE_ALLOCATION_FAILED;
+    }
+}
+
+result BufferMap::WrapWidePlane(
+    const   cl_command_queue    &cq,    
+    const   byte                *host_buffer,
+    const   int                 &width, 
+    const   int                 &height,
+    const   int                 &host_pitch,
+    const   int                 &pixel_size,
+            int                 *new_index) {
+
+    result status = FILTER_OK;
+
+    Plane *new_plane = (pixel_size == 4) ? static_cast<Plane*>(new FloatPlane) : new WidePlane;
+    new_plane->Wrap(cq, host_buffer, width, height, host_pitch, host_alignment_);
+    if (new_plane->valid()) {
+        Mem *new_mem = new_plane;
+        status = Append(&new_mem, new_index);
+        return status;
+    } else {
+        return FILTER_PLANE_ALLOCATION_FAILED;
+    }
+}
+
+result BufferMap::WrapPitchedPlane(
+    const   cl_command_queue    &cq,    
+    const   byte                *host_buffer,
+    const   int                 &width, 
+    const   int                 &height,
+    const   int                 &host_pitch,
+            int                 *new_index) {
+
+    result status = FILTER_OK;
+
+    Plane *new_plane = new PitchedPlane;
+    new_plane->Wrap(cq, host_buffer, width, height, host_pitch, host_alignment_);
     if (new_plane->valid()) {
         Mem *new_mem = new_plane;
         status = Append(&new_mem, new_index);
@@ -140,6 +283,22 @@ result BufferMap::CopyFromPlaneAsynch(
     return source->CopyFromAsynch(host_cols, host_rows, host_pitch, antecedent, event, host_buffer);
 }
 
+result BufferMap::CopyFromPlaneAsynch(
+    const   int                 &index,
+    const   cl_command_queue    &cq,
+    const   int                 &first_row,
+    const   int                 &host_cols,                 
+    const   int                 &host_rows,                 
+    const   int                 &host_pitch,
+    const   cl_event            *antecedent,
+            cl_event            *event,
+            byte                *host_buffer) {
+
+    Plane *source;
+    source = static_cast<Plane*>(buffer_map_[index]);
+    return source->CopyFromAsynch(cq, first_row, host_cols, host_rows, host_pitch, antecedent, event, host_buffer);
+}
+
 void BufferMap::Destroy(
     const int &index) { 
 
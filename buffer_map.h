@@ -17,17 +17,39 @@ using namespace std;
 enum result;
 class Mem;
 
+// Planes are padded to blocks of 8 pixels across and 64 rows down, given
+// as powers of 2. Finalise writes whole 8x2 tiles and whole regions, of
+// at most 64 rows, without checking the bounds of the plane.
+#define PLANE_WIDTH_POWER_OF_2 3
+#define PLANE_HEIGHT_POWER_OF_2 6
+
 // BufferMap
 // Set of buffers currently in use on a device.
 //
 // Buffers can be either plain old data or 
-// 8-bit pixels of luma or chroma data, 
+// 8-bit, 16-bit or float pixels of luma or chroma data, 
 // known as "plane".
 class BufferMap {
 public:
-    BufferMap() {}
+    BufferMap() : cal_buffer_size_fault_(false), host_alignment_(0) {}
     ~BufferMap() {}
 
+    // set_cal_buffer_size_fault
+    // Planes allocated subsequently are padded to work around
+    // the CAL buffer size fault, if the device has it
+    void set_cal_buffer_size_fault(
+        const   bool                &fault) {       // device has the fault
+        cal_buffer_size_fault_ = fault;
+    }
+
+    // set_host_alignment
+    // Planes that wrap host buffers use them in place only if
+    // they are aligned to this many bytes
+    void set_host_alignment(
+        const   int                 &alignment) {   // alignment in bytes
+        host_alignment_ = alignment;
+    }
+
     // AllocBuffer
     // Creates a new OpenCL buffer on the device and puts it in the map
     // of open buffers.
@@ -57,13 +79,88 @@ public:
     // of open buffers.
     // Format of the buffer is 2D pixels, with pixels organised as strips
     // of 4 horizontally.
-    // width and height represent native size of data, exclusive of padding.
+    // width and height represent native size of data, exclusive of padding,
+    // which is PLANE_WIDTH_POWER_OF_2 and PLANE_HEIGHT_POWER_OF_2 blocks.
     result AllocPlane(
         const   cl_command_queue    &cq,            // device specific command queue
         const   int                 &width,         // width in pixels
         const   int                 &height,        // rows
                 int                 *new_index);    // map index of the new buffer
 
+    // AllocWidePlane
+    // As AllocPlane, for a plane of 16-bit or float pixels
+    result AllocWidePlane(
+        const   cl_command_queue    &cq,            // device specific command queue
+        const   int                 &width,         // width in pixels
+        const   int                 &height,        // rows
+        const   int                 &pixel_size,    // bytes per pixel, 2 for 16-bit pixels or 4 for floats
+                int                 *new_index);    // map index of the new buffer
+
+    // AllocLinearPlane
+    // As AllocPlane, for a plane of pixels in linear light, written
+    // and read solely by kernels
+    result AllocLinearPlane(
+        const   cl_command_queue    &cq,            // device specific command queue
+        const   int                 &width,         // width in pixels
+        const   int                 &height,        // rows
+        const   bool                &wide,          // converted from 16-bit or float pixels, so held as floats
+                int                 *new_index);    // map index of the new buffer
+
+    // AllocPitchedPlane
+    // Creates a new OpenCL buffer on the device and puts it in the map
+    // of open buffers.
+    // Format of the buffer is 1D uchar pixels, row by row, with each row
+    // padded to a pitch. Once allocated it is used exactly as a plane.
+    result AllocPitchedPlane(
+        const   cl_command_queue    &cq,            // device specific command queue
+        const   int                 &width,         // width in pixels
+        const   int                 &height,        // rows
+                int                 *new_index);    // map index of the new buffer
+
+    // AllocPitchedPlane
+    // As above, but with rows padded to the pitch specified
+    result AllocPitchedPlane(
+        const   cl_command_queue    &cq,            // device specific command queue
+        const   int                 &width,         // width in pixels
+        const   int                 &height,        // rows
+        const   int                 &pitch,         // length in bytes of each row
+                int                 *new_index);    // map index of the new buffer
+
+    // WrapPlane
+    // Creates a read-only plane that uses the host's buffer of pixels
+    // in place, and puts it in the map of open buffers. The host's
+    // buffer must outlive the plane.
+    result WrapPlane(
+        const   cl_command_queue    &cq,            // device specific command queue
+        const   byte                *host_buffer,   // host's buffer of pixels in row major layout
+        const   int                 &width,         // width in pixels
+        const   int                 &height,        // rows
+        const   int                 &host_pitch,    // size in pixels of each row of host buffer
+                int                 *new_index);    // map index of the new buffer
+
+    // WrapWidePlane
+    // As WrapPlane, for a host buffer of 16-bit or float pixels
+    result WrapWidePlane(
+        const   cl_command_queue    &cq,            // device specific command queue
+        const   byte                *host_buffer,   // host's buffer of pixels in row major layout
+        const   int                 &width,         // width in pixels
+        const   int                 &height,        // rows
+        const   int                 &host_pitch,    // size in bytes of each row of host buffer
+        const   int                 &pixel_size,    // bytes per pixel, 2 for 16-bit pixels or 4 for floats
+                int                 *new_index);    // map index of the new buffer
+
+    // WrapPitchedPlane
+    // Creates a read-only pitched plane that uses the host's buffer of 
+    // pixels in place, adopting the host's pitch, and puts it in the map
+    // of open buffers. The host's buffer must outlive the plane.
+    result WrapPitchedPlane(
+        const   cl_command_queue    &cq,            // device specific command queue
+        const   byte                *host_buffer,   // host's buffer of pixels in row major layout
+        const   int                 &width,         // width in pixels
+        const   int                 &height,        // rows
+        const   int                 &host_pitch,    // size in pixels of each row of host buffer
+                int                 *new_index);    // map index of the new buffer
+
     // CopyToPlane
     // Copy pixels from host buffer to plane
     // Method returns immediately, i.e. copy completion 
@@ -117,6 +214,24 @@ public:
                 cl_event            *event,         // event to track completion of this copy
                 byte                *host_buffer);  // host's buffer of pixels in row major layout
 
+    // CopyFromPlaneAsynch
+    // Copy a band of rows from plane to host buffer using a 
+    // command queue dedicated to copying, so that the copy can 
+    // overlap kernels that continue to execute on the plane's
+    // own queue.
+    //
+    // host_buffer is the address of first_row in the host's buffer.
+    result CopyFromPlaneAsynch(
+        const   int                 &index,         // index of the device buffer
+        const   cl_command_queue    &cq,            // command queue used solely for the copy
+        const   int                 &first_row,     // first row of the plane to be copied
+        const   int                 &host_cols,     // count of pixels per row to be copied                
+        const   int                 &host_rows,     // count of rows to be copied                            
+        const   int                 &host_pitch,    // size in pixels of each row of host buffer
+        const   cl_event            *antecedent,    // event that must complete before this copy can start
+                cl_event            *event,         // event to track completion of this copy
+                byte                *host_buffer);  // host's buffer of pixels in row major layout
+
     // Destroy
     // Destroys buffer entry in map and releases the device-allocated buffer
     void Destroy(
@@ -151,6 +266,8 @@ private:
         const int &index);                          // index of the buffer to check
 
     map<int, Mem*> buffer_map_;                     // indexed set of buffers
+    bool cal_buffer_size_fault_;                    // planes must be padded to work around the CAL fault
+    int host_alignment_;                            // alignment in bytes required for host buffers to be used in place
 };
 
 #endif // _BUFFER_MAP_H_
\ No newline at end of file
@@ -5,16 +5,25 @@
  * Copyright 2015, Jawed Ashraf - Deathray@cupidity.f9.co.uk
  */
 
+#include <algorithm>
 #include <cmath>
+#include <cstdlib>
 
 #include "result.h"
 #include "util.h"
 #include "clutil.h"
 #include "device.h"
+#include "DeviceSelection.h"
+#include "Autotune.h"
 #include "deathray.h"
 #include "SingleFrame.h"
+#include "ChromaFrame.h"
+#include "SplitFrame.h"
 #include "MultiFrame.h"
 #include "MultiFrameRequest.h"
+#include "PackedFrame.h"
+#include "Profiler.h"
+#include "Benchmark.h"
 
 #define DEVICE 0 // Filter currently only uses a single device
 
@@ -31,6 +40,11 @@ bool        g_opencl_failed_to_initialise   = false;
 cl_context  g_context                       = NULL;
 cl_int      g_last_cl_error                 = CL_SUCCESS;
 
+// Start-up of OpenCL, running in the background while the script loads
+HANDLE  g_start_thread  = NULL;
+result  g_start_status  = FILTER_OK;
+bool    g_filters_ready = false;
+
 // Buffer containing the gaussian weights
 int g_gaussian = 0;
 
@@ -39,6 +53,27 @@ FilterFrame *g_Y;
 FilterFrame *g_U;
 FilterFrame *g_V;
 
+// Single frame filtering of U and V together, used instead of g_U and g_V when the device allows
+ChromaFrame *g_UV;
+
+// Unpacks frames of YUY2 and RGB32 clips into the planes filtered by g_Y, g_U and g_V, and packs them again
+PackedFrame *g_packed;
+
+// OpenCL was started by Deathray2Sweep, whose kernels are compiled for its own alpha size
+bool g_sweeping = false;
+
+// ProfilePlane
+// Attributes the commands enqueued from now on to the plane, when profiling
+static void ProfilePlane(const string &plane) {
+    if (g_profiler != NULL) g_profiler->Attribute(plane);
+}
+
+// ProfileCount
+// Adds to a counter, when profiling
+static void ProfileCount(const string &counter, const int &amount) {
+    if (g_profiler != NULL) g_profiler->Count(counter, amount);
+}
+
 void GaussianGenerator(const float &sigma, const int &device_id) {
     float two_sigma_squared = 2 * sigma * sigma;
 
@@ -71,6 +106,13 @@ Deathray::Deathray(PClip child,
                    int correction,
                    int balanced,
                    int alpha_size,
+                   bool hybrid,
+                   const char *device,
+                   bool guide,
+                   int pixel_size,
+                   const char *profile,
+                   const char *trace,
+                   int reuse,
                    IScriptEnvironment *env) : GenericVideoFilter(child),
                                               h_Y_(static_cast<float>(h_Y/10000.)), 
                                               h_UV_(static_cast<float>(h_UV/10000.)), 
@@ -82,43 +124,141 @@ Deathray::Deathray(PClip child,
                                               correction_(correction),
                                               balanced_(balanced),
                                               alpha_size_(alpha_size / 8),
+                                              hybrid_(hybrid),
+                                              split_(false),
+                                              device_(device),
+                                              guide_(guide),
+                                              pixel_size_(pixel_size),
+                                              packed_(vi.IsYUY2() || vi.IsRGB32()),
+                                              profiling_(false),
+                                              reuse_(reuse),
                                               env_(env) {
+
+    // Queues time their commands only if the profiler exists before they are created
+    if (*profile != '\0' && g_profiler == NULL && g_devices == NULL) {
+        g_profiler = new Profiler(profile, trace);
+        profiling_ = true;
+    }
+
+    // Only the first instance starts OpenCL. Should the thread not be
+    // created, Init starts OpenCL instead
+    if ((h_Y_ > 0.f || h_UV_ > 0.f) && g_devices == NULL && g_start_thread == NULL && !g_opencl_failed_to_initialise)
+        g_start_thread = CreateThread(NULL, 0, StartThread, this, 0, NULL);
 }
 
 Deathray::~Deathray() {
-    if (g_opencl_available) g_devices[DEVICE].buffers_.DestroyAll();
+    // The thread might be using this instance's parameters
+    if (g_start_thread != NULL) WaitForSingleObject(g_start_thread, INFINITE);
+
+    if (profiling_) {
+        delete g_profiler;
+        g_profiler = NULL;
+    }
+
+    if (!g_opencl_available) return;
+
+    for (int i = 0; i < g_device_count; ++i)
+        g_devices[i].buffers_.DestroyAll();
 }
 
-result Deathray::Init() {
+DWORD WINAPI Deathray::StartThread(void *filter) {
+    g_start_status = static_cast<Deathray*>(filter)->StartDevices();
+    return 0;
+}
+
+result Deathray::StartDevices() {
     if (g_devices != NULL) return FILTER_OK;
 
     // No point continuing, as prior attempt failed
     if (g_opencl_failed_to_initialise) return FILTER_ERROR;
 
-    int device_count = 0;
     const string cl_include = "-D ALPHASIZE=" +  GetAlphaSize(alpha_size_);
-    result status = StartOpenCL(&device_count, cl_include);
-    if (status != FILTER_OK) env_->ThrowError("OpenCL could not start, status=%d and OpenCL status=%d", status, g_last_cl_error);    
-    if (device_count != 0) {
-        g_opencl_available = true;
-        GaussianGenerator(sigma_, DEVICE);
-        status = SetupFilters(DEVICE);
-    } else {
+
+    // Clips of 16-bit or float pixels are wider in bytes than in pixels
+    const int width = vi.width / pixel_size_;
+
+    cl_platform_id platform = NULL;
+    vector<cl_device_id> devices;
+    result status = SelectDevices(device_, width, vi.height, sample_expand_, sigma_, cl_include, hybrid_, &platform, &devices);
+    if (status == FILTER_NO_PLATFORM || status == FILTER_NO_DEVICES_FOUND) {
         g_opencl_failed_to_initialise = true;
+        return status;
+    }
+    if (status != FILTER_OK) return status;
+
+    status = StartOpenCL(platform, devices, cl_include);
+    if (status != FILTER_OK) return status;
+    const int device_count = g_device_count;
+
+    g_opencl_available = true;
+
+    // The gaussian is the first buffer on each device, so g_gaussian 
+    // is the index of every device's copy
+    for (int i = 0; i < device_count; ++i)
+        GaussianGenerator(sigma_, i);
+
+    for (int i = 0; i < device_count; ++i)
+        g_devices[i].WarmUp();
+
+    // Spatial chroma on a single device that uses images is filtered as
+    // a pair by ChromaFrame, see SingleFrameInit
+    const bool chroma_pair = temporal_radius_UV_ == 0 && pixel_size_ != 4 && !(hybrid_ && device_count > 1) && !g_devices[DEVICE].pitched_planes();
+
+    // Only the devices that will filter each plane are tuned for it. 
+    // Failures are left for the filters to report.
+    for (int i = 0; i < device_count; ++i) {
+        if (h_Y_ > 0.f && (i == DEVICE || (hybrid_ && temporal_radius_Y_ == 0)))
+            TuneGeometry(i, width, vi.height, temporal_radius_Y_, sample_expand_, alpha_size_);
+        if (h_UV_ > 0.f && vi.IsYV12() && chroma_pair && i == DEVICE)
+            TuneGeometry(i, width >> 1, vi.height >> 1, CHROMA_PAIR_RADIUS, sample_expand_, alpha_size_);
+        else if (h_UV_ > 0.f && vi.IsYV12() && (i == DEVICE || (hybrid_ && temporal_radius_UV_ == 0)))
+            TuneGeometry(i, width >> 1, vi.height >> 1, temporal_radius_UV_, sample_expand_, alpha_size_);
+        if (h_UV_ > 0.f && packed_ && i == DEVICE)
+            TuneGeometry(i, vi.IsRGB32() ? width : width >> 1, vi.height, temporal_radius_UV_, sample_expand_, alpha_size_);
     }
 
     return status;
 }
 
+result Deathray::Init() {
+    if (g_start_thread != NULL) {
+        WaitForSingleObject(g_start_thread, INFINITE);
+        CloseHandle(g_start_thread);
+        g_start_thread = NULL;
+    } else if (g_devices == NULL) {
+        g_start_status = StartDevices();
+    }
+
+    if (g_start_status != FILTER_OK) {
+        if (g_opencl_failed_to_initialise) return g_start_status;
+        if (g_start_status == FILTER_NO_SUCH_DEVICE) env_->ThrowError("Deathray2: no OpenCL device matches device=\"%s\"", device_.c_str());
+        env_->ThrowError("OpenCL could not start, status=%d and OpenCL status=%d", g_start_status, g_last_cl_error);
+    }
+
+    // Planes of packed clips are unpacked on a single device
+    split_ = hybrid_ && g_device_count > 1 && !packed_;
+
+    // Filters depend upon the pitches of frames, which are unknown 
+    // until the first frame arrives
+    if (g_filters_ready) return FILTER_OK;
+    g_filters_ready = true;
+
+    return SetupFilters(DEVICE);
+}
+
 result Deathray::SetupFilters(const int &device_id) {
     result status = FILTER_OK;
 
     if ((temporal_radius_Y_ == 0 && h_Y_ > 0.f) || (temporal_radius_UV_ == 0 && h_UV_ > 0.f)) {
         status = SingleFrameInit(device_id);
+        if (status == FILTER_WIDE_PLANES_UNSUPPORTED) env_->ThrowError("Deathray2: 16-bit and float clips require devices that support images");
+        if (status == FILTER_PACKED_FRAMES_UNSUPPORTED) env_->ThrowError("Deathray2: YUY2 and RGB32 clips require devices that support images");
         if (status != FILTER_OK) env_->ThrowError("Single-frame initialisation failed, status=%d and OpenCL status=%d", status, g_last_cl_error);    
     }
     if ((temporal_radius_Y_ > 0 && h_Y_ > 0.f) || (temporal_radius_UV_ > 0 && h_UV_ > 0.f)) {
         status = MultiFrameInit(device_id);
+        if (status == FILTER_WIDE_PLANES_UNSUPPORTED) env_->ThrowError("Deathray2: 16-bit and float clips require devices that support images");
+        if (status == FILTER_FIELDS_UNSUPPORTED) env_->ThrowError("Deathray2: reuse requires a device that supports images");
         if (status != FILTER_OK) env_->ThrowError("Multi-frame initialisation failed, status=%d and OpenCL status=%d", status, g_last_cl_error);    
     }    
 
@@ -126,34 +266,59 @@ result Deathray::SetupFilters(const int &device_id) {
 }
 
 PVideoFrame __stdcall Deathray::GetFrame(int n, IScriptEnvironment *env) {
+    HostTimer frame("GetFrame");
+    ProfileCount("frames served", 1);
+
+    HostTimer upstream("upstream GetFrame");
     src_ = child->GetFrame(n, env);
+    upstream.Stop();
+
+    HostTimer setup("frame setup");
     dst_ = env->NewVideoFrame(vi);
 
     InitPointers();
     InitDimensions();
+    setup.Stop();
 
-    if (h_Y_ == 0.f)                    PassThroughLuma();
-    if (h_UV_ == 0.f)                   PassThroughChroma();
-    if (h_Y_ == 0.f && h_UV_ == 0.f)    return dst_;
+    // The rows of packed frames hold every plane, so luma's pass through is the whole frame's
+    if (h_Y_ == 0.f && (!packed_ || h_UV_ == 0.f))  PassThroughLuma();
+    if (h_UV_ == 0.f && !packed_)                   PassThroughChroma();
+    if (h_Y_ == 0.f && h_UV_ == 0.f)                return dst_;
 
     result status = FILTER_OK;
+    HostTimer initialisation("initialisation");
     status = Init();
-    if (status != FILTER_OK || !(vi.IsPlanar())) { 
+    initialisation.Stop();
+    if (status != FILTER_OK || !(vi.IsPlanar() || packed_)) { 
         if (g_opencl_failed_to_initialise) {
             env->ThrowError("Deathray2: Error in OpenCL status=%d frame %d and OpenCL status=%d", status, n, g_last_cl_error);
         } else {
-            env->ThrowError("Deathray2: Check that clip is planar format - status=%d frame %d", status, n);
+            env->ThrowError("Deathray2: Check that clip is planar, YUY2 or RGB32 format - status=%d frame %d", status, n);
         }
     }
 
-    if ((temporal_radius_Y_ == 0 && h_Y_ > 0.f) || (temporal_radius_UV_ == 0 && h_UV_ > 0.f))
+    HostTimer copy("copy to device");
+    if (packed_) {
+        ProfilePlane("frame");
+        status = g_packed->CopyTo(srcpY_);
+        if (status != FILTER_OK) env_->ThrowError("Deathray2: Copy frame to device status=%d and OpenCL status=%d", status, g_last_cl_error);
+    } else if ((temporal_radius_Y_ == 0 && h_Y_ > 0.f) || (temporal_radius_UV_ == 0 && h_UV_ > 0.f)) {
         SingleFrameCopy();
+    }
+
+    copy.Stop();
 
     if ((temporal_radius_Y_ > 0 && h_Y_ > 0.f) || (temporal_radius_UV_ > 0 && h_UV_ > 0.f))
         MultiFrameCopy(n);
 
     Execute();
 
+    if (g_profiler != NULL) {
+        frame.Stop();
+        ProfilePlane("");
+        g_profiler->Collect();
+    }
+
     return dst_;
 }
 
@@ -168,6 +333,23 @@ void Deathray::InitPointers() {
 }
 
 void Deathray::InitDimensions() {
+    if (packed_) {
+        // Packed frames are a single set of rows. The planes exist only
+        // on the device, where the pitch of each is its width.
+        src_pitchY_ = src_->GetPitch();
+        dst_pitchY_ = dst_->GetPitch();
+        row_sizeY_ = src_->GetRowSize();
+        heightY_ = src_->GetHeight();
+
+        widthY_ = vi.width;
+        widthUV_ = vi.IsRGB32() ? vi.width : vi.width >> 1;
+        heightUV_ = heightY_;
+        src_pitchUV_ = widthUV_;
+        dst_pitchUV_ = widthUV_;
+        row_sizeUV_ = 0;
+        return;
+    }
+
     src_pitchY_ = src_->GetPitch(PLANAR_Y);
     src_pitchUV_ = src_->GetPitch(PLANAR_V);
 
@@ -179,13 +361,18 @@ void Deathray::InitDimensions() {
               
     heightY_ = src_->GetHeight(PLANAR_Y);
     heightUV_ = src_->GetHeight(PLANAR_V);
+
+    widthY_ = row_sizeY_ / pixel_size_;
+    widthUV_ = row_sizeUV_ / pixel_size_;
 }
 
 void Deathray::PassThroughLuma() {
+    HostTimer pass_through("pass through");
     env_->BitBlt(dstpY_, dst_pitchY_, srcpY_, src_pitchY_, row_sizeY_, heightY_);
 }
 
 void Deathray::PassThroughChroma() {
+    HostTimer pass_through("pass through");
     env_->BitBlt(dstpV_, dst_pitchUV_, srcpV_, src_pitchUV_, row_sizeUV_, heightUV_);
     env_->BitBlt(dstpU_, dst_pitchUV_, srcpU_, src_pitchUV_, row_sizeUV_, heightUV_);
 }
@@ -193,23 +380,64 @@ void Deathray::PassThroughChroma() {
 result Deathray::SingleFrameInit(const int &device_id) {
     result status = FILTER_OK;
             
+    if (split_) {
+        if (temporal_radius_Y_ == 0 && h_Y_ > 0.f) {
+            g_Y = new SplitFrame();
+            status = static_cast<SplitFrame*>(g_Y)->Init(g_device_count, widthY_, heightY_, pixel_size_, src_pitchY_, dst_pitchY_, h_Y_, sample_expand_, linear_, correction_, balanced_);
+            if (status != FILTER_OK) return status;
+        }
+
+        if (temporal_radius_UV_ == 0 && h_UV_ > 0.f) {
+            g_U = new SplitFrame();
+            g_V = new SplitFrame();
+
+            status = static_cast<SplitFrame*>(g_U)->Init(g_device_count, widthUV_, heightUV_, pixel_size_, src_pitchUV_, dst_pitchUV_, h_UV_, sample_expand_, 0, correction_, 0);
+            if (status != FILTER_OK) return status;
+
+            status = static_cast<SplitFrame*>(g_V)->Init(g_device_count, widthUV_, heightUV_, pixel_size_, src_pitchUV_, dst_pitchUV_, h_UV_, sample_expand_, 0, correction_, 0);
+        }
+
+        return status;
+    }
+
     if (temporal_radius_Y_ == 0 && h_Y_ > 0.f) {
         g_Y = new SingleFrame();
-        status = static_cast<SingleFrame*>(g_Y)->Init(device_id, row_sizeY_, heightY_, src_pitchY_, dst_pitchY_, h_Y_, sample_expand_, linear_, correction_, balanced_);
+        status = static_cast<SingleFrame*>(g_Y)->Init(device_id, widthY_, heightY_, pixel_size_, src_pitchY_, dst_pitchY_, h_Y_, sample_expand_, linear_, correction_, balanced_);
         if (status != FILTER_OK) return status;
     }
 
+    if (temporal_radius_UV_ == 0 && h_UV_ > 0.f && !g_devices[device_id].pitched_planes() && pixel_size_ != 4 && !packed_) {
+        // Luma guides chroma's weights only on request
+        const int luma_width = guide_ ? widthY_ : 0;
+
+        g_UV = new ChromaFrame();
+        return g_UV->Init(device_id, widthUV_, heightUV_, pixel_size_, src_pitchUV_, dst_pitchUV_, h_UV_, sample_expand_, luma_width, heightY_, src_pitchY_);
+    }
+
     if (temporal_radius_UV_ == 0 && h_UV_ > 0.f) {
         g_U = new SingleFrame();
         g_V = new SingleFrame();
 
-        status = static_cast<SingleFrame*>(g_U)->Init(device_id, row_sizeUV_, heightUV_, src_pitchUV_, dst_pitchUV_, h_UV_, sample_expand_, 0, correction_, 0);
+        status = static_cast<SingleFrame*>(g_U)->Init(device_id, widthUV_, heightUV_, pixel_size_, src_pitchUV_, dst_pitchUV_, h_UV_, sample_expand_, 0, correction_, 0);
         if (status != FILTER_OK) return status;
 
-        status = static_cast<SingleFrame*>(g_V)->Init(device_id, row_sizeUV_, heightUV_, src_pitchUV_, dst_pitchUV_, h_UV_, sample_expand_, 0, correction_, 0);
+        status = static_cast<SingleFrame*>(g_V)->Init(device_id, widthUV_, heightUV_, pixel_size_, src_pitchUV_, dst_pitchUV_, h_UV_, sample_expand_, 0, correction_, 0);
         if (status != FILTER_OK) return status;
     }
 
+    if (packed_) {
+        g_packed = new PackedFrame();
+        return g_packed->Init(device_id, 
+                              vi.IsRGB32(), 
+                              widthY_, 
+                              heightY_, 
+                              src_pitchY_, 
+                              dst_pitchY_, 
+                              h_Y_ > 0.f ? static_cast<SingleFrame*>(g_Y) : NULL,
+                              h_UV_ > 0.f ? static_cast<SingleFrame*>(g_U) : NULL,
+                              h_UV_ > 0.f ? static_cast<SingleFrame*>(g_V) : NULL);
+    }
+
     return status;
 }
 
@@ -217,36 +445,72 @@ void Deathray::SingleFrameCopy() {
     result status;
 
     if (temporal_radius_Y_ == 0 && h_Y_ > 0.f) {
-        status = static_cast<SingleFrame*>(g_Y)->CopyTo(srcpY_);
+        ProfilePlane("Y");
+        status = SingleFrameCopyPlane(g_Y, srcpY_);
         if (status != FILTER_OK) env_->ThrowError("Deathray2: Copy Y to device status=%d and OpenCL status=%d", status, g_last_cl_error);
     }
 
-    if (temporal_radius_UV_ == 0 && h_UV_ > 0.f) {
-        status = static_cast<SingleFrame*>(g_U)->CopyTo(srcpU_);
+    if (temporal_radius_UV_ == 0 && h_UV_ > 0.f && g_UV != NULL) {
+        ProfilePlane("UV");
+        status = g_UV->CopyTo(srcpY_, srcpU_, srcpV_);
+        if (status != FILTER_OK) env_->ThrowError("Deathray2: Copy U and V to device status=%d and OpenCL status=%d", status, g_last_cl_error);
+    } else if (temporal_radius_UV_ == 0 && h_UV_ > 0.f) {
+        ProfilePlane("U");
+        status = SingleFrameCopyPlane(g_U, srcpU_);
         if (status != FILTER_OK) env_->ThrowError("Deathray2: Copy U to device status=%d and OpenCL status=%d", status, g_last_cl_error);
 
-        status = static_cast<SingleFrame*>(g_V)->CopyTo(srcpV_);
+        ProfilePlane("V");
+        status = SingleFrameCopyPlane(g_V, srcpV_);
         if (status != FILTER_OK) env_->ThrowError("Deathray2: Copy V to device status=%d and OpenCL status=%d", status, g_last_cl_error);
     }
 }
 
+result Deathray::SingleFrameCopyPlane(
+    FilterFrame         *plane,
+    const unsigned char *source) {
+
+    if (split_)
+        return static_cast<SplitFrame*>(plane)->CopyTo(source);
+    else
+        return static_cast<SingleFrame*>(plane)->CopyTo(source);
+}
+
 result Deathray::MultiFrameInit(const int &device_id) {
     result status = FILTER_OK;
 
+    // Luma has first call upon the budget for fields, then each chroma
+    // plane. The budget cannot exceed the device's memory.
+    const cl_ulong reuse_bytes = static_cast<cl_ulong>(reuse_) << 20;
+    cl_ulong field_budget = min(reuse_bytes, g_devices[device_id].ulong_info(CL_DEVICE_GLOBAL_MEM_SIZE));
+
     if (temporal_radius_Y_ > 0 && h_Y_ > 0.f) {
         g_Y = new MultiFrame();
-        status = static_cast<MultiFrame*>(g_Y)->Init(device_id, temporal_radius_Y_, row_sizeY_, heightY_, src_pitchY_, dst_pitchY_, h_Y_, sample_expand_, linear_, correction_, balanced_);
+        status = static_cast<MultiFrame*>(g_Y)->Init(device_id, temporal_radius_Y_, widthY_, heightY_, pixel_size_, src_pitchY_, dst_pitchY_, h_Y_, sample_expand_, linear_, correction_, balanced_);
         if (status != FILTER_OK) return status;
+        if (field_budget > 0) {
+            status = static_cast<MultiFrame*>(g_Y)->InitFields(field_budget);
+            if (status != FILTER_OK) return status;
+            field_budget -= static_cast<MultiFrame*>(g_Y)->field_bytes();
+        }
     }
 
     if (temporal_radius_UV_ > 0 && h_UV_ > 0.f) {
         g_U = new MultiFrame();
-        status = static_cast<MultiFrame*>(g_U)->Init(device_id, temporal_radius_UV_, row_sizeUV_, heightUV_, src_pitchUV_, dst_pitchUV_, h_UV_, sample_expand_, 0, correction_, 0);
+        status = static_cast<MultiFrame*>(g_U)->Init(device_id, temporal_radius_UV_, widthUV_, heightUV_, pixel_size_, src_pitchUV_, dst_pitchUV_, h_UV_, sample_expand_, 0, correction_, 0);
         if (status != FILTER_OK) return status;
+        if (field_budget > 0) {
+            status = static_cast<MultiFrame*>(g_U)->InitFields(field_budget);
+            if (status != FILTER_OK) return status;
+            field_budget -= static_cast<MultiFrame*>(g_U)->field_bytes();
+        }
 
         g_V = new MultiFrame();
-        status = static_cast<MultiFrame*>(g_V)->Init(device_id, temporal_radius_UV_, row_sizeUV_, heightUV_, src_pitchUV_, dst_pitchUV_, h_UV_, sample_expand_, 0, correction_, 0);
+        status = static_cast<MultiFrame*>(g_V)->Init(device_id, temporal_radius_UV_, widthUV_, heightUV_, pixel_size_, src_pitchUV_, dst_pitchUV_, h_UV_, sample_expand_, 0, correction_, 0);
         if (status != FILTER_OK) return status;
+        if (field_budget > 0) {
+            status = static_cast<MultiFrame*>(g_V)->InitFields(field_budget);
+            if (status != FILTER_OK) return status;
+        }
     }
 
     return status;
@@ -259,13 +523,28 @@ void Deathray::MultiFrameCopy(const int &n) {
     if (temporal_radius_Y_ > 0 && h_Y_ > 0.f) {
         MultiFrameRequest frames_Y;
         static_cast<MultiFrame*>(g_Y)->SupplyFrameNumbers(n, &frames_Y);
+        int misses = 0;
         while (frames_Y.GetFrameNumber(&frame_number)) {
+            HostTimer upstream("upstream GetFrame, temporal");
             PVideoFrame Y = child->GetFrame(frame_number, env_);
+            upstream.Stop();
             const unsigned char* ptr_Y = Y->GetReadPtr(PLANAR_Y);
             frames_Y.Supply(frame_number, ptr_Y);
+            if (g_devices[DEVICE].zero_copy()) resident_Y_[frame_number] = Y;
+            ++misses;
         }
+        // Frames of the window that are already on the device are hits
+        ProfileCount("temporal Y cache hits", 2 * temporal_radius_Y_ + 1 - misses);
+        ProfileCount("temporal Y cache misses", misses);
+
+        ProfilePlane("Y");
+        HostTimer copy("copy to device, temporal");
         status = static_cast<MultiFrame*>(g_Y)->CopyTo(&frames_Y);
         if (status != FILTER_OK ) env_->ThrowError("Deathray2: Copy Y to device, status=%d and OpenCL status=%d", status, g_last_cl_error);
+        copy.Stop();
+
+        HostTimer wait("wait for copies, temporal");
+        static_cast<MultiFrame*>(g_Y)->WaitForCopies();
     }
 
     if (temporal_radius_UV_ > 0 && h_UV_ > 0.f) {
@@ -273,52 +552,252 @@ void Deathray::MultiFrameCopy(const int &n) {
         MultiFrameRequest frames_V;
         static_cast<MultiFrame*>(g_U)->SupplyFrameNumbers(n, &frames_U);
         static_cast<MultiFrame*>(g_V)->SupplyFrameNumbers(n, &frames_V);
+        int misses = 0;
         while (frames_U.GetFrameNumber(&frame_number)) {
+            HostTimer upstream("upstream GetFrame, temporal");
             PVideoFrame UV = child->GetFrame(frame_number, env_);
+            upstream.Stop();
             const unsigned char* ptr_U = UV->GetReadPtr(PLANAR_U);
             const unsigned char* ptr_V = UV->GetReadPtr(PLANAR_V);
             frames_U.Supply(frame_number, ptr_U);
             frames_V.Supply(frame_number, ptr_V);
+            if (g_devices[DEVICE].zero_copy()) resident_UV_[frame_number] = UV;
+            ++misses;
         }
+        ProfileCount("temporal UV cache hits", 2 * temporal_radius_UV_ + 1 - misses);
+        ProfileCount("temporal UV cache misses", misses);
+
+        HostTimer copy("copy to device, temporal");
+        ProfilePlane("U");
         status = static_cast<MultiFrame*>(g_U)->CopyTo(&frames_U);
         if (status != FILTER_OK ) env_->ThrowError("Deathray2: Copy U to device, status=%d and OpenCL status=%d", status, g_last_cl_error);
+        ProfilePlane("V");
         status = static_cast<MultiFrame*>(g_V)->CopyTo(&frames_V);
         if (status != FILTER_OK ) env_->ThrowError("Deathray2: Copy V to device, status=%d and OpenCL status=%d", status, g_last_cl_error);
+        copy.Stop();
+
+        HostTimer wait("wait for copies, temporal");
+        static_cast<MultiFrame*>(g_U)->WaitForCopies();
+        static_cast<MultiFrame*>(g_V)->WaitForCopies();
+    }
+
+    RetainFrames(n);
+}
+
+void Deathray::RetainFrames(const int &n) {
+    // Frames outside each window have been replaced on the device
+    if (!resident_Y_.empty()) {
+        resident_Y_.erase(resident_Y_.begin(), resident_Y_.lower_bound(n - temporal_radius_Y_));
+        resident_Y_.erase(resident_Y_.upper_bound(n + temporal_radius_Y_), resident_Y_.end());
+    }
+    if (!resident_UV_.empty()) {
+        resident_UV_.erase(resident_UV_.begin(), resident_UV_.lower_bound(n - temporal_radius_UV_));
+        resident_UV_.erase(resident_UV_.upper_bound(n + temporal_radius_UV_), resident_UV_.end());
     }
 }
 
 void Deathray::Execute() {    
+    if (packed_) {
+        ExecutePacked();
+        return;
+    }
+
     cl_uint wait_list_length = 0;
     cl_event wait_list[3];
     result status = FILTER_OK;
 
+    // Setting the kernels' arguments and enqueueing, short of waiting
+    HostTimer enqueue("enqueue");
+
+    // Each plane's rows are streamed to the host as they are finalised,
+    // so the copies overlap computation of the remaining regions and planes
     if (h_Y_ > 0.f) {
-        status = g_Y->Execute();
+        ProfilePlane("Y");
+        status = g_Y->Execute(dstpY_);
         if (status != FILTER_OK) env_->ThrowError("Deathray2: Execute Y kernel status=%d and OpenCL status=%d", status, g_last_cl_error);
-        status = g_Y->CopyFrom(dstpY_, wait_list);
+        status = g_Y->CopyFrom(wait_list);
         if (status != FILTER_OK) env_->ThrowError("Deathray2: Copy Y to host status=%d and OpenCL status=%d", status, g_last_cl_error);
         ++wait_list_length;
     }
 
-    if (h_UV_ > 0.f) {
-        g_U->Execute();
+    if (h_UV_ > 0.f && g_UV != NULL) {
+        ProfilePlane("UV");
+        status = g_UV->Execute(dstpU_, dstpV_);
+        if (status != FILTER_OK) env_->ThrowError("Deathray2: Execute U and V kernel status=%d and OpenCL status=%d", status, g_last_cl_error);
+        status = g_UV->CopyFrom(wait_list + wait_list_length++);
+        if (status != FILTER_OK) env_->ThrowError("Deathray2: Copy U and V to host status=%d and OpenCL status=%d", status, g_last_cl_error);
+    } else if (h_UV_ > 0.f) {
+        ProfilePlane("U");
+        status = g_U->Execute(dstpU_);
         if (status != FILTER_OK) env_->ThrowError("Deathray2: Execute U kernel status=%d and OpenCL status=%d", status, g_last_cl_error);
-        g_U->CopyFrom(dstpU_, wait_list + wait_list_length++);
+        status = g_U->CopyFrom(wait_list + wait_list_length++);
         if (status != FILTER_OK) env_->ThrowError("Deathray2: Copy U to host status=%d and OpenCL status=%d", status, g_last_cl_error);
 
-        g_V->Execute();
+        ProfilePlane("V");
+        status = g_V->Execute(dstpV_);
         if (status != FILTER_OK) env_->ThrowError("Deathray2: Execute V kernel status=%d and OpenCL status=%d", status, g_last_cl_error);
-        g_V->CopyFrom(dstpV_, wait_list + wait_list_length++);
+        status = g_V->CopyFrom(wait_list + wait_list_length++);
         if (status != FILTER_OK) env_->ThrowError("Deathray2: Copy V to host status=%d and OpenCL status=%d", status, g_last_cl_error);
     }
 
+    enqueue.Stop();
+
+    HostTimer wait("wait for device");
     clWaitForEvents(wait_list_length, wait_list);
+    wait.Stop();
 
     for (cl_uint wait_index = 0; wait_index < wait_list_length; wait_index++) {
         clReleaseEvent(wait_list[wait_index]);
     }
 }
 
+void Deathray::ExecutePacked() {
+    result status = FILTER_OK;
+
+    HostTimer enqueue("enqueue");
+
+    // Filtered planes stay on the device until they are packed
+    if (h_Y_ > 0.f) {
+        ProfilePlane("Y");
+        status = g_Y->Execute(NULL);
+        if (status != FILTER_OK) env_->ThrowError("Deathray2: Execute Y kernel status=%d and OpenCL status=%d", status, g_last_cl_error);
+    }
+
+    if (h_UV_ > 0.f) {
+        ProfilePlane("U");
+        status = g_U->Execute(NULL);
+        if (status != FILTER_OK) env_->ThrowError("Deathray2: Execute U kernel status=%d and OpenCL status=%d", status, g_last_cl_error);
+
+        ProfilePlane("V");
+        status = g_V->Execute(NULL);
+        if (status != FILTER_OK) env_->ThrowError("Deathray2: Execute V kernel status=%d and OpenCL status=%d", status, g_last_cl_error);
+    }
+
+    ProfilePlane("frame");
+    status = g_packed->Execute(dstpY_);
+    if (status != FILTER_OK) env_->ThrowError("Deathray2: Execute pack kernel status=%d and OpenCL status=%d", status, g_last_cl_error);
+
+    cl_event copied = NULL;
+    status = g_packed->CopyFrom(&copied);
+    if (status != FILTER_OK) env_->ThrowError("Deathray2: Copy frame to host status=%d and OpenCL status=%d", status, g_last_cl_error);
+
+    enqueue.Stop();
+
+    HostTimer wait("wait for device");
+    clWaitForEvents(1, &copied);
+    wait.Stop();
+    clReleaseEvent(copied);
+}
+
+DeathraySweep::DeathraySweep(PClip child,
+                             const vector<double> &h_Y,
+                             const vector<int> &alpha_sizes,
+                             double sigma,
+                             int sample_expand,
+                             const char *device,
+                             IScriptEnvironment *env) : GenericVideoFilter(child),
+                                                        h_Y_(0.f),
+                                                        alpha_sizes_(alpha_sizes),
+                                                        sigma_(static_cast<float>(sigma)),
+                                                        sample_expand_(sample_expand),
+                                                        device_(device),
+                                                        height_(vi.height),
+                                                        luma_(NULL) {
+
+    // Raising the weights of the greatest strength to a power of at least 1
+    // gives the weights of every other strength without losing precision
+    double h_max = 0.;
+    int alpha_max = 0;
+    for (size_t i = 0; i < h_Y.size(); ++i) {
+        h_max = max(h_max, h_Y[i]);
+        alpha_max = max(alpha_max, alpha_sizes[i]);
+    }
+    h_Y_ = static_cast<float>(h_max / 10000.);
+    for (size_t i = 0; i < h_Y.size(); ++i)
+        exponents_.push_back(static_cast<float>(h_max / h_Y[i]));
+
+    vi.height *= static_cast<int>(h_Y.size());
+
+    // Kernels are compiled for a single alpha size, so OpenCL cannot be shared with Deathray2
+    if (g_devices != NULL || g_start_thread != NULL) 
+        env->ThrowError("Deathray2Sweep: cannot be used in a script with Deathray2 or another Deathray2Sweep");
+
+    result status = StartDevice(alpha_max);
+    if (status == FILTER_NO_SUCH_DEVICE) env->ThrowError("Deathray2Sweep: no OpenCL device matches device=\"%s\"", device);
+    if (status != FILTER_OK) env->ThrowError("Deathray2Sweep: OpenCL could not start, status=%d and OpenCL status=%d", status, g_last_cl_error);
+}
+
+DeathraySweep::~DeathraySweep() {
+    delete luma_;
+
+    if (!g_opencl_available) return;
+
+    for (int i = 0; i < g_device_count; ++i)
+        g_devices[i].buffers_.DestroyAll();
+}
+
+result DeathraySweep::StartDevice(const int &alpha_size) {
+    const string cl_include = "-D ALPHASIZE=" + GetAlphaSize(alpha_size / 8);
+
+    cl_platform_id platform = NULL;
+    vector<cl_device_id> devices;
+    result status = SelectDevices(device_, vi.width, height_, sample_expand_, sigma_, cl_include, false, &platform, &devices);
+    if (status != FILTER_OK) return status;
+
+    const vector<cl_device_id> device(1, devices[0]);
+    status = StartOpenCL(platform, device, cl_include);
+    if (status != FILTER_OK) return status;
+
+    g_opencl_available = true;
+    g_sweeping = true;
+
+    // The sweep launches regions, so the geometry is not tuned, since
+    // tuning might choose the persistent kernel
+    GaussianGenerator(sigma_, DEVICE);
+    g_devices[DEVICE].WarmUp();
+
+    return FILTER_OK;
+}
+
+result DeathraySweep::InitFilter(
+    const int &src_pitch,
+    const int &dst_pitch) {
+
+    luma_ = new SingleFrame();
+    result status = luma_->Init(DEVICE, vi.width, height_, 1, src_pitch, dst_pitch, h_Y_, sample_expand_, 0, 1, 0);
+    if (status != FILTER_OK) return status;
+
+    return luma_->InitSweep(exponents_, alpha_sizes_);
+}
+
+PVideoFrame __stdcall DeathraySweep::GetFrame(int n, IScriptEnvironment *env) {
+    src_ = child->GetFrame(n, env);
+    PVideoFrame dst = env->NewVideoFrame(vi);
+
+    result status = FILTER_OK;
+    if (luma_ == NULL) {
+        status = InitFilter(src_->GetPitch(PLANAR_Y), dst->GetPitch(PLANAR_Y));
+        if (status == FILTER_SWEEP_UNSUPPORTED) env->ThrowError("Deathray2Sweep: requires a device that supports images");
+        if (status != FILTER_OK) env->ThrowError("Deathray2Sweep: initialisation failed, status=%d and OpenCL status=%d", status, g_last_cl_error);
+    }
+
+    status = luma_->CopyTo(src_->GetReadPtr(PLANAR_Y));
+    if (status == FILTER_OK) status = FilterAndWait(luma_, dst->GetWritePtr(PLANAR_Y));
+    if (status != FILTER_OK) env->ThrowError("Deathray2Sweep: frame %d status=%d and OpenCL status=%d", n, status, g_last_cl_error);
+
+    // Each result's chroma is the source's
+    const int height_UV = src_->GetHeight(PLANAR_U);
+    const int count = static_cast<int>(exponents_.size());
+    for (int i = 0; i < count; ++i) {
+        env->BitBlt(dst->GetWritePtr(PLANAR_U) + i * height_UV * dst->GetPitch(PLANAR_U), dst->GetPitch(PLANAR_U), 
+                    src_->GetReadPtr(PLANAR_U), src_->GetPitch(PLANAR_U), src_->GetRowSize(PLANAR_U), height_UV);
+        env->BitBlt(dst->GetWritePtr(PLANAR_V) + i * height_UV * dst->GetPitch(PLANAR_V), dst->GetPitch(PLANAR_V), 
+                    src_->GetReadPtr(PLANAR_V), src_->GetPitch(PLANAR_V), src_->GetRowSize(PLANAR_V), height_UV);
+    }
+
+    return dst;
+}
+
 AVSValue __cdecl CreateDeathray(AVSValue args, void *user_data, IScriptEnvironment *env) {
 
     double h_Y = args[1].AsFloat(1.);
@@ -352,6 +831,39 @@ AVSValue __cdecl CreateDeathray(AVSValue args, void *user_data, IScriptEnvironme
     if (alpha_size < 8) alpha_size = 8;
     if (alpha_size > 128) alpha_size = 128;
 
+    bool hybrid = args[11].AsBool(false);
+
+    const char *device = args[12].AsString("");
+
+    bool guide = args[13].AsBool(false);
+
+    bool wide = args[14].AsBool(false);
+
+    bool floats = args[15].AsBool(false);
+
+    const char *profile = args[16].AsString("");
+
+    const char *trace = args[17].AsString("");
+
+    int reuse = args[18].AsInt(0);
+    if (reuse < 0) reuse = 0;
+
+    if (wide && floats) env->ThrowError("Deathray2: i16 and f32 cannot both be set");
+
+    if (g_sweeping) env->ThrowError("Deathray2: cannot be used in a script with Deathray2Sweep");
+
+    // Packed clips are filtered spatially, one byte per pixel
+    const VideoInfo &vi = args[0].AsClip()->GetVideoInfo();
+    if (vi.IsYUY2() || vi.IsRGB32()) {
+        if (temporal_radius_Y > 0 || temporal_radius_UV > 0) env->ThrowError("Deathray2: YUY2 and RGB32 clips require tY=0 and tUV=0");
+        if (wide || floats) env->ThrowError("Deathray2: i16 and f32 require a planar clip");
+    }
+
+    // Chroma rows must also hold whole pixels
+    int pixel_size = floats ? 4 : (wide ? 2 : 1);
+    if (pixel_size > 1 && (vi.width % (2 * pixel_size)) != 0)
+        env->ThrowError("Deathray2: i16 requires a clip whose width in bytes is a multiple of 4, f32 a multiple of 8");
+
     return new Deathray(args[0].AsClip(),
                         h_Y, 
                         h_UV, 
@@ -363,11 +875,214 @@ AVSValue __cdecl CreateDeathray(AVSValue args, void *user_data, IScriptEnvironme
                         correction,
                         balanced,
                         alpha_size,
+                        hybrid,
+                        device,
+                        guide,
+                        pixel_size,
+                        profile,
+                        trace,
+                        reuse,
                         env);
 }
 
+AVSValue __cdecl CreateBenchmark(AVSValue args, void *user_data, IScriptEnvironment *env) {
+
+    const char *report = args[1].AsString("");
+    if (*report == '\0') env->ThrowError("Deathray2Benchmark: report must name the file for the report");
+
+    const char *device = args[2].AsString("");
+
+    int frames = args[3].AsInt(4);
+    if (frames < 1) frames = 1;
+
+    double gflops = args[4].AsFloat(0.);
+    if (gflops < 0.) gflops = 0.;
+
+    double gbs = args[5].AsFloat(0.);
+    if (gbs < 0.) gbs = 0.;
+
+    // OpenCL is started and stopped for each alpha size, which cannot happen beneath a filter
+    if (g_devices != NULL || g_start_thread != NULL) 
+        env->ThrowError("Deathray2Benchmark: must come before Deathray2 in the script");
+
+    const VideoInfo &vi = args[0].AsClip()->GetVideoInfo();
+    result status = RunBenchmark(device, vi.width, vi.height, frames, gflops, gbs, report);
+    if (status == FILTER_NO_SUCH_DEVICE) env->ThrowError("Deathray2Benchmark: no OpenCL device matches device=\"%s\"", device);
+    if (status != FILTER_OK) env->ThrowError("Deathray2Benchmark: status=%d and OpenCL status=%d", status, g_last_cl_error);
+
+    // The clip is untouched
+    return args[0];
+}
+
+// ParseList
+// Appends the numbers of a list separated by spaces or commas, returning
+// false if anything else is found
+static bool ParseList(const char *list, vector<double> *numbers) {
+    const char *next = list;
+    while (*next != '\0') {
+        if (*next == ' ' || *next == ',') {
+            ++next;
+            continue;
+        }
+
+        char *end = NULL;
+        const double number = strtod(next, &end);
+        if (end == next) return false;
+
+        numbers->push_back(number);
+        next = end;
+    }
+    return true;
+}
+
+AVSValue __cdecl CreateQualityBenchmark(AVSValue args, void *user_data, IScriptEnvironment *env) {
+
+    const char *report = args[1].AsString("");
+    if (*report == '\0') env->ThrowError("Deathray2Quality: report must name the file for the report");
+
+    double noise = args[2].AsFloat(5.);
+    if (noise < 0.) noise = 0.;
+
+    vector<double> h_Y, sample_expand, alpha_size, temporal_radius;
+    if (!ParseList(args[4].AsString("0.5 1 2 3"), &h_Y) || h_Y.empty())
+        env->ThrowError("Deathray2Quality: hY must be a list of numbers");
+    if (!ParseList(args[5].AsString("1 2 3 4"), &sample_expand) || sample_expand.empty())
+        env->ThrowError("Deathray2Quality: x must be a list of numbers");
+    if (!ParseList(args[6].AsString("16 64 128"), &alpha_size) || alpha_size.empty())
+        env->ThrowError("Deathray2Quality: a must be a list of numbers");
+    if (!ParseList(args[7].AsString("0 1 2"), &temporal_radius) || temporal_radius.empty())
+        env->ThrowError("Deathray2Quality: tY must be a list of numbers");
+
+    const char *device = args[8].AsString("");
+
+    // OpenCL is started and stopped for each alpha size, which cannot happen beneath a filter
+    if (g_devices != NULL || g_start_thread != NULL) 
+        env->ThrowError("Deathray2Quality: must come before Deathray2 in the script");
+
+    PClip clip = args[0].AsClip();
+    const VideoInfo &vi = clip->GetVideoInfo();
+    if (!vi.IsPlanar()) env->ThrowError("Deathray2Quality: requires a planar clip");
+
+    int frames = args[3].AsInt(10);
+    if (frames > vi.num_frames) frames = vi.num_frames;
+    if (frames < 2) env->ThrowError("Deathray2Quality: requires a clip of at least 2 frames");
+
+    // Settings are ranged as Deathray2 ranges its arguments, alpha sizes rounded to the multiple of 8 compiled
+    vector<QualitySetting> settings;
+    for (size_t t = 0; t < temporal_radius.size(); ++t) {
+        for (size_t a = 0; a < alpha_size.size(); ++a) {
+            for (size_t x = 0; x < sample_expand.size(); ++x) {
+                for (size_t h = 0; h < h_Y.size(); ++h) {
+                    QualitySetting setting;
+                    setting.h               = h_Y[h] < 0. ? 0. : h_Y[h];
+                    setting.sample_expand   = min(max(static_cast<int>(sample_expand[x]), 1), 4);
+                    setting.alpha_size      = min(max(static_cast<int>(alpha_size[a]), 8), 128) & ~7;
+                    setting.temporal_radius = min(max(static_cast<int>(temporal_radius[t]), 0), 64);
+                    settings.push_back(setting);
+                }
+            }
+        }
+    }
+
+    // The clean luma of the first frames
+    const int pitch = ByPowerOf2(vi.width, 6);
+    vector<vector<unsigned char> > clean(frames, vector<unsigned char>(pitch * vi.height, 0));
+    for (int n = 0; n < frames; ++n) {
+        PVideoFrame frame = clip->GetFrame(n, env);
+        env->BitBlt(&clean[n][0], pitch, frame->GetReadPtr(PLANAR_Y), frame->GetPitch(PLANAR_Y), frame->GetRowSize(PLANAR_Y), frame->GetHeight(PLANAR_Y));
+    }
+
+    result status = RunQualityBenchmark(device, vi.width, vi.height, pitch, clean, noise, settings, report);
+    if (status == FILTER_NO_SUCH_DEVICE) env->ThrowError("Deathray2Quality: no OpenCL device matches device=\"%s\"", device);
+    if (status != FILTER_OK) env->ThrowError("Deathray2Quality: status=%d and OpenCL status=%d", status, g_last_cl_error);
+
+    // The clip is untouched
+    return args[0];
+}
+
+AVSValue __cdecl CreateSweep(AVSValue args, void *user_data, IScriptEnvironment *env) {
+
+    vector<double> h_Y, alpha_size;
+    if (!ParseList(args[1].AsString("0.5 1 1.5 2"), &h_Y) || h_Y.empty())
+        env->ThrowError("Deathray2Sweep: hY must be a list of numbers");
+    if (!ParseList(args[2].AsString("128"), &alpha_size) || alpha_size.empty())
+        env->ThrowError("Deathray2Sweep: a must be a list of numbers");
+
+    double sigma = args[3].AsFloat(1.);
+    if (sigma < 0.1) sigma = 0.1;
+
+    int sample_expand = args[4].AsInt(1);    
+    if (sample_expand <= 0) sample_expand = 1;
+    if (sample_expand > 4) sample_expand = 4;
+
+    const char *device = args[5].AsString("");
+
+    const VideoInfo &vi = args[0].AsClip()->GetVideoInfo();
+    if (!vi.IsYV12()) env->ThrowError("Deathray2Sweep: requires a YV12 clip");
+
+    // Every alpha size with every strength, strengths varying fastest
+    vector<double> sweep_h_Y;
+    vector<int> sweep_alpha_sizes;
+    for (size_t a = 0; a < alpha_size.size(); ++a) {
+        for (size_t h = 0; h < h_Y.size(); ++h) {
+            if (h_Y[h] <= 0.) env->ThrowError("Deathray2Sweep: each hY must be more than 0");
+            sweep_h_Y.push_back(h_Y[h]);
+            sweep_alpha_sizes.push_back(min(max(static_cast<int>(alpha_size[a]), 8), 128) & ~7);
+        }
+    }
+
+    // The results share a plane on the device, one beneath the other
+    if (sweep_h_Y.size() > 16) env->ThrowError("Deathray2Sweep: no more than 16 combinations of hY and a");
+
+    return new DeathraySweep(args[0].AsClip(),
+                             sweep_h_Y,
+                             sweep_alpha_sizes,
+                             sigma,
+                             sample_expand,
+                             device,
+                             env);
+}
+
+AVSValue __cdecl CreateRegression(AVSValue args, void *user_data, IScriptEnvironment *env) {
+
+    const char *directory = args[1].AsString("");
+    if (*directory == '\0') env->ThrowError("Deathray2Regression: directory must name the directory of the golden frames and baselines");
+
+    bool record = args[2].AsBool(false);
+
+    int tolerance = args[3].AsInt(1);
+    if (tolerance < 0) tolerance = 0;
+
+    double slowdown = args[4].AsFloat(10.);
+    if (slowdown < 0.) slowdown = 0.;
+
+    const string report = args[5].Defined() ? string(args[5].AsString()) : string(directory) + "\\regression.txt";
+
+    const char *device = args[6].AsString("");
+
+    // OpenCL is started and stopped for each setting, which cannot happen beneath a filter
+    if (g_devices != NULL || g_start_thread != NULL) 
+        env->ThrowError("Deathray2Regression: must come before Deathray2 in the script");
+
+    int failures = 0;
+    result status = RunRegression(device, directory, record, tolerance, slowdown, report, &failures);
+    if (status == FILTER_NO_SUCH_DEVICE) env->ThrowError("Deathray2Regression: no OpenCL device matches device=\"%s\"", device);
+    if (status == FILTER_NO_GOLDEN_FRAMES) env->ThrowError("Deathray2Regression: %s holds no golden frames, record them with record=true on a build known to be good", directory);
+    if (status != FILTER_OK) env->ThrowError("Deathray2Regression: status=%d and OpenCL status=%d", status, g_last_cl_error);
+
+    // Failures stop the script, so that whatever runs it sees them
+    if (failures > 0) env->ThrowError("Deathray2Regression: %d settings failed, see %s", failures, report.c_str());
+
+    // The clip is untouched
+    return args[0];
+}
+
 extern "C" __declspec(dllexport) const char* __stdcall AvisynthPluginInit2(IScriptEnvironment *env) {
 
-    env->AddFunction("deathray2", "c[hY]f[hUV]f[tY]i[tUV]i[s]f[x]i[l]b[c]b[b]b[a]i", CreateDeathray, 0);
+    env->AddFunction("deathray2", "c[hY]f[hUV]f[tY]i[tUV]i[s]f[x]i[l]b[c]b[b]b[a]i[hybrid]b[device]s[guide]b[i16]b[f32]b[profile]s[trace]s[reuse]i", CreateDeathray, 0);
+    env->AddFunction("deathray2benchmark", "c[report]s[device]s[frames]i[gflops]f[gbs]f", CreateBenchmark, 0);
+    env->AddFunction("deathray2quality", "c[report]s[noise]f[frames]i[hY]s[x]s[a]s[tY]s[device]s", CreateQualityBenchmark, 0);
+    env->AddFunction("deathray2regression", "c[directory]s[record]b[tolerance]i[slowdown]f[report]s[device]s", CreateRegression, 0);
+    env->AddFunction("deathray2sweep", "c[hY]s[a]s[s]f[x]i[device]s", CreateSweep, 0);
     return "Deathray2";
 }
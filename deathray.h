@@ -8,9 +8,17 @@
 #ifndef _DEATHRAY_
 #define _DEATHRAY_
 
+#include <Windows.h>
+#include <map>
+#include <string>
+#include <vector>
 #include "avisynth.h"
 
+using namespace std;
+
 enum result;
+class FilterFrame;
+class SingleFrame;
 
 class Deathray : public GenericVideoFilter {
 public:
@@ -27,6 +35,13 @@ public:
         int correction, 
         int balanced, 
         int alpha_size, 
+        bool hybrid,
+        const char *device,
+        bool guide,
+        int pixel_size,
+        const char *profile,
+        const char *trace,
+        int reuse,
         IScriptEnvironment* env);
 
     ~Deathray();
@@ -34,9 +49,24 @@ public:
     PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env);
 
 private:
+    // StartThread
+    // Entry point of the thread, created by the constructor, that 
+    // starts OpenCL while Avisynth continues to load the script
+    static DWORD WINAPI StartThread(
+        void *filter);          // Deathray instance whose parameters configure OpenCL
+
+    // StartDevices
+    // Selects the devices, starts OpenCL, compiles the kernels, puts 
+    // the gaussian weights on every device, warms up each device and
+    // tunes the kernels' geometry for the clip's planes. None of this
+    // depends upon the frames, so it runs before the first frame is
+    // requested.
+    result StartDevices();
+
     // Init
-    // Verifies that OpenCL is ready to go and that at least
-    // one device is ready.
+    // Waits for StartDevices to finish, verifying that OpenCL is 
+    // ready to go and that at least one device is ready, then
+    // configures the filters once the dimensions of frames are known.
     result Init();
 
     // SetupFilters
@@ -72,6 +102,12 @@ private:
     // single frame filtering
     void SingleFrameCopy();
 
+    // SingleFrameCopyPlane
+    // Copies a plane to the device, or devices, filtering it
+    result SingleFrameCopyPlane(
+        FilterFrame         *plane,     // object filtering the plane
+        const unsigned char *source);   // host buffer containing the plane
+
     // MultiFrameInit
     // Configure the plane-type specific objects
     // for multi frame filtering
@@ -85,11 +121,24 @@ private:
     void MultiFrameCopy(
         const int &n);          // frame number being filtered
 
+    // RetainFrames
+    // On devices that use host frames in place, frames fetched for
+    // multi-frame filtering are held until they leave the temporal
+    // window centred upon frame n. Luma and chroma are held separately,
+    // as their windows and the frames fetched for them differ.
+    void RetainFrames(
+        const int &n);          // frame number being filtered
+
     // Execute
     // Filter all applicable frames and copy the
     // result back to the host
     void Execute();
 
+    // ExecutePacked
+    // Filter the planes of a packed frame, leaving them on the device,
+    // then pack them and copy the frame back to the host
+    void ExecutePacked();
+
     float h_Y_              ;   // strength of luma noise reduction
     float h_UV_             ;   // strength of chroma noise reduction
     int temporal_radius_Y_  ;   // luma temporal radius
@@ -100,6 +149,14 @@ private:
     int correction_         ;   // apply a post-filtering correction
     int balanced_           ;   // balanced tonal range de-noising
     int alpha_size_         ;   // 1/8th count of sorted samples used for filtering
+    bool hybrid_            ;   // share single frame filtering amongst all devices, CPUs included
+    bool split_             ;   // single frame filtering is shared amongst more than one device
+    string device_          ;   // index or part of the name of the device chosen by the user, empty for automatic selection
+    bool guide_             ;   // weights of spatially filtered chroma come from luma
+    int pixel_size_         ;   // bytes per pixel: 1, 2 for 16-bit pixels or 4 for floats, interleaved as bytes in the clip's rows
+    bool packed_            ;   // clip is YUY2 or RGB32, whose frames are unpacked into planes on the device
+    bool profiling_         ;   // this instance created g_profiler, which reports when the instance is destroyed
+    int reuse_              ;   // megabytes for fields of weights shared by pairs of frames in temporal filtering, 0 for none
 
     // Following are standard Avisynth properties of environment, source and destination: frames and planes
     IScriptEnvironment *env_;
@@ -107,6 +164,9 @@ private:
     PVideoFrame src_;
     PVideoFrame dst_;
 
+    map<int, PVideoFrame> resident_Y_;      // frames whose luma is used in place by the device, by frame number
+    map<int, PVideoFrame> resident_UV_;     // frames whose chroma is used in place by the device, by frame number
+
     const unsigned char *srcpY_;
     const unsigned char *srcpU_;
     const unsigned char *srcpV_;
@@ -127,6 +187,54 @@ private:
     int heightY_;
     int heightUV_;
 
+    int widthY_;                // width in pixels, the row size divided by the pixel size
+    int widthUV_;
+
+};
+
+// DeathraySweep
+// Filters luma spatially with each of a list of settings of strength and
+// alpha size, returning the results one beneath the other. The weights
+// are computed and sorted once per frame, with the greatest strength, 
+// and each setting re-weights the sorted samples. Chroma is unfiltered.
+class DeathraySweep : public GenericVideoFilter {
+public:
+
+    DeathraySweep(
+        PClip _child,
+        const vector<double> &h_Y,      // strengths, for each setting
+        const vector<int> &alpha_sizes, // counts of sorted samples used for filtering, for each setting
+        double sigma,
+        int sample_expand,
+        const char *device,
+        IScriptEnvironment* env);
+
+    ~DeathraySweep();
+
+    PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env);
+
+private:
+    // StartDevice
+    // Selects the device and starts OpenCL, with the kernels compiled for
+    // the largest alpha size, then puts the gaussian weights on the device
+    result StartDevice(
+        const int &alpha_size);         // largest alpha size of the settings
+
+    // InitFilter
+    // Configures the filter of luma once the pitches of frames are known
+    result InitFilter(
+        const int &src_pitch,           // length in bytes of each row of the source frame's luma
+        const int &dst_pitch);          // length in bytes of each row of the destination frame's luma
+
+    float h_Y_              ;   // greatest strength of the settings, with which the weights are computed
+    vector<float> exponents_;   // power to which the weights are raised, for each setting
+    vector<int> alpha_sizes_;   // count of sorted samples used for filtering, for each setting
+    float sigma_            ;   // gaussian weights are computed based upon sigma
+    int sample_expand_      ;   // factor by which the sample radius is expanded
+    string device_          ;   // index or part of the name of the device chosen by the user, empty for automatic selection
+    int height_             ;   // height of the source clip
+    SingleFrame *luma_      ;   // filter of luma, created for the first frame
+    PVideoFrame src_        ;   // source frame, which devices that use frames in place read until the next is filtered
 };
 
 #endif // _DEATHRAY_
\ No newline at end of file
@@ -5,18 +5,118 @@
  * Copyright 2015, Jawed Ashraf - Deathray@cupidity.f9.co.uk
  */
 
+#include <sstream>
+#include <vector>
+
 #include "result.h"
+#include "buffer.h"
+#include "clutil.h"
 #include "device.h"
+#include "Profiler.h"
 
 extern cl_int       g_last_cl_error;
 extern cl_context   g_context;
 
+// Quirks value of a database entry which asks for the device to be tested
+#define QUIRK_TEST -1
+
+// QuirkProfile
+// An entry in the database of device quirks. The entry applies when the
+// device's vendor contains vendor and its driver version contains driver.
+// An empty driver matches every driver from the vendor. The first entry
+// that applies is used.
+struct QuirkProfile {
+    const char  *vendor;
+    const char  *driver;
+    int         quirks;
+};
+
+static const QuirkProfile k_quirk_profiles[] = {
+    // AMD drivers built upon CAL report versions such as "CAL 1.4.1720"
+    {"Advanced Micro Devices",  "CAL",  QUIRK_CAL_BUFFER_SIZE_FAULT},
+    {"ATI Technologies",        "CAL",  QUIRK_CAL_BUFFER_SIZE_FAULT},
+    // Later AMD drivers are not known to have the fault, but are checked
+    {"Advanced Micro Devices",  "",     QUIRK_TEST},
+};
+
 Device::Device() {
-    id_ = NULL;
+    id_             = NULL;
+    type_           = CL_DEVICE_TYPE_GPU;
+    quirks_         = 0;
+    unified_memory_ = CL_FALSE;
 }
 
 void Device::Init(const cl_device_id &single_device) {
     id_ = single_device;
+    clGetDeviceInfo(id_, CL_DEVICE_TYPE, sizeof(cl_device_type), &type_, NULL);
+
+    clGetDeviceInfo(id_, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(cl_bool), &unified_memory_, NULL);
+
+    // Reported in bits
+    cl_uint base_address_align = 0;
+    clGetDeviceInfo(id_, CL_DEVICE_MEM_BASE_ADDR_ALIGN, sizeof(cl_uint), &base_address_align, NULL);
+
+    IdentifyQuirks();
+    buffers_.set_cal_buffer_size_fault(cal_buffer_size_fault());
+    buffers_.set_host_alignment(base_address_align >> 3);
+}
+
+void Device::IdentifyQuirks() {
+    const string vendor = info(CL_DEVICE_VENDOR);
+    const string driver = info(CL_DRIVER_VERSION);
+
+    quirks_ = 0;
+
+    const int profile_count = sizeof(k_quirk_profiles) / sizeof(k_quirk_profiles[0]);
+    for (int i = 0; i < profile_count; ++i) {
+        if (vendor.find(k_quirk_profiles[i].vendor) == string::npos) continue;
+        if (driver.find(k_quirk_profiles[i].driver) == string::npos) continue;
+
+        if (k_quirk_profiles[i].quirks == QUIRK_TEST) {
+            if (CALBufferSizeFaultTest()) quirks_ |= QUIRK_CAL_BUFFER_SIZE_FAULT;
+        } else {
+            quirks_ = k_quirk_profiles[i].quirks;
+        }
+        return;
+    }
+}
+
+bool Device::CALBufferSizeFaultTest() {
+    // 2304 byte4s is the width that the fault widens to 2560, the case
+    // whose padding motivated the quirk profiles, see FixCALBufferSizeFault
+    const size_t test_width  = 2304;
+    const size_t test_height = 4;
+    const size_t test_bytes  = test_width * test_height * 4;
+
+    cl_int cl_status = CL_SUCCESS;
+    const cl_image_format format = GetFormatPixel();
+    cl_mem image = clCreateImage2D(g_context,
+                                   CL_MEM_READ_WRITE,
+                                   &format,
+                                   test_width,
+                                   test_height,
+                                   0,
+                                   NULL,
+                                   &cl_status);
+    if (cl_status != CL_SUCCESS) return true;
+
+    vector<unsigned char> pattern(test_bytes);
+    vector<unsigned char> returned(test_bytes, 0);
+    for (size_t i = 0; i < test_bytes; ++i)
+        pattern[i] = static_cast<unsigned char>((i * 7 + (i >> 10)) & 255);
+
+    cl_command_queue test_cq = cq();
+    size_t zero_offset[] = {0, 0, 0};
+    size_t test_region[] = {test_width, test_height, 1};
+
+    cl_status = clEnqueueWriteImage(test_cq, image, CL_TRUE, zero_offset, test_region, 0, 0, &pattern[0], 0, NULL, NULL);
+    if (cl_status == CL_SUCCESS)
+        cl_status = clEnqueueReadImage(test_cq, image, CL_TRUE, zero_offset, test_region, 0, 0, &returned[0], 0, NULL, NULL);
+
+    clReleaseMemObject(image);
+    clReleaseCommandQueue(test_cq);
+
+    return (cl_status != CL_SUCCESS) || (pattern != returned);
 }
 
 result Device::KernelInit(
@@ -27,6 +127,8 @@ result Device::KernelInit(
     cl_int status = CL_SUCCESS;
 
     program_ = program;
+    tile_program_.clear();
+    tile_program_[DEFAULT_TILE_ROWS] = program;
 
     for (size_t i = 0; i < kernel_count; ++i) {
         kernel_[kernels[i]] = clCreateKernel(program, kernels[i].c_str(), &status);
@@ -39,6 +141,30 @@ result Device::KernelInit(
     return FILTER_OK;
 }
 
+void Device::WarmUp() {
+    const size_t item_count = 256;
+
+    cl_int cl_status = CL_SUCCESS;
+    cl_mem target = clCreateBuffer(g_context, CL_MEM_WRITE_ONLY, item_count * sizeof(cl_uint), NULL, &cl_status);
+    if (cl_status != CL_SUCCESS) return;
+
+    cl_kernel initialise = NewKernelInstance("Initialise");
+    cl_command_queue warm_up_cq = cq();
+
+    const cl_uint value = 0;
+    cl_status = clSetKernelArg(initialise, 0, sizeof(cl_mem), &target);
+    if (cl_status == CL_SUCCESS)
+        cl_status = clSetKernelArg(initialise, 1, sizeof(cl_uint), &value);
+    if (cl_status == CL_SUCCESS)
+        cl_status = clEnqueueNDRangeKernel(warm_up_cq, initialise, 1, NULL, &item_count, NULL, 0, NULL, NULL);
+    if (cl_status == CL_SUCCESS)
+        clFinish(warm_up_cq);
+
+    clReleaseCommandQueue(warm_up_cq);
+    if (initialise != NULL) clReleaseKernel(initialise);
+    clReleaseMemObject(target);
+}
+
 cl_kernel Device::kernel(const string &kernel) {
     return kernel_[kernel];
 }
@@ -47,11 +173,109 @@ cl_kernel Device::NewKernelInstance(const string &kernel) {
     return clCreateKernel(program_, kernel.c_str(), NULL);
 }
 
+cl_kernel Device::NewKernelInstance(
+    const   string  &kernel, 
+    const   int     &tile_rows) {
+
+    if (tile_program_.count(tile_rows) == 0) {
+        cl_program program = NULL;
+        if (CompileTileProgram(id_, tile_rows, &program) != FILTER_OK) program = NULL;
+        tile_program_[tile_rows] = program;
+    }
+
+    if (tile_program_[tile_rows] == NULL) return NULL;
+    return clCreateKernel(tile_program_[tile_rows], kernel.c_str(), NULL);
+}
+
+string Device::info(const cl_device_info &param) {
+    size_t info_size = 0;
+    if (clGetDeviceInfo(id_, param, 0, NULL, &info_size) != CL_SUCCESS || info_size == 0) 
+        return "";
+
+    vector<char> value(info_size);
+    clGetDeviceInfo(id_, param, info_size, &value[0], NULL);
+    return string(&value[0]);
+}
+
+string Device::GeometryKey(
+    const int &width,
+    const int &height,
+    const int &temporal_radius) {
+
+    stringstream key;
+    key << width << "x" << height << "/" << temporal_radius;
+    return key.str();
+}
+
+void Device::set_geometry(
+    const int            &width,
+    const int            &height,
+    const int            &temporal_radius,
+    const KernelGeometry &geometry) {
+
+    geometry_[GeometryKey(width, height, temporal_radius)] = geometry;
+}
+
+void Device::ClearGeometry(
+    const int            &width,
+    const int            &height,
+    const int            &temporal_radius) {
+
+    geometry_.erase(GeometryKey(width, height, temporal_radius));
+}
+
+bool Device::geometry(
+    const int            &width,
+    const int            &height,
+    const int            &temporal_radius,
+          KernelGeometry *geometry) {
+
+    map<string, KernelGeometry>::iterator recorded = geometry_.find(GeometryKey(width, height, temporal_radius));
+    if (recorded == geometry_.end()) return false;
+
+    *geometry = recorded->second;
+    return true;
+}
+
+bool Device::cal_buffer_size_fault() {
+    return (quirks_ & QUIRK_CAL_BUFFER_SIZE_FAULT) != 0;
+}
+
+bool Device::zero_copy() {
+    // Planes that wrap host buffers cannot be padded for CAL
+    return unified_memory_ == CL_TRUE && !cal_buffer_size_fault();
+}
+
+int Device::compute_units() {
+    cl_uint units = 1;
+    clGetDeviceInfo(id_, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint), &units, NULL);
+    return units > 0 ? static_cast<int>(units) : 1;
+}
+
+cl_uint Device::uint_info(const cl_device_info &param) {
+    cl_uint value = 0;
+    if (clGetDeviceInfo(id_, param, sizeof(cl_uint), &value, NULL) != CL_SUCCESS) return 0;
+    return value;
+}
+
+cl_ulong Device::ulong_info(const cl_device_info &param) {
+    cl_ulong value = 0;
+    if (clGetDeviceInfo(id_, param, sizeof(cl_ulong), &value, NULL) != CL_SUCCESS) return 0;
+    return value;
+}
+
+bool Device::pitched_planes() {
+    return (type_ & CL_DEVICE_TYPE_CPU) != 0;
+}
+
 cl_command_queue Device::cq() {
 
+    // Commands are timed only by queues that enable profiling
+    const cl_command_queue_properties properties = g_profiler != NULL ? CL_QUEUE_PROFILING_ENABLE : 0;
+
     cl_command_queue new_cq = clCreateCommandQueue(g_context, 
                                                    id_, 
-                                                   NULL,
+                                                   properties,
                                                    NULL);
 
     return new_cq;
@@ -16,6 +16,39 @@
 
 using namespace std;
 
+// Device quirks
+// Driver faults that require a workaround, combined as a bitmask
+enum {
+    QUIRK_CAL_BUFFER_SIZE_FAULT = 1     // 2D images restricted to specific dimensions, see FixCALBufferSizeFault
+};
+
+// KernelGeometry
+// Shape of the work done by each launch of the filter kernels. The image
+// weighting kernels' work groups have 8 cooperators for each pixel of a
+// tile that's 8 wide and tile_rows high. Their tile height, and with it
+// the height of their caches, is compiled into the program, so each
+// height has a program of its own. The image Finalise kernels always take
+// 8x2 tiles. The pitched kernels have a free work group shape.
+//
+// Single frame filters can instead launch a persistent kernel once per
+// plane, whose work groups take tiles of the plane from a queue.
+struct KernelGeometry {
+    int     region_height;      // rows of the plane filtered by each launch
+    size_t  local_width;        // work group width of the pitched kernels
+    size_t  local_height;       // work group height of the pitched kernels
+    int     persistent_groups;  // work groups per compute unit of the persistent kernel, 0 to launch regions
+    int     tile_rows;          // rows of the tile of each work group of the image weighting kernels
+};
+
+// Tile height of the image weighting kernels in the program compiled by 
+// CompileAll, which is the only height the persistent kernel supports
+#define DEFAULT_TILE_ROWS 2
+
+// Temporal radius under which the geometry of ChromaFrame is recorded.
+// Filtering U and V together costs differently per launch from filtering
+// a single plane, and ChromaFrame has no persistent kernel.
+#define CHROMA_PAIR_RADIUS -1
+
 
 // Device
 // An object for each installed device that can be found and used, which
@@ -39,7 +72,8 @@ public:
     ~Device() {};
 
     // Init
-    // Record the new device and create a command queue for it
+    // Record the new device, determine its quirks and configure
+    // its buffers to work around them
     void Init(
         const cl_device_id  &single_device);    // id of a single OpenCL device
 
@@ -66,18 +100,120 @@ public:
     cl_kernel NewKernelInstance(
         const string        &kernel);           // name of kernel
 
+    // NewKernelInstance
+    // As above, from the program compiled for image weighting tiles of
+    // the given height. The program is compiled for the device the first 
+    // time the height is asked for. Returns NULL if it cannot be compiled.
+    cl_kernel NewKernelInstance(
+        const string        &kernel,            // name of kernel
+        const int           &tile_rows);        // rows of the image weighting kernels' tiles
+
+    // WarmUp
+    // Executes a trivial kernel and waits for it, so that the driver's 
+    // lazily performed allocations for the device are made before the 
+    // first frame. Failures are ignored, since the filters report them.
+    void WarmUp();
+
     // cq
     // Returns a new command queue. 
     // This command queue can be shared by multiple objects or 
     // used exclusively by the object that calls this method.
     cl_command_queue        cq();
 
+    // pitched_planes
+    // Returns true when planes should be held as linear buffers
+    // with a pitch, rather than as images, and processed by the 
+    // kernels written for that layout. CPU devices emulate image 
+    // sampling in software and prefer plain buffers.
+    bool                    pitched_planes();
+
+    // zero_copy
+    // Returns true when the device shares memory with the host, so 
+    // that planes can use the host's frames in place instead of 
+    // holding copies of them
+    bool                    zero_copy();
+
+    // compute_units
+    // Returns the count of the device's compute units
+    int                     compute_units();
+
+    // uint_info
+    // Returns an unsigned integer property of the device, e.g. 
+    // CL_DEVICE_MAX_CLOCK_FREQUENCY, or 0 if it cannot be queried
+    cl_uint                 uint_info(
+        const cl_device_info &param);           // property to query
+
+    // ulong_info
+    // Returns a 64-bit unsigned integer property of the device, e.g.
+    // CL_DEVICE_MAX_MEM_ALLOC_SIZE, or 0 if it cannot be queried
+    cl_ulong                ulong_info(
+        const cl_device_info &param);           // property to query
+
+    // set_geometry
+    // Records the geometry to be used by filters of planes of the given
+    // dimensions and temporal radius on this device
+    void                    set_geometry(
+        const int            &width,            // width of the plane in pixels
+        const int            &height,           // height of the plane in pixels
+        const int            &temporal_radius,  // temporal radius of the filter
+        const KernelGeometry &geometry);        // geometry for the filter
+
+    // ClearGeometry
+    // Forgets the geometry recorded for the plane, so that the filter's
+    // default geometry is used
+    void                    ClearGeometry(
+        const int            &width,            // width of the plane in pixels
+        const int            &height,           // height of the plane in pixels
+        const int            &temporal_radius); // temporal radius of the filter
+
+    // geometry
+    // Returns true and the recorded geometry, if there is one, for
+    // planes of the given dimensions and temporal radius. Otherwise 
+    // geometry is unchanged.
+    bool                    geometry(
+        const int            &width,            // width of the plane in pixels
+        const int            &height,           // height of the plane in pixels
+        const int            &temporal_radius,  // temporal radius of the filter
+              KernelGeometry *geometry);        // recorded geometry
+
+    // info
+    // Returns a string property of the device, e.g. CL_DEVICE_NAME
+    string                  info(
+        const cl_device_info &param);           // property to query
+
+    // cal_buffer_size_fault
+    // Returns true if the device's driver cannot use freely sized images
+    bool                    cal_buffer_size_fault();
+
     BufferMap               buffers_;   // set of buffers on the device - TODO make private and create methods in this class
 
 private:
+    // IdentifyQuirks
+    // Matches the device's vendor and driver version against the
+    // database of known faults. Where the database cannot decide,
+    // the device is tested for the fault.
+    void IdentifyQuirks();
+
+    // GeometryKey
+    // Identifies the filter of a plane in geometry_
+    static string GeometryKey(
+        const int &width,                       // width of the plane in pixels
+        const int &height,                      // height of the plane in pixels
+        const int &temporal_radius);            // temporal radius of the filter
+
+    // CALBufferSizeFaultTest
+    // Returns true if an image whose width is invalid for CAL 
+    // fails to hold data copied to it
+    bool CALBufferSizeFaultTest();
+
     cl_device_id            id_;        // sequence number of the device
+    cl_device_type          type_;      // CPU, GPU etc.
+    int                     quirks_;    // bitmask of faults in the device's driver
+    cl_bool                 unified_memory_;    // device and host share memory
     map<string, cl_kernel>  kernel_;    // set of kernel objects that have been pre-compiled
+    map<string, KernelGeometry> geometry_;  // geometry for each plane's filter, by dimensions and temporal radius
     cl_program              program_;   // program object used to generate new instances of named kernels
+    map<int, cl_program>    tile_program_;  // program compiled for each tile height, NULL if compilation failed
 };
 
 extern Device*              g_devices ;
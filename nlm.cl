@@ -5,15 +5,21 @@
  * Copyright 2015, Jawed Ashraf - Deathray@cupidity.f9.co.uk
  */
 
-float GetWindowDistance(
-    local       float   *target_cache,  // caches pixels around the 8x2 tile of target pixels
-    local       float   *sample_cache,  // caches pixels around the 8x2 tile of sample pixels
-    const       int2    sample,         // centre coordinates of sample window
+// Count of samples in the largest set, for sample_expand of 4, less the target pixel
+#define MAX_SET_SAMPLES 624
+
+// GetWindowDistanceAt
+// Gaussian-weighted distance between the target window and the window 
+// whose top-left is at the linear address in the sample cache
+float GetWindowDistanceAt(
+    local       float   *target_cache,  // caches pixels around the tile of target pixels
+    local       float   *sample_cache,  // caches pixels around the tile of sample pixels
+    const       int     sample_window,  // linear address of top-left of window in sample cache
     const       int     target,         // linear address of top-left of window in target cache
     constant    float   *g_gaussian) {  // 49 weights of gaussian kernel
 
     float distance = 0.f;
-    int s_linear = mul24(sample.y - 3, 40) + sample.x - 3;
+    int s_linear = sample_window;
     int t_linear = target;
     int gaussian_position = 0;
 
@@ -28,6 +34,20 @@ float GetWindowDistance(
     return distance;
 }
 
+// GetWindowDistance
+// Gaussian-weighted distance between the target window and the window
+// centred upon the sample
+float GetWindowDistance(
+    local       float   *target_cache,  // caches pixels around the tile of target pixels
+    local       float   *sample_cache,  // caches pixels around the tile of sample pixels
+    const       int2    sample,         // centre coordinates of sample window
+    const       int     target,         // linear address of top-left of window in target cache
+    constant    float   *g_gaussian) {  // 49 weights of gaussian kernel
+
+    const int sample_window = mul24(sample.y - 3, 40) + sample.x - 3;
+    return GetWindowDistanceAt(target_cache, sample_cache, sample_window, target, g_gaussian);
+}
+
 // WriteAlpha
 // Each work item writes an alpha weight/pixel pair to the region's alpha buffer
 void WriteAlpha(
@@ -46,6 +66,95 @@ void WriteAlpha(
     region_alpha[linear_address] = weight;
 }
 
+// WriteExactPixel
+// Writes a sample pixel of a float plane to the region's pixel stream, at
+// the address of its alpha entry, returning the sample's position in its
+// set for the entry to hold
+uint WriteExactPixel(
+    const       float   pixel,          // sample pixel
+    const       int     region_base,    // base address within the region_pixels buffer for all samples
+    const       int     alpha_index,    // counter of weights generated by cooperator
+    global      float   *region_pixels) {// region's sample pixels, entry for entry with the region's alpha
+
+    const int linear_address = (alpha_index << 3) + region_base;
+    region_pixels[linear_address] = pixel;
+    return (alpha_index << 3) + get_local_id(0);
+}
+
+// Modes of the field of weights given to WeightAnEighth, for multi-frame
+// filtering: unused, storing each interior pixel's weights or reusing
+// the weights stored when the sample's frame was the target
+#define FIELD_UNUSED 0
+#define FIELD_STORE 1
+#define FIELD_REUSE 2
+
+// GetFieldAddress
+// Returns the address in a field of the weight of the sample at the
+// offset from the pixel. Each pixel has an entry for each position of its
+// set that is sampled, in raster order.
+//
+// Fields of large planes have more entries than mad24 can address, so
+// the address is a full unsigned product. The host creates no field
+// with more than INT_MAX entries.
+uint GetFieldAddress(
+    const       int2    pixel,          // coordinates of the target pixel
+    const       int2    offset,         // coordinates of the sample relative to the pixel
+    const       int     width,          // width in pixels
+    const       int     radius) {       // radius of the set of samples
+
+    const uint position = mad24(offset.y + radius, GetSetSide(radius), offset.x + radius);
+    const uint pixel_index = (uint)pixel.y * (uint)width + (uint)pixel.x;
+    return pixel_index * ((uint)GetStrideCount(radius) << 3) + position;
+}
+
+// ReuseFieldWeight
+// The distance between a window in one frame and a window in another is
+// the same whichever of the two frames is the target, as only the sign of
+// each difference changes. So this sample's weight is the weight that the
+// sample pixel stored, when its frame was the target, for the sample at
+// the opposite offset in this frame.
+//
+// Only interior pixels store their weights, and the bottom-right position
+// of a set is never sampled, so returns false when there is no weight to
+// reuse.
+bool ReuseFieldWeight(
+    const       int     field_mode,     // FIELD_REUSE to look for the weight
+    const       int2    target,         // coordinates of the target pixel
+    const       int2    offset,         // coordinates of the sample relative to the target pixel
+    const       int     width,          // width in pixels
+    const       int     height,         // height in pixels
+    const       int     radius,         // radius of the set of samples
+    global      uint    *field,         // weights stored when the sample's frame was the target
+                uint    *weight) {      // packed weight of the sample, without its pixel
+
+    if (field_mode != FIELD_REUSE) return false;
+    if (any(offset < -radius) || any(offset > radius) || all(offset == -radius)) return false;
+
+    const int2 sample = target + offset;
+    if (!IsInteriorPixel(sample, (int2)(width, height), radius)) return false;
+
+    *weight = field[GetFieldAddress(sample, -offset, width, radius)];
+    return true;
+}
+
+// StoreFieldWeight
+// Stores the packed weight of an interior pixel's sample, for when the
+// sample's frame is the target
+void StoreFieldWeight(
+    const       int     field_mode,     // FIELD_STORE to store the weight
+    const       int2    target,         // coordinates of the target pixel
+    const       int2    offset,         // coordinates of the sample relative to the target pixel
+    const       int     width,          // width in pixels
+    const       int     height,         // height in pixels
+    const       int     radius,         // radius of the set of samples
+    const       uint    weight,         // packed weight of the sample, without its pixel
+    global      uint    *field) {       // weights of this frame's pixels against the sample frame
+
+    if (field_mode != FIELD_STORE || !IsInteriorPixel(target, (int2)(width, height), radius)) return;
+
+    field[GetFieldAddress(target, offset, width, radius)] = weight;
+}
+
 // WeightAnEighth
 // Process one-eighth of the samples.
 //
@@ -64,9 +173,13 @@ void WeightAnEighth(
     local       float       *sample_cache,  // caches pixels around the 8x1 strip of sample pixels
     const       int         alpha_set_size, // number of weight/pixel pairs per target pixel
     const       int         alpha_so_far,   // count of alpha samples generated so far (multi-frame support)
-    global      uint        *region_alpha) {// region's alpha weight/pixel pairs packed as uints
+    const       int         region_width,   // width in pixels of the region whose alpha sets are in region_alpha
+    global      uint        *region_alpha,  // region's alpha weight/pixel pairs packed as uints
+    global      float       *region_pixels, // region's sample pixels, written only for float planes
+    const       int         field_mode,     // FIELD_UNUSED, FIELD_STORE or FIELD_REUSE
+    global      uint        *field) {       // weights of pixels against samples shared by a pair of frames
 
-    int2 target = GetTargetCoordinates(top_left);
+    int2 target = GetTileTargetCoordinates(top_left);
     int radius = GetRadius(sample_expand);
     int eighth = GetEighthSequenceNumber();
 
@@ -84,15 +197,26 @@ void WeightAnEighth(
     const int target_offset = target_col_offset + target_row_offset;
 
     // Determine base address in region_alpha buffer
-    const int region_base = GetFilterRegionBaseAddress(width, alpha_set_size);
+    const int region_base = GetFilterRegionBaseAddress(region_width, alpha_set_size);
+
+    // Pixels are coded in as many bits as the plane's format requires, 
+    // unless they are kept exactly
+    const int sample_format = get_image_channel_data_type(plane);
+    const int pixel_bits = SampleBits(sample_format, alpha_set_size);
 
     int alpha_index = alpha_so_far;
 
     while (true) {
         int2 sample_offset = GetSampleOffset(sample, sample_cache_base);
-        float euclidean_distance = GetWindowDistance(target_cache, sample_cache, sample_offset, target_offset, g_gaussian);
-        uint sample_weight = (uint)(floor(16777215.f * exp(-euclidean_distance * h))) << 8;    
-        uint sample_pixel = floor(255.f * sample_cache[mul24(sample_offset.y, 40) + sample_offset.x]);
+        uint sample_weight = 0;
+        if (!ReuseFieldWeight(field_mode, target, sample - target, width, height, radius, field, &sample_weight)) {
+            float euclidean_distance = GetWindowDistance(target_cache, sample_cache, sample_offset, target_offset, g_gaussian);
+            sample_weight = PackSampleWeight(exp(-euclidean_distance * h), pixel_bits);
+            StoreFieldWeight(field_mode, target, sample - target, width, height, radius, sample_weight, field);
+        }
+        float pixel = sample_cache[mul24(sample_offset.y, 40) + sample_offset.x];
+        uint sample_pixel = IsExactSample(sample_format) ? WriteExactPixel(pixel, region_base, alpha_index, region_pixels)
+                                                         : PackSamplePixel(pixel, linear, pixel_bits);
 
         sample_weight |= sample_pixel;
 
@@ -107,3 +231,265 @@ void WeightAnEighth(
     }
 }
 
+// BuildSampleTable
+// Lists the samples of an interior target pixel's set in the order that 
+// the cooperators take them, 8 apart, so that the i-th sample of the set is
+// at entry i. Each entry is the linear address in the sample cache of the
+// sample relative to the set's top-left sample. The target pixel is left
+// out when it is skipped.
+//
+// Every pixel of an interior tile has a full, unclamped set, so the
+// table serves them all. The samples are the same as those taken by
+// WeightAnEighth, though shared differently amongst the cooperators.
+void BuildSampleTable(
+    const       int         radius,         // spatial sampling radius
+    const       int         skip_target,    // when set do not sample at the target pixel
+    local       int         *sample_table) {// MAX_SET_SAMPLES entries
+
+    const int set_side = GetSetSide(radius);
+    const int centre = mul24(set_side, set_side) >> 1;
+    const int sample_count = GetStrideCount(radius) << 3;
+
+    for (int i = mad24((int)get_local_id(1), 8, (int)get_local_id(0)); i < sample_count; i += TILE_ITEMS) {
+        const int set_position = (skip_target && i >= centre) ? i + 1 : i;
+        sample_table[i] = mad24(set_position / set_side, 40, set_position % set_side);
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+}
+
+// WeightAnEighthInterior
+// As WeightAnEighth, for a tile where IsInteriorTile is true. Samples 
+// are taken from the table, so there is no wrapping or clamping of
+// coordinates from one stride to the next.
+void WeightAnEighthInterior(
+    read_only   image2d_t   plane,          // input plane
+    const       float       h,              // strength of denoising
+    const       int         sample_expand,  // factor to expand sample radius
+    const       int         width,          // width in pixels
+    const       int         height,         // height in pixels
+    const       int2        top_left,       // coordinates of the top left corner of the region to be filtered
+    constant    float       *g_gaussian,    // 49 weights of gaussian kernel
+    const       int         linear,         // process plane in linear space instead of gamma space
+    local       float       *target_cache,  // caches pixels around the 8x1 strip of target pixels
+    local       float       *sample_cache,  // caches pixels around the 8x1 strip of sample pixels
+    local       int         *sample_table,  // set built by BuildSampleTable
+    const       int         alpha_set_size, // number of weight/pixel pairs per target pixel
+    const       int         alpha_so_far,   // count of alpha samples generated so far (multi-frame support)
+    const       int         region_width,   // width in pixels of the region whose alpha sets are in region_alpha
+    global      uint        *region_alpha,  // region's alpha weight/pixel pairs packed as uints
+    global      float       *region_pixels, // region's sample pixels, written only for float planes
+    const       int         field_mode,     // FIELD_UNUSED, FIELD_STORE or FIELD_REUSE
+    global      uint        *field) {       // weights of pixels against samples shared by a pair of frames
+
+    const int2 target = GetTileTargetCoordinates(top_left);
+    const int radius = GetRadius(sample_expand);
+
+    const int2 sample_cache_base = GetSampleCacheBaseCoordinates(top_left, (int2)(width, height));
+    PopulateSampleCache(plane, linear, sample_cache_base, sample_cache);
+
+    // Linear address in the sample cache of the set's top-left sample
+    const int2 set_top_left = target - (int2)(radius, radius) - sample_cache_base;
+    const int set_base = mad24(set_top_left.y, 40, set_top_left.x);
+
+    // Determine linear address in target cache
+    const int target_col_offset = get_local_id(1) & 7;
+    const int target_row_offset = (get_local_id(1) >> 3) << 4;
+    const int target_offset = target_col_offset + target_row_offset;
+
+    // Determine base address in region_alpha buffer
+    const int region_base = GetFilterRegionBaseAddress(region_width, alpha_set_size);
+
+    // Pixels are coded in as many bits as the plane's format requires, 
+    // unless they are kept exactly
+    const int sample_format = get_image_channel_data_type(plane);
+    const int pixel_bits = SampleBits(sample_format, alpha_set_size);
+
+    const int stride_count = GetStrideCount(radius);
+    int table_index = GetEighthSequenceNumber();
+    int alpha_index = alpha_so_far;
+
+    for (int stride = 0; stride < stride_count; ++stride) {
+        const int sample = set_base + sample_table[table_index];
+
+        // The table's entries are rows of 40 from the set's top-left sample
+        const int2 offset = field_mode == FIELD_UNUSED ? (int2)(0, 0)
+                          : (int2)(sample_table[table_index] % 40, sample_table[table_index] / 40) - (int2)(radius, radius);
+        uint sample_weight = 0;
+        if (!ReuseFieldWeight(field_mode, target, offset, width, height, radius, field, &sample_weight)) {
+            float euclidean_distance = GetWindowDistanceAt(target_cache, sample_cache, sample - 123, target_offset, g_gaussian);
+            sample_weight = PackSampleWeight(exp(-euclidean_distance * h), pixel_bits);
+            StoreFieldWeight(field_mode, target, offset, width, height, radius, sample_weight, field);
+        }
+        uint sample_pixel = IsExactSample(sample_format) ? WriteExactPixel(sample_cache[sample], region_base, alpha_index, region_pixels)
+                                                         : PackSamplePixel(sample_cache[sample], linear, pixel_bits);
+
+        WriteAlpha(sample_weight | sample_pixel, region_base, alpha_index, region_alpha);
+
+        table_index += 8;
+        ++alpha_index;
+    }
+}
+
+// WeightAnEighthPair
+// As WeightAnEighth, for a pair of planes of the same dimensions, e.g. U
+// and V. Each plane's weights are computed from its own windows, but the 
+// pair share the sample coordinates, the cache addresses and the alpha
+// addresses. Interior tiles take their samples from the table, as in 
+// WeightAnEighthInterior.
+void WeightAnEighthPair(
+    read_only   image2d_t   plane_u,        // first input plane
+    read_only   image2d_t   plane_v,        // second input plane
+    const       float       h,              // strength of denoising
+    const       int         sample_expand,  // factor to expand sample radius
+    const       int         width,          // width in pixels
+    const       int         height,         // height in pixels
+    const       int2        top_left,       // coordinates of the top left corner of the region to be filtered
+    const       int         skip_target,    // when set do not sample at the target pixel
+    constant    float       *g_gaussian,    // 49 weights of gaussian kernel
+    const       int         linear,         // process plane in linear space instead of gamma space
+    local       float       *target_cache_u,// caches pixels around the tile of the first plane
+    local       float       *target_cache_v,// caches pixels around the tile of the second plane
+    local       float       *sample_cache_u,// caches pixels around the samples of the first plane
+    local       float       *sample_cache_v,// caches pixels around the samples of the second plane
+    local       int         *sample_table,  // MAX_SET_SAMPLES entries, for BuildSampleTable
+    const       int         alpha_set_size, // number of weight/pixel pairs per target pixel
+    const       int         region_width,   // width in pixels of the region whose alpha sets are in region_alpha
+    global      uint        *alpha_u,       // region's alpha weight/pixel pairs of the first plane
+    global      uint        *alpha_v) {     // region's alpha weight/pixel pairs of the second plane
+
+    const int2 image_max = (int2)(width, height);
+    const int2 target = GetTileTargetCoordinates(top_left);
+    const int radius = GetRadius(sample_expand);
+
+    const int2 sample_cache_base = GetSampleCacheBaseCoordinates(top_left, image_max);
+    PopulateSampleCachePair(plane_u, plane_v, linear, sample_cache_base, sample_cache_u, sample_cache_v);
+
+    // The choice is the same for every work item in the group
+    const bool interior = IsInteriorTile(top_left, image_max, radius);
+    if (interior) BuildSampleTable(radius, skip_target, sample_table);
+
+    // Linear address in the sample cache of the set's top-left sample, for interior tiles
+    const int2 set_top_left = target - (int2)(radius, radius) - sample_cache_base;
+    const int set_base = mad24(set_top_left.y, 40, set_top_left.x);
+
+    const int2 set_max = GetSetMax(target, image_max, radius);
+    int2 sample = GetSampleStartCoordinates(target, radius, set_max, GetEighthSequenceNumber());
+    int table_index = GetEighthSequenceNumber();
+
+    // Determine linear address in target cache
+    const int target_col_offset = get_local_id(1) & 7;
+    const int target_row_offset = (get_local_id(1) >> 3) << 4;
+    const int target_offset = target_col_offset + target_row_offset;
+
+    // Determine base address in each plane's alpha buffer
+    const int region_base = GetFilterRegionBaseAddress(region_width, alpha_set_size);
+
+    // Pixels are coded in as many bits as the plane's format requires
+    const int pixel_bits = SampleBits(get_image_channel_data_type(plane_u), alpha_set_size);
+
+    const int stride_count = GetStrideCount(radius);
+
+    for (int alpha_index = 0; alpha_index < stride_count; ++alpha_index) {
+        int sample_address;
+        if (interior) {
+            sample_address = set_base + sample_table[table_index];
+            table_index += 8;
+        } else {
+            const int2 sample_offset = GetSampleOffset(sample, sample_cache_base);
+            sample_address = mad24(sample_offset.y, 40, sample_offset.x);
+            sample = NextStride(target, sample, radius, set_max, skip_target);
+        }
+
+        const int sample_window = sample_address - 123;
+        float distance_u = GetWindowDistanceAt(target_cache_u, sample_cache_u, sample_window, target_offset, g_gaussian);
+        float distance_v = GetWindowDistanceAt(target_cache_v, sample_cache_v, sample_window, target_offset, g_gaussian);
+
+        uint weight_u = PackSampleWeight(exp(-distance_u * h), pixel_bits);
+        uint weight_v = PackSampleWeight(exp(-distance_v * h), pixel_bits);
+        uint pixel_u = PackSamplePixel(sample_cache_u[sample_address], linear, pixel_bits);
+        uint pixel_v = PackSamplePixel(sample_cache_v[sample_address], linear, pixel_bits);
+
+        WriteAlpha(weight_u | pixel_u, region_base, alpha_index, alpha_u);
+        WriteAlpha(weight_v | pixel_v, region_base, alpha_index, alpha_v);
+    }
+}
+
+// WeightAnEighthGuided
+// As WeightAnEighthPair, except that the pair's samples are weighted by
+// the distance between windows of the guide, luma at the dimensions of
+// the pair, so a single distance serves both planes.
+void WeightAnEighthGuided(
+    read_only   image2d_t   guide_plane,        // luma plane at the dimensions of the pair
+    read_only   image2d_t   plane_u,            // first input plane
+    read_only   image2d_t   plane_v,            // second input plane
+    const       float       h,                  // strength of denoising
+    const       int         sample_expand,      // factor to expand sample radius
+    const       int         width,              // width in pixels
+    const       int         height,             // height in pixels
+    const       int2        top_left,           // coordinates of the top left corner of the region to be filtered
+    const       int         skip_target,        // when set do not sample at the target pixel
+    constant    float       *g_gaussian,        // 49 weights of gaussian kernel
+    const       int         linear,             // process plane in linear space instead of gamma space
+    local       float       *target_cache,      // caches pixels around the tile of the guide
+    local       float       *sample_cache,      // caches pixels around the samples of the guide
+    local       float       *sample_cache_u,    // caches pixels around the samples of the first plane
+    local       float       *sample_cache_v,    // caches pixels around the samples of the second plane
+    local       int         *sample_table,      // MAX_SET_SAMPLES entries, for BuildSampleTable
+    const       int         alpha_set_size,     // number of weight/pixel pairs per target pixel
+    const       int         region_width,       // width in pixels of the region whose alpha sets are in region_alpha
+    global      uint        *alpha_u,           // region's alpha weight/pixel pairs of the first plane
+    global      uint        *alpha_v) {         // region's alpha weight/pixel pairs of the second plane
+
+    const int2 image_max = (int2)(width, height);
+    const int2 target = GetTileTargetCoordinates(top_left);
+    const int radius = GetRadius(sample_expand);
+
+    const int2 sample_cache_base = GetSampleCacheBaseCoordinates(top_left, image_max);
+    PopulateSampleCache(guide_plane, linear, sample_cache_base, sample_cache);
+    PopulateSampleCachePair(plane_u, plane_v, linear, sample_cache_base, sample_cache_u, sample_cache_v);
+
+    // The choice is the same for every work item in the group
+    const bool interior = IsInteriorTile(top_left, image_max, radius);
+    if (interior) BuildSampleTable(radius, skip_target, sample_table);
+
+    // Linear address in the sample cache of the set's top-left sample, for interior tiles
+    const int2 set_top_left = target - (int2)(radius, radius) - sample_cache_base;
+    const int set_base = mad24(set_top_left.y, 40, set_top_left.x);
+
+    const int2 set_max = GetSetMax(target, image_max, radius);
+    int2 sample = GetSampleStartCoordinates(target, radius, set_max, GetEighthSequenceNumber());
+    int table_index = GetEighthSequenceNumber();
+
+    // Determine linear address in target cache
+    const int target_col_offset = get_local_id(1) & 7;
+    const int target_row_offset = (get_local_id(1) >> 3) << 4;
+    const int target_offset = target_col_offset + target_row_offset;
+
+    // Determine base address in each plane's alpha buffer
+    const int region_base = GetFilterRegionBaseAddress(region_width, alpha_set_size);
+
+    // Pixels are coded in as many bits as the plane's format requires
+    const int pixel_bits = SampleBits(get_image_channel_data_type(plane_u), alpha_set_size);
+
+    const int stride_count = GetStrideCount(radius);
+
+    for (int alpha_index = 0; alpha_index < stride_count; ++alpha_index) {
+        int sample_address;
+        if (interior) {
+            sample_address = set_base + sample_table[table_index];
+            table_index += 8;
+        } else {
+            const int2 sample_offset = GetSampleOffset(sample, sample_cache_base);
+            sample_address = mad24(sample_offset.y, 40, sample_offset.x);
+            sample = NextStride(target, sample, radius, set_max, skip_target);
+        }
+
+        float euclidean_distance = GetWindowDistanceAt(target_cache, sample_cache, sample_address - 123, target_offset, g_gaussian);
+        uint sample_weight = PackSampleWeight(exp(-euclidean_distance * h), pixel_bits);
+        uint pixel_u = PackSamplePixel(sample_cache_u[sample_address], linear, pixel_bits);
+        uint pixel_v = PackSamplePixel(sample_cache_v[sample_address], linear, pixel_bits);
+
+        WriteAlpha(sample_weight | pixel_u, region_base, alpha_index, alpha_u);
+        WriteAlpha(sample_weight | pixel_v, region_base, alpha_index, alpha_v);
+    }
+}
@@ -14,4 +14,7 @@
 #define RC_NLM_SINGLE   10003
 #define RC_SORT         10004
 #define RC_NLM_MULTI    10005
+#define RC_NLM_PITCHED  10006
+#define RC_NLM_PERSISTENT 10007
+#define RC_PACKED       10008
 
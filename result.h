@@ -33,7 +33,13 @@ enum result {
     FILTER_OPENCL_COMPILATION_FAILED,
     FILTER_OPENCL_KERNEL_DEVICE_BUILD_FAILED,
     FILTER_OPENCL_KERNEL_INITIALISATION_FAILED,
-    FILTER_MULTI_FRAME_INITIALISATION_FAILED
+    FILTER_MULTI_FRAME_INITIALISATION_FAILED,
+    FILTER_SPLIT_FRAME_SYNCHRONISATION_FAILED,
+    FILTER_WIDE_PLANES_UNSUPPORTED,
+    FILTER_PACKED_FRAMES_UNSUPPORTED,
+    FILTER_SWEEP_UNSUPPORTED,
+    FILTER_FIELDS_UNSUPPORTED,
+    FILTER_NO_GOLDEN_FRAMES
 };
 
 #endif // RESULT_H_
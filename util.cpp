@@ -10,6 +10,8 @@
 
 #include "result.h"
 #include "util.h"
+#include <fstream>
+#include <iterator>
 #include <sstream>
 
 
@@ -44,20 +46,32 @@ int FixCALBufferSizeFault(const int& length) {
 }
 
 void GetFrameDimensions(
-    const int &width,                
-    const int &height,                
-    const int &width_power_of_2,    
-    const int &height_power_of_2,    
-          int *device_width,            
-          int *device_height) {
+    const int  &width,                
+    const int  &height,                
+    const int  &width_power_of_2,    
+    const int  &height_power_of_2,    
+    const bool &cal_buffer_size_fault,
+          int  *device_width,            
+          int  *device_height) {
 
     const int checked_width_power_of_2 = (width_power_of_2 < 2) ? 2 : width_power_of_2;
     const int element_count = ByPowerOf2(width, 2) >> 2;
     const int element_width = ByPowerOf2(element_count, checked_width_power_of_2 - 2);
     const int element_height = ByPowerOf2(height, height_power_of_2);
 
-    *device_width = FixCALBufferSizeFault(element_width);
-    *device_height = FixCALBufferSizeFault(element_height);
+    if (cal_buffer_size_fault) {
+        *device_width = FixCALBufferSizeFault(element_width);
+        *device_height = FixCALBufferSizeFault(element_height);
+    } else {
+        *device_width = element_width;
+        *device_height = element_height;
+    }
+}
+
+int GetPitchedPlanePitch(
+    const int &width) {
+
+    return ByPowerOf2(width, 4);
 }
 
 string GetAlphaSize(
@@ -90,6 +104,96 @@ int GetAlphaBufferSize(
     return region_width * region_height * GetAlphaSetSize(temporal_radius, sample_expand);
 }
 
+string HashString(
+    const string &text) {
+
+    unsigned long long hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < text.size(); ++i) {
+        hash ^= static_cast<unsigned char>(text[i]);
+        hash *= 1099511628211ULL;
+    }
+
+    stringstream hash_stream;
+    hash_stream.width(16);
+    hash_stream.fill('0');
+    hash_stream << hex << hash;
+    return hash_stream.str();
+}
+
+result GetCacheDirectory(
+    string *directory) {
+
+    char path[MAX_PATH];
+    DWORD length = GetEnvironmentVariableA("LOCALAPPDATA", path, MAX_PATH);
+    if (length == 0 || length >= MAX_PATH) {
+        length = GetTempPathA(MAX_PATH, path);
+        if (length == 0 || length >= MAX_PATH) return FILTER_ERROR;
+    }
+
+    directory->assign(path, length);
+    if ((*directory)[directory->size() - 1] != '\\') directory->append("\\");
+    directory->append("Deathray2\\");
+
+    // Fails harmlessly if the directory already exists
+    CreateDirectoryA(directory->c_str(), NULL);
+    return FILTER_OK;
+}
+
+// CacheRecordFileName
+// File that holds the record of the given kind for the key
+static result CacheRecordFileName(
+    const   string  &kind,
+    const   string  &key,
+            string  *file_name) {
+
+    string directory;
+    result status = GetCacheDirectory(&directory);
+    if (status != FILTER_OK) return status;
+
+    *file_name = directory + kind + "-" + HashString(key) + ".txt";
+    return FILTER_OK;
+}
+
+bool LoadCacheRecord(
+    const   string  &kind,
+    const   string  &key,
+            string  *value) {
+
+    string file_name;
+    if (CacheRecordFileName(kind, key, &file_name) != FILTER_OK) return false;
+
+    ifstream cache(file_name.c_str(), ios::in | ios::binary);
+    if (!cache) return false;
+
+    // The file holds the key followed by the value
+    const string contents((istreambuf_iterator<char>(cache)), istreambuf_iterator<char>());
+    if (contents.compare(0, key.size(), key) != 0) return false;
+
+    *value = contents.substr(key.size());
+    return true;
+}
+
+void SaveCacheRecord(
+    const   string  &kind,
+    const   string  &key,
+    const   string  &value) {
+
+    string file_name;
+    if (CacheRecordFileName(kind, key, &file_name) != FILTER_OK) return;
+
+    // Other processes may be reading the record, so the file is
+    // written under a private name and then moved into place
+    stringstream temporary_name;
+    temporary_name << file_name << "." << GetCurrentProcessId() << ".tmp";
+
+    ofstream cache(temporary_name.str().c_str(), ios::out | ios::binary | ios::trunc);
+    cache << key << value;
+    cache.close();
+
+    if (!cache || !MoveFileExA(temporary_name.str().c_str(), file_name.c_str(), MOVEFILE_REPLACE_EXISTING))
+        DeleteFileA(temporary_name.str().c_str());
+}
+
 result GetSourceFromResource(int resource_id, string *source) {
     // resource.h contains a set of #DEFINEs that specify
     // the "filenames" of resources that have been compiled
@@ -44,14 +44,24 @@ int FixCALBufferSizeFault(const int &length) ;
 //
 // CAL has a bug where 2D image buffers cannot be sized freely.
 // Instead buffer dimensions must have specific sizes. A workaround
-// for this bug is included in the returned values.
+// for this bug is included in the returned values only for devices
+// that have the fault.
 void GetFrameDimensions(
-    const int &width,                    // required width in pixels
-    const int &height,                    // required height
-    const int &width_power_of_2,        // power of 2 that specifies block size horizontally
-    const int &height_power_of_2,        // power of 2 that specifies block size vertically
-          int *device_width,            // computed width in byte4s
-          int *device_height);            // computed height in rows of byte4s
+    const int  &width,                  // required width in pixels
+    const int  &height,                 // required height
+    const int  &width_power_of_2,       // power of 2 that specifies block size horizontally
+    const int  &height_power_of_2,      // power of 2 that specifies block size vertically
+    const bool &cal_buffer_size_fault,  // device has the CAL fault, see FixCALBufferSizeFault
+          int  *device_width,           // computed width in byte4s
+          int  *device_height);         // computed height in rows of byte4s
+
+// GetPitchedPlanePitch
+// Returns the length in bytes of each row of a plane that is
+// stored as a linear buffer rather than as an image. Rows start
+// on 16-byte boundaries so that a work item's reads can be
+// vectorised.
+int GetPitchedPlanePitch(
+    const int &width);                  // width in pixels
 
 // GetAlphaSize
 // Converts integer alpha size to string
@@ -79,6 +89,38 @@ int GetAlphaBufferSize(
     const    int        &region_height,
     const    int        &sample_expand);
 
+// HashString
+// Returns the 64-bit FNV-1a hash of the text, as 16 hexadecimal 
+// digits. Used to name files in the cache.
+string HashString(
+    const string &text);
+
+// GetCacheDirectory
+// Returns the directory, ending with a separator, in which Deathray2
+// keeps files that persist between processes, creating it if necessary.
+// This is Deathray2 in the user's local application data, or in the
+// temporary directory if that is unavailable.
+result GetCacheDirectory(
+    string *directory);
+
+// LoadCacheRecord
+// Fetches the value recorded in the cache for the key, returning
+// false if there is none. Records of different kinds, e.g. 
+// "calibration", are kept apart.
+bool LoadCacheRecord(
+    const   string  &kind,              // kind of record
+    const   string  &key,               // everything the value depends upon
+            string  *value);            // value recorded for the key
+
+// SaveCacheRecord
+// Records the value for the key in the cache, replacing any earlier
+// value. Failures are ignored, since the cache is merely an 
+// optimisation.
+void SaveCacheRecord(
+    const   string  &kind,              // kind of record
+    const   string  &key,               // everything the value depends upon
+    const   string  &value);            // value to record
+
 // GetSourceFromResource
 // Returns a string from a single OpenCL kernel source file.
 //